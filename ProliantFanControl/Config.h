@@ -12,17 +12,132 @@
 /** Debug logging for PWM measurment */
 //#define DEBUG_PWM_IN
 
+/** Debug - A5 is high while in the PWM capture ISRs, measure the ISR duration with a scope/logic analyzer */
+//#define DEBUG_ISR_TIMING
+
+
+/** Number of PWM inputs (1 .. 4). PWM1 is on D8 (timer1 input capture), PWM2 .. PWM4 on D4, D6, D7 (pin change interrupts).
+    PWM2 .. PWM4 are for low frequency PWM, up to about 2kHz: their timestamps are taken in the ISR, so any
+    other interrupt running at the edge (up to ~200 cycles) delays them, which must stay under
+    1/PWM_IN_EDGE_TOL of the period. Faster inputs get rejected captures (the last good value holds), the
+    CPU load stays bounded (see PCINT2_vect). A 25kHz input belongs to PWM1. */
+#define PWM_INPUTS 1
 
 /** Define if we want just the duty cycle (do not measure frequency, etc.) and save some bits */
 #define DUTY_CYCLE_ONLY
 
-/** Define if we want to mesure negative pulse duty cycle */
+/** Define if we want to mesure negative pulse duty cycle. Just the default now, the polarity is detected
+    at runtime unless set by SetPwmPol (see PWM_POL_AUTO_SHIFT) */
 #define PWM_NEG_MEASURE
 // Proliant G8 uses negative PWM
 
+/** Polarity detection - weight of the long term positive duty cycle average is 2^-N per decoded capture,
+    13 -> 1/8192, i.e. minutes. Fans running at 100% for a while (e.g. server boot) must not switch it. */
+#define PWM_POL_AUTO_SHIFT 13
+
+/** Polarity detection hysteresis (tenths of percent around 50%) */
+#define PWM_POL_AUTO_HYST 100
+
+/** "Flatline" timeout when the period is not known, in timer1 overflows (4.1ms). Also sets the slowest PWM
+    we can measure - half of the timeout, 64 -> 131ms ~ 7.6Hz. At most 128. */
+#define PWM_IN_FLATLINE_OVF 64
+
+/** Input loss - no edge for this long (ms, up to 1000) with the input at the pull-up (high) level means it is
+    disconnected, the fans then get the fallback duty (SetPwmFallback). Detected within 4.1ms + one loop after
+    that. A flat line at the low level is always a real 0% or 100% (driven against the pull-up), a flat high
+    one is a real 0% or 100% until this timeout. Must be longer than the flatline timeout
+    (PWM_IN_FLATLINE_OVF, 262ms), checked at compile time. */
+#define PWM_IN_LOSS_MS 500
+
+/** Default input duty cycle (%) used for a fan whose PWM input(s) are all lost */
+#define PWM_IN_FALLBACK_DEFAULT 100
+
 /** How many times we sample (to filter out any noise) pin if we could not detect pulses. Should be an even number. */
 #define PWM_IN_RESAMPLE 100
 
+/** Size of the PWM capture ring buffer (number of edges). Power of 2, multiple of 4, at least 16. */
+#define PWM_CAPT_EDGES 16
+
+/** Max. deviation of a captured period from the median period (as a fraction 1/N of the period) */
+#define PWM_IN_PERIOD_TOL 16
+
+/** Max. deviation of a captured edge from its expected position (as a fraction 1/N of the period) */
+#define PWM_IN_EDGE_TOL   32
+
+
+/* ---- Fan tachometer ---- */
+
+/** Debug logging for tach measurement */
+//#define DEBUG_TACH
+
+/** RPM measurement window in ms (at most 1000) */
+#define TACH_WINDOW_MS 1000
+
+/** Default tach pulses per fan revolution (most of the fans use 2) */
+#define TACH_PPR_DEFAULT 2
+
+/** Define to generate emulated tach signals for the server on D9 (fan 1) and D10 (fan 2) */
+#define TACH_EMU
+
+/** Number of points of the emulated RPM vs. input duty cycle curve (0 .. 100%, evenly spaced, 100 must be divisible by N-1) */
+#define TACH_EMU_POINTS 5
+
+/** Emulated RPM curve default - RPM at 0% and at 100% input duty cycle, linear in between */
+#define TACH_EMU_RPM_MIN 1500
+#define TACH_EMU_RPM_MAX 6000
+
+
+/* ---- PID temperature control (mode 'P') ---- */
+
+/** Debug logging for the PID control */
+//#define DEBUG_PID
+
+/** PID update period in ms (at most 1000, measured by timer1) */
+#define PID_PERIOD_MS 1000
+
+/** Default target temperature (C) */
+#define PID_SETPOINT_DEFAULT 45
+
+/** Default gains - Kp in %/C, Ki in %/(C*s), Kd in %/(C/s) */
+#define PID_KP_DEFAULT 5.0
+#define PID_KI_DEFAULT 0.1
+#define PID_KD_DEFAULT 0.0
+
+
+/* ---- Feed-forward boost on fast temperature rise (modes 'A' and 'P') ---- */
+
+/** Debug logging for the feed-forward boost */
+//#define DEBUG_FEEDFWD
+
+/** Temperature rate sampling period in ms (at most 1000, measured by timer1) */
+#define FF_PERIOD_MS 1000
+
+/** Default gain in % per C/s, 0 disables the boost */
+#define FF_GAIN_DEFAULT 0
+
+/** Default max. boost in % */
+#define FF_MAX_DEFAULT 30
+
+/** Default decay of the boost in %/s (0 - no hold, the boost follows the rate) */
+#define FF_DECAY_DEFAULT 2
+
+
+/* ---- Output slew rate limit and hysteresis (modes 'A', 'P' and optionally 'M') ---- */
+
+/** Debug logging for the output slew rate limit */
+//#define DEBUG_SLEW
+
+/** Slew rate update period in ms (at most 1000, measured by timer1) */
+#define SLEW_PERIOD_MS 100
+
+/** Default slew rates in %/s (0 - unlimited), e.g. 20 and 5 for a quick rise and a slow fall */
+#define SLEW_RISE_DEFAULT 0
+#define SLEW_FALL_DEFAULT 0
+
+/** Default hysteresis in % - ignore a rise / fall of the computed duty up to this, e.g. 0 and 2 */
+#define SLEW_HYST_UP_DEFAULT   0
+#define SLEW_HYST_DOWN_DEFAULT 0
+
 
 /* ---- EEPROM config store ---- */
 //#define DEBUG_EEPROM_CONFIG
@@ -34,9 +149,12 @@
 /** Debug logging for PWM out */
 //#define DEBUG_PWM_OUT
 
-/** Define if you want to invert PWM out */
+/** Define if you want to invert PWM out (inverting compare output, the pin idles high) */
 #define PWM_OUT_NEG
 
+/** Sub-percent output duty by dithering over the PWM periods (timer0/2 interrupt at 25kHz while active) */
+#define PWM_OUT_DITHER
+
 // Proliant G8 uses negative PWM.
 // BUT if you choose to add ouput transistor (NPN open collector) then it would invert the signal
 // and gets us back to positive PWM out from the Arduino.
@@ -46,6 +164,9 @@
 /** Debug logging command parsing/execution */
 //#define DEBUG_CMD_PROC
 
+/** Serial speed (see ISR latencies in PFCmain.cpp before changing it) */
+#define SERIAL_SPEED 115200
+
 
 /* ---- Generic configuration ---- */
 
@@ -59,38 +180,76 @@
 /** Number of external temperature sensors connected to analog inputs. Temp 0 is AVR internal temp (always present), Ext. sensors are on A0, A1, ... */
 #define TEMP_EXT_SENSORS 3
 
-/* Temperature configuration data (see the description in readme. All the temperatures are in Celsius (for now) */
+/* Temperature configuration data (see the description in readme. All the temperatures are in Celsius (for now).
+   TEMP_MIN, TEMP_STEP, TEMP_MAX and PWM_STEP are the default mapping table geometry, it can be changed at runtime
+   (SetMapGeometry) within the RAM and EEPROM space of this one. */
 
-/** Temp. mapping table step size */
+/** Temp. mapping table step size. Together with TEMP_MIN/TEMP_MAX it sets the number of table rows and their
+    default temperatures, the breakpoints can be moved at runtime (SetTempAxis). */
 #define TEMP_STEP    5
 
+/** Internal temperature resolution - number of fractional bits (4 -> 1/16 C). Measured, averaged and
+    interpolated temperatures (temps[] etc.) are in these units, reports show one decimal place. */
+#define TEMP_FRAC_BITS 4
+#define TEMP_ONE     (1 << TEMP_FRAC_BITS)
+
 /** Temp. minimal value. Also any temp. below will be considered as TEMP_MIN */
 #define TEMP_MIN     20
 
 /** Temp. max value. Also any temp. above will be considered as TEMP_MAX */
 #define TEMP_MAX     55
 
-/** PWM mapping table step size (in percents) */
+/** PWM mapping table step size (in percents). Sets the number of table columns and their default input PWM,
+    the breakpoints can be moved at runtime (SetPwmAxis). */
 #define PWM_STEP     5
 
+/** Max. number of mapping table rows (temperatures) and columns (input PWM) of the runtime geometry, sizes the axes */
+#define TEMP_COEFFS_MAX  16
+#define PWM_COEFFS_MAX   26
+
+/** Number of points of the per sensor temperature curves (fan control MAXCURVE, see SetFanCtrl) */
+#define TEMP_CURVE_POINTS  4
+
 
 /* ---- Starting defaults (when EEPROM config is not usable) ---- */
 
 /** Default value for PWM mapping table, i.e. PWM duty cycle for any input */
 #define PWM_MAPPING_TABLE_DEFAULT  35
 
-/** PWM in exp. filter - starting value */
-#define PWM_EXPFILT_INIT 0.0
+/** PWM in exp. filter - starting value (in tenths of percent) */
+#define PWM_EXPFILT_INIT 0
 
-/** PWM in exp. filter - starting value */
-#define PWM_EXPFILT_WEIGHT 0.05
+/** PWM in exp. filter - time constant in s (0 - no filtering) */
+#define PWM_EXPFILT_TC 0.4
+
+/** PWM in adaptive filter - relative weight increase per 1% of the deviation, 0 - plain exp. filter (see @AdaptFilterInt) */
+#define PWM_ADAPTFILT_GAIN 0.0
 
 
 /** TEMP in exp. filter - starting value */
 #define TEMP_EXPFILT_INIT 20.0
 
-/** TEMP in exp. filter - starting value */
-#define TEMP_EXPFILT_WEIGHT 0.05
+/** TEMP in exp. filter - time constant in s (0 - no filtering) */
+#define TEMP_EXPFILT_TC 0.4
+
+/** Internal temperature - time for the ADC to settle after switching to the internal 1.1V reference (ms).
+    The loop keeps running, the external sensors wait (see @readInternalTemp). */
+#define INT_TEMP_SETTLE_MS 20
+
+/** Max. exp. filter time constant in s */
+#define EXPFILT_TC_MAX 60.0
+
+/** Main loop period (ms) assumed when converting the old per loop filter weights from EEPROM to time constants */
+#define EXPFILT_LEGACY_LOOP_MS 21
+
+/** TEMP Kalman filter - process noise in ADC counts per s^2 and measurement noise in ADC counts (see @tempSetKalman),
+    zero q - exp. filter */
+#define TEMP_KALMAN_Q 0.0
+#define TEMP_KALMAN_R 1.0
+
+/** TEMP Kalman filter - sample period (ms), the filter takes the average of the readings once per period.
+    Longer than the main loop and the internal sensor cycle (see @readInternalTemp). */
+#define TEMP_KALMAN_PERIOD_MS 100
 
 
 /* ---- Main loop ---- */
@@ -99,8 +258,11 @@
 
 //#define DEBUG_DATA_PROCESSING
 
-/** How often we send reports. Number of loop iterations */
-#define REPORT_FREQ  70
+/** Debug - raw MCP9701 readings "TT<sensor> <ms> <ADC counts>" on every read, to record a trace for test/kalman_test */
+//#define DEBUG_TEMP_TRACE
+
+/** How often we send reports (ms, timer1). A report is ~150 characters, i.e. ~13ms at 115200 Bd */
+#define REPORT_PERIOD_MS  1500
 
 /** Do not send periodic reports (for testing only) */
 //#define NO_REPORTS
@@ -108,5 +270,8 @@
 /** On which pin we have LED for heartbeat (Nano uses D13) */
 #define LED_PIN  13
 
+/** Heartbeat LED toggles every LED_PERIOD_MS (ms, timer1) while the loop runs */
+#define LED_PERIOD_MS  250
+
 
-#endif // __CONFIG_H__
+#endif // __CONFIG_H__
@@ -3,96 +3,360 @@
 #include "PFCmain.h"
 
 
-float ExpFilter(float *oldVal, float weight, float newVal)
+unsigned int ExpFilterWeight(float weight)
 {
-    *oldVal = (weight * newVal) + ((1.0-weight ) * (*oldVal));
-    return *oldVal;
+    if(weight <= 0.0)
+        return 0;
+
+    if(weight >= 1.0)
+        return EXPFILT_WEIGHT_ONE;
+
+    return (unsigned int)(weight * EXPFILT_WEIGHT_ONE + 0.5);
 }
 
 
-int averageTemp(unsigned char fan)
+unsigned long ExpFilterTc(float tc)
 {
-    float sum    = 0.0;
-    float wSum   = 0.0;
-    int   result = 0;
+    if(tc <= 0.0)
+        return 0;
 
-    for(int a=0; a<TEMP_SENSORS; ++a)
+    if(tc > EXPFILT_TC_MAX)
+        tc = EXPFILT_TC_MAX;
+
+    return (unsigned long)(tc * FILT_TIME_PER_S + 0.5);
+}
+
+
+unsigned int ExpFilterWeightDt(unsigned long tc, unsigned long dt)
+{
+    if(dt > FILT_DT_MAX)
+        dt = FILT_DT_MAX;
+
+    unsigned long d = tc + dt/2;
+    if(d <= dt)
+        return EXPFILT_WEIGHT_ONE;
+
+    // dt < 2^16 so dt << 15 fits to unsigned long
+    return (unsigned int)(((dt << 15) + d/2) / d);
+}
+
+
+int ExpFilterInt(long *state, unsigned int weight, int newVal)
+{
+    long diff = ((long)newVal << EXPFILT_FRAC_BITS) - *state;
+
+    // |diff| < 2^16, weight <= 2^15 so the product fits to long
+    *state += (diff * weight + (1L << 14)) >> 15;
+
+    return (int)((*state + (1L << (EXPFILT_FRAC_BITS - 1))) >> EXPFILT_FRAC_BITS);
+}
+
+
+int AdaptFilterInt(long *state, long *dev, unsigned int weight, unsigned int gain, int newVal)
+{
+    if(gain)
     {
-        sum += tempWeights[fan][a] * temps[a];
+        // the weight from the deviation so far, a single glitch gets just the min. weight
+        long absDev = (labs(*dev) + (1L << (EXPFILT_FRAC_BITS - 1))) >> EXPFILT_FRAC_BITS;
+        long wg     = ((long)weight * gain + (1L << 14)) >> 15;
+        long w      = weight + (wg * absDev + 5) / 10;
+
+        // the deviation filter follows the min. weight, so it is time based as well
+        long devW = (long)weight * ADAPTFILT_DEV_SPEED;
+        if(devW > (long)ADAPTFILT_DEV_WEIGHT)
+            devW = ADAPTFILT_DEV_WEIGHT;
+
+        // |diff| <= 2 * 1000 << EXPFILT_FRAC_BITS, devW <= 2^13 so it fits to long
+        long diff = ((long)newVal << EXPFILT_FRAC_BITS) - *state - *dev;
+        *dev += (diff * devW + (1L << 14)) >> 15;
+
+        weight = (w > (long)EXPFILT_WEIGHT_ONE) ? EXPFILT_WEIGHT_ONE : (unsigned int)w;
+    }
+
+    return ExpFilterInt(state, weight, newVal);
+}
+
+
+int KalmanGains(float q, float r, unsigned int *alpha, unsigned int *beta)
+{
+    if(!(r > 0.0 && q > 0.0 && q <= 0.1 * r))
+        return -1;
+
+    // Kalata - steady state alpha-beta from the tracking index
+    float l  = q / r;
+    float rr = (4.0 + l - sqrt(8.0 * l + l * l)) / 4.0;
+    float a  = 1.0 - rr * rr;
+    float b  = 2.0 * (2.0 - a) - 4.0 * sqrt(1.0 - a);
+
+    *alpha = (unsigned int)(a * (1L << KALMAN_LEVEL_FRAC_BITS) + 0.5);
+    *beta  = (unsigned int)(b * (1L << 18) + 0.5);
+    return 0;
+}
+
+
+long KalmanFilterInt(long *level, long *slope, unsigned int alpha, unsigned int beta, unsigned long steps, long newVal)
+{
+    long z = newVal << (KALMAN_LEVEL_FRAC_BITS - EXPFILT_FRAC_BITS);
+    long e = 0;
+
+    if(steps > KALMAN_STEPS_MAX)
+        *slope = KALMAN_SLOPE_INVALID;
+
+    if(*slope != KALMAN_SLOPE_INVALID)
+    {
+        // predict, one period at a time
+        long inc = (*slope + (1L << (KALMAN_SLOPE_FRAC_BITS - KALMAN_LEVEL_FRAC_BITS - 1))) >> (KALMAN_SLOPE_FRAC_BITS - KALMAN_LEVEL_FRAC_BITS);
+        for(byte k=0; k<steps; ++k)
+            *level += inc;
+        e = z - *level;
+    }
+
+    if(*slope == KALMAN_SLOPE_INVALID || labs(e) > ((long)KALMAN_RESET_RESIDUAL << KALMAN_LEVEL_FRAC_BITS))
+    {
+        *level = z;
+        *slope = 0;
+    }
+    else
+    {
+        // |e| <= 2^18, alpha < 2^11 and beta < 2^15 (q/r <= 0.1) so the products fit to long
+        *level += (e * alpha + (1L << (KALMAN_LEVEL_FRAC_BITS - 1))) >> KALMAN_LEVEL_FRAC_BITS;
+        *slope += ((e >> 4) * (long)beta) >> (18 + KALMAN_LEVEL_FRAC_BITS - 4 - KALMAN_SLOPE_FRAC_BITS);
+    }
+
+    return (*level + (1L << (KALMAN_LEVEL_FRAC_BITS - EXPFILT_FRAC_BITS - 1))) >> (KALMAN_LEVEL_FRAC_BITS - EXPFILT_FRAC_BITS);
+}
+
+
+void normalizeTempWeights(unsigned char fan)
+{
+    float        wSum  = 0.0;
+    unsigned int total = 0;
+    int          maxW  = 0;
+
+    for(int a=0; a<TEMP_SENSORS; ++a)
         wSum += tempWeights[fan][a];
+
+    for(int a=0; a<TEMP_SENSORS; ++a)
+    {
+        float w = (wSum > 0.0) ? tempWeights[fan][a] / wSum : 1.0 / TEMP_SENSORS;
+
+        tempWeightsQ[fan][a] = (unsigned int)(w * TEMP_WEIGHT_ONE + 0.5);
+        total += tempWeightsQ[fan][a];
+        if(tempWeightsQ[fan][a] > tempWeightsQ[fan][maxW])
+            maxW = a;
     }
-    result = (int)(sum / wSum);
 
-    if(result < TEMP_MIN)
-        result = TEMP_MIN;
+    // make the sum exactly 1.0
+    tempWeightsQ[fan][maxW] += TEMP_WEIGHT_ONE - total;
+}
+
+
+int averageTemp(unsigned char fan)
+{
+    long sum    = 0;
+    int  result = 0;
+
+    // weights sum to TEMP_WEIGHT_ONE, no division needed
+    for(int a=0; a<TEMP_SENSORS; ++a)
+        sum += (long)tempWeightsQ[fan][a] * temps[a];
+
+    result = (int)((sum + (long)(TEMP_WEIGHT_ONE / 2)) >> 15);
+
+    if(result < tempAxis[0] * TEMP_ONE)
+        result = tempAxis[0] * TEMP_ONE;
     else
     {
-        if(result > TEMP_MAX)
-            result = TEMP_MAX;
+        if(result > tempAxis[mapTempCoeffs-1] * TEMP_ONE)
+            result = tempAxis[mapTempCoeffs-1] * TEMP_ONE;
     }
     return result;
 }
 
 
-int interpolatePwm(unsigned char fan, unsigned char pwm, unsigned char tmp)
+unsigned char axisIndex(const unsigned char *axis, unsigned char n, int v)
+{
+    unsigned char i = n - 1;
+
+    while(i > 0 && axis[i] > v)
+        --i;
+
+    return i;
+}
+
+
+int checkTempAxis(const unsigned char *axis)
+{
+    for(int a=1; a<mapTempCoeffs; ++a)
+        if(axis[a] <= axis[a-1])
+            return -1;
+
+    return 0;
+}
+
+
+int checkPwmAxis(const unsigned char *axis)
 {
-    tmp -= TEMP_MIN; // normalize to start from 0
+    if(axis[0] != 0 || axis[mapPwmCoeffs-1] != 100)
+        return -1;
 
-    unsigned char idxTmp1 = tmp / TEMP_STEP;
-    unsigned char distTmp = tmp % TEMP_STEP;
+    for(int a=1; a<mapPwmCoeffs; ++a)
+        if(axis[a] <= axis[a-1])
+            return -1;
+
+    return 0;
+}
+
+
+int interpolatePwm(unsigned char fan, unsigned char pwm, int tmp)
+{
+    // segment of the temperature axis (in C), distance from its start in 1/TEMP_ONE C
+    unsigned char idxTmp1 = axisIndex(tempAxis, mapTempCoeffs, tmp >> TEMP_FRAC_BITS);
     unsigned char idxTmp2 = idxTmp1;
+    int           spanTmp = 1;
+    int           distTmp = 0;
 
-    if(distTmp != 0)
-        ++idxTmp2;
+    if(idxTmp1 < mapTempCoeffs-1)
+    {
+        idxTmp2 = idxTmp1 + 1;
+        spanTmp = (tempAxis[idxTmp2] - tempAxis[idxTmp1]) * TEMP_ONE;
+        distTmp = tmp - tempAxis[idxTmp1] * TEMP_ONE;
+        if(distTmp < 0)
+            distTmp = 0;  // below the axis
+    }
 
 #ifdef DEBUG_DATA_PROCESSING
     Serial.print(fan);
-    Serial.print(": ");
+    Serial.print(F(": "));
     Serial.print(tmp);
-    Serial.print(", ");
+    Serial.print(F(", "));
     Serial.print(idxTmp1);
-    Serial.print(", ");
+    Serial.print(F(", "));
     Serial.print(distTmp);
-    Serial.print(", ");
+    Serial.print(F(", "));
     Serial.print(idxTmp2);
-    Serial.print(" | ");
+    Serial.print(F(" | "));
 #endif
 
-    unsigned char idxPwm1 = pwm / PWM_STEP;
-    unsigned char distPwm = pwm % PWM_STEP;
+    // segment of the input PWM axis
+    unsigned char idxPwm1 = axisIndex(pwmAxis, mapPwmCoeffs, pwm);
     unsigned char idxPwm2 = idxPwm1;
+    int           spanPwm = 1;
+    int           distPwm = 0;
 
-    if(distPwm != 0)
-        ++idxPwm2;
+    if(idxPwm1 < mapPwmCoeffs-1)
+    {
+        idxPwm2 = idxPwm1 + 1;
+        spanPwm = pwmAxis[idxPwm2] - pwmAxis[idxPwm1];
+        distPwm = pwm - pwmAxis[idxPwm1];
+    }
 
 #ifdef DEBUG_DATA_PROCESSING
     Serial.print(idxPwm1);
-    Serial.print(", ");
+    Serial.print(F(", "));
     Serial.print(distPwm);
-    Serial.print(", ");
+    Serial.print(F(", "));
     Serial.print(idxPwm2);
-    Serial.print(" | ");
+    Serial.print(F(" | "));
 #endif
 
-    float pwmVal1 = ( (float)(mappingTable[fan][idxTmp1][idxPwm1]) * (float)(PWM_STEP-distPwm) 
-                      +
-                      (float)(mappingTable[fan][idxTmp1][idxPwm2]) * (float)distPwm )
-        / (float)(PWM_STEP);
-
-    float pwmVal2 = ((float)(mappingTable[fan][idxTmp2][idxPwm1]) * (float)(PWM_STEP-distPwm)
-                     +
-                     (float)(mappingTable[fan][idxTmp2][idxPwm2]) * (float)distPwm )
-        / (float)(PWM_STEP);
+    // both rows along the PWM axis, not divided by spanPwm yet (cells <= 100, spanPwm <= 100, fits to int)
+    int pwmVal1 = mapCell(fan, idxTmp1, idxPwm1) * (spanPwm-distPwm) + mapCell(fan, idxTmp1, idxPwm2) * distPwm;
+    int pwmVal2 = mapCell(fan, idxTmp2, idxPwm1) * (spanPwm-distPwm) + mapCell(fan, idxTmp2, idxPwm2) * distPwm;
 
-    float pwmOut = (pwmVal1 * (float)(TEMP_STEP-distTmp) + pwmVal2 * (float)distTmp) / (float)(TEMP_STEP);
+    // then along the temperature axis, max. 100 * 100 * 255*TEMP_ONE fits to long, a single division
+    long num = (long)pwmVal1 * (spanTmp-distTmp) + (long)pwmVal2 * distTmp;
+    long den = (long)spanPwm * spanTmp;
 
 #ifdef DEBUG_DATA_PROCESSING
-    Serial.print(pwmVal1, 4);
-    Serial.print(", ");
-    Serial.print(pwmVal2, 4);
-    Serial.print(", ");
-    Serial.println(pwmOut, 4);
+    Serial.print(pwmVal1);
+    Serial.print(F(", "));
+    Serial.print(pwmVal2);
+    Serial.print(F(", "));
+    Serial.println(num);
 #endif
 
-    return (int) (pwmOut+0.5);
-}
+    return (int)((num + den/2) / den);
+}
+
+
+int checkTempCurve(const unsigned char *t)
+{
+    for(int a=1; a<TEMP_CURVE_POINTS; ++a)
+        if(t[a] <= t[a-1])
+            return -1;
+
+    return 0;
+}
+
+
+int curveDutyAt(unsigned char fan, unsigned char sensor, int tmp)
+{
+    const unsigned char *t = curveTemp[fan][sensor];
+    const unsigned char *d = curveDuty[fan][sensor];
+
+    if(tmp <= t[0] * TEMP_ONE)
+        return d[0];
+
+    for(unsigned char a=1; a<TEMP_CURVE_POINTS; ++a)
+    {
+        if(tmp < t[a] * TEMP_ONE)
+        {
+            // d[a-1]*(span-dist) + d[a]*dist is never negative, no rounding issues
+            int  span = (t[a] - t[a-1]) * TEMP_ONE;
+            int  dist = tmp - t[a-1] * TEMP_ONE;
+            long num  = (long)d[a-1] * (span - dist) + (long)d[a] * dist;
+
+            return (int)((num + span/2) / span);
+        }
+    }
+
+    return d[TEMP_CURVE_POINTS-1];
+}
+
+
+int maxCurvePwm(unsigned char fan, int pwm)
+{
+    for(unsigned char s=0; s<TEMP_SENSORS; ++s)
+    {
+        int c = curveDutyAt(fan, s, temps[s]);
+        if(c > pwm)
+            pwm = c;
+    }
+
+    return pwm;
+}
+
+
+int setMapGeometry(unsigned char tMin, unsigned char tStep, unsigned char tMax, unsigned char pStep)
+{
+    if(tStep == 0 || tMax <= tMin || ((tMax - tMin) % tStep) != 0)
+        return -1;
+
+    if(pStep == 0 || pStep > 50 || (100 % pStep) != 0)
+        return -1;
+
+    int tCoeffs = (tMax - tMin) / tStep + 1;
+    int pCoeffs = 100 / pStep + 1;
+
+    if(tCoeffs > TEMP_COEFFS_MAX || pCoeffs > PWM_COEFFS_MAX)
+        return -1;
+
+    if(tCoeffs * pCoeffs > MAP_CELLS || tCoeffs * (pCoeffs + 1) > MAP_EE_CELLS)
+        return -1;
+
+    mapTempMin    = tMin;
+    mapTempStep   = tStep;
+    mapTempCoeffs = tCoeffs;
+    mapPwmStep    = pStep;
+    mapPwmCoeffs  = pCoeffs;
+
+    for(int a=0; a<mapTempCoeffs; ++a)
+        tempAxis[a] = mapTempMin + a*mapTempStep;
+    for(int a=0; a<mapPwmCoeffs; ++a)
+        pwmAxis[a] = a*mapPwmStep;
+
+    for(int fan=0; fan<FANS; ++fan)
+        memset(mappingTable[fan], PWM_MAPPING_TABLE_DEFAULT, MAP_CELLS);
+
+    return 0;
+}
@@ -2,40 +2,298 @@
 #define __DATAPROCESSING_H__
 
 
+/** Number of fractional bits kept in the integer exponential filter state */
+#define EXPFILT_FRAC_BITS 6
+
+/** Integer exponential filter weight 1.0 (weights are in Q15) */
+#define EXPFILT_WEIGHT_ONE 32768U
+
+
 /** 
- * Filter new measured value
+ * Convert exponential filter weight to the integer (Q15) one
+ * 
+ * @param weight filter weight (0.0 .. 1.0)
  * 
- * @param oldVal old filter value (will be updated)
- * @param weight filter weight
+ * @return filter weight for @ExpFilterInt (0 .. EXPFILT_WEIGHT_ONE)
+ */
+unsigned int ExpFilterWeight(float weight);
+
+
+/** 
+ * Integer exponential filter - filter new measured value without floats
+ * 
+ * Used for the PWM inputs and the temperatures (raw ADC readings). The state keeps EXPFILT_FRAC_BITS
+ * fractional bits. Difference between the new and the filtered value must be less than 1024 (e.g. duty
+ * cycle in tenths of percent or ADC counts are OK). Step response follows the float filter
+ * state = w*new + (1-w)*state within 1/(2^(EXPFILT_FRAC_BITS+1) * w) of the value (e.g. 0.16 for 0.05),
+ * that is where the rounding stops moving the state.
+ *
+ * @param state old filter value (will be updated), in 1/(2^EXPFILT_FRAC_BITS) units of the value
+ * @param weight filter weight in Q15 (see @ExpFilterWeight)
  * @param newVal newly measured value
  * 
- * @return new filtered value
+ * @return new filtered value (rounded)
+ */
+int ExpFilterInt(long *state, unsigned int weight, int newVal);
+
+
+/** Filter time unit - 2^FILT_TIME_SHIFT timer1 counts (64us) */
+#define FILT_TIME_SHIFT  10
+
+/** Filter time units per second */
+#define FILT_TIME_PER_S  (F_CPU >> FILT_TIME_SHIFT)
+
+/** Longest time between the samples taken into account (filter time units, about 4s) */
+#define FILT_DT_MAX      0xffffUL
+
+/**
+ * Min. weight of a filter update in Q15 (1/32, see @timerFilterWeight). Smaller weights would stall
+ * @ExpFilterInt more than 1/4 of the value away and the Q15 weight itself would be off by percents,
+ * so with a fast loop and a long time constant the filters take every n-th sample instead.
+ */
+#define EXPFILT_WEIGHT_MIN 1024U
+
+
+/** 
+ * Convert exponential filter time constant to the filter time units
+ * 
+ * @param tc time constant in s (0 .. EXPFILT_TC_MAX)
+ * 
+ * @return time constant for @ExpFilterWeightDt
+ */
+unsigned long ExpFilterTc(float tc);
+
+
+/** 
+ * Exponential filter weight for the time elapsed since the previous sample
+ * 
+ * The filters run once per loop but the loop period varies (PWM input frequency, serial traffic, ...),
+ * so the weight comes from the measured time: dt / (tc + dt/2), i.e. the smoothing time stays the same.
+ * That is 1 - e^(-dt/tc) to the 2nd order, so long steps (see @timerFilterWeight) keep the time constant
+ * as well. Saturates at EXPFILT_WEIGHT_ONE for dt >= 2*tc.
+ * 
+ * @param tc time constant (see @ExpFilterTc), 0 for no filtering
+ * @param dt time since the previous sample in filter time units (see @timerFilterWeight)
+ * 
+ * @return filter weight in Q15 for @ExpFilterInt
+ */
+unsigned int ExpFilterWeightDt(unsigned long tc, unsigned long dt);
+
+
+/** Max. weight of the deviation filter in @AdaptFilterInt in Q15 (0.25), at most 0.25 to fit to long */
+#define ADAPTFILT_DEV_WEIGHT 8192U
+
+/** The deviation filter in @AdaptFilterInt is this many times faster than the min. weight (time constant / 4) */
+#define ADAPTFILT_DEV_SPEED  4
+
+
+/** 
+ * Adaptive integer exponential filter - tracks real steps quickly and still rejects noise
+ * 
+ * Like @ExpFilterInt but the weight grows with the deviation of the new values from the filtered one:
+ * weight = weight * (1 + gain * |dev| / 10), where dev is the signed deviation (new - filtered value)
+ * filtered with ADAPTFILT_DEV_SPEED times the weight (at most ADAPTFILT_DEV_WEIGHT). Zero mean noise
+ * averages out in dev, a real step keeps it high until the filter catches up (the idea of the "one euro"
+ * filter, the deviation instead of the derivative). The weight comes from dev before the new value, so a
+ * single glitch gets just the min. weight. With zero gain it is exactly @ExpFilterInt. The values are in
+ * tenths (duty cycle in tenths of percent), i.e. the gain is per unit (percent) of the deviation.
+ *
+ * Both weights scale with the min. one, so with the weight from the sample time (see @timerFilterWeight)
+ * the gain divides the time constant by 1 + gain * |dev| independently of the sample rate.
+ *
+ * @param state old filter value (will be updated), see @ExpFilterInt
+ * @param dev filtered deviation (will be updated), in 1/(2^EXPFILT_FRAC_BITS) units of the value
+ * @param weight min. filter weight in Q15 (see @ExpFilterWeight)
+ * @param gain relative weight increase per unit of the deviation in Q15 (see @ExpFilterWeight)
+ * @param newVal newly measured value (0 .. 1000)
+ * 
+ * @return new filtered value (rounded)
+ */
+int AdaptFilterInt(long *state, long *dev, unsigned int weight, unsigned int gain, int newVal);
+
+
+/** Fractional bits of the level kept by @KalmanFilterInt */
+#define KALMAN_LEVEL_FRAC_BITS 12
+
+/** Fractional bits of the slope kept by @KalmanFilterInt */
+#define KALMAN_SLOPE_FRAC_BITS 20
+
+/** Slope value which (re)starts @KalmanFilterInt from the next value */
+#define KALMAN_SLOPE_INVALID   0x7fffffffL
+
+/** Residual (in the units of the value) which restarts @KalmanFilterInt, e.g. a sensor reconnected */
+#define KALMAN_RESET_RESIDUAL  64
+
+/** Longest gap (sample periods) @KalmanFilterInt predicts over, it restarts after a longer one */
+#define KALMAN_STEPS_MAX       16
+
+
+/** 
+ * Steady state gains of @KalmanFilterInt for the given noise
+ * 
+ * The filter is the constant velocity (level + slope) Kalman filter, the gains are the steady state
+ * ones from the tracking index q/r (Kalata), so there is no covariance to keep at runtime.
+ *
+ * @param q process noise - std. deviation of the slope change per sample (units of the value per sample^2,
+ *          see @tempSetKalman for the conversion from seconds)
+ * @param r measurement noise - std. deviation of the value, q/r must be at most 0.1
+ * @param alpha output - level gain in Q(KALMAN_LEVEL_FRAC_BITS)
+ * @param beta output - slope gain in Q18
+ * 
+ * @return 0 when OK, -1 for invalid noise values (gains are not changed)
+ */
+int KalmanGains(float q, float r, unsigned int *alpha, unsigned int *beta);
+
+
+/** 
+ * Integer Kalman filter (steady state, constant velocity) - tracks ramps without the exp. filter lag
+ * 
+ * Prediction level + steps * slope, both corrected by the residual with the gains from @KalmanGains.
+ * Integer only. The gains are for a fixed sample period, so the caller takes the samples on a fixed
+ * time grid and passes the number of periods since the previous one (more than one after a gap).
+ * Starts (level = new value, zero slope) when the slope is KALMAN_SLOPE_INVALID, when the residual is
+ * above KALMAN_RESET_RESIDUAL or after more than KALMAN_STEPS_MAX periods.
+ *
+ * @param level filter level (will be updated), in 1/(2^KALMAN_LEVEL_FRAC_BITS) units of the value
+ * @param slope filter slope (will be updated), in 1/(2^KALMAN_SLOPE_FRAC_BITS) units of the value per period
+ * @param alpha level gain (see @KalmanGains)
+ * @param beta slope gain (see @KalmanGains)
+ * @param steps sample periods since the previous value (1 .. )
+ * @param newVal newly measured value in 1/(2^EXPFILT_FRAC_BITS) units (0 .. 1023, e.g. ADC counts)
+ * 
+ * @return new filtered value in 1/(2^EXPFILT_FRAC_BITS) units (the same as the @ExpFilterInt state)
  */
-float ExpFilter(float *oldVal, float weight, float newVal);
+long KalmanFilterInt(long *level, long *slope, unsigned int alpha, unsigned int beta, unsigned long steps, long newVal);
+
+
+/** Normalized temperature weight 1.0 (weights are in Q15, see @normalizeTempWeights) */
+#define TEMP_WEIGHT_ONE 32768U
+
+
+/** 
+ * Convert the fan temperature weights (tempWeights) to tempWeightsQ used by @averageTemp
+ * 
+ * Weights are divided by their sum once here, the Q15 values then sum exactly to TEMP_WEIGHT_ONE
+ * (the rounding error goes to the biggest weight). All zero weights (the default) mean plain average.
+ * Call it whenever tempWeights change.
+ *
+ * @param fan fan index (0 .. NUM_FANS-1)
+ */
+void normalizeTempWeights(unsigned char fan);
 
 
 /** 
  * Average measured temperatures for given fan
  * 
- * Using global temps[] as input, compute wighted average and do saturation against temp limits.
+ * Using global temps[] as input, compute wighted average (integer, rounded) and do saturation
+ * against the temperature axis limits.
  *
  * @param fan fan index (0 .. NUM_FANS-1)
  * 
- * @return resulting temperature
+ * @return resulting temperature in 1/TEMP_ONE C
  */
 int averageTemp(unsigned char fan);
 
 
+/** 
+ * Find the mapping table axis segment
+ * 
+ * Linear search from the top, the axes are short (mapTempCoeffs, mapPwmCoeffs).
+ *
+ * @param axis breakpoints (tempAxis or pwmAxis, increasing)
+ * @param n number of breakpoints
+ * @param v value in the axis units
+ * 
+ * @return index of the last breakpoint <= v, 0 if v is below the first one
+ */
+unsigned char axisIndex(const unsigned char *axis, unsigned char n, int v);
+
+
+/** 
+ * Check the temperature axis (strictly increasing)
+ * 
+ * @param axis mapTempCoeffs breakpoints
+ * 
+ * @return zero when valid
+ */
+int checkTempAxis(const unsigned char *axis);
+
+
+/** 
+ * Check the input PWM axis (strictly increasing, from 0 to 100)
+ * 
+ * @param axis mapPwmCoeffs breakpoints
+ * 
+ * @return zero when valid
+ */
+int checkPwmAxis(const unsigned char *axis);
+
+
 /** 
  * Bilinear interpolation in the mapping table using PWM and temperature as inputs
  * 
+ * Integer only, the exact bilinear value rounded (half up) - a single long division, no state, so a
+ * table or axis change takes effect at once. The axis segments are found by @axisIndex.
+ *
  * @param fan zero based fan index (0 .. NUM_FANS-1)
  * @param pwm input PWM value (0 .. 100)
- * @param tmp input tempetarture index (already averaged/wighted, sanitized, etc.)
+ * @param tmp input tempetarture in 1/TEMP_ONE C (already averaged/wighted, sanitized, etc.)
  * 
  * @return resulting PWM (0 .. 100)
  */
-int interpolatePwm(unsigned char fan, unsigned char pwm, unsigned char tmp);
+int interpolatePwm(unsigned char fan, unsigned char pwm, int tmp);
+
+
+/** 
+ * Check a temperature curve (strictly increasing temperatures)
+ * 
+ * @param t TEMP_CURVE_POINTS temperatures
+ * 
+ * @return zero when valid
+ */
+int checkTempCurve(const unsigned char *t);
+
+
+/** 
+ * Duty cycle from the temperature curve of one sensor, integer linear interpolation (rounded). Flat
+ * outside the curve.
+ * 
+ * @param fan fan index (0 .. NUM_FANS-1)
+ * @param sensor temperature sensor index (0 .. TEMP_SENSORS-1)
+ * @param tmp temperature in 1/TEMP_ONE C
+ * 
+ * @return duty cycle in %
+ */
+int curveDutyAt(unsigned char fan, unsigned char sensor, int tmp);
+
+
+/** 
+ * Max. of the given (mapping table) PWM and the temperature curves of all the sensors at the
+ * current temperatures (global temps[]), i.e. a single hot sensor is not diluted by the average.
+ * 
+ * @param fan fan index (0 .. NUM_FANS-1)
+ * @param pwm output PWM from the mapping table in %
+ * 
+ * @return output PWM in %
+ */
+int maxCurvePwm(unsigned char fan, int pwm);
+
+
+/** 
+ * Change the mapping table geometry
+ *
+ * The number of rows is (tMax-tMin)/tStep+1, columns 100/pStep+1. It must fit into the space of the default
+ * (compile time) geometry - MAP_CELLS of RAM and MAP_EE_CELLS of EEPROM per fan. When accepted, the axes
+ * are reset to the uniform ones and all the tables to PWM_MAPPING_TABLE_DEFAULT.
+ * 
+ * @param tMin temperature axis start (C)
+ * @param tStep temperature axis step (C), must divide the range
+ * @param tMax temperature axis end (C)
+ * @param pStep input PWM axis step (%), must divide 100
+ * 
+ * @return zero when accepted, nothing is changed otherwise
+ */
+int setMapGeometry(unsigned char tMin, unsigned char tStep, unsigned char tMax, unsigned char pStep);
 
 
-#endif // __DATAPROCESSING_H__
+#endif // __DATAPROCESSING_H__
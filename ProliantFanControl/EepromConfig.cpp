@@ -5,6 +5,11 @@
 #include "PFCmain.h"
 #include "PwmMeasure.h"
 #include "MCP9701.h"
+#include "Tach.h"
+#include "Pid.h"
+#include "FeedFwd.h"
+#include "Slew.h"
+#include "DataProcessing.h"
 
 #include "EepromConfig.h"
 
@@ -17,17 +22,70 @@
   F2 TEMP_SENSORS * float, 1B checksum
   ...
      
-  expFilterWeight
+  expFilterWeight (legacy per loop weights, only read when filterTc is not valid)
   float, float, 1B checksum
    
-  mappingTable
+  mappingTable (the space of the default geometry, TEMP_COEFFS * (PWM_COEFFS + 1) per fan)
   F1
-  TempCoefs[0]  PWM_COEFFS * 1Bytye (unsigned char), 1B checksum
-  TempCoefs[1]  PWM_COEFFS * 1Bytye (unsigned char), 1B checksum
+  TempCoefs[0]  mapPwmCoeffs * 1Bytye (unsigned char), 1B checksum
+  TempCoefs[1]  mapPwmCoeffs * 1Bytye (unsigned char), 1B checksum
   ...
   F2
   ...
   ...
+
+  pwmInSel
+  FANS * 1Byte, 1B checksum
+
+  pwmPolMode
+  PWM_INPUTS * 1Byte, 1B checksum
+
+  tachPpr
+  FANS * 1Byte, 1B checksum
+
+  tachEmuCurve (reserved even without TACH_EMU)
+  F1 TACH_EMU_POINTS * unsigned int, 1B checksum
+  F2 TACH_EMU_POINTS * unsigned int, 1B checksum
+
+  pwmFallback
+  FANS * 1Byte, 1B checksum
+
+  tempAxis
+  TEMP_COEFFS_MAX * 1Byte, 1B checksum
+
+  pwmAxis
+  PWM_COEFFS_MAX * 1Byte, 1B checksum
+
+  mapGeometry
+  version, temp. min, temp. step, temp. max, PWM step, 1B checksum
+
+  fanCtrl
+  FANS * 1Byte, 1B checksum
+
+  temp. curves
+  F1 TEMP_SENSORS * TEMP_CURVE_POINTS * 1Byte temp, TEMP_SENSORS * TEMP_CURVE_POINTS * 1Byte duty, 1B checksum
+  F2 ...
+
+  pid
+  F1 setpoint 1Byte, Kp, Ki, Kd float, 1B checksum
+  F2 ...
+
+  feed-forward
+  F1 gain, max., decay 1Byte, 1B checksum
+  F2 ...
+
+  slew
+  F1 rise, fall, hysteresis up, down, flags 1Byte, 1B checksum
+  F2 ...
+
+  pwmAdaptFilterGain
+  float, 1B checksum
+
+  tempKalman
+  q float, r float, 1B checksum
+
+  filterTc
+  PWM time constant float, temp. time constant float, 1B checksum
      
 */
 
@@ -55,17 +113,145 @@
 #define EE_EXPFILTER_END        (EE_EXPFILTER_START + EE_EXPFILTER_SIZE)
 
 
+// rows depend on the runtime geometry, the default one gives the same layout as the fixed one before
 #define EE_MAPPINGTABLE_START     (EE_EXPFILTER_END)
-#define EE_MAPPINGTABLE_DATA_SIZE (PWM_COEFFS)
-#define EE_MAPPINGTABLE_ROW_SIZE  (PWM_COEFFS + 1)
-#define EE_MAPPINGTABLE_FAN_SIZE  (EE_MAPPINGTABLE_ROW_SIZE * TEMP_COEFFS)
-#define EE_MAPPINGTABLE_END       (EE_MAPPINGTABLE_START + FANS * TEMP_COEFFS * EE_MAPPINGTABLE_ROW)
+#define EE_MAPPINGTABLE_DATA_SIZE (mapPwmCoeffs)
+#define EE_MAPPINGTABLE_ROW_SIZE  (mapPwmCoeffs + 1)
+#define EE_MAPPINGTABLE_FAN_SIZE  (MAP_EE_CELLS)
+#define EE_MAPPINGTABLE_END       (EE_MAPPINGTABLE_START + FANS * EE_MAPPINGTABLE_FAN_SIZE)
 
 
 #define eepMapTableRowAddr(f,t)  ( EE_MAPPINGTABLE_START + (f)*EE_MAPPINGTABLE_FAN_SIZE + (t)*EE_MAPPINGTABLE_ROW_SIZE )
 #define eepMapTableCsumAddr(f,t) ( eepMapTableRowAddr(f,t) + EE_MAPPINGTABLE_DATA_SIZE )
 
 
+#define EE_PWMINSEL_START      (EE_MAPPINGTABLE_END)
+#define EE_PWMINSEL_DATA_SIZE  (FANS)
+#define EE_PWMINSEL_SIZE       (EE_PWMINSEL_DATA_SIZE + 1)
+#define EE_PWMINSEL_CSUM       (EE_PWMINSEL_START + EE_PWMINSEL_DATA_SIZE)
+#define EE_PWMINSEL_END        (EE_PWMINSEL_START + EE_PWMINSEL_SIZE)
+
+
+#define EE_PWMPOL_START        (EE_PWMINSEL_END)
+#define EE_PWMPOL_DATA_SIZE    (PWM_INPUTS)
+#define EE_PWMPOL_SIZE         (EE_PWMPOL_DATA_SIZE + 1)
+#define EE_PWMPOL_CSUM         (EE_PWMPOL_START + EE_PWMPOL_DATA_SIZE)
+#define EE_PWMPOL_END          (EE_PWMPOL_START + EE_PWMPOL_SIZE)
+
+
+#define EE_TACHPPR_START       (EE_PWMPOL_END)
+#define EE_TACHPPR_DATA_SIZE   (FANS)
+#define EE_TACHPPR_SIZE        (EE_TACHPPR_DATA_SIZE + 1)
+#define EE_TACHPPR_CSUM        (EE_TACHPPR_START + EE_TACHPPR_DATA_SIZE)
+#define EE_TACHPPR_END         (EE_TACHPPR_START + EE_TACHPPR_SIZE)
+
+
+#define EE_TACHEMU_START       (EE_TACHPPR_END)
+#define EE_TACHEMU_DATA_SIZE   (TACH_EMU_POINTS * sizeof(unsigned int))
+#define EE_TACHEMU_ROW_SIZE    (EE_TACHEMU_DATA_SIZE + 1)
+#define EE_TACHEMU_END         (EE_TACHEMU_START + FANS * EE_TACHEMU_ROW_SIZE)
+
+#define eepTachEmuRowAddr(f)   (EE_TACHEMU_START + (f)*EE_TACHEMU_ROW_SIZE)
+#define eepTachEmuCsumAddr(f)  (eepTachEmuRowAddr((f)) + EE_TACHEMU_DATA_SIZE)
+
+
+#define EE_PWMFALLBACK_START      (EE_TACHEMU_END)
+#define EE_PWMFALLBACK_DATA_SIZE  (FANS)
+#define EE_PWMFALLBACK_SIZE       (EE_PWMFALLBACK_DATA_SIZE + 1)
+#define EE_PWMFALLBACK_CSUM       (EE_PWMFALLBACK_START + EE_PWMFALLBACK_DATA_SIZE)
+#define EE_PWMFALLBACK_END        (EE_PWMFALLBACK_START + EE_PWMFALLBACK_SIZE)
+
+
+#define EE_TEMPAXIS_START      (EE_PWMFALLBACK_END)
+#define EE_TEMPAXIS_DATA_SIZE  (TEMP_COEFFS_MAX)
+#define EE_TEMPAXIS_SIZE       (EE_TEMPAXIS_DATA_SIZE + 1)
+#define EE_TEMPAXIS_CSUM       (EE_TEMPAXIS_START + EE_TEMPAXIS_DATA_SIZE)
+#define EE_TEMPAXIS_END        (EE_TEMPAXIS_START + EE_TEMPAXIS_SIZE)
+
+
+#define EE_PWMAXIS_START       (EE_TEMPAXIS_END)
+#define EE_PWMAXIS_DATA_SIZE   (PWM_COEFFS_MAX)
+#define EE_PWMAXIS_SIZE        (EE_PWMAXIS_DATA_SIZE + 1)
+#define EE_PWMAXIS_CSUM        (EE_PWMAXIS_START + EE_PWMAXIS_DATA_SIZE)
+#define EE_PWMAXIS_END         (EE_PWMAXIS_START + EE_PWMAXIS_SIZE)
+
+
+// bump the version when the meaning of the geometry data changes
+#define EE_GEOMETRY_VERSION    1
+
+#define EE_GEOMETRY_START      (EE_PWMAXIS_END)
+#define EE_GEOMETRY_DATA_SIZE  5
+#define EE_GEOMETRY_SIZE       (EE_GEOMETRY_DATA_SIZE + 1)
+#define EE_GEOMETRY_CSUM       (EE_GEOMETRY_START + EE_GEOMETRY_DATA_SIZE)
+#define EE_GEOMETRY_END        (EE_GEOMETRY_START + EE_GEOMETRY_SIZE)
+
+
+#define EE_FANCTRL_START       (EE_GEOMETRY_END)
+#define EE_FANCTRL_DATA_SIZE   (FANS)
+#define EE_FANCTRL_SIZE        (EE_FANCTRL_DATA_SIZE + 1)
+#define EE_FANCTRL_CSUM        (EE_FANCTRL_START + EE_FANCTRL_DATA_SIZE)
+#define EE_FANCTRL_END         (EE_FANCTRL_START + EE_FANCTRL_SIZE)
+
+
+#define EE_TEMPCURVE_START     (EE_FANCTRL_END)
+#define EE_TEMPCURVE_HALF_SIZE (TEMP_SENSORS * TEMP_CURVE_POINTS)
+#define EE_TEMPCURVE_DATA_SIZE (2 * EE_TEMPCURVE_HALF_SIZE)
+#define EE_TEMPCURVE_ROW_SIZE  (EE_TEMPCURVE_DATA_SIZE + 1)
+#define EE_TEMPCURVE_END       (EE_TEMPCURVE_START + FANS * EE_TEMPCURVE_ROW_SIZE)
+
+#define eepTempCurveRowAddr(f)   (EE_TEMPCURVE_START + (f)*EE_TEMPCURVE_ROW_SIZE)
+#define eepTempCurveCsumAddr(f)  (eepTempCurveRowAddr((f)) + EE_TEMPCURVE_DATA_SIZE)
+
+
+#define EE_PID_START           (EE_TEMPCURVE_END)
+#define EE_PID_GAINS_SIZE      (3 * sizeof(float))
+#define EE_PID_DATA_SIZE       (1 + EE_PID_GAINS_SIZE)
+#define EE_PID_ROW_SIZE        (EE_PID_DATA_SIZE + 1)
+#define EE_PID_END             (EE_PID_START + FANS * EE_PID_ROW_SIZE)
+
+#define eepPidRowAddr(f)       (EE_PID_START + (f)*EE_PID_ROW_SIZE)
+#define eepPidCsumAddr(f)      (eepPidRowAddr((f)) + EE_PID_DATA_SIZE)
+
+
+#define EE_FEEDFWD_START       (EE_PID_END)
+#define EE_FEEDFWD_DATA_SIZE   3
+#define EE_FEEDFWD_ROW_SIZE    (EE_FEEDFWD_DATA_SIZE + 1)
+#define EE_FEEDFWD_END         (EE_FEEDFWD_START + FANS * EE_FEEDFWD_ROW_SIZE)
+
+#define eepFeedFwdRowAddr(f)   (EE_FEEDFWD_START + (f)*EE_FEEDFWD_ROW_SIZE)
+#define eepFeedFwdCsumAddr(f)  (eepFeedFwdRowAddr((f)) + EE_FEEDFWD_DATA_SIZE)
+
+
+#define EE_SLEW_START          (EE_FEEDFWD_END)
+#define EE_SLEW_DATA_SIZE      5
+#define EE_SLEW_ROW_SIZE       (EE_SLEW_DATA_SIZE + 1)
+#define EE_SLEW_END            (EE_SLEW_START + FANS * EE_SLEW_ROW_SIZE)
+
+#define eepSlewRowAddr(f)      (EE_SLEW_START + (f)*EE_SLEW_ROW_SIZE)
+#define eepSlewCsumAddr(f)     (eepSlewRowAddr((f)) + EE_SLEW_DATA_SIZE)
+
+
+#define EE_ADAPTFILTER_START      (EE_SLEW_END)
+#define EE_ADAPTFILTER_DATA_SIZE  (sizeof(float))
+#define EE_ADAPTFILTER_SIZE       (EE_ADAPTFILTER_DATA_SIZE + 1)
+#define EE_ADAPTFILTER_CSUM       (EE_ADAPTFILTER_START + EE_ADAPTFILTER_DATA_SIZE)
+#define EE_ADAPTFILTER_END        (EE_ADAPTFILTER_START + EE_ADAPTFILTER_SIZE)
+
+
+#define EE_TEMPKALMAN_START       (EE_ADAPTFILTER_END)
+#define EE_TEMPKALMAN_DATA_SIZE   (2 * sizeof(float))
+#define EE_TEMPKALMAN_SIZE        (EE_TEMPKALMAN_DATA_SIZE + 1)
+#define EE_TEMPKALMAN_CSUM        (EE_TEMPKALMAN_START + EE_TEMPKALMAN_DATA_SIZE)
+#define EE_TEMPKALMAN_END         (EE_TEMPKALMAN_START + EE_TEMPKALMAN_SIZE)
+
+
+#define EE_FILTERTC_START         (EE_TEMPKALMAN_END)
+#define EE_FILTERTC_DATA_SIZE     (2 * sizeof(float))
+#define EE_FILTERTC_SIZE          (EE_FILTERTC_DATA_SIZE + 1)
+#define EE_FILTERTC_CSUM          (EE_FILTERTC_START + EE_FILTERTC_DATA_SIZE)
+#define EE_FILTERTC_END           (EE_FILTERTC_START + EE_FILTERTC_SIZE)
+
+
 //#if EE_mappingTable_END >= 1024
 //#error EEProm size overrun
 //#endif
@@ -114,11 +300,12 @@ int LoadTempWeights(int fan)
     if(LoadAndCheck(eepTempWeightRowAddr(fan), tempRow, EE_TEMPWEIGHTS_ROW_SIZE))
     {
 #ifdef DEBUG_EEPROM_CONFIG
-        Serial.println("Failed checksum in LoadTempWeights");
+        Serial.println(F("Failed checksum in LoadTempWeights"));
 #endif
         return -1;   // checksum mismatch
     }
     memcpy(tempWeights[fan], tempRow, EE_TEMPWEIGHTS_DATA_SIZE);
+    normalizeTempWeights(fan);
 
     return 0;
 }
@@ -147,23 +334,62 @@ int SaveTempWeights(int fan)
 }
 
 
-// --------------------------- PWM exp filter weight -----------------------
+// --------------------------- PWM exp filter time constants -----------------------
+
+/** 
+ * Time constant equivalent to a legacy per loop weight
+ * 
+ * @param weight filter weight (0.0 .. 1.0) applied once per EXPFILT_LEGACY_LOOP_MS
+ * 
+ * @return time constant in s (0.0 .. EXPFILT_TC_MAX)
+ */
+static float legacyWeightToTc(float weight)
+{
+    if(!(weight < 1.0))   // catches NaN as well
+        return 0.0;
+
+    if(weight <= 0.0)
+        return EXPFILT_TC_MAX;
+
+    float tc = -(EXPFILT_LEGACY_LOOP_MS / 1000.0) / log(1.0 - weight);
+    return (tc > EXPFILT_TC_MAX) ? EXPFILT_TC_MAX : tc;
+}
+
 
 int LoadPwmExpFilter(void)
 {
     unsigned char filtData[EE_EXPFILTER_SIZE];
+    float tc[2];
 
 
-    if(LoadAndCheck(EE_EXPFILTER_START, filtData, EE_EXPFILTER_SIZE))
+    if(!LoadAndCheck(EE_FILTERTC_START, filtData, EE_FILTERTC_SIZE))
+    {
+        memcpy((void*)tc, filtData, EE_FILTERTC_DATA_SIZE);
+    }
+    else
     {
+        // not saved since the time constants were introduced, convert the old weights
+        if(LoadAndCheck(EE_EXPFILTER_START, filtData, EE_EXPFILTER_SIZE))
+        {
 #ifdef DEBUG_EEPROM_CONFIG
-        Serial.println("Failed checksum in LoadPwmExpFilter");
+            Serial.println(F("Failed checksum in LoadPwmExpFilter"));
 #endif
-        return -1;
+            return -1;
+        }
+
+        float weight[2];
+        memcpy((void*)weight, filtData, EE_EXPFILTER_DATA_SIZE);
+
+        tc[0] = legacyWeightToTc(weight[0]);
+        tc[1] = legacyWeightToTc(weight[1]);
     }
 
-    memcpy((void*)(&pwmExpFilterWeight),  filtData,                       EE_EXPFILTER_PWM_SIZE);
-    memcpy((void*)(&tempExpFilterWeight), filtData+EE_EXPFILTER_PWM_SIZE, EE_EXPFILTER_TEMP_SIZE);
+    // also catches NaN
+    if(!(tc[0] >= 0.0 && tc[0] <= EXPFILT_TC_MAX && tc[1] >= 0.0 && tc[1] <= EXPFILT_TC_MAX))
+        return -1;
+
+    pwmSetFilterTc(tc[0]);
+    tempSetFilterTc(tc[1]);
 
     return 0;
 }
@@ -171,29 +397,105 @@ int LoadPwmExpFilter(void)
 
 int SavePwmExpFilter(void)
 {
+    float tc[2] = { pwmExpFilterTc, tempExpFilterTc };
     unsigned char sum = EE_CHECKSUM_MAGIC;
-    int a = 0;
+    const unsigned char *data = (const unsigned char*)tc;
 
-    unsigned char *data = (unsigned char*)(&pwmExpFilterWeight);
+    for(int a=0; a<EE_FILTERTC_DATA_SIZE; ++a)
+        sum += data[a];
 
-    for(a=0; a<EE_EXPFILTER_PWM_SIZE; ++a)
-        sum += *(data++);
+    eeprom_update_block((const void*)tc,                    // data
+                        (void*)(EE_FILTERTC_START),          // addr
+                        EE_FILTERTC_DATA_SIZE);              // size
 
-    data = (unsigned char*)(&tempExpFilterWeight);
-    for(a=0; a<EE_EXPFILTER_TEMP_SIZE; ++a)
-        sum += *(data++);
+    eeprom_update_byte((void*)(EE_FILTERTC_CSUM),           // addr
+                       sum);                                // data
+
+    return 0;
+}
+
+
+// --------------------------- PWM adaptive filter gain -----------------------
+
+int LoadPwmAdaptFilter(void)
+{
+    unsigned char filtData[EE_ADAPTFILTER_SIZE];
+    float gain;
+
+    if(LoadAndCheck(EE_ADAPTFILTER_START, filtData, EE_ADAPTFILTER_SIZE))
+    {
+#ifdef DEBUG_EEPROM_CONFIG
+        Serial.println(F("Failed checksum in LoadPwmAdaptFilter"));
+#endif
+        return -1;
+    }
+
+    memcpy((void*)(&gain), filtData, EE_ADAPTFILTER_DATA_SIZE);
+
+    // also catches NaN
+    if(!(gain >= 0.0 && gain <= 1.0))
+        return -1;
+
+    pwmSetFilterGain(gain);
+
+    return 0;
+}
+
+
+int SavePwmAdaptFilter(void)
+{
+    unsigned char sum = EE_CHECKSUM_MAGIC;
+    const unsigned char *data = (const unsigned char*)(&pwmAdaptFilterGain);
+
+    for(int a=0; a<EE_ADAPTFILTER_DATA_SIZE; ++a)
+        sum += data[a];
+
+    eeprom_update_block((const void*)(&pwmAdaptFilterGain), // data
+                        (void*)(EE_ADAPTFILTER_START),       // addr
+                        EE_ADAPTFILTER_DATA_SIZE);           // size
+
+    eeprom_update_byte((void*)(EE_ADAPTFILTER_CSUM),        // addr
+                       sum);                                // data
+
+    return 0;
+}
+
+
+int LoadTempKalman(void)
+{
+    unsigned char filtData[EE_TEMPKALMAN_SIZE];
+    float noise[2];
 
+    if(LoadAndCheck(EE_TEMPKALMAN_START, filtData, EE_TEMPKALMAN_SIZE))
+    {
+#ifdef DEBUG_EEPROM_CONFIG
+        Serial.println(F("Failed checksum in LoadTempKalman"));
+#endif
+        return -1;
+    }
 
-    eeprom_update_block((const void*)(&pwmExpFilterWeight), // data
-                        (void*)(EE_EXPFILTER_PWM),          // addr
-                        EE_EXPFILTER_PWM_SIZE);             // size
+    memcpy((void*)noise, filtData, EE_TEMPKALMAN_DATA_SIZE);
 
-    eeprom_update_block((const void*)(&tempExpFilterWeight), // data
-                        (void*)(EE_EXPFILTER_TEMP),          // addr
-                        EE_EXPFILTER_TEMP_SIZE);             // size
+    // validates the values too
+    return tempSetKalman(noise[0], noise[1]);
+}
 
-    eeprom_update_byte((void*)(EE_EXPFILTER_CSUM),        // addr
-                       sum);                              // data
+
+int SaveTempKalman(void)
+{
+    float noise[2] = { tempKalmanQ, tempKalmanR };
+    unsigned char sum = EE_CHECKSUM_MAGIC;
+    const unsigned char *data = (const unsigned char*)noise;
+
+    for(int a=0; a<EE_TEMPKALMAN_DATA_SIZE; ++a)
+        sum += data[a];
+
+    eeprom_update_block((const void*)noise,                 // data
+                        (void*)(EE_TEMPKALMAN_START),        // addr
+                        EE_TEMPKALMAN_DATA_SIZE);            // size
+
+    eeprom_update_byte((void*)(EE_TEMPKALMAN_CSUM),         // addr
+                       sum);                                // data
 
     return 0;
 }
@@ -203,23 +505,23 @@ int SavePwmExpFilter(void)
 
 int LoadMappingTable(int fan, int tempIdx)
 {
-    unsigned char mapRow[EE_MAPPINGTABLE_ROW_SIZE];
+    unsigned char rowData[PWM_COEFFS_MAX + 1];
 
     if(fan<0 || fan>=FANS)
         return -1; // fan index out of range
 
-    if(tempIdx<0 || tempIdx>=TEMP_COEFFS)
+    if(tempIdx<0 || tempIdx>=mapTempCoeffs)
         return -1; // temp index out of range
 
-    if(LoadAndCheck(eepMapTableRowAddr(fan, tempIdx), mapRow, EE_MAPPINGTABLE_ROW_SIZE))
+    if(LoadAndCheck(eepMapTableRowAddr(fan, tempIdx), rowData, EE_MAPPINGTABLE_ROW_SIZE))
     {
 #ifdef DEBUG_EEPROM_CONFIG
-        Serial.println("Failed checksum in LoadMappingTable");
+        Serial.println(F("Failed checksum in LoadMappingTable"));
 #endif
         return -1;
     }
 
-    memcpy((void*)(mappingTable[fan][tempIdx]), mapRow, EE_MAPPINGTABLE_DATA_SIZE);
+    memcpy((void*)mapRow(fan, tempIdx), rowData, EE_MAPPINGTABLE_DATA_SIZE);
 
     return 0;
 }
@@ -233,15 +535,15 @@ int SaveMappingTable(int fan, int tempIdx)
     if(fan<0 || fan>=FANS)
         return -1;
 
-    if(tempIdx<0 || tempIdx>=TEMP_COEFFS)
+    if(tempIdx<0 || tempIdx>=mapTempCoeffs)
         return -1;
 
-    data = (unsigned char*)(mappingTable[fan][tempIdx]);
+    data = mapRow(fan, tempIdx);
 
     for(int a=0; a<EE_MAPPINGTABLE_DATA_SIZE; ++a)
         sum += *(data++);
 
-    eeprom_update_block((const void*)(mappingTable[fan][tempIdx]), // data
+    eeprom_update_block((const void*)mapRow(fan, tempIdx),       // data
                         (void*)eepMapTableRowAddr(fan, tempIdx),   // addr
                         EE_MAPPINGTABLE_DATA_SIZE);                // size
 
@@ -250,4 +552,613 @@ int SaveMappingTable(int fan, int tempIdx)
     return 0;
 }
 
+
+// --------------------------- PWM input selection -----------------------
+
+int LoadPwmInSel(void)
+{
+    unsigned char selData[EE_PWMINSEL_SIZE];
+
+    if(LoadAndCheck(EE_PWMINSEL_START, selData, EE_PWMINSEL_SIZE))
+    {
+#ifdef DEBUG_EEPROM_CONFIG
+        Serial.println(F("Failed checksum in LoadPwmInSel"));
+#endif
+        return -1;
+    }
+
+    // the inputs may have been saved by a build with more of them
+    for(int fan=0; fan<FANS; ++fan)
+        if((selData[fan] & PWM_IN_SEL_ALL) == 0)
+            return -1;
+
+    for(int fan=0; fan<FANS; ++fan)
+        pwmInSel[fan] = selData[fan] & (PWM_IN_SEL_ALL | PWM_IN_SEL_AVG);
+
+    return 0;
+}
+
+
+int SavePwmInSel(void)
+{
+    unsigned char sum = EE_CHECKSUM_MAGIC;
+
+    for(int fan=0; fan<FANS; ++fan)
+        sum += pwmInSel[fan];
+
+    eeprom_update_block((const void*)(pwmInSel),  // data
+                        (void*)(EE_PWMINSEL_START), // addr
+                        EE_PWMINSEL_DATA_SIZE);     // size
+
+    eeprom_update_byte((void*)(EE_PWMINSEL_CSUM),   // addr
+                       sum);                        // data
+    return 0;
+}
+
+
+// --------------------------- PWM input polarity -----------------------
+
+int LoadPwmPolarity(void)
+{
+    unsigned char polData[EE_PWMPOL_SIZE];
+
+    if(LoadAndCheck(EE_PWMPOL_START, polData, EE_PWMPOL_SIZE))
+    {
+#ifdef DEBUG_EEPROM_CONFIG
+        Serial.println(F("Failed checksum in LoadPwmPolarity"));
+#endif
+        return -1;
+    }
+
+    for(int in=0; in<PWM_INPUTS; ++in)
+        if(polData[in] > PWM_POL_AUTO)
+            return -1;
+
+    for(int in=0; in<PWM_INPUTS; ++in)
+        pwmSetPolarityMode(in, polData[in]);
+
+    return 0;
+}
+
+
+int SavePwmPolarity(void)
+{
+    unsigned char sum = EE_CHECKSUM_MAGIC;
+
+    for(int in=0; in<PWM_INPUTS; ++in)
+        sum += pwmPolMode[in];
+
+    eeprom_update_block((const void*)(pwmPolMode),  // data
+                        (void*)(EE_PWMPOL_START),   // addr
+                        EE_PWMPOL_DATA_SIZE);       // size
+
+    eeprom_update_byte((void*)(EE_PWMPOL_CSUM),     // addr
+                       sum);                        // data
+    return 0;
+}
+
+
+
+// --------------------------- Tach pulses per revolution -----------------------
+
+int LoadTachPpr(void)
+{
+    unsigned char pprData[EE_TACHPPR_SIZE];
+
+    if(LoadAndCheck(EE_TACHPPR_START, pprData, EE_TACHPPR_SIZE))
+    {
+#ifdef DEBUG_EEPROM_CONFIG
+        Serial.println(F("Failed checksum in LoadTachPpr"));
+#endif
+        return -1;
+    }
+
+    for(int fan=0; fan<FANS; ++fan)
+        if(pprData[fan] == 0)
+            return -1;
+
+    memcpy((void*)tachPpr, pprData, EE_TACHPPR_DATA_SIZE);
+
+    return 0;
+}
+
+
+int SaveTachPpr(void)
+{
+    unsigned char sum = EE_CHECKSUM_MAGIC;
+
+    for(int fan=0; fan<FANS; ++fan)
+        sum += tachPpr[fan];
+
+    eeprom_update_block((const void*)(tachPpr),     // data
+                        (void*)(EE_TACHPPR_START),  // addr
+                        EE_TACHPPR_DATA_SIZE);      // size
+
+    eeprom_update_byte((void*)(EE_TACHPPR_CSUM),    // addr
+                       sum);                        // data
+    return 0;
+}
+
+
+
+// --------------------------- Emulated tach curve -----------------------
+
+#ifdef TACH_EMU
+
+int LoadTachEmuCurve(int fan)
+{
+    unsigned char curveRow[EE_TACHEMU_ROW_SIZE];
+
+    if(fan<0 || fan>=FANS)
+        return -1;  // fan index out of range
+
+    if(LoadAndCheck(eepTachEmuRowAddr(fan), curveRow, EE_TACHEMU_ROW_SIZE))
+    {
+#ifdef DEBUG_EEPROM_CONFIG
+        Serial.println(F("Failed checksum in LoadTachEmuCurve"));
+#endif
+        return -1;   // checksum mismatch
+    }
+    memcpy(tachEmuCurve[fan], curveRow, EE_TACHEMU_DATA_SIZE);
+
+    return 0;
+}
+
+
+int SaveTachEmuCurve(int fan)
+{
+    unsigned char *data = NULL;
+    unsigned char sum = EE_CHECKSUM_MAGIC;
+
+    if(fan<0 || fan>=FANS)
+        return -1;  // fan index out of range
+
+    data = (unsigned char*)(tachEmuCurve[fan]);
+
+    for(int a=0; a<EE_TACHEMU_DATA_SIZE; ++a)
+        sum += *(data++);
+
+    eeprom_update_block((const void*)(tachEmuCurve[fan]),   // data
+                        (void*)eepTachEmuRowAddr(fan),      // addr
+                        EE_TACHEMU_DATA_SIZE);              // size
+
+    eeprom_update_byte((void*)eepTachEmuCsumAddr(fan),      // addr
+                       sum);                                // data
+    return 0;
+}
+
+#endif // TACH_EMU
+
+
+
+// --------------------------- PWM input fallback -----------------------
+
+int LoadPwmFallback(void)
+{
+    unsigned char fbData[EE_PWMFALLBACK_SIZE];
+
+    if(LoadAndCheck(EE_PWMFALLBACK_START, fbData, EE_PWMFALLBACK_SIZE))
+    {
+#ifdef DEBUG_EEPROM_CONFIG
+        Serial.println(F("Failed checksum in LoadPwmFallback"));
+#endif
+        return -1;
+    }
+
+    for(int fan=0; fan<FANS; ++fan)
+        if(fbData[fan] > 100)
+            return -1;
+
+    memcpy((void*)pwmFallback, fbData, EE_PWMFALLBACK_DATA_SIZE);
+
+    return 0;
+}
+
+
+int SavePwmFallback(void)
+{
+    unsigned char sum = EE_CHECKSUM_MAGIC;
+
+    for(int fan=0; fan<FANS; ++fan)
+        sum += pwmFallback[fan];
+
+    eeprom_update_block((const void*)(pwmFallback),    // data
+                        (void*)(EE_PWMFALLBACK_START), // addr
+                        EE_PWMFALLBACK_DATA_SIZE);     // size
+
+    eeprom_update_byte((void*)(EE_PWMFALLBACK_CSUM),   // addr
+                       sum);                           // data
+    return 0;
+}
+
+
+
+
+// --------------------------- Mapping table axes -----------------------
+
+int LoadTempAxis(void)
+{
+    unsigned char axisData[EE_TEMPAXIS_SIZE];
+
+    if(LoadAndCheck(EE_TEMPAXIS_START, axisData, EE_TEMPAXIS_SIZE))
+    {
+#ifdef DEBUG_EEPROM_CONFIG
+        Serial.println(F("Failed checksum in LoadTempAxis"));
+#endif
+        return -1;
+    }
+
+    if(checkTempAxis(axisData))
+        return -1;
+
+    memcpy((void*)tempAxis, axisData, EE_TEMPAXIS_DATA_SIZE);
+
+    return 0;
+}
+
+
+int SaveTempAxis(void)
+{
+    unsigned char sum = EE_CHECKSUM_MAGIC;
+
+    for(int a=0; a<TEMP_COEFFS_MAX; ++a)
+        sum += tempAxis[a];
+
+    eeprom_update_block((const void*)(tempAxis),    // data
+                        (void*)(EE_TEMPAXIS_START), // addr
+                        EE_TEMPAXIS_DATA_SIZE);     // size
+
+    eeprom_update_byte((void*)(EE_TEMPAXIS_CSUM),   // addr
+                       sum);                        // data
+    return 0;
+}
+
+
+int LoadPwmAxis(void)
+{
+    unsigned char axisData[EE_PWMAXIS_SIZE];
+
+    if(LoadAndCheck(EE_PWMAXIS_START, axisData, EE_PWMAXIS_SIZE))
+    {
+#ifdef DEBUG_EEPROM_CONFIG
+        Serial.println(F("Failed checksum in LoadPwmAxis"));
+#endif
+        return -1;
+    }
+
+    if(checkPwmAxis(axisData))
+        return -1;
+
+    memcpy((void*)pwmAxis, axisData, EE_PWMAXIS_DATA_SIZE);
+
+    return 0;
+}
+
+
+int SavePwmAxis(void)
+{
+    unsigned char sum = EE_CHECKSUM_MAGIC;
+
+    for(int a=0; a<PWM_COEFFS_MAX; ++a)
+        sum += pwmAxis[a];
+
+    eeprom_update_block((const void*)(pwmAxis),    // data
+                        (void*)(EE_PWMAXIS_START), // addr
+                        EE_PWMAXIS_DATA_SIZE);     // size
+
+    eeprom_update_byte((void*)(EE_PWMAXIS_CSUM),   // addr
+                       sum);                       // data
+    return 0;
+}
+
+
+
+// --------------------------- Mapping table geometry -----------------------
+
+int LoadMapGeometry(void)
+{
+    unsigned char geomData[EE_GEOMETRY_SIZE];
+
+    if(LoadAndCheck(EE_GEOMETRY_START, geomData, EE_GEOMETRY_SIZE))
+    {
+#ifdef DEBUG_EEPROM_CONFIG
+        Serial.println(F("Failed checksum in LoadMapGeometry"));
+#endif
+        return -1;
+    }
+
+    if(geomData[0] != EE_GEOMETRY_VERSION)
+        return -1;
+
+    return setMapGeometry(geomData[1], geomData[2], geomData[3], geomData[4]);
+}
+
+
+int SaveMapGeometry(void)
+{
+    unsigned char geomData[EE_GEOMETRY_DATA_SIZE];
+    unsigned char sum = EE_CHECKSUM_MAGIC;
+
+    geomData[0] = EE_GEOMETRY_VERSION;
+    geomData[1] = mapTempMin;
+    geomData[2] = mapTempStep;
+    geomData[3] = mapTempMin + (mapTempCoeffs-1)*mapTempStep;
+    geomData[4] = mapPwmStep;
+
+    for(int a=0; a<EE_GEOMETRY_DATA_SIZE; ++a)
+        sum += geomData[a];
+
+    eeprom_update_block((const void*)(geomData),    // data
+                        (void*)(EE_GEOMETRY_START), // addr
+                        EE_GEOMETRY_DATA_SIZE);     // size
+
+    eeprom_update_byte((void*)(EE_GEOMETRY_CSUM),   // addr
+                       sum);                        // data
+    return 0;
+}
+
+
+
+// --------------------------- Fan control -----------------------
+
+int LoadFanCtrl(void)
+{
+    unsigned char ctrlData[EE_FANCTRL_SIZE];
+
+    if(LoadAndCheck(EE_FANCTRL_START, ctrlData, EE_FANCTRL_SIZE))
+    {
+#ifdef DEBUG_EEPROM_CONFIG
+        Serial.println(F("Failed checksum in LoadFanCtrl"));
+#endif
+        return -1;
+    }
+
+    for(int fan=0; fan<FANS; ++fan)
+        if(ctrlData[fan] > FAN_CTRL_MAXCURVE)
+            return -1;
+
+    memcpy((void*)fanCtrl, ctrlData, EE_FANCTRL_DATA_SIZE);
+
+    return 0;
+}
+
+
+int SaveFanCtrl(void)
+{
+    unsigned char sum = EE_CHECKSUM_MAGIC;
+
+    for(int fan=0; fan<FANS; ++fan)
+        sum += fanCtrl[fan];
+
+    eeprom_update_block((const void*)(fanCtrl),    // data
+                        (void*)(EE_FANCTRL_START), // addr
+                        EE_FANCTRL_DATA_SIZE);     // size
+
+    eeprom_update_byte((void*)(EE_FANCTRL_CSUM),   // addr
+                       sum);                       // data
+    return 0;
+}
+
+
+int LoadTempCurves(int fan)
+{
+    unsigned char curveData[EE_TEMPCURVE_ROW_SIZE];
+
+    if(fan<0 || fan>=FANS)
+        return -1;
+
+    if(LoadAndCheck(eepTempCurveRowAddr(fan), curveData, EE_TEMPCURVE_ROW_SIZE))
+    {
+#ifdef DEBUG_EEPROM_CONFIG
+        Serial.println(F("Failed checksum in LoadTempCurves"));
+#endif
+        return -1;
+    }
+
+    for(int s=0; s<TEMP_SENSORS; ++s)
+    {
+        if(checkTempCurve(&curveData[s * TEMP_CURVE_POINTS]))
+            return -1;
+
+        for(int a=0; a<TEMP_CURVE_POINTS; ++a)
+            if(curveData[EE_TEMPCURVE_HALF_SIZE + s * TEMP_CURVE_POINTS + a] > 100)
+                return -1;
+    }
+
+    memcpy((void*)curveTemp[fan], curveData, EE_TEMPCURVE_HALF_SIZE);
+    memcpy((void*)curveDuty[fan], curveData + EE_TEMPCURVE_HALF_SIZE, EE_TEMPCURVE_HALF_SIZE);
+
+    return 0;
+}
+
+
+int SaveTempCurves(int fan)
+{
+    unsigned char sum = EE_CHECKSUM_MAGIC;
+
+    if(fan<0 || fan>=FANS)
+        return -1;
+
+    const unsigned char *t = (const unsigned char*)curveTemp[fan];
+    const unsigned char *d = (const unsigned char*)curveDuty[fan];
+
+    for(int a=0; a<EE_TEMPCURVE_HALF_SIZE; ++a)
+        sum += t[a] + d[a];
+
+    eeprom_update_block((const void*)t,                                   // data
+                        (void*)eepTempCurveRowAddr(fan),                  // addr
+                        EE_TEMPCURVE_HALF_SIZE);                          // size
+
+    eeprom_update_block((const void*)d,                                   // data
+                        (void*)(eepTempCurveRowAddr(fan) + EE_TEMPCURVE_HALF_SIZE), // addr
+                        EE_TEMPCURVE_HALF_SIZE);                          // size
+
+    eeprom_update_byte((void*)eepTempCurveCsumAddr(fan),                  // addr
+                       sum);                                              // data
+    return 0;
+}
+
+
+
+// --------------------------- PID control -----------------------
+
+int LoadPid(int fan)
+{
+    unsigned char pidRow[EE_PID_ROW_SIZE];
+    float         gains[3];
+
+    if(fan<0 || fan>=FANS)
+        return -1;
+
+    if(LoadAndCheck(eepPidRowAddr(fan), pidRow, EE_PID_ROW_SIZE))
+    {
+#ifdef DEBUG_EEPROM_CONFIG
+        Serial.println(F("Failed checksum in LoadPid"));
+#endif
+        return -1;
+    }
+
+    memcpy(gains, pidRow + 1, EE_PID_GAINS_SIZE);
+
+    // also catches NaN
+    for(int a=0; a<3; ++a)
+        if(!(gains[a] >= 0.0 && gains[a] <= 255.0))
+            return -1;
+
+    pidSetpoint[fan] = pidRow[0];
+    memcpy(pidGain[fan], gains, EE_PID_GAINS_SIZE);
+    pidSetGains(fan);
+
+    return 0;
+}
+
+
+int SavePid(int fan)
+{
+    unsigned char sum = EE_CHECKSUM_MAGIC;
+
+    if(fan<0 || fan>=FANS)
+        return -1;
+
+    const unsigned char *data = (const unsigned char*)(pidGain[fan]);
+
+    sum += pidSetpoint[fan];
+    for(int a=0; a<EE_PID_GAINS_SIZE; ++a)
+        sum += data[a];
+
+    eeprom_update_byte((void*)eepPidRowAddr(fan),              // addr
+                       pidSetpoint[fan]);                      // data
+
+    eeprom_update_block((const void*)(pidGain[fan]),           // data
+                        (void*)(eepPidRowAddr(fan) + 1),       // addr
+                        EE_PID_GAINS_SIZE);                    // size
+
+    eeprom_update_byte((void*)eepPidCsumAddr(fan),             // addr
+                       sum);                                   // data
+    return 0;
+}
+
+
+
+// --------------------------- Feed-forward boost -----------------------
+
+int LoadFeedFwd(int fan)
+{
+    unsigned char ffRow[EE_FEEDFWD_ROW_SIZE];
+
+    if(fan<0 || fan>=FANS)
+        return -1;
+
+    if(LoadAndCheck(eepFeedFwdRowAddr(fan), ffRow, EE_FEEDFWD_ROW_SIZE))
+    {
+#ifdef DEBUG_EEPROM_CONFIG
+        Serial.println(F("Failed checksum in LoadFeedFwd"));
+#endif
+        return -1;
+    }
+
+    if(ffRow[1] > 100 || ffRow[2] > 100)
+        return -1;
+
+    ffGain[fan]  = ffRow[0];
+    ffMax[fan]   = ffRow[1];
+    ffDecay[fan] = ffRow[2];
+
+    return 0;
+}
+
+
+int SaveFeedFwd(int fan)
+{
+    if(fan<0 || fan>=FANS)
+        return -1;
+
+    unsigned char ffRow[EE_FEEDFWD_DATA_SIZE] = { ffGain[fan], ffMax[fan], ffDecay[fan] };
+    unsigned char sum = EE_CHECKSUM_MAGIC;
+
+    for(int a=0; a<EE_FEEDFWD_DATA_SIZE; ++a)
+        sum += ffRow[a];
+
+    eeprom_update_block((const void*)ffRow,                    // data
+                        (void*)eepFeedFwdRowAddr(fan),         // addr
+                        EE_FEEDFWD_DATA_SIZE);                 // size
+
+    eeprom_update_byte((void*)eepFeedFwdCsumAddr(fan),         // addr
+                       sum);                                   // data
+    return 0;
+}
+
+
+
+// --------------------------- Output slew rate and hysteresis -----------------------
+
+int LoadSlew(int fan)
+{
+    unsigned char slewRow[EE_SLEW_ROW_SIZE];
+
+    if(fan<0 || fan>=FANS)
+        return -1;
+
+    if(LoadAndCheck(eepSlewRowAddr(fan), slewRow, EE_SLEW_ROW_SIZE))
+    {
+#ifdef DEBUG_EEPROM_CONFIG
+        Serial.println(F("Failed checksum in LoadSlew"));
+#endif
+        return -1;
+    }
+
+    for(int a=0; a<4; ++a)
+        if(slewRow[a] > 100)
+            return -1;
+
+    slewRise[fan]     = slewRow[0];
+    slewFall[fan]     = slewRow[1];
+    slewHystUp[fan]   = slewRow[2];
+    slewHystDown[fan] = slewRow[3];
+    slewFlags[fan]    = slewRow[4] & SLEW_FLAG_MANUAL;
+
+    return 0;
+}
+
+
+int SaveSlew(int fan)
+{
+    if(fan<0 || fan>=FANS)
+        return -1;
+
+    unsigned char slewRow[EE_SLEW_DATA_SIZE] = { slewRise[fan], slewFall[fan], slewHystUp[fan], slewHystDown[fan], slewFlags[fan] };
+    unsigned char sum = EE_CHECKSUM_MAGIC;
+
+    for(int a=0; a<EE_SLEW_DATA_SIZE; ++a)
+        sum += slewRow[a];
+
+    eeprom_update_block((const void*)slewRow,                  // data
+                        (void*)eepSlewRowAddr(fan),            // addr
+                        EE_SLEW_DATA_SIZE);                    // size
+
+    eeprom_update_byte((void*)eepSlewCsumAddr(fan),            // addr
+                       sum);                                   // data
+    return 0;
+}
+
 
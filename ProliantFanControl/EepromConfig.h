@@ -23,10 +23,12 @@ int LoadTempWeights(int fan);
 int SaveTempWeights(int fan);
 
 
-// --------------------------- PWM exp filter weight -----------------------
+// --------------------------- PWM exp filter time constants -----------------------
 
 /** 
- * Load PWM exp filter params (starting value and wight)
+ * Load PWM and temp. exp filter time constants
+ * 
+ * Falls back to the old per loop weights (converted) when the time constants were never saved.
  * 
  * @return zero when successful
  */
@@ -34,13 +36,45 @@ int LoadPwmExpFilter(void);
 
 
 /** 
- * Save PWM exp filter params (starting value and wight)
+ * Save PWM and temp. exp filter time constants
  *
  * @return zero when successful
  */
 int SavePwmExpFilter(void);
 
 
+/** 
+ * Load PWM adaptive filter gain (see @pwmSetFilterGain)
+ * 
+ * @return zero when successful
+ */
+int LoadPwmAdaptFilter(void);
+
+
+/** 
+ * Save PWM adaptive filter gain
+ *
+ * @return zero when successful
+ */
+int SavePwmAdaptFilter(void);
+
+
+/** 
+ * Load temperature Kalman filter noise (see @tempSetKalman)
+ * 
+ * @return zero when successful
+ */
+int LoadTempKalman(void);
+
+
+/** 
+ * Save temperature Kalman filter noise
+ *
+ * @return zero when successful
+ */
+int SaveTempKalman(void);
+
+
 // --------------------------- Mapping table -----------------------
 
 /** 
@@ -65,6 +99,261 @@ int LoadMappingTable(int fan, int tempIdx);
 int SaveMappingTable(int fan, int tempIdx);
 
 
+// --------------------------- PWM input selection -----------------------
+
+/** 
+ * Load PWM input selection for all the fans
+ * 
+ * @return zero when successful
+ */
+int LoadPwmInSel(void);
+
+
+/** 
+ * Save PWM input selection for all the fans
+ *
+ * @return zero when successful
+ */
+int SavePwmInSel(void);
+
+
+// --------------------------- PWM input polarity -----------------------
+
+/** 
+ * Load PWM input polarity modes (see @pwmSetPolarityMode) for all the inputs
+ * 
+ * @return zero when successful
+ */
+int LoadPwmPolarity(void);
+
+
+/** 
+ * Save PWM input polarity modes for all the inputs
+ *
+ * @return zero when successful
+ */
+int SavePwmPolarity(void);
+
+
+// --------------------------- Tach pulses per revolution -----------------------
+
+/** 
+ * Load tach pulses per revolution for all the fans
+ * 
+ * @return zero when successful
+ */
+int LoadTachPpr(void);
+
+
+/** 
+ * Save tach pulses per revolution for all the fans
+ *
+ * @return zero when successful
+ */
+int SaveTachPpr(void);
+
+
+// --------------------------- Emulated tach curve -----------------------
+
+#ifdef TACH_EMU
+
+/** 
+ * Load emulated tach RPM curve for the given fan
+ * 
+ * @param fan zero based fan index
+ * 
+ * @return zero when successful
+ */
+int LoadTachEmuCurve(int fan);
+
+
+/** 
+ * Save emulated tach RPM curve for the given fan
+ * 
+ * @param fan zero based fan index
+ *
+ * @return zero when successful
+ */
+int SaveTachEmuCurve(int fan);
+
+#endif // TACH_EMU
+
+
+// --------------------------- PWM input fallback -----------------------
+
+/** 
+ * Load fallback input duty cycle (used when the PWM inputs are lost) for all the fans
+ * 
+ * @return zero when successful
+ */
+int LoadPwmFallback(void);
+
+
+/** 
+ * Save fallback input duty cycle for all the fans
+ *
+ * @return zero when successful
+ */
+int SavePwmFallback(void);
+
+
+// --------------------------- Mapping table axes -----------------------
+
+/** 
+ * Load the temperature axis of the mapping tables (rejected when not strictly increasing)
+ * 
+ * @return zero when successful
+ */
+int LoadTempAxis(void);
+
+
+/** 
+ * Save the temperature axis of the mapping tables
+ *
+ * @return zero when successful
+ */
+int SaveTempAxis(void);
+
+
+/** 
+ * Load the input PWM axis of the mapping tables (rejected when not strictly increasing from 0 to 100)
+ * 
+ * @return zero when successful
+ */
+int LoadPwmAxis(void);
+
+
+/** 
+ * Save the input PWM axis of the mapping tables
+ *
+ * @return zero when successful
+ */
+int SavePwmAxis(void);
+
+
+// --------------------------- Mapping table geometry -----------------------
+
+/** 
+ * Load and apply the mapping table geometry (see @setMapGeometry), has to be called before loading
+ * the axes and the tables. Fails also on a different EEPROM geometry version.
+ * 
+ * @return zero when successful
+ */
+int LoadMapGeometry(void);
+
+
+/** 
+ * Save the mapping table geometry (the axes and the tables are saved separately)
+ *
+ * @return zero when successful
+ */
+int SaveMapGeometry(void);
+
+
+// --------------------------- Fan control -----------------------
+
+/** 
+ * Load fan control (FAN_CTRL_*) for all the fans
+ * 
+ * @return zero when successful
+ */
+int LoadFanCtrl(void);
+
+
+/** 
+ * Save fan control for all the fans
+ *
+ * @return zero when successful
+ */
+int SaveFanCtrl(void);
+
+
+/** 
+ * Load temperature curves of all the sensors for the given fan
+ * 
+ * @param fan fan index (0 .. NUM_FANS-1)
+ *
+ * @return zero when successful
+ */
+int LoadTempCurves(int fan);
+
+
+/** 
+ * Save temperature curves of all the sensors for the given fan
+ * 
+ * @param fan fan index (0 .. NUM_FANS-1)
+ *
+ * @return zero when successful
+ */
+int SaveTempCurves(int fan);
+
+
+// --------------------------- PID control -----------------------
+
+/** 
+ * Load PID setpoint and gains for the given fan
+ * 
+ * @param fan fan index (0 .. NUM_FANS-1)
+ *
+ * @return zero when successful
+ */
+int LoadPid(int fan);
+
+
+/** 
+ * Save PID setpoint and gains for the given fan
+ * 
+ * @param fan fan index (0 .. NUM_FANS-1)
+ *
+ * @return zero when successful
+ */
+int SavePid(int fan);
+
+
+// --------------------------- Feed-forward boost -----------------------
+
+/** 
+ * Load feed-forward gain, max. boost and decay for the given fan
+ * 
+ * @param fan fan index (0 .. NUM_FANS-1)
+ *
+ * @return zero when successful
+ */
+int LoadFeedFwd(int fan);
+
+
+/** 
+ * Save feed-forward gain, max. boost and decay for the given fan
+ * 
+ * @param fan fan index (0 .. NUM_FANS-1)
+ *
+ * @return zero when successful
+ */
+int SaveFeedFwd(int fan);
+
+
+// --------------------------- Output slew rate and hysteresis -----------------------
+
+/** 
+ * Load slew rates, hysteresis and flags for the given fan
+ * 
+ * @param fan fan index (0 .. NUM_FANS-1)
+ *
+ * @return zero when successful
+ */
+int LoadSlew(int fan);
+
+
+/** 
+ * Save slew rates, hysteresis and flags for the given fan
+ * 
+ * @param fan fan index (0 .. NUM_FANS-1)
+ *
+ * @return zero when successful
+ */
+int SaveSlew(int fan);
+
+
 // ------------------------- TODO - temp callibration coeffs --------
 
 #endif // __EEPROMCONFIG_H__
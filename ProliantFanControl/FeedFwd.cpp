@@ -0,0 +1,102 @@
+#include <Arduino.h>
+#include "Config.h"
+#include "PwmMeasure.h"
+#include "FeedFwd.h"
+
+#define FF_PERIOD_TICKS  ((unsigned long)FF_PERIOD_MS * (F_CPU / 1000))
+
+#if FF_PERIOD_MS > 1000
+#error FF_PERIOD_MS must be at most 1000
+#endif
+
+#define FF_TEMP_INVALID  0x7fff
+
+unsigned char ffGain[FANS];           /**< Gain in % per C/s, 0 disables the boost */
+unsigned char ffMax[FANS];            /**< Max. boost in % */
+unsigned char ffDecay[FANS];          /**< Decay of the boost in %/s, 0 - no hold */
+unsigned char ffBoost[FANS];          /**< Current boost in % */
+
+int           ffBoostQ[FANS];         /**< Current boost in 1/TEMP_ONE % */
+int           ffLastTemp[FANS];       /**< Temperature at the last sample, FF_TEMP_INVALID after reset */
+unsigned long ffPeriodStart;          /**< Start of the current period (see @pwmTimerTicks) */
+
+
+void ffBegin(void)
+{
+    for(byte f=0; f<FANS; ++f)
+    {
+        ffBoostQ[f]   = 0;
+        ffBoost[f]    = 0;
+        ffLastTemp[f] = FF_TEMP_INVALID;
+    }
+
+    ffPeriodStart = pwmTimerTicks();
+}
+
+
+int ffTick(void)
+{
+    unsigned long now = pwmTimerTicks();
+
+    unsigned long dt  = (uint32_t)(now - ffPeriodStart);
+
+    if(dt < FF_PERIOD_TICKS)
+        return 1;
+
+    // keep the periods exact (a late loop does not stretch them, the rate is per FF_PERIOD_MS)
+    if(dt < 2 * FF_PERIOD_TICKS)
+    {
+        ffPeriodStart = (uint32_t)(ffPeriodStart + FF_PERIOD_TICKS);
+        return 0;
+    }
+
+    // start over after a long stall, the next rise would span more than one period
+    ffPeriodStart = now;
+    for(byte f=0; f<FANS; ++f)
+        ffLastTemp[f] = FF_TEMP_INVALID;
+    return 0;
+}
+
+
+int ffControl(byte fan, int tmp, int pwm, byte update)
+{
+    if(update)
+    {
+        // temperature rise per period, only the rise counts
+        long d = (ffLastTemp[fan] == FF_TEMP_INVALID) ? 0 : (tmp - ffLastTemp[fan]);
+        ffLastTemp[fan] = tmp;
+
+        // gain in % per C/s and d in 1/TEMP_ONE C per period -> 1/TEMP_ONE %
+        long target = (d > 0) ? (long)ffGain[fan] * d * 1000 / FF_PERIOD_MS : 0;
+        long maxQ   = (long)ffMax[fan] * TEMP_ONE;
+        if(target > maxQ)
+            target = maxQ;
+
+        // hold the peak and decay linearly, at least 1 per period so it always gets back to zero
+        long boost = target;
+        if(ffDecay[fan])
+        {
+            long step = (long)ffDecay[fan] * TEMP_ONE * FF_PERIOD_MS / 1000;
+            boost = ffBoostQ[fan] - (step ? step : 1);
+            if(boost < target)
+                boost = target;
+        }
+
+        ffBoostQ[fan] = boost;
+        ffBoost[fan]  = (boost + TEMP_ONE/2) >> TEMP_FRAC_BITS;
+
+#ifdef DEBUG_FEEDFWD
+        Serial.print(F("FF "));
+        Serial.print(fan);
+        Serial.print(F(": dT "));
+        Serial.print(d);
+        Serial.print(F(" target "));
+        Serial.print(target);
+        Serial.print(F(" boost "));
+        Serial.println(ffBoost[fan]);
+#endif
+    }
+
+    pwm += ffBoost[fan];
+    return (pwm > 100) ? 100 : pwm;
+}
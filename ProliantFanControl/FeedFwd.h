@@ -0,0 +1,54 @@
+#ifndef __FEEDFWD_H__
+#define __FEEDFWD_H__
+
+#include "Config.h"
+
+/*******************************************************************************
+ *
+ *  Feed-forward boost on fast temperature rise (operating modes 'A' and 'P')
+ *
+ * The temperatures are heavily filtered (TEMP_EXPFILT_TC), so the mapping table reacts to a
+ * sudden load late. The boost adds duty in proportion to the rate of rise of the fan temperature
+ * (the weighted average, see @averageTemp), clamped to a max. and decaying linearly when the rise
+ * stops. Integer only - the boost is kept in 1/TEMP_ONE %, sampled once per FF_PERIOD_MS (timer1).
+ ******************************************************************************/
+
+extern unsigned char ffGain[FANS];   /**< Gain in % per C/s, 0 disables the boost */
+extern unsigned char ffMax[FANS];    /**< Max. boost in % */
+extern unsigned char ffDecay[FANS];  /**< Decay of the boost in %/s, 0 - no hold */
+extern unsigned char ffBoost[FANS];  /**< Current boost in % (for the reports) */
+
+
+/** 
+ * Reset the state of all the fans (last temperatures, boosts) and restart the period, call when
+ * entering an automatic mode
+ */
+void ffBegin(void);
+
+
+/** 
+ * Check the sampling period - non blocking
+ *
+ * The periods advance by FF_PERIOD_MS (no drift with the loop period). After a stall of two periods
+ * they start over from now and the next sample of each fan has no rate (no boost from the stall).
+ * 
+ * @return 0 once per FF_PERIOD_MS (time to call @ffControl with update), 1 otherwise
+ */
+int ffTick(void);
+
+
+/** 
+ * Add the feed-forward boost to the output of one fan
+ * 
+ * @param fan zero based fan index
+ * @param tmp fan temperature in 1/TEMP_ONE C (not clamped to the mapping table axis)
+ * @param pwm duty cycle in % computed by the control law (mapping table, curves)
+ * @param update non zero to sample the temperature rate (once per period, see @ffTick), otherwise
+ *        just the last boost is added
+ * 
+ * @return output duty cycle in %, at most 100
+ */
+int ffControl(byte fan, int tmp, int pwm, byte update);
+
+
+#endif // __FEEDFWD_H__
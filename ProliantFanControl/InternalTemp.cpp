@@ -1,46 +1,95 @@
 #include <Arduino.h>
-#include <util/delay.h>
 #include "MCP9701.h"
 #include "DataProcessing.h"
 #include "InternalTemp.h"
+#include "PwmMeasure.h"
 
-float intTempExpFilterVal = TEMP_EXPFILT_INIT;
+long intTempExpFilterVal = AVR_INT_TEMP_FILT_VAL(TEMP_EXPFILT_INIT);
+long intTempKalmanLevel;
+long intTempKalmanSlope = KALMAN_SLOPE_INVALID;
+word intTempKalmanSum;
+byte intTempKalmanCnt;
+unsigned long intTempFilterTime;
 
-float readInternalTemp(void)
+// ADC state machine (see @readInternalTemp)
+#define INT_TEMP_IDLE     0   // external sensors may use the ADC
+#define INT_TEMP_SETTLE   1   // internal reference selected, waiting for it to settle
+#define INT_TEMP_DISCARD  2   // first conversion running
+#define INT_TEMP_CONVERT  3   // second conversion running
+
+#define INT_TEMP_SETTLE_TICKS  ((unsigned long)INT_TEMP_SETTLE_MS * (F_CPU / 1000))
+
+static byte          intTempState = INT_TEMP_IDLE;
+static unsigned long intTempStart;    // timer1 ticks when the reference has been switched
+static int           intTempLast = (int)(TEMP_EXPFILT_INIT * TEMP_ONE);
+
+// Offset with the filter fractional bits and 1/coeff in Q12 - constants only, no floats at runtime.
+// (filter value - offset) * 1/coeff fits to 32 bits (2^16 * 2^12).
+#define AVR_INT_TEMP_OFFSET_Q  ((long)(AVR_INT_TEMP_offset * (1 << EXPFILT_FRAC_BITS) + 0.5))
+#define AVR_INT_TEMP_K_Q12     ((long)(4096.0 / AVR_INT_TEMP_coeff + 0.5))
+
+byte intTempAdcBusy(void)
+{
+    return intTempState != INT_TEMP_IDLE;
+}
+
+
+int readInternalTemp(void)
 {
     unsigned int wADC;
-    float temp;
+    long temp;
 
-    // The internal temperature has to be used with the internal reference of 1.1V.
-    // Channel 8 can not be selected with the analogRead function yet.
+    switch(intTempState)
+    {
+    case INT_TEMP_IDLE:
+        // The internal temperature has to be used with the internal reference of 1.1V.
+        // Channel 8 can not be selected with the analogRead function yet.
 
-    // Set the internal reference and mux.
-    ADMUX = (_BV(REFS1) | _BV(REFS0) | _BV(MUX3));
+        // Set the internal reference and mux.
+        ADMUX = (_BV(REFS1) | _BV(REFS0) | _BV(MUX3));
 
-    ADCSRA |= _BV(ADEN);  // enable the ADC
+        ADCSRA |= _BV(ADEN);  // enable the ADC
 
-    _delay_ms(20);
+        intTempStart = pwmTimerTicks();
+        intTempState = INT_TEMP_SETTLE;
+        return intTempLast;
 
-    ADCSRA |= _BV(ADSC);  // Start the ADC
+    case INT_TEMP_SETTLE:
+        if((uint32_t)(pwmTimerTicks() - intTempStart) < INT_TEMP_SETTLE_TICKS)
+            return intTempLast;
 
-    // Detect end-of-conversion
-    while (bit_is_set(ADCSRA,ADSC))
-        ;
+        // discard first reading
+        ADCSRA |= _BV(ADSC);  // Start the ADC
+        intTempState = INT_TEMP_DISCARD;
+        return intTempLast;
 
-    // Reading register "ADCW" takes care of how to read ADCL and ADCH.
-    wADC = ADCW;
+    case INT_TEMP_DISCARD:
+        // Detect end-of-conversion
+        if(bit_is_set(ADCSRA,ADSC))
+            return intTempLast;
 
-    // discard first reading
-    ADCSRA |= _BV(ADEN);  // enable the ADC
-    ADCSRA |= _BV(ADSC);  // Start the ADC
-    while (bit_is_set(ADCSRA,ADSC))
-        ;
+        ADCSRA |= _BV(ADSC);  // Start the ADC
+        intTempState = INT_TEMP_CONVERT;
+        return intTempLast;
+
+    default:
+        if(bit_is_set(ADCSRA,ADSC))
+            return intTempLast;
+        break;
+    }
+
+    // Reading register "ADCW" takes care of how to read ADCL and ADCH.
     wADC = ADCW;
+    intTempState = INT_TEMP_IDLE;
 
-    // todo - temp filtering/averaging?
-    temp = (wADC - AVR_INT_TEMP_offset ) / AVR_INT_TEMP_coeff;
+    if(tempKalmanAlphaQ)
+        intTempExpFilterVal = tempKalmanSample(&intTempKalmanLevel, &intTempKalmanSlope, &intTempFilterTime,
+                                               &intTempKalmanSum, &intTempKalmanCnt, wADC, intTempExpFilterVal);
+    else
+        ExpFilterInt(&intTempExpFilterVal, timerFilterWeight(tempExpFilterTcQ, &intTempFilterTime), wADC);
 
-    temp = ExpFilter(&intTempExpFilterVal, tempExpFilterWeight, temp);
+    temp = (intTempExpFilterVal - AVR_INT_TEMP_OFFSET_Q) * AVR_INT_TEMP_K_Q12;
 
-    return temp;
-}
+    intTempLast = (int)((temp + (1L << (11 + EXPFILT_FRAC_BITS - TEMP_FRAC_BITS))) >> (12 + EXPFILT_FRAC_BITS - TEMP_FRAC_BITS));
+    return intTempLast;
+}
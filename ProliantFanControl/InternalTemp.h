@@ -1,39 +1,65 @@
-#ifndef __INTERNALTEMP_H__
-#define __INTERNALTEMP_H__
-
-/*******************************************************************************
- *
- *  Filtering - exponential filter used for temperature
- *
- ******************************************************************************/
-extern float intTempExpFilterVal;  /**< Current filter value */
-
-/*******************************************************************************
- *
- *  Internal temperature measurements
- *
- ******************************************************************************/
-
-// Datasheet says about 1mV/C, example in the DS is more like 1.1 and offset 288
-// See also:
-//  - http://ww1.microchip.com/downloads/en/AppNotes/Atmel-8108-Calibration-of-the-AVRs-Internal-Temperature-Reference_ApplicationNote_AVR122.pdf
-//  - http://www.avdweb.nl/arduino/hardware-interfacing/temperature-measurement.html
-//  - http://www.netquote.it/nqmain/2011/04/arduino-nano-v3-internal-temperature-sensor/
-//  - http://nerdralph.blogspot.com/2014/08/writing-library-for-internal.html <<==
-//
-// These values are from the Arduino web. Either way, the sensor needs calibration and some filtering.
-#define AVR_INT_TEMP_offset 324.31
-#define AVR_INT_TEMP_coeff    1.22
-
-
-/** 
- * Read AVR internal temperature
- *
- * Requires calibration.... 
- * 
- * @return internal temperature in C
- */
-float readInternalTemp(void);
-
-
-#endif // __INTERNALTEMP_H__
+#ifndef __INTERNALTEMP_H__
+#define __INTERNALTEMP_H__
+
+#include "DataProcessing.h"
+
+/*******************************************************************************
+ *
+ *  Filtering - exponential filter used for temperature
+ *
+ * Raw ADC readings are filtered, the time constant is shared with MCP9701 (see @tempSetFilterTc).
+ ******************************************************************************/
+extern long intTempExpFilterVal;  /**< Current filter value (ADC counts with EXPFILT_FRAC_BITS fractional bits) */
+extern long intTempKalmanLevel;   /**< Kalman filter level, shares the noise with MCP9701 (see @tempSetKalman) */
+extern long intTempKalmanSlope;   /**< Kalman filter slope */
+extern word intTempKalmanSum;     /**< Sum of the readings in the current period (see @tempKalmanSample) */
+extern byte intTempKalmanCnt;     /**< Number of the readings in the sum */
+extern unsigned long intTempFilterTime; /**< Time of the last filtered sample (see @timerFilterWeight) */
+
+/*******************************************************************************
+ *
+ *  Internal temperature measurements
+ *
+ ******************************************************************************/
+
+// Datasheet says about 1mV/C, example in the DS is more like 1.1 and offset 288
+// See also:
+//  - http://ww1.microchip.com/downloads/en/AppNotes/Atmel-8108-Calibration-of-the-AVRs-Internal-Temperature-Reference_ApplicationNote_AVR122.pdf
+//  - http://www.avdweb.nl/arduino/hardware-interfacing/temperature-measurement.html
+//  - http://www.netquote.it/nqmain/2011/04/arduino-nano-v3-internal-temperature-sensor/
+//  - http://nerdralph.blogspot.com/2014/08/writing-library-for-internal.html <<==
+//
+// These values are from the Arduino web. Either way, the sensor needs calibration and some filtering.
+#define AVR_INT_TEMP_offset 324.31
+#define AVR_INT_TEMP_coeff    1.22
+
+/** Filter value for the given temperature in C (e.g. TEMP_EXPFILT_INIT) */
+#define AVR_INT_TEMP_FILT_VAL(t)  ((long)(((t) * AVR_INT_TEMP_coeff + AVR_INT_TEMP_offset) * (1 << EXPFILT_FRAC_BITS) + 0.5))
+
+
+/** 
+ * Read AVR internal temperature
+ *
+ * Requires calibration.... 
+ *
+ * Non blocking, one step per call: switch the ADC to the internal reference, wait INT_TEMP_SETTLE_MS
+ * (timer1), discard the first conversion, filter the second one, repeat. Until the new sample is in
+ * it returns the last value. The ADC is ours from the switch to the end of the conversion, nobody else
+ * may use it meanwhile (see @intTempAdcBusy).
+ * 
+ * @return filtered internal temperature in 1/TEMP_ONE C (rounded)
+ */
+int readInternalTemp(void);
+
+
+/** 
+ * ADC is switched to the internal sensor
+ *
+ * analogRead would switch the reference back and the settling would start over.
+ *
+ * @return non zero while readInternalTemp needs the ADC
+ */
+byte intTempAdcBusy(void);
+
+
+#endif // __INTERNALTEMP_H__
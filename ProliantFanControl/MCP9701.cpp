@@ -1,51 +1,109 @@
 #include <Arduino.h>
 #include "DataProcessing.h"
 #include "MCP9701.h"
+#include "InternalTemp.h"
+#include "PwmMeasure.h"
 
-float tempExpFilterVal[TEMP_EXT_SENSORS];
-float tempExpFilterWeight  = TEMP_EXPFILT_WEIGHT;
+long  tempExpFilterVal[TEMP_EXT_SENSORS];
+float tempExpFilterTc = TEMP_EXPFILT_TC;
+unsigned long tempExpFilterTcQ = (unsigned long)(TEMP_EXPFILT_TC * FILT_TIME_PER_S + 0.5);
+unsigned long tempFilterTime[TEMP_EXT_SENSORS];
 
-/*
-  MCP9701 conversion parameters and function
-  V0 = 400mV
-  tc = 19.5mV/C
-  Vref = 5V
-  
-  Vout = analogRead / 1024 * Vref
-  Vout = tc * temp + V0
-  
-  temp  = ((analogRead / 1024 * Vref) - V0) / tc
-  temp  = analogRead / 1024 * Vref / tc - V0 / tc
-  
-  Or if we prepare the fixed part:
-  temp = A * analogRead - B
-*/
+float tempKalmanQ = 0.0;
+float tempKalmanR = TEMP_KALMAN_R;
+unsigned int tempKalmanAlphaQ = 0;
+unsigned int tempKalmanBetaQ  = 0;
+long  tempKalmanLevel[TEMP_EXT_SENSORS];
+long  tempKalmanSlope[TEMP_EXT_SENSORS];
+word  tempKalmanSum[TEMP_EXT_SENSORS];
+byte  tempKalmanCnt[TEMP_EXT_SENSORS];
 
-#define MCP9701_V0          0.400
-#define MCP9701_tc          0.0195
+// A and B in Q16 - constants only, no floats at runtime. Filter value * A fits to 32 bits (1023 * 2^6 * 2^14).
+#define MCP9701_A_Q16  ((long)(MCP9701_A * 65536.0 + 0.5))
+#define MCP9701_B_Q16  ((long)(MCP9701_B * 65536.0 + 0.5))
 
-// when powered by USB there is a schotky diode which results in about 4.75V
-//#define MCP9701_Vref        5.0
-//#define MCP9701_Vref        4.746
-#define MCP9701_Vref        4.97
-#define MCP9701_AD_steps 1024.0
+#define TEMP_KALMAN_PERIOD_TICKS  ((unsigned long)TEMP_KALMAN_PERIOD_MS * (F_CPU / 1000))
 
-// 0.25040064102564102564102564102564
-#define MCP9701_A ((MCP9701_Vref / MCP9701_tc) / MCP9701_AD_steps)
 
-// 20.512820512820512820512820512821
-#define MCP9701_B (MCP9701_V0 / MCP9701_tc)
+void tempSetFilterTc(float tc)
+{
+    tempExpFilterTc  = tc;
+    tempExpFilterTcQ = ExpFilterTc(tc);
+}
+
+
+int tempSetKalman(float q, float r)
+{
+    unsigned int alpha = 0, beta = 0;
+
+    if(!(r > 0.0))
+        return -1;
 
+    // per sample^2 for the fixed sample period
+    if(q != 0.0 && KalmanGains(q * (TEMP_KALMAN_PERIOD_MS / 1000.0) * (TEMP_KALMAN_PERIOD_MS / 1000.0), r, &alpha, &beta))
+        return -1;
 
+    tempKalmanQ      = q;
+    tempKalmanR      = r;
+    tempKalmanAlphaQ = alpha;
+    tempKalmanBetaQ  = beta;
 
-float readTemp(unsigned char pin)
+    for(byte a=0; a<TEMP_EXT_SENSORS; ++a)
+        tempKalmanSlope[a] = KALMAN_SLOPE_INVALID;
+    intTempKalmanSlope = KALMAN_SLOPE_INVALID;
+
+    return 0;
+}
+
+
+long tempKalmanSample(long *level, long *slope, unsigned long *last, word *sum, byte *cnt, int adc, long filtVal)
+{
+    if(*cnt < TEMP_KALMAN_READINGS_MAX)
+    {
+        *sum += adc;
+        ++(*cnt);
+    }
+
+    unsigned long dt = (uint32_t)(pwmTimerTicks() - *last);
+    if(dt < TEMP_KALMAN_PERIOD_TICKS)
+        return filtVal;
+
+    // whole periods since the last sample, the filter restarts after a long gap
+    unsigned long steps = dt / TEMP_KALMAN_PERIOD_TICKS;
+    *last = (steps <= KALMAN_STEPS_MAX) ? (uint32_t)(*last + steps * TEMP_KALMAN_PERIOD_TICKS) : (uint32_t)(*last + dt);
+
+    // average with EXPFILT_FRAC_BITS fractional bits, sum < 2^16
+    long avg = (((long)*sum << EXPFILT_FRAC_BITS) + *cnt / 2) / *cnt;
+    *sum = 0;
+    *cnt = 0;
+
+    return KalmanFilterInt(level, slope, tempKalmanAlphaQ, tempKalmanBetaQ, steps, avg);
+}
+
+
+int readTemp(unsigned char pin)
 {
     // throw away the first read
-    float temp = (float)analogRead(A0 + pin);
-    
-    temp = ((float)analogRead(pin)) * MCP9701_A - MCP9701_B;
+    analogRead(A0 + pin);
+
+    int adc = analogRead(pin);
+
+#ifdef DEBUG_TEMP_TRACE
+    Serial.print(F("TT"));
+    Serial.print(pin + 1);
+    Serial.print(' ');
+    Serial.print(pwmTimerTicks() / (F_CPU / 1000));
+    Serial.print(' ');
+    Serial.println(adc);
+#endif
+
+    if(tempKalmanAlphaQ)
+        tempExpFilterVal[pin] = tempKalmanSample(&(tempKalmanLevel[pin]), &(tempKalmanSlope[pin]), &(tempFilterTime[pin]),
+                                                 &(tempKalmanSum[pin]), &(tempKalmanCnt[pin]), adc, tempExpFilterVal[pin]);
+    else
+        ExpFilterInt(&(tempExpFilterVal[pin]), timerFilterWeight(tempExpFilterTcQ, &(tempFilterTime[pin])), adc);
 
-    temp = ExpFilter(&(tempExpFilterVal[pin]), tempExpFilterWeight, temp);
+    long temp = ((tempExpFilterVal[pin] * MCP9701_A_Q16) >> EXPFILT_FRAC_BITS) - MCP9701_B_Q16;
 
-    return temp;
+    return (int)((temp + (1L << (15 - TEMP_FRAC_BITS))) >> (16 - TEMP_FRAC_BITS));
 }
@@ -1,26 +1,121 @@
-#ifndef __MCP9701_H__
-#define __MCP9701_H__
-
-#include "Config.h"
-
-/*******************************************************************************
- *
- *  Filtering - exponential filter used for temperature
- *
- ******************************************************************************/
-
-extern float tempExpFilterVal[TEMP_EXT_SENSORS]; /**< Current filter value */
-extern float tempExpFilterWeight;                /**< Weight for the exponential filter, Let's make it "slower".  */
-
-
-/** 
- * Read temperature in C from a MCP9071 sensor on the given analog pin
- * 
- * @param pin analog pin number (0..7)
- * 
- * @return temperature in C
- */
-float readTemp(unsigned char pin);
-
-
-#endif // __MCP9701_H__
+#ifndef __MCP9701_H__
+#define __MCP9701_H__
+
+#include "Config.h"
+#include "DataProcessing.h"
+
+/*
+  MCP9701 conversion parameters
+  V0 = 400mV
+  tc = 19.5mV/C
+  Vref = 5V
+  
+  Vout = analogRead / 1024 * Vref
+  Vout = tc * temp + V0
+  
+  temp  = ((analogRead / 1024 * Vref) - V0) / tc
+  temp  = analogRead / 1024 * Vref / tc - V0 / tc
+  
+  Or if we prepare the fixed part:
+  temp = A * analogRead - B
+*/
+
+#define MCP9701_V0          0.400
+#define MCP9701_tc          0.0195
+
+// when powered by USB there is a schotky diode which results in about 4.75V
+//#define MCP9701_Vref        5.0
+//#define MCP9701_Vref        4.746
+#define MCP9701_Vref        4.97
+#define MCP9701_AD_steps 1024.0
+
+// 0.25040064102564102564102564102564
+#define MCP9701_A ((MCP9701_Vref / MCP9701_tc) / MCP9701_AD_steps)
+
+// 20.512820512820512820512820512821
+#define MCP9701_B (MCP9701_V0 / MCP9701_tc)
+
+
+/*******************************************************************************
+ *
+ *  Filtering - exponential filter used for temperature
+ *
+ * Raw ADC readings are filtered (the conversion is linear), see @ExpFilterInt.
+ ******************************************************************************/
+
+extern long  tempExpFilterVal[TEMP_EXT_SENSORS]; /**< Current filter value (ADC counts with EXPFILT_FRAC_BITS fractional bits) */
+extern float tempExpFilterTc;                    /**< Time constant of the exponential filter in s */
+extern unsigned long tempExpFilterTcQ;           /**< The same in filter time units, set by @tempSetFilterTc */
+extern unsigned long tempFilterTime[TEMP_EXT_SENSORS]; /**< Time of the last filtered sample (see @timerFilterWeight) */
+
+extern float tempKalmanQ;                        /**< Kalman filter process noise, 0 - exp. filter (see @tempSetKalman) */
+extern float tempKalmanR;                        /**< Kalman filter measurement noise */
+extern unsigned int tempKalmanAlphaQ;            /**< Kalman filter level gain, 0 - exp. filter (see @KalmanGains) */
+extern unsigned int tempKalmanBetaQ;             /**< Kalman filter slope gain */
+extern long  tempKalmanLevel[TEMP_EXT_SENSORS];  /**< Kalman filter level (see @KalmanFilterInt) */
+extern long  tempKalmanSlope[TEMP_EXT_SENSORS];  /**< Kalman filter slope */
+extern word  tempKalmanSum[TEMP_EXT_SENSORS];    /**< Sum of the readings in the current period (see @tempKalmanSample) */
+extern byte  tempKalmanCnt[TEMP_EXT_SENSORS];    /**< Number of the readings in the sum */
+
+/** Filter value for the given temperature in C (e.g. TEMP_EXPFILT_INIT) */
+#define MCP9701_FILT_VAL(t)  ((long)(((t) + MCP9701_B) / MCP9701_A * (1 << EXPFILT_FRAC_BITS) + 0.5))
+
+
+/** 
+ * Set the temperature exponential filter time constant (MCP9701 and the internal sensor)
+ * 
+ * @param tc time constant in s (0.0 .. EXPFILT_TC_MAX), 0.0 for no filtering
+ */
+void tempSetFilterTc(float tc);
+
+
+/** 
+ * Set the temperature Kalman filter noise (MCP9701 and the internal sensor), it replaces the exp.
+ * filter when q is not zero. The filters restart from the next reading.
+ *
+ * The filter runs every TEMP_KALMAN_PERIOD_MS (see @tempKalmanSample), q is converted to that period
+ * for @KalmanGains (q * T^2), so the setting does not depend on the loop rate.
+ * 
+ * @param q process noise - std. deviation of the slope change in ADC counts per s^2, 0.0 - use the exp. filter
+ * @param r measurement noise - std. deviation of the period average in ADC counts
+ *
+ * @return 0 when OK, -1 for invalid values (nothing changed)
+ */
+int tempSetKalman(float q, float r);
+
+
+/** Max. number of the readings averaged in a Kalman filter period, the rest of the period is dropped */
+#define TEMP_KALMAN_READINGS_MAX  64
+
+/** 
+ * Kalman filter sample for a raw reading (MCP9701 and the internal sensor)
+ *
+ * The steady state gains are for a fixed sample period, so the readings are summed and the filter
+ * takes their average once per TEMP_KALMAN_PERIOD_MS of timer1 (the period start advances by whole
+ * periods, no drift with the loop rate). A period with no reading (a slow loop) is predicted over,
+ * see @KalmanFilterInt.
+ *
+ * @param level filter level (see @KalmanFilterInt)
+ * @param slope filter slope
+ * @param last start of the current period, timer1 counts
+ * @param sum sum of the readings in the current period
+ * @param cnt number of the readings in the sum
+ * @param adc new reading (ADC counts)
+ * @param filtVal current filter value (returned while the period runs)
+ *
+ * @return filter value (ADC counts with EXPFILT_FRAC_BITS fractional bits)
+ */
+long tempKalmanSample(long *level, long *slope, unsigned long *last, word *sum, byte *cnt, int adc, long filtVal);
+
+
+/** 
+ * Read temperature in C from a MCP9071 sensor on the given analog pin
+ * 
+ * @param pin analog pin number (0..7)
+ * 
+ * @return filtered temperature in 1/TEMP_ONE C (rounded)
+ */
+int readTemp(unsigned char pin);
+
+
+#endif // __MCP9701_H__
@@ -2,9 +2,39 @@
  * Arduino Nano
  *  Using:
  *  - timer0 - for PWM out for the first fan. NOTE that we can NOT use delay, millis, etc.
- *  - timer1 - measure duty cycle of incoming PWM. When not used (planned for) manual mode watchdog.
+ *  - timer1 - free running, captures edges of incoming PWM in the background (see PwmMeasure).
  *  - timer2 - for PWM out for the second fan.
  *
+ * ISRs and the worst case time they block other interrupts (CPU cycles at 16MHz, entry to reti).
+ * The figures are counted from the instructions, not measured yet - make -C test avr-bench measures
+ * them on a Nano from the TCNT1 delta (with PWM_INPUTS 4 for PCINT2_vect), run it and replace them;
+ * DEBUG_ISR_TIMING shows the PWM input ones on A5 in the running firmware:
+ *  - TIMER1_CAPT_vect  ~120 cycles (7.5us), once per captured edge (25kHz PWM in -> every 40us)
+ *  - PCINT2_vect       ~200 cycles (12.5us), ~260 cycles (16us) with 3 inputs changing at once, only
+ *    with PWM_INPUTS > 1, per edge on PWM2 .. PWM4 until the input has PWM_CAPT_EDGES edges, then
+ *    masked until the loop takes them (at most ~32 per input and loop, i.e. under 1.2ms per loop for
+ *    3 inputs at any frequency)
+ *  - TIMER1_OVF_vect   ~60 cycles (3.8us), every 4.1ms
+ *  - PCINT0_vect       ~50 cycles (3.1us), per edge of the fan tach signals (few hundreds per second)
+ *  - TIMER1_COMPA/B_vect ~90 cycles (5.6us), with TACH_EMU, per emulated tach edge or every 2ms
+ *  - USART_RX_vect     ~80 cycles (5us), Arduino core, per received character
+ *  - USART_UDRE_vect   ~90 cycles (5.6us), Arduino core, per sent character
+ *  - TIMER0/2_COMPA_vect ~35 cycles (2.2us), with PWM_OUT_DITHER, once per output PWM period (40us)
+ *    while the duty has a fraction of a timer count, i.e. 25kHz per timer - 5.5% of the CPU each,
+ *    11% with both outputs dithering
+ *  - TIMER0/2_COMPB_vect ~45 cycles (2.8us), once per period for 1-4 periods when the output stops
+ *    (0) or starts again
+ *  - pwmCaptureSnapshot disables interrupts for ~280 cycles (17.5us) once per loop and input
+ * A single ISR or the snapshot blocks the others for under 20us. In the worst case everything above
+ * is pending at the end of a pwmCaptureSnapshot and the last ISR in the priority order runs ~80us
+ * late (17.5us + ~62us of the ISRs before it). At 115200 Bd we get a character every 87us and the
+ * USART has 2 characters buffer, so serial is still safe, but with little margin in that case. A
+ * capture that late may be overwritten at 25kHz (the decoder drops that group), a TIMER0/2_COMPB_vect
+ * later than ~19us (to TOP - 1) just tries again in the next period.
+ * ISR budget (CPU load in the worst case): TIMER1_CAPT_vect 19% with 25kHz on D8, TIMER0/2_COMPA_vect
+ * 11%, PCINT2_vect ~5% per input at 2kHz (see PWM_INPUTS), the rest ~2% - under 50% with 3 inputs on
+ * PCINT, the loop keeps at least a half of the CPU.
+ *
  * 
  * Serial for communication
  * 
@@ -14,7 +44,7 @@
  *
  * Keeping it in one file for now (needs refactoring).
 
- * PWM input od D8 !!
+ * PWM input od D8 !! (more inputs on D4, D6, D7, see PWM_INPUTS)
 
  temp in (MCP9701)
  a0 .. a7
@@ -24,6 +54,13 @@
  PWM out 1 - using timer 0 (cannot use delay), controlling a fan on D5
  PWM out 2 - using timer2, controlling a fan on D3
 
+ Fan tach in - D11 (fan 1), D12 (fan 2)
+ Emulated tach out (for the server) - D9 (fan 1), D10 (fan 2), timer1 compare match
+
+ Operating modes - A auto (mapping table), P PID (auto + closed loop on the temperature), M manual, F failsafe
+ Feed-forward boost on fast temperature rise in A and P (see FeedFwd.h)
+ Output hysteresis and slew rate limit in A, P and optionally M (see Slew.h)
+
 
 
  TODO:
@@ -43,6 +80,10 @@
 #include "MCP9701.h"
 #include "PwmMeasure.h"
 #include "PwmOut.h"
+#include "Tach.h"
+#include "Pid.h"
+#include "FeedFwd.h"
+#include "Slew.h"
 #include "EepromConfig.h"
 #include "DataProcessing.h"
 
@@ -55,10 +96,23 @@
 
 
 float          tempWeights[FANS][TEMP_SENSORS];            /**< Temperature weights for each fan */
-unsigned char mappingTable[FANS][TEMP_COEFFS][PWM_COEFFS]; /**< Fan PWM and temperature mapping tables */
-int                  temps[TEMP_SENSORS];                  /**< Measured temperatures*/
-
-char opMode = "A";                                         /**< Mode: A - auto, M - manual, F - failsafe */
+unsigned int  tempWeightsQ[FANS][TEMP_SENSORS];            /**< The same weights normalized to Q15 (see @normalizeTempWeights) */
+unsigned char mappingTable[FANS][MAP_CELLS];              /**< Fan PWM and temperature mapping tables (see @mapCell) */
+unsigned char     tempAxis[TEMP_COEFFS_MAX];               /**< Mapping table temperature breakpoints in C (increasing) */
+unsigned char      pwmAxis[PWM_COEFFS_MAX];                /**< Mapping table input PWM breakpoints in % (increasing, 0 .. 100) */
+unsigned char   mapTempMin;                               /**< Mapping table geometry - default temp. axis start (C) */
+unsigned char   mapTempStep;                              /**< Mapping table geometry - default temp. axis step (C) */
+unsigned char   mapTempCoeffs;                            /**< Mapping table geometry - number of rows (temperatures) */
+unsigned char   mapPwmStep;                               /**< Mapping table geometry - default PWM axis step (%) */
+unsigned char   mapPwmCoeffs;                             /**< Mapping table geometry - number of columns (input PWM) */
+int                  temps[TEMP_SENSORS];                  /**< Measured temperatures in 1/TEMP_ONE C */
+unsigned char      pwmInSel[FANS];                         /**< PWM input(s) for each fan (see @pwmSelectDuty) */
+unsigned char   pwmFallback[FANS];                         /**< Input duty cycle (%) for each fan when its PWM input(s) are lost */
+unsigned char       fanCtrl[FANS];                         /**< Fan control in auto mode (FAN_CTRL_*) */
+unsigned char     curveTemp[FANS][TEMP_SENSORS][TEMP_CURVE_POINTS]; /**< Per sensor curves - temperatures in C (increasing) */
+unsigned char     curveDuty[FANS][TEMP_SENSORS][TEMP_CURVE_POINTS]; /**< Per sensor curves - duty cycle in % */
+
+char opMode = 'A';                                         /**< Mode: A - auto, P - PID, M - manual, F - failsafe */
 
 
 
@@ -81,11 +135,41 @@ char opMode = "A";                                         /**< Mode: A - auto,
 #define CMD_ERR_SAVE_PWM_FILT      -12
 #define CMD_ERR_SAVE_PWM_MAP       -13
 #define CMD_ERR_SAVE_TEMP_WEIGHTS  -14
+#define CMD_ERR_SYNTAX_PWM_IN      -15
+#define CMD_ERR_PWM_IN_NUMBER      -16
+#define CMD_ERR_SAVE_PWM_IN        -17
+#define CMD_ERR_SYNTAX_PWM_POL     -18
+#define CMD_ERR_SAVE_PWM_POL       -19
+#define CMD_ERR_SYNTAX_TACH_PPR    -20
+#define CMD_ERR_SAVE_TACH_PPR      -21
+#define CMD_ERR_SYNTAX_TACH_EMU    -22
+#define CMD_ERR_SAVE_TACH_EMU      -23
+#define CMD_ERR_SYNTAX_PWM_FALLBACK -24
+#define CMD_ERR_SAVE_PWM_FALLBACK  -25
+#define CMD_ERR_SYNTAX_TEMP_AXIS   -26
+#define CMD_ERR_SAVE_TEMP_AXIS     -27
+#define CMD_ERR_SYNTAX_PWM_AXIS    -28
+#define CMD_ERR_SAVE_PWM_AXIS      -29
+#define CMD_ERR_SYNTAX_MAP_GEOMETRY -30
+#define CMD_ERR_SAVE_MAP_GEOMETRY  -31
+#define CMD_ERR_SYNTAX_FAN_CTRL    -32
+#define CMD_ERR_SAVE_FAN_CTRL      -33
+#define CMD_ERR_SYNTAX_TEMP_CURVE  -34
+#define CMD_ERR_SAVE_TEMP_CURVE    -35
+#define CMD_ERR_SYNTAX_PID         -36
+#define CMD_ERR_SAVE_PID           -37
+#define CMD_ERR_SYNTAX_FEEDFWD     -38
+#define CMD_ERR_SAVE_FEEDFWD       -39
+#define CMD_ERR_SYNTAX_SLEW        -40
+#define CMD_ERR_SAVE_SLEW          -41
+#define CMD_ERR_SYNTAX_TEMP_KALMAN -42
+#define CMD_ERR_SAVE_TEMP_KALMAN   -43
 #define CMD_ERR_NOT_IMPLEMENTED   -100
 
 
 
 #define CMD_BUFF_SIZE  160
+#define SER_CMD_NAME_LEN 16   // longest command name + 1, a longer one does not compile
 char  serCmd[CMD_BUFF_SIZE];
 int   serCmdCnt = 0;
 int   checksum  = 0;
@@ -151,6 +235,47 @@ int parseFan(char * s)
     return (*s - '0');
 }
 
+/** 
+ * Parse 'P<n> and returns <n> (e.g. "P2" -> 2)
+ * 
+ * @param s string to parse
+ * 
+ * @return PWM input number from the string (not zero based index) if successfull, <0 for error
+ */
+int parsePwmIn(char * s)
+{
+    if(s == NULL)
+        return CMD_ERR_SYNTAX_PWM_IN;
+
+    if(*s != 'P')
+        return CMD_ERR_SYNTAX_PWM_IN;
+
+    ++s;
+    if(*s<'1' || *s>('0'+PWM_INPUTS) || *(s+1) != '\0')
+        return CMD_ERR_PWM_IN_NUMBER;
+
+    return (*s - '0');
+}
+
+/** 
+ * Parse 'T<n> and returns <n> (e.g. "T2" -> 2)
+ * 
+ * @param s string to parse
+ * 
+ * @return temperature sensor index (0 is the internal one) if successfull, <0 for error
+ */
+int parseSensor(char * s)
+{
+    if(s == NULL || *s != 'T')
+        return CMD_ERR_SYNTAX_TEMP_CURVE;
+
+    ++s;
+    if(*s<'0' || *s>=('0'+TEMP_SENSORS) || *(s+1) != '\0')
+        return CMD_ERR_SYNTAX_TEMP_CURVE;
+
+    return (*s - '0');
+}
+
 // T:20
 int parseTemp(char * s)
 {
@@ -180,13 +305,14 @@ float parseFloat(char * s)
     return atof(s);
 }
 
+// t in 1/TEMP_ONE C
 int normalizeTemp(int t)
 {
-    if(t < TEMP_MIN)
-        return TEMP_MIN;
+    if(t < tempAxis[0] * TEMP_ONE)
+        return tempAxis[0] * TEMP_ONE;
 
-    if(t > TEMP_MAX)
-	return TEMP_MAX;
+    if(t > tempAxis[mapTempCoeffs-1] * TEMP_ONE)
+	return tempAxis[mapTempCoeffs-1] * TEMP_ONE;
 
     return t;
 }
@@ -197,60 +323,55 @@ int normalizeTemp(int t)
  * 
  * @param t input temperature
  * 
- * @return table index
+ * @return table index (the nearest breakpoint at or below the temperature)
  */
 unsigned int tempIndex(int t)
 {
-    if(t <= TEMP_MIN)
-        return 0;
-    if(t >= TEMP_MAX)
-        return TEMP_COEFFS-1;
-
-    // if(((t-TEMP_MIN) % TEMP_STEP) != 0)
-    //     some warning...
-
-    return (t-TEMP_MIN) / TEMP_STEP;
+    return axisIndex(tempAxis, mapTempCoeffs, t);
 }
 
 int tempFromIndex(int t)
 {
-    return TEMP_MIN + (t*TEMP_STEP);
+    return tempAxis[t];
 }
 
 
 // --------------------------- Generic -----------------------
 int cmdVer(void)
 {
-    Serial.println("ProliantFanControl " VERSION);
+    Serial.println(F("ProliantFanControl " VERSION));
     return 0;
 }
 
 
 int cmdGetCfg(void)
 {
-    Serial.print("Fans:");
+    Serial.print(F("Fans:"));
     Serial.print(FANS);
 
-    Serial.print(" Temps:");
+    Serial.print(F(" Temps:"));
     Serial.print(TEMP_SENSORS);
 
-    Serial.print(" PWM_step:");
-    Serial.print(PWM_STEP);
+    Serial.print(F(" PWM_inputs:"));
+    Serial.print(PWM_INPUTS);
+
+    Serial.print(F(" PWM_step:"));
+    Serial.print(mapPwmStep);
 
-    Serial.print(" PWM_coeffs:");
-    Serial.print(PWM_COEFFS);
+    Serial.print(F(" PWM_coeffs:"));
+    Serial.print(mapPwmCoeffs);
 
-    Serial.print(" Temp_min:");
-    Serial.print(TEMP_MIN);
+    Serial.print(F(" Temp_min:"));
+    Serial.print(mapTempMin);
 
-    Serial.print(" Temp_step:");
-    Serial.print(TEMP_STEP);
+    Serial.print(F(" Temp_step:"));
+    Serial.print(mapTempStep);
 
-    Serial.print(" Temp_max:");
-    Serial.print(TEMP_MAX);
+    Serial.print(F(" Temp_max:"));
+    Serial.print(mapTempMin + (mapTempCoeffs-1)*mapTempStep);
 
-    Serial.print(" Temp_coeffs:");
-    Serial.println(TEMP_COEFFS);
+    Serial.print(F(" Temp_coeffs:"));
+    Serial.println(mapTempCoeffs);
     return 0;
 }
 
@@ -269,16 +390,16 @@ int cmdGetTempWeights(void)
     if(strtok(NULL, " ") != NULL) // another token?
         return CMD_ERR_SYNTAX_EXTRA_DATA;
 
-    Serial.print("F");
+    Serial.print('F');
     Serial.print(f);
-    Serial.print(" ");
+    Serial.print(' ');
 
     --f;
     for(int i=0; i<TEMP_SENSORS; ++i)
     {
         Serial.print(tempWeights[f][i], 4); // using 4 decimal places
         if(i<(TEMP_SENSORS-1))
-            Serial.print(" ");
+            Serial.print(' ');
     }
     Serial.println();
     return 0;
@@ -313,8 +434,9 @@ int cmdSetTempWeights(void)
 
     for(int a=0; a<TEMP_SENSORS; ++a)
         tempWeights[f][a] = coeffs[a];
+    normalizeTempWeights(f);
 
-    Serial.println("OK");
+    Serial.println(F("OK"));
     return 0;
 }
 
@@ -336,7 +458,7 @@ int cmdSaveTempWeights(void)
     if(SaveTempWeights(f))
 	return CMD_ERR_SAVE_TEMP_WEIGHTS;
 
-    Serial.println("OK");
+    Serial.println(F("OK"));
     return 0;
 }
 
@@ -349,22 +471,24 @@ int cmdGetPwmFilt(void)
     if(strtok(NULL, " ") != NULL) // another token?
         return CMD_ERR_SYNTAX_EXTRA_DATA;
 
-    Serial.print(pwmExpFilterWeight, 4);
-    Serial.print(" ");
-    Serial.println(tempExpFilterWeight, 4);
+    Serial.print(pwmExpFilterTc, 3);
+    Serial.print(' ');
+    Serial.print(tempExpFilterTc, 3);
+    Serial.print(' ');
+    Serial.println(pwmAdaptFilterGain, 4);
     return 0;
 }
 
-// SetPwmFilt 30 0.1
+// SetPwmFilt 0.4 0.4 [0.4]  (time constants in s)
 int cmdSetPwmFilt(void)
 {
     char *p = strtok(NULL, " ");
     if(p == NULL)
         return CMD_ERR_SYNTAX_PWM_FILT;
 
-    float pwmW = parseFloat(p);
+    float pwmTc = parseFloat(p);
 
-    if(pwmW<0.0 || pwmW>1.0)
+    if(pwmTc<0.0 || pwmTc>EXPFILT_TC_MAX)
         return CMD_ERR_SYNTAX_PWM_FILT;
 
 
@@ -373,24 +497,35 @@ int cmdSetPwmFilt(void)
     if(p == NULL)
         return CMD_ERR_SYNTAX_PWM_FILT;
 
-    float tempW = parseFloat(p);
+    float tempTc = parseFloat(p);
 
-    if(tempW<0.0 || tempW>1.0)
+    if(tempTc<0.0 || tempTc>EXPFILT_TC_MAX)
         return CMD_ERR_SYNTAX_PWM_FILT;
 
+    // optional, the adaptive filter gain stays when not given
+    float gain = pwmAdaptFilterGain;
+    p = strtok(NULL, " ");
+    if(p != NULL)
+    {
+        gain = parseFloat(p);
+        if(gain<0.0 || gain>1.0)
+            return CMD_ERR_SYNTAX_PWM_FILT;
+    }
+
     if(strtok(NULL, " ") != NULL) // another token?
         return CMD_ERR_SYNTAX_EXTRA_DATA;
 
-    pwmExpFilterWeight  = pwmW;
-    tempExpFilterWeight = tempW;
+    pwmSetFilterTc(pwmTc);
+    tempSetFilterTc(tempTc);
+    pwmSetFilterGain(gain);
 
 #ifdef DEBUG_CMD_PROC
-    Serial.print(pwmW , 4);
-    Serial.print(" ");
-    Serial.println(tempW, 4);
+    Serial.print(pwmTc, 3);
+    Serial.print(' ');
+    Serial.println(tempTc, 3);
 #endif
 
-    Serial.println("OK");
+    Serial.println(F("OK"));
     return 0;
 }
 
@@ -400,107 +535,125 @@ int cmdSavePwmFilt(void)
     if(strtok(NULL, " ") != NULL) // another token?
         return CMD_ERR_SYNTAX_EXTRA_DATA;
 
-    if(SavePwmExpFilter())
+    if(SavePwmExpFilter() || SavePwmAdaptFilter())
       return CMD_ERR_SAVE_PWM_FILT;
 
-    Serial.println("OK");
+    Serial.println(F("OK"));
     return 0;
 }
 
-// --------------------------- Mapping table -----------------------
-
-// GetPwmMap F1 T:20
-int cmdGetPwmMap(void)
+// GetTempKalman
+int cmdGetTempKalman(void)
 {
-    char *p = strtok(NULL, " ");
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
 
-    int fan = parseFan(p);
-    if(fan < 0)
-        return fan;
+    Serial.print(tempKalmanQ, 6);
+    Serial.print(' ');
+    Serial.println(tempKalmanR, 4);
+    return 0;
+}
 
-    p = strtok(NULL, " ");
-    if(p == NULL) // early end..
-        return CMD_ERR_SYNTAX_TEMP;
+// SetTempKalman 1.0 1.0
+int cmdSetTempKalman(void)
+{
+    float v[2];
+    for(int a=0; a<2; ++a)
+    {
+        char *p = strtok(NULL, " ");
+        if(p == NULL)
+            return CMD_ERR_SYNTAX_TEMP_KALMAN;
 
-    int t = parseTemp(p);
+        v[a] = parseFloat(p);
+    }
 
     if(strtok(NULL, " ") != NULL) // another token?
         return CMD_ERR_SYNTAX_EXTRA_DATA;
 
-    int tIdx = tempIndex(t);
+    if(tempSetKalman(v[0], v[1]))
+        return CMD_ERR_SYNTAX_TEMP_KALMAN;
 
-    Serial.print("F");
-    Serial.print(fan);
-    Serial.print(" T:");
-    Serial.print(tempFromIndex(tIdx)); // map back to show what temp we actually use (in case the request was not in the grid/step)
-    Serial.print(" ");
+    Serial.println(F("OK"));
+    return 0;
+}
 
-    --fan;
+// SaveTempKalman
+int cmdSaveTempKalman(void)
+{
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
 
-    for(int pc=0; pc<PWM_COEFFS; ++pc)
-    {
-        Serial.print(mappingTable[fan][tIdx][pc]);
-        if(pc<(PWM_COEFFS-1))
-            Serial.print(" ");
-    }
-    Serial.println();
+    if(SaveTempKalman())
+      return CMD_ERR_SAVE_TEMP_KALMAN;
 
+    Serial.println(F("OK"));
     return 0;
 }
 
-// SetPwmMap F1 T:20 0 10 15 20 25 30 35 40 45 50 55 60 65 70 75 80 85 90 95 100
-int cmdSetPwmMap(void)
+// GetPwmStats P1
+int cmdGetPwmStats(void)
 {
-    char *p = strtok(NULL, " ");
+    int in = 1;
 
-    int fan = parseFan(p);
-    if(fan < 0)
-        return fan;
-    --fan;
+    char *p = strtok(NULL, " ");
+    if(p != NULL) // optional input, P1 by default
+    {
+        in = parsePwmIn(p);
+        if(in < 0)
+            return in;
 
-    p = strtok(NULL, " ");
-    if(p == NULL) // expected temp. token...
-        return CMD_ERR_SYNTAX_TEMP;
+        if(strtok(NULL, " ") != NULL) // another token?
+            return CMD_ERR_SYNTAX_EXTRA_DATA;
+    }
 
-    int t = parseTemp(p);
+    Serial.print('P');
+    Serial.print(in);
+
+    --in;
+    Serial.print(F(" Accepted:"));
+    Serial.print(pwmStatAccepted[in]);
+    Serial.print(F(" Rejected:"));
+    Serial.print(pwmStatRejected[in]);
+    Serial.print(F(" Flatline:"));
+    Serial.print(pwmStatFlatline[in]);
+    Serial.print(F(" Lost:"));
+    Serial.println(pwmStatLost[in]);
+    return 0;
+}
 
-    t = tempIndex(t);
 
-    unsigned char pMap[PWM_COEFFS];
-    int tmp=0;
-    for(int a=0; a<PWM_COEFFS; ++a)
-    {
-        p = strtok(NULL, " ");
-        if(p == NULL) // expected pwm token...
-            return CMD_ERR_SYNTAX_PWM_TABLE;
-        
-        tmp = atoi(p);
+// --------------------------- PWM input selection -----------------------
 
-#ifdef DEBUG_CMD_PROC
-	Serial.print(a);
-	Serial.print(": ");
-	Serial.println(tmp);
-	Serial.println(p);
-#endif
+// GetPwmIn F1
+int cmdGetPwmIn(void)
+{
+    char *p = strtok(NULL, " ");
 
-        if(tmp<0 || tmp>100)
-            return CMD_ERR_SYNTAX_PWM_TABLE;
-        
-        pMap[a] = (unsigned char) tmp;
-    }
+    int f = parseFan(p);
+    if(f < 0)
+        return f;
 
     if(strtok(NULL, " ") != NULL) // another token?
         return CMD_ERR_SYNTAX_EXTRA_DATA;
 
-    for(int a=0; a<PWM_COEFFS; ++a)
-        mappingTable[fan][t][a] = pMap[a];
+    Serial.print('F');
+    Serial.print(f);
+
+    --f;
+    Serial.print((pwmInSel[f] & PWM_IN_SEL_AVG) ? F(" AVG") : F(" MAX"));
 
-    Serial.println("OK");
+    for(int in=0; in<PWM_INPUTS; ++in)
+        if(pwmInSel[f] & bit (in))
+        {
+            Serial.print(F(" P"));
+            Serial.print(in+1);
+        }
+    Serial.println();
     return 0;
 }
 
-// SavePwmMap F1 T:20 
-int cmdSavePwmMap(void)
+// SetPwmIn F1 MAX P1 P2
+int cmdSetPwmIn(void)
 {
     char *p = strtok(NULL, " ");
 
@@ -509,205 +662,1422 @@ int cmdSavePwmMap(void)
         return f;
     --f;
 
+    unsigned char sel = 0;
+
     p = strtok(NULL, " ");
-    if(p == NULL) // early end..
-        return CMD_ERR_SYNTAX_TEMP;
+    if(p == NULL)
+        return CMD_ERR_SYNTAX_PWM_IN;
 
-    int t = parseTemp(p);
+    if(!strcmp_P(p, PSTR("AVG")))
+        sel = PWM_IN_SEL_AVG;
+    else if(strcmp_P(p, PSTR("MAX")))
+        return CMD_ERR_SYNTAX_PWM_IN;
 
-    if(strtok(NULL, " ") != NULL) // another token?
-        return CMD_ERR_SYNTAX_EXTRA_DATA;
+    // at least one input
+    while((p = strtok(NULL, " ")) != NULL)
+    {
+        int in = parsePwmIn(p);
+        if(in < 0)
+            return in;
 
-    t = tempIndex(t);
+        sel |= bit (in-1);
+    }
 
-    if(SaveMappingTable(f, t))
-      return CMD_ERR_SAVE_PWM_MAP;
+    if((sel & PWM_IN_SEL_ALL) == 0)
+        return CMD_ERR_SYNTAX_PWM_IN;
+
+    pwmInSel[f] = sel;
 
-    Serial.println("OK");
+    Serial.println(F("OK"));
     return 0;
 }
 
+// SavePwmIn
+int cmdSavePwmIn(void)
+{
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
 
-// --------------------------- Op modes -----------------------
+    if(SavePwmInSel())
+      return CMD_ERR_SAVE_PWM_IN;
 
-unsigned char manualPwm[FANS];
+    Serial.println(F("OK"));
+    return 0;
+}
 
-// ModeManual F1:20 F2:30
-int cmdModeManual(void)
-{
-    char *p = NULL;
-    unsigned char pwm[FANS];
 
-    unsigned char fan;
-    int rc = -1;
+// --------------------------- PWM input signal -----------------------
 
-    for(int a=0; a<FANS; ++a)
+const __FlashStringHelper *polarityName(byte pol)
+{
+    switch(pol)
     {
-	p = strtok(NULL, " ");
-	if(p==NULL)
-	    return CMD_ERR_SYNTAX_FAN_PWM; // out of order...
-
-	rc = parseFanPwm(p, &fan, &(pwm[a]));
-	if(rc != 0)
-	    return rc;
+    case PWM_POL_POS:
+        return F("POS");
 
-	if(fan != a)
-	    return CMD_ERR_SYNTAX_FAN_PWM; // out of order...
+    case PWM_POL_NEG:
+        return F("NEG");
 
-#ifdef DEBUG_CMD_PROC
-	Serial.print(a);
-	Serial.print(": ");
-	Serial.println(fan);
-	Serial.print(" ");
-	Serial.println(pwm[a]);
-#endif
+    default:
+        return F("AUTO");
     }
+}
 
-    for(int a=0; a<FANS; ++a)
-	manualPwm[a] = pwm[a];
+// GetPwmSig P1
+int cmdGetPwmSig(void)
+{
+    char *p = strtok(NULL, " ");
 
-    opMode = 'M';
+    int in = parsePwmIn(p);
+    if(in < 0)
+        return in;
+
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
 
-    Serial.println("OK");
+    Serial.print('P');
+    Serial.print(in);
+
+    --in;
+    Serial.print(F(" Freq:"));
+    Serial.print(pwmInFrequency(in));
+    Serial.print(F(" Pol:"));
+    Serial.print(polarityName(pwmPolarity[in]));
+    Serial.print(F(" Mode:"));
+    Serial.print(polarityName(pwmPolMode[in]));
+    Serial.print(F(" Input:"));
+    Serial.println(pwmInLost[in] ? F("LOST") : F("OK"));
     return 0;
 }
 
-
-int cmdModeAuto(void)
+// SetPwmPol P1 AUTO
+int cmdSetPwmPol(void)
 {
+    char *p = strtok(NULL, " ");
+
+    int in = parsePwmIn(p);
+    if(in < 0)
+        return in;
+    --in;
+
+    p = strtok(NULL, " ");
+    if(p == NULL)
+        return CMD_ERR_SYNTAX_PWM_POL;
+
+    byte mode;
+    if(!strcmp_P(p, PSTR("POS")))
+        mode = PWM_POL_POS;
+    else if(!strcmp_P(p, PSTR("NEG")))
+        mode = PWM_POL_NEG;
+    else if(!strcmp_P(p, PSTR("AUTO")))
+        mode = PWM_POL_AUTO;
+    else
+        return CMD_ERR_SYNTAX_PWM_POL;
+
     if(strtok(NULL, " ") != NULL) // another token?
         return CMD_ERR_SYNTAX_EXTRA_DATA;
 
-    // TODO: check if we have all the data (eeprom checksum) and then confirm??
-    //....
-    opMode = 'A';
-    Serial.println("OK");
+    pwmSetPolarityMode(in, mode);
+
+    Serial.println(F("OK"));
     return 0;
 }
 
-
-int cmdModeFailsafe(void)
+// SavePwmPol
+int cmdSavePwmPol(void)
 {
     if(strtok(NULL, " ") != NULL) // another token?
         return CMD_ERR_SYNTAX_EXTRA_DATA;
 
-    opMode = 'F';
-    Serial.println("OK");
+    if(SavePwmPolarity())
+      return CMD_ERR_SAVE_PWM_POL;
+
+    Serial.println(F("OK"));
     return 0;
 }
 
 
-// ----------------------------------------------------------------------------------------------------------------------------
+// --------------------------- PWM input fallback -----------------------
 
-/** 
- * Reads any data up to the new line from the serial
- * 
- * 
- * @return 1 of we have a complete line (in serCmd)
- */
-int ReadSerialLine(void)
+// GetPwmFallback F1
+int cmdGetPwmFallback(void)
 {
-    // default Arduino serial buffer is 64B Tx and 64B Rx !!!
-    // it may still overflow!!!!
-    int c;
-    while((c=Serial.read()) >= 0)
-    {
-        if(serCmdCnt < 0) // error mode / overflow, just skip till the end of line
-        {
-            if(c == '\n')
-            {
-                serCmdCnt = 0; // back to normal...
-                break;
-            }
-        }
-        else
-        {
-            if(c == '\n')
-            {
-                serCmd[serCmdCnt] = '\0';
-                return 1;
-            }
-            else
-            {
-                serCmd[serCmdCnt++] = c;
+    char *p = strtok(NULL, " ");
 
-                // buffer overflow - would not fit even the terminating '\0', indicate error mode
-                if(serCmdCnt >= CMD_BUFF_SIZE)
-		{
-		    Serial.println("E Buffer overflow");
-                    serCmdCnt = -1;
-		}
-            }
-        }
-        
-    }
-    return 0;
-}
+    int f = parseFan(p);
+    if(f < 0)
+        return f;
 
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
 
+    Serial.print('F');
+    Serial.print(f);
+    Serial.print(' ');
+    Serial.println(pwmFallback[f-1]);
+    return 0;
+}
 
-void errorResponse(int e)
+// SetPwmFallback F1 100
+int cmdSetPwmFallback(void)
 {
-    switch(e)
-    {
-    case CMD_ERR_NODATA:
-        Serial.println("E No data");
-        break;
+    char *p = strtok(NULL, " ");
 
-    case CMD_ERR_SYNTAX:
-        Serial.println("E Syntax error");
-        break;
+    int f = parseFan(p);
+    if(f < 0)
+        return f;
+    --f;
 
-    case CMD_ERR_SYNTAX_FAN:
-        Serial.println("E Syntax error (fan)");
-        break;
+    p = strtok(NULL, " ");
+    if(p == NULL)
+        return CMD_ERR_SYNTAX_PWM_FALLBACK;
 
-    case CMD_ERR_SYNTAX_TEMP:
-        Serial.println("E Syntax error (temperature)");
-        break;
+    int fb = atoi(p);
+    if(fb<0 || fb>100)
+        return CMD_ERR_SYNTAX_PWM_FALLBACK;
+
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    pwmFallback[f] = (unsigned char)fb;
+
+    Serial.println(F("OK"));
+    return 0;
+}
+
+// SavePwmFallback
+int cmdSavePwmFallback(void)
+{
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    if(SavePwmFallback())
+      return CMD_ERR_SAVE_PWM_FALLBACK;
+
+    Serial.println(F("OK"));
+    return 0;
+}
+
+// --------------------------- Mapping table axes -----------------------
+
+/** 
+ * Print an axis (space separated values)
+ * 
+ * @param axis breakpoints
+ * @param n number of breakpoints
+ */
+void printAxis(const unsigned char *axis, unsigned char n)
+{
+    for(unsigned char a=0; a<n; ++a)
+    {
+        Serial.print(axis[a]);
+        if(a<(n-1))
+            Serial.print(' ');
+    }
+    Serial.println();
+}
+
+/** 
+ * Parse an axis (or any other list of byte values) from the rest of the command line
+ * 
+ * @param axis output - breakpoints
+ * @param n number of breakpoints
+ * @param maxVal max. allowed value
+ * 
+ * @return zero when all n values were parsed, without any extra data
+ */
+int parseAxis(unsigned char *axis, unsigned char n, int maxVal)
+{
+    for(unsigned char a=0; a<n; ++a)
+    {
+        char *p = strtok(NULL, " ");
+        if(p == NULL)
+            return -1;
+
+        int v = atoi(p);
+        if(v<0 || v>maxVal)
+            return -1;
+
+        axis[a] = (unsigned char)v;
+    }
+
+    if(strtok(NULL, " ") != NULL) // another token?
+        return -1;
+
+    return 0;
+}
+
+// GetTempAxis
+int cmdGetTempAxis(void)
+{
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    printAxis(tempAxis, mapTempCoeffs);
+    return 0;
+}
+
+// SetTempAxis 20 30 35 40 44 48 52 60
+int cmdSetTempAxis(void)
+{
+    unsigned char axis[TEMP_COEFFS_MAX];
+
+    if(parseAxis(axis, mapTempCoeffs, 255) || checkTempAxis(axis))
+        return CMD_ERR_SYNTAX_TEMP_AXIS;
+
+    for(int a=0; a<mapTempCoeffs; ++a)
+        tempAxis[a] = axis[a];
+
+    Serial.println(F("OK"));
+    return 0;
+}
+
+// SaveTempAxis
+int cmdSaveTempAxis(void)
+{
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    if(SaveTempAxis())
+      return CMD_ERR_SAVE_TEMP_AXIS;
+
+    Serial.println(F("OK"));
+    return 0;
+}
+
+// GetPwmAxis
+int cmdGetPwmAxis(void)
+{
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    printAxis(pwmAxis, mapPwmCoeffs);
+    return 0;
+}
+
+// SetPwmAxis 0 5 10 15 20 25 30 35 40 45 50 55 60 65 70 75 80 85 90 95 100
+int cmdSetPwmAxis(void)
+{
+    unsigned char axis[PWM_COEFFS_MAX];
+
+    if(parseAxis(axis, mapPwmCoeffs, 100) || checkPwmAxis(axis))
+        return CMD_ERR_SYNTAX_PWM_AXIS;
+
+    for(int a=0; a<mapPwmCoeffs; ++a)
+        pwmAxis[a] = axis[a];
+
+    Serial.println(F("OK"));
+    return 0;
+}
+
+// SavePwmAxis
+int cmdSavePwmAxis(void)
+{
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    if(SavePwmAxis())
+      return CMD_ERR_SAVE_PWM_AXIS;
+
+    Serial.println(F("OK"));
+    return 0;
+}
+
+// --------------------------- Mapping table geometry -----------------------
+
+// GetMapGeometry
+int cmdGetMapGeometry(void)
+{
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    Serial.print(mapTempMin);
+    Serial.print(' ');
+    Serial.print(mapTempStep);
+    Serial.print(' ');
+    Serial.print(mapTempMin + (mapTempCoeffs-1)*mapTempStep);
+    Serial.print(' ');
+    Serial.println(mapPwmStep);
+    return 0;
+}
+
+// SetMapGeometry 20 5 55 5
+int cmdSetMapGeometry(void)
+{
+    // temp. min, step, max and PWM step
+    unsigned char geom[4];
+
+    if(parseAxis(geom, 4, 255))
+        return CMD_ERR_SYNTAX_MAP_GEOMETRY;
+
+    if(setMapGeometry(geom[0], geom[1], geom[2], geom[3]))
+        return CMD_ERR_SYNTAX_MAP_GEOMETRY;
+
+    Serial.println(F("OK"));
+    return 0;
+}
+
+// SaveMapGeometry
+int cmdSaveMapGeometry(void)
+{
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    // the table rows and the axes are stored according to the geometry, save all of it
+    if(SaveMapGeometry() || SaveTempAxis() || SavePwmAxis())
+      return CMD_ERR_SAVE_MAP_GEOMETRY;
+
+    for(int fan=0; fan<FANS; ++fan)
+        for(int temp=0; temp<mapTempCoeffs; ++temp)
+            if(SaveMappingTable(fan, temp))
+                return CMD_ERR_SAVE_MAP_GEOMETRY;
+
+    Serial.println(F("OK"));
+    return 0;
+}
+
+// --------------------------- Fan control -----------------------
+
+// GetFanCtrl F1
+int cmdGetFanCtrl(void)
+{
+    char *p = strtok(NULL, " ");
+
+    int f = parseFan(p);
+    if(f < 0)
+        return f;
+
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    Serial.print('F');
+    Serial.print(f);
+    Serial.println((fanCtrl[f-1] == FAN_CTRL_MAXCURVE) ? F(" MAXCURVE") : F(" TABLE"));
+    return 0;
+}
+
+// SetFanCtrl F1 MAXCURVE
+int cmdSetFanCtrl(void)
+{
+    char *p = strtok(NULL, " ");
+
+    int f = parseFan(p);
+    if(f < 0)
+        return f;
+    --f;
+
+    unsigned char ctrl;
+
+    p = strtok(NULL, " ");
+    if(p == NULL)
+        return CMD_ERR_SYNTAX_FAN_CTRL;
+
+    if(!strcmp_P(p, PSTR("MAXCURVE")))
+        ctrl = FAN_CTRL_MAXCURVE;
+    else if(!strcmp_P(p, PSTR("TABLE")))
+        ctrl = FAN_CTRL_TABLE;
+    else
+        return CMD_ERR_SYNTAX_FAN_CTRL;
+
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    fanCtrl[f] = ctrl;
+
+    Serial.println(F("OK"));
+    return 0;
+}
+
+// SaveFanCtrl
+int cmdSaveFanCtrl(void)
+{
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    if(SaveFanCtrl())
+      return CMD_ERR_SAVE_FAN_CTRL;
+
+    Serial.println(F("OK"));
+    return 0;
+}
+
+// GetTempCurve F1 T1
+int cmdGetTempCurve(void)
+{
+    char *p = strtok(NULL, " ");
+
+    int f = parseFan(p);
+    if(f < 0)
+        return f;
+
+    int s = parseSensor(strtok(NULL, " "));
+    if(s < 0)
+        return s;
+
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    Serial.print('F');
+    Serial.print(f);
+    Serial.print(F(" T"));
+    Serial.print(s);
+
+    --f;
+    for(int a=0; a<TEMP_CURVE_POINTS; ++a)
+    {
+        Serial.print(' ');
+        Serial.print(curveTemp[f][s][a]);
+        Serial.print(':');
+        Serial.print(curveDuty[f][s][a]);
+    }
+    Serial.println();
+    return 0;
+}
+
+// SetTempCurve F1 T1 30:0 40:50 50:80 60:100
+int cmdSetTempCurve(void)
+{
+    char *p = strtok(NULL, " ");
+
+    int f = parseFan(p);
+    if(f < 0)
+        return f;
+    --f;
+
+    int s = parseSensor(strtok(NULL, " "));
+    if(s < 0)
+        return s;
+
+    unsigned char t[TEMP_CURVE_POINTS];
+    unsigned char d[TEMP_CURVE_POINTS];
+
+    for(int a=0; a<TEMP_CURVE_POINTS; ++a)
+    {
+        p = strtok(NULL, " ");
+        if(p == NULL)
+            return CMD_ERR_SYNTAX_TEMP_CURVE;
+
+        char *c = strchr(p, ':');
+        if(c == NULL)
+            return CMD_ERR_SYNTAX_TEMP_CURVE;
+
+        int tv = atoi(p);
+        int dv = atoi(c+1);
+        if(tv<0 || tv>255 || dv<0 || dv>100)
+            return CMD_ERR_SYNTAX_TEMP_CURVE;
+
+        t[a] = (unsigned char)tv;
+        d[a] = (unsigned char)dv;
+    }
+
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    if(checkTempCurve(t))
+        return CMD_ERR_SYNTAX_TEMP_CURVE;
+
+    for(int a=0; a<TEMP_CURVE_POINTS; ++a)
+    {
+        curveTemp[f][s][a] = t[a];
+        curveDuty[f][s][a] = d[a];
+    }
+
+    Serial.println(F("OK"));
+    return 0;
+}
+
+// SaveTempCurve F1
+int cmdSaveTempCurve(void)
+{
+    char *p = strtok(NULL, " ");
+
+    int f = parseFan(p);
+    if(f < 0)
+        return f;
+
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    if(SaveTempCurves(f-1))
+      return CMD_ERR_SAVE_TEMP_CURVE;
+
+    Serial.println(F("OK"));
+    return 0;
+}
+
+// --------------------------- Fan tach -----------------------
+
+// GetRpm
+int cmdGetRpm(void)
+{
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    for(int f=0; f<FANS; ++f)
+    {
+        Serial.print('F');
+        Serial.print(f+1);
+        Serial.print(':');
+        Serial.print(tachRpm[f]);
+        if(f<(FANS-1))
+            Serial.print(' ');
+    }
+    Serial.println();
+    return 0;
+}
+
+// GetTachPpr F1
+int cmdGetTachPpr(void)
+{
+    char *p = strtok(NULL, " ");
+
+    int f = parseFan(p);
+    if(f < 0)
+        return f;
+
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    Serial.print('F');
+    Serial.print(f);
+    Serial.print(' ');
+    Serial.println(tachPpr[f-1]);
+    return 0;
+}
+
+// SetTachPpr F1 2
+int cmdSetTachPpr(void)
+{
+    char *p = strtok(NULL, " ");
+
+    int f = parseFan(p);
+    if(f < 0)
+        return f;
+    --f;
+
+    p = strtok(NULL, " ");
+    if(p == NULL)
+        return CMD_ERR_SYNTAX_TACH_PPR;
+
+    int ppr = atoi(p);
+    if(ppr<1 || ppr>16)
+        return CMD_ERR_SYNTAX_TACH_PPR;
+
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    tachPpr[f] = (byte)ppr;
+
+    Serial.println(F("OK"));
+    return 0;
+}
+
+// SaveTachPpr
+int cmdSaveTachPpr(void)
+{
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    if(SaveTachPpr())
+      return CMD_ERR_SAVE_TACH_PPR;
+
+    Serial.println(F("OK"));
+    return 0;
+}
+
+
+// --------------------------- Emulated tach -----------------------
+
+#ifdef TACH_EMU
+
+// GetTachEmu F1
+int cmdGetTachEmu(void)
+{
+    char *p = strtok(NULL, " ");
+
+    int f = parseFan(p);
+    if(f < 0)
+        return f;
+
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    Serial.print('F');
+    Serial.print(f);
+
+    --f;
+    for(int i=0; i<TACH_EMU_POINTS; ++i)
+    {
+        Serial.print(' ');
+        Serial.print(tachEmuCurve[f][i]);
+    }
+    Serial.println();
+    return 0;
+}
+
+// SetTachEmu F1 1500 2600 3700 4900 6000
+int cmdSetTachEmu(void)
+{
+    char *p = strtok(NULL, " ");
+
+    int f = parseFan(p);
+    if(f < 0)
+        return f;
+    --f;
+
+    unsigned int curve[TACH_EMU_POINTS];
+    for(int i=0; i<TACH_EMU_POINTS; ++i)
+    {
+        p = strtok(NULL, " ");
+        if(p == NULL)
+            return CMD_ERR_SYNTAX_TACH_EMU;
+
+        long rpm = atol(p);
+        if(rpm<0 || rpm>30000)
+            return CMD_ERR_SYNTAX_TACH_EMU;
+
+        curve[i] = (unsigned int)rpm;
+    }
+
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    for(int i=0; i<TACH_EMU_POINTS; ++i)
+        tachEmuCurve[f][i] = curve[i];
+
+    Serial.println(F("OK"));
+    return 0;
+}
+
+// SaveTachEmu F1
+int cmdSaveTachEmu(void)
+{
+    char *p = strtok(NULL, " ");
+
+    int f = parseFan(p);
+    if(f < 0)
+        return f;
+
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    if(SaveTachEmuCurve(f-1))
+        return CMD_ERR_SAVE_TACH_EMU;
+
+    Serial.println(F("OK"));
+    return 0;
+}
+
+#endif // TACH_EMU
+
+
+// --------------------------- Mapping table -----------------------
+
+// GetPwmMap F1 T:20
+int cmdGetPwmMap(void)
+{
+    char *p = strtok(NULL, " ");
+
+    int fan = parseFan(p);
+    if(fan < 0)
+        return fan;
+
+    p = strtok(NULL, " ");
+    if(p == NULL) // early end..
+        return CMD_ERR_SYNTAX_TEMP;
+
+    int t = parseTemp(p);
+
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    int tIdx = tempIndex(t);
+
+    Serial.print('F');
+    Serial.print(fan);
+    Serial.print(F(" T:"));
+    Serial.print(tempFromIndex(tIdx)); // map back to show what temp we actually use (in case the request was not in the grid/step)
+    Serial.print(' ');
+
+    --fan;
+
+    for(int pc=0; pc<mapPwmCoeffs; ++pc)
+    {
+        Serial.print(mapCell(fan, tIdx, pc));
+        if(pc<(mapPwmCoeffs-1))
+            Serial.print(' ');
+    }
+    Serial.println();
+
+    return 0;
+}
+
+// SetPwmMap F1 T:20 0 10 15 20 25 30 35 40 45 50 55 60 65 70 75 80 85 90 95 100
+int cmdSetPwmMap(void)
+{
+    char *p = strtok(NULL, " ");
+
+    int fan = parseFan(p);
+    if(fan < 0)
+        return fan;
+    --fan;
+
+    p = strtok(NULL, " ");
+    if(p == NULL) // expected temp. token...
+        return CMD_ERR_SYNTAX_TEMP;
+
+    int t = parseTemp(p);
+
+    t = tempIndex(t);
+
+    unsigned char pMap[PWM_COEFFS_MAX];
+    int tmp=0;
+    for(int a=0; a<mapPwmCoeffs; ++a)
+    {
+        p = strtok(NULL, " ");
+        if(p == NULL) // expected pwm token...
+            return CMD_ERR_SYNTAX_PWM_TABLE;
+        
+        tmp = atoi(p);
+
+#ifdef DEBUG_CMD_PROC
+	Serial.print(a);
+	Serial.print(F(": "));
+	Serial.println(tmp);
+	Serial.println(p);
+#endif
+
+        if(tmp<0 || tmp>100)
+            return CMD_ERR_SYNTAX_PWM_TABLE;
+        
+        pMap[a] = (unsigned char) tmp;
+    }
+
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    for(int a=0; a<mapPwmCoeffs; ++a)
+        mapCell(fan, t, a) = pMap[a];
+
+    Serial.println(F("OK"));
+    return 0;
+}
+
+// SavePwmMap F1 T:20 
+int cmdSavePwmMap(void)
+{
+    char *p = strtok(NULL, " ");
+
+    int f = parseFan(p);
+    if(f < 0)
+        return f;
+    --f;
+
+    p = strtok(NULL, " ");
+    if(p == NULL) // early end..
+        return CMD_ERR_SYNTAX_TEMP;
+
+    int t = parseTemp(p);
+
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    t = tempIndex(t);
+
+    if(SaveMappingTable(f, t))
+      return CMD_ERR_SAVE_PWM_MAP;
+
+    Serial.println(F("OK"));
+    return 0;
+}
+
+
+// --------------------------- PID control -----------------------
+
+// GetPid F1
+int cmdGetPid(void)
+{
+    char *p = strtok(NULL, " ");
+
+    int f = parseFan(p);
+    if(f < 0)
+        return f;
+
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    Serial.print('F');
+    Serial.print(f);
+
+    --f;
+    Serial.print(' ');
+    Serial.print(pidSetpoint[f]);
+    Serial.print(' ');
+    Serial.print(pidGain[f][PID_KP], 3);
+    Serial.print(' ');
+    Serial.print(pidGain[f][PID_KI], 3);
+    Serial.print(' ');
+    Serial.println(pidGain[f][PID_KD], 3);
+    return 0;
+}
+
+// SetPid F1 45 5.0 0.1 0.0
+int cmdSetPid(void)
+{
+    char *p = strtok(NULL, " ");
+
+    int f = parseFan(p);
+    if(f < 0)
+        return f;
+    --f;
+
+    p = strtok(NULL, " ");
+    if(p == NULL)
+        return CMD_ERR_SYNTAX_PID;
+
+    int sp = atoi(p);
+    if(sp<0 || sp>255)
+        return CMD_ERR_SYNTAX_PID;
+
+    float g[3];
+    for(int a=0; a<3; ++a)
+    {
+        p = strtok(NULL, " ");
+        if(p == NULL)
+            return CMD_ERR_SYNTAX_PID;
+
+        g[a] = parseFloat(p);
+        if(g[a] < 0.0 || g[a] > 255.0)
+            return CMD_ERR_SYNTAX_PID;
+    }
+
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    pidSetpoint[f] = (unsigned char)sp;
+    for(int a=0; a<3; ++a)
+        pidGain[f][a] = g[a];
+    pidSetGains(f);
+
+    Serial.println(F("OK"));
+    return 0;
+}
+
+// SavePid F1
+int cmdSavePid(void)
+{
+    char *p = strtok(NULL, " ");
+
+    int f = parseFan(p);
+    if(f < 0)
+        return f;
+
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    if(SavePid(f-1))
+      return CMD_ERR_SAVE_PID;
+
+    Serial.println(F("OK"));
+    return 0;
+}
+
+
+// --------------------------- Feed-forward boost -----------------------
+
+// GetFeedFwd F1
+int cmdGetFeedFwd(void)
+{
+    char *p = strtok(NULL, " ");
+
+    int f = parseFan(p);
+    if(f < 0)
+        return f;
+
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    Serial.print('F');
+    Serial.print(f);
+
+    --f;
+    Serial.print(' ');
+    Serial.print(ffGain[f]);
+    Serial.print(' ');
+    Serial.print(ffMax[f]);
+    Serial.print(' ');
+    Serial.println(ffDecay[f]);
+    return 0;
+}
+
+// SetFeedFwd F1 20 30 2
+int cmdSetFeedFwd(void)
+{
+    char *p = strtok(NULL, " ");
+
+    int f = parseFan(p);
+    if(f < 0)
+        return f;
+    --f;
+
+    // gain, max. boost, decay
+    static const unsigned char limits[3] = { 255, 100, 100 };
+    int v[3];
+    for(int a=0; a<3; ++a)
+    {
+        p = strtok(NULL, " ");
+        if(p == NULL)
+            return CMD_ERR_SYNTAX_FEEDFWD;
+
+        v[a] = atoi(p);
+        if(v[a] < 0 || v[a] > limits[a])
+            return CMD_ERR_SYNTAX_FEEDFWD;
+    }
+
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    ffGain[f]  = v[0];
+    ffMax[f]   = v[1];
+    ffDecay[f] = v[2];
+
+    Serial.println(F("OK"));
+    return 0;
+}
+
+// SaveFeedFwd F1
+int cmdSaveFeedFwd(void)
+{
+    char *p = strtok(NULL, " ");
+
+    int f = parseFan(p);
+    if(f < 0)
+        return f;
+
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    if(SaveFeedFwd(f-1))
+      return CMD_ERR_SAVE_FEEDFWD;
+
+    Serial.println(F("OK"));
+    return 0;
+}
+
+
+// --------------------------- Output slew rate and hysteresis -----------------------
+
+// GetSlew F1
+int cmdGetSlew(void)
+{
+    char *p = strtok(NULL, " ");
+
+    int f = parseFan(p);
+    if(f < 0)
+        return f;
+
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    Serial.print('F');
+    Serial.print(f);
+
+    --f;
+    Serial.print(' ');
+    Serial.print(slewRise[f]);
+    Serial.print(' ');
+    Serial.print(slewFall[f]);
+    Serial.print(' ');
+    Serial.print(slewHystUp[f]);
+    Serial.print(' ');
+    Serial.print(slewHystDown[f]);
+    if(slewFlags[f] & SLEW_FLAG_MANUAL)
+        Serial.print(F(" MANUAL"));
+    Serial.println();
+    return 0;
+}
+
+// SetSlew F1 20 5 0 2 [MANUAL]
+int cmdSetSlew(void)
+{
+    char *p = strtok(NULL, " ");
+
+    int f = parseFan(p);
+    if(f < 0)
+        return f;
+    --f;
+
+    // rise, fall, hysteresis up, down
+    int v[4];
+    for(int a=0; a<4; ++a)
+    {
+        p = strtok(NULL, " ");
+        if(p == NULL)
+            return CMD_ERR_SYNTAX_SLEW;
+
+        v[a] = atoi(p);
+        if(v[a] < 0 || v[a] > 100)
+            return CMD_ERR_SYNTAX_SLEW;
+    }
+
+    unsigned char flags = 0;
+    p = strtok(NULL, " ");
+    if(p != NULL)
+    {
+        if(strcmp_P(p, PSTR("MANUAL")))
+            return CMD_ERR_SYNTAX_SLEW;
+        flags |= SLEW_FLAG_MANUAL;
+    }
+
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    slewRise[f]     = v[0];
+    slewFall[f]     = v[1];
+    slewHystUp[f]   = v[2];
+    slewHystDown[f] = v[3];
+    slewFlags[f]    = flags;
+
+    Serial.println(F("OK"));
+    return 0;
+}
+
+// SaveSlew F1
+int cmdSaveSlew(void)
+{
+    char *p = strtok(NULL, " ");
+
+    int f = parseFan(p);
+    if(f < 0)
+        return f;
+
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    if(SaveSlew(f-1))
+      return CMD_ERR_SAVE_SLEW;
+
+    Serial.println(F("OK"));
+    return 0;
+}
+
+
+// --------------------------- Op modes -----------------------
+
+unsigned char manualPwm[FANS];
+
+// ModeManual F1:20 F2:30
+int cmdModeManual(void)
+{
+    char *p = NULL;
+    unsigned char pwm[FANS];
+
+    unsigned char fan;
+    int rc = -1;
+
+    for(int a=0; a<FANS; ++a)
+    {
+	p = strtok(NULL, " ");
+	if(p==NULL)
+	    return CMD_ERR_SYNTAX_FAN_PWM; // out of order...
+
+	rc = parseFanPwm(p, &fan, &(pwm[a]));
+	if(rc != 0)
+	    return rc;
+
+	if(fan != a)
+	    return CMD_ERR_SYNTAX_FAN_PWM; // out of order...
+
+#ifdef DEBUG_CMD_PROC
+	Serial.print(a);
+	Serial.print(F(": "));
+	Serial.println(fan);
+	Serial.print(' ');
+	Serial.println(pwm[a]);
+#endif
+    }
+
+    for(int a=0; a<FANS; ++a)
+	manualPwm[a] = pwm[a];
+
+    opMode = 'M';
+
+    Serial.println(F("OK"));
+    return 0;
+}
+
+
+int cmdModeAuto(void)
+{
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    // TODO: check if we have all the data (eeprom checksum) and then confirm??
+    //....
+    if(opMode != 'A' && opMode != 'P')
+        ffBegin();
+
+    opMode = 'A';
+    Serial.println(F("OK"));
+    return 0;
+}
+
+
+int cmdModePid(void)
+{
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    if(opMode != 'P')
+        pidBegin();
+
+    if(opMode != 'A' && opMode != 'P')
+        ffBegin();
+
+    opMode = 'P';
+    Serial.println(F("OK"));
+    return 0;
+}
+
+
+int cmdModeFailsafe(void)
+{
+    if(strtok(NULL, " ") != NULL) // another token?
+        return CMD_ERR_SYNTAX_EXTRA_DATA;
+
+    opMode = 'F';
+    Serial.println(F("OK"));
+    return 0;
+}
+
+
+// ----------------------------------------------------------------------------------------------------------------------------
+
+/** 
+ * Reads any data up to the new line from the serial
+ * 
+ * 
+ * @return 1 of we have a complete line (in serCmd)
+ */
+int ReadSerialLine(void)
+{
+    // default Arduino serial buffer is 64B Tx and 64B Rx !!!
+    // it may still overflow!!!!
+    int c;
+    while((c=Serial.read()) >= 0)
+    {
+        if(serCmdCnt < 0) // error mode / overflow, just skip till the end of line
+        {
+            if(c == '\n')
+            {
+                serCmdCnt = 0; // back to normal...
+                break;
+            }
+        }
+        else
+        {
+            if(c == '\n')
+            {
+                serCmd[serCmdCnt] = '\0';
+                return 1;
+            }
+            else
+            {
+                serCmd[serCmdCnt++] = c;
+
+                // buffer overflow - would not fit even the terminating '\0', indicate error mode
+                if(serCmdCnt >= CMD_BUFF_SIZE)
+		{
+		    Serial.println(F("E Buffer overflow"));
+                    serCmdCnt = -1;
+		}
+            }
+        }
+        
+    }
+    return 0;
+}
+
+
+
+void errorResponse(int e)
+{
+    switch(e)
+    {
+    case CMD_ERR_NODATA:
+        Serial.println(F("E No data"));
+        break;
+
+    case CMD_ERR_SYNTAX:
+        Serial.println(F("E Syntax error"));
+        break;
+
+    case CMD_ERR_SYNTAX_FAN:
+        Serial.println(F("E Syntax error (fan)"));
+        break;
+
+    case CMD_ERR_SYNTAX_TEMP:
+        Serial.println(F("E Syntax error (temperature)"));
+        break;
 
     case CMD_ERR_SYNTAX_TEMP_WEIGHT:
-        Serial.println("E Syntax error (temperature weight)");
+        Serial.println(F("E Syntax error (temperature weight)"));
         break;
 
     case CMD_ERR_SYNTAX_FAN_PWM:
-        Serial.println("E Syntax error (fan/pwm)");
+        Serial.println(F("E Syntax error (fan/pwm)"));
         break;
 
     case CMD_ERR_SYNTAX_PWM_VALUE:
-        Serial.println("E Syntax error (PWM value)");
+        Serial.println(F("E Syntax error (PWM value)"));
         break;
 
     case CMD_ERR_SYNTAX_PWM_FILT:
-        Serial.println("E Syntax error (PWM filter)");
+        Serial.println(F("E Syntax error (PWM filter)"));
         break;
 
     case CMD_ERR_SYNTAX_PWM_TABLE:
-        Serial.println("E Syntax error (PWM table)");
+        Serial.println(F("E Syntax error (PWM table)"));
         break;
 
     case CMD_ERR_SYNTAX_EXTRA_DATA:
-        Serial.println("E Syntax error (extra data/token)");
+        Serial.println(F("E Syntax error (extra data/token)"));
         break;
 
     case CMD_ERR_FAN_NUMBER:
-        Serial.println("E Wrong fan number");
+        Serial.println(F("E Wrong fan number"));
         break;
 
     case CMD_ERR_SAVE_PWM_FILT:
-        Serial.println("E Saving PWM filter params");
+        Serial.println(F("E Saving PWM filter params"));
         break;
 
     case CMD_ERR_SAVE_PWM_MAP:
-        Serial.println("E Saving PWM map");
+        Serial.println(F("E Saving PWM map"));
         break;
 
     case CMD_ERR_SAVE_TEMP_WEIGHTS:
-        Serial.println("E Saving temp. weights");
+        Serial.println(F("E Saving temp. weights"));
+        break;
+
+    case CMD_ERR_SYNTAX_PWM_IN:
+        Serial.println(F("E Syntax error (PWM input)"));
+        break;
+
+    case CMD_ERR_PWM_IN_NUMBER:
+        Serial.println(F("E Wrong PWM input number"));
+        break;
+
+    case CMD_ERR_SAVE_PWM_IN:
+        Serial.println(F("E Saving PWM input selection"));
+        break;
+
+    case CMD_ERR_SYNTAX_PWM_POL:
+        Serial.println(F("E Syntax error (PWM polarity)"));
+        break;
+
+    case CMD_ERR_SAVE_PWM_POL:
+        Serial.println(F("E Saving PWM polarity"));
+        break;
+
+    case CMD_ERR_SYNTAX_TACH_PPR:
+        Serial.println(F("E Syntax error (tach pulses per revolution)"));
+        break;
+
+    case CMD_ERR_SAVE_TACH_PPR:
+        Serial.println(F("E Saving tach pulses per revolution"));
+        break;
+
+    case CMD_ERR_SYNTAX_TACH_EMU:
+        Serial.println(F("E Syntax error (emulated tach curve)"));
+        break;
+
+    case CMD_ERR_SAVE_TACH_EMU:
+        Serial.println(F("E Saving emulated tach curve"));
+        break;
+
+    case CMD_ERR_SYNTAX_PWM_FALLBACK:
+        Serial.println(F("E Syntax error (PWM input fallback)"));
+        break;
+
+    case CMD_ERR_SAVE_PWM_FALLBACK:
+        Serial.println(F("E Saving PWM input fallback"));
+        break;
+
+    case CMD_ERR_SYNTAX_TEMP_AXIS:
+        Serial.println(F("E Syntax error (temp. axis)"));
+        break;
+
+    case CMD_ERR_SAVE_TEMP_AXIS:
+        Serial.println(F("E Saving temp. axis"));
+        break;
+
+    case CMD_ERR_SYNTAX_PWM_AXIS:
+        Serial.println(F("E Syntax error (PWM axis)"));
+        break;
+
+    case CMD_ERR_SAVE_PWM_AXIS:
+        Serial.println(F("E Saving PWM axis"));
+        break;
+
+    case CMD_ERR_SYNTAX_MAP_GEOMETRY:
+        Serial.println(F("E Syntax error (mapping table geometry)"));
+        break;
+
+    case CMD_ERR_SAVE_MAP_GEOMETRY:
+        Serial.println(F("E Saving mapping table geometry"));
+        break;
+
+    case CMD_ERR_SYNTAX_FAN_CTRL:
+        Serial.println(F("E Syntax error (fan control)"));
+        break;
+
+    case CMD_ERR_SAVE_FAN_CTRL:
+        Serial.println(F("E Saving fan control"));
+        break;
+
+    case CMD_ERR_SYNTAX_TEMP_CURVE:
+        Serial.println(F("E Syntax error (temp. curve)"));
+        break;
+
+    case CMD_ERR_SAVE_TEMP_CURVE:
+        Serial.println(F("E Saving temp. curve"));
+        break;
+
+    case CMD_ERR_SYNTAX_PID:
+        Serial.println(F("E Syntax error (PID)"));
+        break;
+
+    case CMD_ERR_SAVE_PID:
+        Serial.println(F("E Saving PID"));
+        break;
+
+    case CMD_ERR_SYNTAX_FEEDFWD:
+        Serial.println(F("E Syntax error (feed-forward)"));
+        break;
+
+    case CMD_ERR_SAVE_FEEDFWD:
+        Serial.println(F("E Saving feed-forward"));
+        break;
+
+    case CMD_ERR_SYNTAX_SLEW:
+        Serial.println(F("E Syntax error (slew rate)"));
+        break;
+
+    case CMD_ERR_SAVE_SLEW:
+        Serial.println(F("E Saving slew rate"));
+        break;
+
+    case CMD_ERR_SYNTAX_TEMP_KALMAN:
+        Serial.println(F("E Syntax error (temp. Kalman filter)"));
+        break;
+
+    case CMD_ERR_SAVE_TEMP_KALMAN:
+        Serial.println(F("E Saving temp. Kalman filter"));
         break;
 
     case CMD_ERR_NOT_IMPLEMENTED:
-        Serial.println("E Not implemented yet");
+        Serial.println(F("E Not implemented yet"));
         break;
         
     default:
@@ -716,6 +2086,98 @@ void errorResponse(int e)
 }
 
 
+/** Serial command - name and handler (see @ParseAndExecute) */
+struct SerCmdEntry
+{
+    char name[SER_CMD_NAME_LEN];
+    int  (*handler)(void);
+};
+
+/** All the commands, in flash - the names are compared with strcmp_P */
+static const SerCmdEntry serCmdTable[] PROGMEM =
+{
+    // generic
+    { "Ver",              cmdVer },
+    { "GetCfg",           cmdGetCfg },
+
+    // temp weights
+    { "GetTempWeights",   cmdGetTempWeights },
+    { "SetTempWeights",   cmdSetTempWeights },
+    { "SaveTempWeights",  cmdSaveTempWeights },
+
+    // pwm measure
+    { "GetPwmFilt",       cmdGetPwmFilt },
+    { "SetPwmFilt",       cmdSetPwmFilt },
+    { "GetTempKalman",    cmdGetTempKalman },
+    { "SetTempKalman",    cmdSetTempKalman },
+    { "SaveTempKalman",   cmdSaveTempKalman },
+    { "SavePwmFilt",      cmdSavePwmFilt },
+    { "GetPwmStats",      cmdGetPwmStats },
+
+    // pwm input selection
+    { "GetPwmIn",         cmdGetPwmIn },
+    { "SetPwmIn",         cmdSetPwmIn },
+    { "SavePwmIn",        cmdSavePwmIn },
+
+    // pwm input signal
+    { "GetPwmSig",        cmdGetPwmSig },
+    { "SetPwmPol",        cmdSetPwmPol },
+    { "SavePwmPol",       cmdSavePwmPol },
+
+    // pwm input fallback
+    { "GetPwmFallback",   cmdGetPwmFallback },
+    { "SetPwmFallback",   cmdSetPwmFallback },
+    { "SavePwmFallback",  cmdSavePwmFallback },
+    { "GetTempAxis",      cmdGetTempAxis },
+    { "SetTempAxis",      cmdSetTempAxis },
+    { "SaveTempAxis",     cmdSaveTempAxis },
+    { "GetPwmAxis",       cmdGetPwmAxis },
+    { "SetPwmAxis",       cmdSetPwmAxis },
+    { "SavePwmAxis",      cmdSavePwmAxis },
+    { "GetMapGeometry",   cmdGetMapGeometry },
+    { "SetMapGeometry",   cmdSetMapGeometry },
+    { "SaveMapGeometry",  cmdSaveMapGeometry },
+    { "GetFanCtrl",       cmdGetFanCtrl },
+    { "SetFanCtrl",       cmdSetFanCtrl },
+    { "SaveFanCtrl",      cmdSaveFanCtrl },
+    { "GetTempCurve",     cmdGetTempCurve },
+    { "SetTempCurve",     cmdSetTempCurve },
+    { "SaveTempCurve",    cmdSaveTempCurve },
+
+    // fan tach
+    { "GetRpm",           cmdGetRpm },
+    { "GetTachPpr",       cmdGetTachPpr },
+    { "SetTachPpr",       cmdSetTachPpr },
+    { "SaveTachPpr",      cmdSaveTachPpr },
+
+#ifdef TACH_EMU
+    { "GetTachEmu",       cmdGetTachEmu },
+    { "SetTachEmu",       cmdSetTachEmu },
+    { "SaveTachEmu",      cmdSaveTachEmu },
+#endif
+
+    // mapping table
+    { "GetPwmMap",        cmdGetPwmMap },
+    { "SetPwmMap",        cmdSetPwmMap },
+    { "SavePwmMap",       cmdSavePwmMap },
+
+    // operational mode
+    { "ModeManual",       cmdModeManual },
+    { "ModeAuto",         cmdModeAuto },
+    { "ModeFailsafe",     cmdModeFailsafe },
+    { "ModePid",          cmdModePid },
+    { "GetPid",           cmdGetPid },
+    { "SetPid",           cmdSetPid },
+    { "SavePid",          cmdSavePid },
+    { "GetFeedFwd",       cmdGetFeedFwd },
+    { "SetFeedFwd",       cmdSetFeedFwd },
+    { "SaveFeedFwd",      cmdSaveFeedFwd },
+    { "GetSlew",          cmdGetSlew },
+    { "SetSlew",          cmdSetSlew },
+    { "SaveSlew",         cmdSaveSlew },
+};
+
+
 int ParseAndExecute(void)
 {
     // TODO: check and remove checksum
@@ -730,52 +2192,9 @@ int ParseAndExecute(void)
     Serial.println(cmd);
 #endif
 
-// generic
-    if(!strcmp(cmd, "Ver"))
-        return cmdVer();
-
-    if(!strcmp(cmd, "GetCfg"))
-        return cmdGetCfg();
-
-// temp weights
-    if(!strcmp(cmd, "GetTempWeights"))
-        return cmdGetTempWeights();
-
-    if(!strcmp(cmd, "SetTempWeights"))
-        return cmdSetTempWeights();
-
-    if(!strcmp(cmd, "SaveTempWeights"))
-        return cmdSaveTempWeights();
-
-// pwm measure
-    if(!strcmp(cmd, "GetPwmFilt"))
-        return cmdGetPwmFilt();
-
-    if(!strcmp(cmd, "SetPwmFilt"))
-        return cmdSetPwmFilt();
-
-    if(!strcmp(cmd, "SavePwmFilt"))
-        return cmdSavePwmFilt();
-
-// mapping table
-    if(!strcmp(cmd, "GetPwmMap"))
-        return cmdGetPwmMap();
-    
-    if(!strcmp(cmd, "SetPwmMap"))
-        return cmdSetPwmMap();
-
-    if(!strcmp(cmd, "SavePwmMap"))
-        return cmdSavePwmMap();
-
-// operational mode
-    if(!strcmp(cmd, "ModeManual"))
-        return cmdModeManual();
-
-    if(!strcmp(cmd, "ModeAuto"))
-        return cmdModeAuto();
-
-    if(!strcmp(cmd, "ModeFailsafe"))
-        return cmdModeFailsafe();
+    for(byte i=0; i<sizeof(serCmdTable)/sizeof(serCmdTable[0]); ++i)
+        if(!strcmp_P(cmd, serCmdTable[i].name))
+            return ((int (*)(void))pgm_read_word(&serCmdTable[i].handler))();
 
 // TBD temp callibration....
 
@@ -794,8 +2213,11 @@ int ParseAndExecute(void)
  ******************************************************************************/
 
 // Vars for loop()
-int duty      = 0;
-int loopCount = 0;
+int duty[FANS];                 /**< Input PWM for each fan (from its selected input(s)) */
+int dutyPm[FANS];               /**< The same in permille (failsafe mode passes it through) */
+unsigned char pwmInLostReported[PWM_INPUTS]; /**< Input loss state already reported (see @pwmInLost) */
+unsigned long reportStart;      /**< Start of the report period (timer1 ticks) */
+unsigned long ledStart;         /**< Start of the heartbeat LED period (timer1 ticks) */
 
 int newTemp   = -1;
 int newPwmA   = -1;
@@ -804,27 +2226,63 @@ int newPwmB   = -1;
 unsigned char ledBlink = 0;
 
 
+/**
+ * Periodic action of the loop on timer1, see @slewTick
+ *
+ * @param start start of the current period, advanced by a period (started over after a long stall)
+ * @param ticks the period in timer1 ticks
+ *
+ * @return non zero once per period
+ */
+static byte loopPeriodDue(unsigned long *start, unsigned long ticks)
+{
+    unsigned long now = pwmTimerTicks();
+    unsigned long dt  = (uint32_t)(now - *start);
+
+    if(dt < ticks)
+        return 0;
+
+    *start = (dt < 2 * ticks) ? (uint32_t)(*start + ticks) : now;
+    return 1;
+}
+
+
 
 /* -----------------------------------------------------------------------
    Setup
    ----------------------------------------------------------------------- */
 void pfcSetup()
 {
-    TIMSK0 = 0; // we do not use interrupts on timer0, using it just as a PWM out
-    TIMSK2 = 0; // we do not use interrupts on timer2, using it just as a PWM out
+    TIMSK0 = 0; // timer0 is just a PWM out, PwmOut enables its own interrupt for dithering
+    TIMSK2 = 0; // timer2 is just a PWM out, PwmOut enables its own interrupt for dithering
+
+    TIMSK1 = 0; // PWM measurement function will set it itself
 
-    TIMSK1 = 0; // PWM measurement function will set it itself as needed
+    // There are no long ISRs anymore (PWM in pin resampling is done in the main loop) so higher speeds are OK
+    Serial.begin(SERIAL_SPEED);
 
-    // At higher speed we sometimes miss a character (disabled interrupts during PWM measurement).
-    // Lower speed seems ot be OK...
+    // set PWM inputs as inputs, internal 20k pullup
+    for(int in=0; in<PWM_INPUTS; ++in)
+        pinMode(pwmInPins[in], INPUT_PULLUP);
+
+    // capture engine runs in the background from now on
+    pwmMeasureBegin();
 
-    Serial.begin(19200);
+    // uses timer1 as the time base
+    for(int fan=0; fan<FANS; ++fan)
+        tachPpr[fan] = TACH_PPR_DEFAULT;
+    tachBegin();
 
-    //Serial.begin(57600);
-    //Serial.begin(115200);
+    // the same time base, we start in auto mode
+    ffBegin();
 
-    // set PWM input as input, internal 20k pullup
-    pinMode(8, INPUT_PULLUP);
+#ifdef TACH_EMU
+    // linear default curve, no pulses till the first loop
+    for(int fan=0; fan<FANS; ++fan)
+        for(int i=0; i<TACH_EMU_POINTS; ++i)
+            tachEmuCurve[fan][i] = TACH_EMU_RPM_MIN + (long)(TACH_EMU_RPM_MAX - TACH_EMU_RPM_MIN) * i / (TACH_EMU_POINTS - 1);
+    tachEmuBegin();
+#endif
 
     pinMode(LED_PIN, OUTPUT);
 
@@ -837,17 +2295,50 @@ void pfcSetup()
 #endif
 
     // initialize everything before trying to load from EEPROM to have some baseline
-    int a,b,c;
+    int a,b;
+    setMapGeometry(TEMP_MIN, TEMP_STEP, TEMP_MAX, PWM_STEP); // axes and tables too
+
     for(a=0; a<FANS; ++a)
     {
+        pwmInSel[a]    = PWM_IN_SEL_ALL;
+        pwmFallback[a] = PWM_IN_FALLBACK_DEFAULT;
+        fanCtrl[a]     = FAN_CTRL_TABLE;
+
+        pidSetpoint[a]      = PID_SETPOINT_DEFAULT;
+        pidGain[a][PID_KP]  = PID_KP_DEFAULT;
+        pidGain[a][PID_KI]  = PID_KI_DEFAULT;
+        pidGain[a][PID_KD]  = PID_KD_DEFAULT;
+        pidSetGains(a);
+
+        ffGain[a]  = FF_GAIN_DEFAULT;
+        ffMax[a]   = FF_MAX_DEFAULT;
+        ffDecay[a] = FF_DECAY_DEFAULT;
+
+        slewRise[a]     = SLEW_RISE_DEFAULT;
+        slewFall[a]     = SLEW_FALL_DEFAULT;
+        slewHystUp[a]   = SLEW_HYST_UP_DEFAULT;
+        slewHystDown[a] = SLEW_HYST_DOWN_DEFAULT;
+        slewFlags[a]    = 0;
+        slewTrack(a, PWM_MAPPING_TABLE_DEFAULT);
+
         for(b=0; b<TEMP_SENSORS; ++b)
+        {
             tempWeights[a][b] = 0.0;
 
-        for(b=0; b<TEMP_COEFFS; ++b)
-            for(c=0; c<PWM_COEFFS; ++c)
-                mappingTable[a][b][c] = PWM_MAPPING_TABLE_DEFAULT;
+            // flat zero curves, no effect even with MAXCURVE
+            for(int c=0; c<TEMP_CURVE_POINTS; ++c)
+            {
+                curveTemp[a][b][c] = TEMP_MIN + c;
+                curveDuty[a][b][c] = 0;
+            }
+        }
+        normalizeTempWeights(a);
     }
 
+    // the rest of the config (axes, mapping tables) depends on it
+    if(LoadMapGeometry())
+        Serial.println(F("*E EEPROM checksum mismatch (mapping table geometry). Using default."));
+
 
     cmdVer();
     cmdGetCfg();
@@ -855,40 +2346,121 @@ void pfcSetup()
 
     opMode='A';
 
+    // not critical, all the inputs are used by default
+    if(LoadPwmInSel())
+        Serial.println(F("*E EEPROM checksum mismatch (PWM input selection). Using all inputs."));
+
+    if(LoadPwmPolarity())
+        Serial.println(F("*E EEPROM checksum mismatch (PWM input polarity). Using auto detection."));
+
+    if(LoadPwmFallback())
+        Serial.println(F("*E EEPROM checksum mismatch (PWM input fallback). Using default."));
+
+    if(LoadTachPpr())
+        Serial.println(F("*E EEPROM checksum mismatch (tach pulses per revolution). Using default."));
+
+    if(LoadTempAxis())
+        Serial.println(F("*E EEPROM checksum mismatch (mapping table temp. axis). Using default."));
+
+    if(LoadPwmAxis())
+        Serial.println(F("*E EEPROM checksum mismatch (mapping table PWM axis). Using default."));
+
+    if(LoadFanCtrl())
+        Serial.println(F("*E EEPROM checksum mismatch (fan control). Using mapping table only."));
+
+    for(int fan=0; fan<FANS; ++fan)
+        if(LoadTempCurves(fan))
+        {
+            Serial.print(F("*E EEPROM checksum mismatch (temp. curves F:"));
+            Serial.print(fan+1);
+            Serial.println(F("). Using default."));
+        }
+
+    for(int fan=0; fan<FANS; ++fan)
+        if(LoadPid(fan))
+        {
+            Serial.print(F("*E EEPROM checksum mismatch (PID F:"));
+            Serial.print(fan+1);
+            Serial.println(F("). Using default."));
+        }
+
+    for(int fan=0; fan<FANS; ++fan)
+        if(LoadFeedFwd(fan))
+        {
+            Serial.print(F("*E EEPROM checksum mismatch (feed-forward F:"));
+            Serial.print(fan+1);
+            Serial.println(F("). Using default."));
+        }
+
+    for(int fan=0; fan<FANS; ++fan)
+        if(LoadSlew(fan))
+        {
+            Serial.print(F("*E EEPROM checksum mismatch (slew rate F:"));
+            Serial.print(fan+1);
+            Serial.println(F("). Using default."));
+        }
+
+#ifdef TACH_EMU
+    for(int fan=0; fan<FANS; ++fan)
+        if(LoadTachEmuCurve(fan))
+        {
+            Serial.print(F("*E EEPROM checksum mismatch (emulated tach curve F:"));
+            Serial.print(fan+1);
+            Serial.println(F("). Using default."));
+        }
+#endif
+
+    // not critical, the plain exp. filters by default
+    if(LoadTempKalman())
+        Serial.println(F("*E EEPROM checksum mismatch (temp. Kalman filter). Using exp. filter."));
+
+    if(LoadPwmAdaptFilter())
+        Serial.println(F("*E EEPROM checksum mismatch (PWM adaptive filter). Using exp. filter only."));
+
     if(LoadPwmExpFilter())
     {
-        Serial.println("*E EEPROM checksum mismatch (PWM exp. filter). Using failsafe mode.");
+        Serial.println(F("*E EEPROM checksum mismatch (PWM exp. filter). Using failsafe mode."));
         opMode='F';
         return;
     }
 
-    // fixed startup value is enough
-    pwmExpFilterVal = PWM_EXPFILT_INIT;
+    // fixed startup value is enough, the filters' time runs from now
+    unsigned long now = pwmTimerTicks();
+
+    for(int in=0; in<PWM_INPUTS; ++in)
+    {
+        pwmExpFilterVal[in] = (long)PWM_EXPFILT_INIT << EXPFILT_FRAC_BITS;
+        pwmFilterTime[in]   = now;
+    }
 
     for(int a=0; a<TEMP_EXT_SENSORS; ++a)
-	tempExpFilterVal[a] = TEMP_EXPFILT_INIT;
+    {
+	tempExpFilterVal[a] = MCP9701_FILT_VAL(TEMP_EXPFILT_INIT);
+	tempFilterTime[a]   = now;
+    }
 
-    intTempExpFilterVal = TEMP_EXPFILT_INIT;
+    intTempExpFilterVal = AVR_INT_TEMP_FILT_VAL(TEMP_EXPFILT_INIT);
+    intTempFilterTime   = now;
 
     for(int fan=0; fan<FANS; ++fan)
         if(LoadTempWeights(fan))
         {
-            Serial.print("*E EEPROM checksum mismatch (temp. weights F:");
+            Serial.print(F("*E EEPROM checksum mismatch (temp. weights F:"));
             Serial.print(fan+1);
-            Serial.println("). Using failsafe mode.");
+            Serial.println(F("). Using failsafe mode."));
             opMode='F';
             return;
         }
 
     for(int fan=0; fan<FANS; ++fan)
-        for(int temp=0; temp<TEMP_COEFFS; ++temp)
+        for(int temp=0; temp<mapTempCoeffs; ++temp)
             if(LoadMappingTable(fan, temp))
             {
-                Serial.print("*E EEPROM checksum mismatch (PWM mapping table F:");
+                Serial.print(F("*E EEPROM checksum mismatch (PWM mapping table F:"));
                 Serial.print(fan+1);
-                Serial.print(" T:");
+                Serial.print(F(" T:"));
                 Serial.print(tempFromIndex(temp));
-                Serial.println("). Using failsafe mode.");
+                Serial.println(F("). Using failsafe mode."));
                 opMode='F';
                 return;
             }
@@ -901,23 +2473,50 @@ void pfcSetup()
    ----------------------------------------------------------------------- */
 void pfcLoop()
 {
-    pwmMeasureBegin();
-    while(pwmMeasureComplete())
-        ;
+    // non blocking, keeps the old value if there are no new edges
+    pwmMeasureUpdate();
+
+    // non blocking, new RPM once per TACH_WINDOW_MS
+    tachUpdate();
+
+    // report input loss and recovery once
+    for(unsigned char in=0; in<PWM_INPUTS; ++in)
+    {
+        if(pwmInLost[in] == pwmInLostReported[in])
+            continue;
+
+        pwmInLostReported[in] = pwmInLost[in];
+        Serial.print(F("*E PWM input P"));
+        Serial.print(in+1);
+        Serial.println(pwmInLost[in] ? F(" lost. Using fallback duty.") : F(" recovered."));
+    }
 
-    duty = int(pwmDuty + 0.5);
+    // each fan follows its own input (or max/average of more of them), fallback when they are all lost
+    // (never below 100% for a lost input with positive polarity, see @pwmSelectDuty)
+    for(unsigned char f=0; f<FANS; ++f)
+    {
+        dutyPm[f] = pwmSelectDuty(pwmInSel[f], pwmFallback[f] * 10);
+        duty[f]   = (dutyPm[f] + 5) / 10;
+    }
+
+#ifdef TACH_EMU
+    // the server sees the speed it expects for its own PWM
+    for(unsigned char f=0; f<FANS; ++f)
+        tachEmuSet(f, duty[f]);
+#endif
 
 #ifdef DEBUG_LOOP
-    Serial.print("Filt ");
-    Serial.print(pwmDuty);
-    Serial.print(", duty ");
-    Serial.println(duty);
+    Serial.print(F("Filt "));
+    Serial.print(pwmDuty[0]);
+    Serial.print(F(", duty "));
+    Serial.println(duty[0]);
 #endif
 
-    // read all the temperature(s)
+    // read all the temperature(s), non blocking - the internal sensor takes the ADC for INT_TEMP_SETTLE_MS
+    // and the external ones keep their values meanwhile
     temps[0] = readInternalTemp();
 
-    for(unsigned char a=1; a<TEMP_SENSORS; ++a)
+    for(unsigned char a=1; a<TEMP_SENSORS && !intTempAdcBusy(); ++a)
     {
         // we are using A0, A1
         temps[a] = readTemp(a - 1);
@@ -926,37 +2525,65 @@ void pfcLoop()
 
     // depedning on the opMode set the output PWM
 
+    // PID runs on top of the auto mode, once per PID_PERIOD_MS
+    byte pidUpdate = (opMode == 'P') && !pidTick();
+
+    // feed-forward boost samples the temperature rate once per FF_PERIOD_MS
+    byte ffUpdate = (opMode == 'A' || opMode == 'P') && !ffTick();
+
+    // output slew rate limit, once per SLEW_PERIOD_MS
+    byte slewUpdate = !slewTick();
+
     // Failsafe mode - just copy input PWM to the outputs
     if(opMode == 'F')
     {
-        newPwmA = duty;
-        pwmSetDcA(newPwmA);
+        newPwmA = duty[0];
+        slewTrack(0, newPwmA);
+        pwmSetPermilleA(dutyPm[0]);
 #if FANS > 1
-        newPwmB = duty;
-        pwmSetDcB(newPwmB);
+        newPwmB = duty[1];
+        slewTrack(1, newPwmB);
+        pwmSetPermilleB(dutyPm[1]);
 #endif
     }
     else
     {
         // Auto mode - do the mapping magic from inputs PWM and temperatures to the PWM outputs
-        if(opMode == 'A')
+        // PID mode - the same as the minimum, PID control of the temperature on top of it
+        if(opMode == 'A' || opMode == 'P')
         {
+            int avgTemp; // not clamped to the axis, for the feed-forward rate and the PID error
+
             // fan A aka fan=0
-            newTemp = normalizeTemp(averageTemp(0));
+            avgTemp = averageTemp(0);
+            newTemp = normalizeTemp(avgTemp);
 #ifdef DEBUG_DATA_PROCESSING
 	    Serial.println(newTemp);
 #endif
-            newPwmA = interpolatePwm(0, duty, newTemp);
-            pwmSetDcA(newPwmA);
+            newPwmA = interpolatePwm(0, duty[0], newTemp);
+            if(fanCtrl[0] == FAN_CTRL_MAXCURVE)
+                newPwmA = maxCurvePwm(0, newPwmA);
+            newPwmA = ffControl(0, avgTemp, newPwmA, ffUpdate);
+            if(opMode == 'P')
+                newPwmA = pidControl(0, avgTemp, newPwmA, pidUpdate);
+            newPwmA = slewControl(0, newPwmA, slewUpdate);
+            pwmSetPermilleA(slewPermille(0));
 
 #if FANS > 1
             // fan B aka fan=0
-            newTemp = normalizeTemp(averageTemp(1));
+            avgTemp = averageTemp(1);
+            newTemp = normalizeTemp(avgTemp);
 #ifdef DEBUG_DATA_PROCESSING
 	    Serial.println(newTemp);
 #endif
-            newPwmB = interpolatePwm(1, duty, newTemp);
-            pwmSetDcB(newPwmB);
+            newPwmB = interpolatePwm(1, duty[1], newTemp);
+            if(fanCtrl[1] == FAN_CTRL_MAXCURVE)
+                newPwmB = maxCurvePwm(1, newPwmB);
+            newPwmB = ffControl(1, avgTemp, newPwmB, ffUpdate);
+            if(opMode == 'P')
+                newPwmB = pidControl(1, avgTemp, newPwmB, pidUpdate);
+            newPwmB = slewControl(1, newPwmB, slewUpdate);
+            pwmSetPermilleB(slewPermille(1));
 #endif
         }
         else
@@ -964,68 +2591,92 @@ void pfcLoop()
             if(opMode == 'M')
             {
 		newPwmA = manualPwm[0];
-		pwmSetDcA(newPwmA);
+		if(slewFlags[0] & SLEW_FLAG_MANUAL)
+		    newPwmA = slewControl(0, newPwmA, slewUpdate);
+		else
+		    slewTrack(0, newPwmA);
+		pwmSetPermilleA(slewPermille(0));
 #if FANS > 1
 		newPwmB = manualPwm[1];
-		pwmSetDcB(newPwmB);
+		if(slewFlags[1] & SLEW_FLAG_MANUAL)
+		    newPwmB = slewControl(1, newPwmB, slewUpdate);
+		else
+		    slewTrack(1, newPwmB);
+		pwmSetPermilleB(slewPermille(1));
 #endif
             }
             else
             {
                 // fatal error
-                Serial.println("*E Invalid opmode, setting failsafe");
+                Serial.println(F("*E Invalid opmode, setting failsafe"));
 		opMode = 'F';
             }
         }
     }
 
 
-    // In every measure/adjust cycle switch the green LED. If everything is OK it should be blinking fairly quickly
-    if(ledBlink)
+    // Heartbeat - switch the green LED every LED_PERIOD_MS while the loop runs, it stops when the loop hangs
+    if(loopPeriodDue(&ledStart, (unsigned long)LED_PERIOD_MS * (F_CPU / 1000)))
     {
-        digitalWrite(LED_PIN, HIGH);
-        ledBlink = 0;
-    }
-    else
-    {
-        digitalWrite(LED_PIN, LOW);
-        ledBlink = 1;
+        digitalWrite(LED_PIN, ledBlink ? HIGH : LOW);
+        ledBlink = !ledBlink;
     }
 
-    // periodic reports
-    if(loopCount >= REPORT_FREQ)
+    // periodic reports, the time based period keeps the serial line (and the send buffer) free
+    // however fast the loop runs
+    if(loopPeriodDue(&reportStart, (unsigned long)REPORT_PERIOD_MS * (F_CPU / 1000)))
     {
 
 #ifndef NO_REPORTS
         // Autonomous mode:
-        // *A PWM1_in:20 T1_in:23 T2_in:30 F1_out:20 F2_out:30
-        Serial.print("*");
+        // *A PWM1_in:20 T1_in:23.4 T2_in:30.1 F1_out:20 F2_out:30
+        Serial.print('*');
         Serial.print(opMode);
-        Serial.print(" PWM1_in:");
-        Serial.print(duty);
+
+        for(unsigned char in=0; in<PWM_INPUTS; ++in)
+        {
+            Serial.print(F(" PWM"));
+            Serial.print(in+1);
+            Serial.print(F("_in:"));
+            Serial.print((pwmDuty[in] + 5) / 10);
+        }
 
         for(unsigned char a=0; a<TEMP_SENSORS; ++a)
         {
-            Serial.print(" T");
+            Serial.print(F(" T"));
             Serial.print(a);
-            Serial.print("_in:");
-            Serial.print(temps[a]);
+            Serial.print(F("_in:"));
+            Serial.print(temps[a] / (float)TEMP_ONE, 1);
         }
 
-        Serial.print(" F1_out:");
+        Serial.print(F(" F1_out:"));
         Serial.print(newPwmA);
 
 #if FANS > 1
-        Serial.print(" F2_out:");
-        Serial.println(newPwmB);
-#else
-        Serial.println();
+        Serial.print(F(" F2_out:"));
+        Serial.print(newPwmB);
 #endif        
+
+        for(unsigned char f=0; f<FANS; ++f)
+        {
+            Serial.print(F(" F"));
+            Serial.print(f+1);
+            Serial.print(F("_rpm:"));
+            Serial.print(tachRpm[f]);
+        }
+
+        // feed-forward boost (already included in the outputs) for tuning
+        if(opMode == 'A' || opMode == 'P')
+            for(unsigned char f=0; f<FANS; ++f)
+            {
+                Serial.print(F(" F"));
+                Serial.print(f+1);
+                Serial.print(F("_ff:"));
+                Serial.print(ffBoost[f]);
+            }
+        Serial.println();
 #endif        
-        loopCount = 0;
     }
-    else
-        ++loopCount;
         
     // handle serial comms...
     if(ReadSerialLine())
@@ -1050,4 +2701,4 @@ int main(int argc, char **argv)
         pfcLoop();
 
     return 0;
-}
+}
@@ -18,12 +18,42 @@
 // results in 21 coeffs
 #define PWM_COEFFS   ((100 / PWM_STEP) + 1)
 
+// Both are just the default (compile time) geometry, the runtime one is mapTempCoeffs x mapPwmCoeffs.
+// It has to fit into the same RAM (MAP_CELLS per fan) and EEPROM (MAP_EE_CELLS, rows with checksum) space.
+#define MAP_CELLS     (TEMP_COEFFS * PWM_COEFFS)
+#define MAP_EE_CELLS  (TEMP_COEFFS * (PWM_COEFFS + 1))
+
+#if TEMP_COEFFS > TEMP_COEFFS_MAX || PWM_COEFFS > PWM_COEFFS_MAX
+#error Default mapping table geometry exceeds TEMP_COEFFS_MAX or PWM_COEFFS_MAX
+#endif
+
+// fan control in auto mode (fanCtrl)
+#define FAN_CTRL_TABLE     0  /**< Mapping table with the weighted average temperature */
+#define FAN_CTRL_MAXCURVE  1  /**< Max. of the mapping table and the per sensor temperature curves */
+
+// mapping table value, row t (temperature), column p (input PWM)
+#define mapCell(fan, t, p)  (mappingTable[(fan)][(t) * mapPwmCoeffs + (p)])
+#define mapRow(fan, t)      (&mapCell((fan), (t), 0))
+
 /* Fans are zero based
    Temp sensors are zero based, 0 is internal temp, first external temp is 1
 */
 
 extern float          tempWeights[FANS][TEMP_SENSORS];            /**< Temperature weights for each fan */
-extern unsigned char mappingTable[FANS][TEMP_COEFFS][PWM_COEFFS]; /**< Fan PWM and temperature mapping tables */
-extern int                  temps[TEMP_SENSORS];                  /**< Measured temperatures*/
+extern unsigned int  tempWeightsQ[FANS][TEMP_SENSORS];            /**< The same weights normalized to Q15 (see @normalizeTempWeights) */
+extern unsigned char mappingTable[FANS][MAP_CELLS];              /**< Fan PWM and temperature mapping tables (see @mapCell) */
+extern unsigned char     tempAxis[TEMP_COEFFS_MAX];               /**< Mapping table temperature breakpoints in C (increasing) */
+extern unsigned char      pwmAxis[PWM_COEFFS_MAX];                /**< Mapping table input PWM breakpoints in % (increasing, 0 .. 100) */
+extern unsigned char   mapTempMin;                               /**< Mapping table geometry - default temp. axis start (C) */
+extern unsigned char   mapTempStep;                              /**< Mapping table geometry - default temp. axis step (C) */
+extern unsigned char   mapTempCoeffs;                            /**< Mapping table geometry - number of rows (temperatures) */
+extern unsigned char   mapPwmStep;                               /**< Mapping table geometry - default PWM axis step (%) */
+extern unsigned char   mapPwmCoeffs;                             /**< Mapping table geometry - number of columns (input PWM) */
+extern int                  temps[TEMP_SENSORS];                  /**< Measured temperatures in 1/TEMP_ONE C */
+extern unsigned char      pwmInSel[FANS];                        /**< PWM input(s) for each fan (see @pwmSelectDuty) */
+extern unsigned char   pwmFallback[FANS];                        /**< Input duty cycle (%) for each fan when its PWM input(s) are lost */
+extern unsigned char       fanCtrl[FANS];                        /**< Fan control in auto mode (FAN_CTRL_*) */
+extern unsigned char     curveTemp[FANS][TEMP_SENSORS][TEMP_CURVE_POINTS]; /**< Per sensor curves - temperatures in C (increasing) */
+extern unsigned char     curveDuty[FANS][TEMP_SENSORS][TEMP_CURVE_POINTS]; /**< Per sensor curves - duty cycle in % */
 
 #endif // __PFCMAIN_H__
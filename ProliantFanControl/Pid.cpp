@@ -0,0 +1,132 @@
+#include <Arduino.h>
+#include "Config.h"
+#include "PwmMeasure.h"
+#include "Pid.h"
+
+#define PID_PERIOD_TICKS  ((unsigned long)PID_PERIOD_MS * (F_CPU / 1000))
+
+#if PID_PERIOD_MS > 1000
+#error PID_PERIOD_MS must be at most 1000
+#endif
+
+#define PID_OUT_MAX       (100L << PID_OUT_FRAC_BITS)
+#define PID_TEMP_INVALID  0x7fff
+
+unsigned char pidSetpoint[FANS];      /**< Target temperature in C */
+float         pidGain[FANS][3];       /**< Kp in %/C, Ki in %/(C*s), Kd in %/(C/s) */
+
+unsigned int  pidGainQ[FANS][3];      /**< Gains in Q8 per update period */
+long          pidInteg[FANS];         /**< Integrator in 1/2^PID_OUT_FRAC_BITS % (0 .. PID_OUT_MAX) */
+int           pidLastTemp[FANS];      /**< Temperature at the last update, PID_TEMP_INVALID after reset */
+unsigned char pidOut[FANS];           /**< PID output at the last update in % */
+unsigned long pidPeriodStart;         /**< Start of the current period (see @pwmTimerTicks) */
+
+
+/** 
+ * Float gain to Q8, saturated
+ * 
+ * @param g gain
+ * 
+ * @return gain in Q8
+ */
+static unsigned int pidGainToQ(float g)
+{
+    if(g <= 0.0)
+        return 0;
+
+    g *= (1 << PID_GAIN_FRAC_BITS);
+    if(g >= 65535.0)
+        return 65535U;
+
+    return (unsigned int)(g + 0.5);
+}
+
+
+void pidSetGains(byte fan)
+{
+    // per period - the integral grows with the period, the derivative shrinks
+    pidGainQ[fan][PID_KP] = pidGainToQ(pidGain[fan][PID_KP]);
+    pidGainQ[fan][PID_KI] = pidGainToQ(pidGain[fan][PID_KI] * (PID_PERIOD_MS / 1000.0));
+    pidGainQ[fan][PID_KD] = pidGainToQ(pidGain[fan][PID_KD] / (PID_PERIOD_MS / 1000.0));
+}
+
+
+void pidBegin(void)
+{
+    for(byte f=0; f<FANS; ++f)
+    {
+        pidInteg[f]    = 0;
+        pidLastTemp[f] = PID_TEMP_INVALID;
+        pidOut[f]      = 0;
+    }
+
+    // the first update right away
+    pidPeriodStart = pwmTimerTicks() - PID_PERIOD_TICKS;
+}
+
+
+int pidTick(void)
+{
+    unsigned long now = pwmTimerTicks();
+
+    unsigned long dt  = (uint32_t)(now - pidPeriodStart);
+
+    if(dt < PID_PERIOD_TICKS)
+        return 1;
+
+    // keep the periods exact (a late loop does not stretch them), start over after a long stall
+    pidPeriodStart = (dt < 2 * PID_PERIOD_TICKS) ? (uint32_t)(pidPeriodStart + PID_PERIOD_TICKS) : now;
+    return 0;
+}
+
+
+int pidControl(byte fan, int tmp, int floor, byte update)
+{
+    if(update)
+    {
+        // positive when too hot, derivative on the measurement (no kick on setpoint change)
+        long e = tmp - pidSetpoint[fan] * TEMP_ONE;
+        long d = (pidLastTemp[fan] == PID_TEMP_INVALID) ? 0 : (tmp - pidLastTemp[fan]);
+        pidLastTemp[fan] = tmp;
+
+        long p  = (long)pidGainQ[fan][PID_KP] * e;
+        long dd = (long)pidGainQ[fan][PID_KD] * d;
+        long di = (long)pidGainQ[fan][PID_KI] * e;
+        long u  = p + pidInteg[fan] + dd;
+
+        // anti-windup - do not integrate further into the saturation (the table output is the low limit)
+        if(!((u >= PID_OUT_MAX && di > 0) || (u <= ((long)floor << PID_OUT_FRAC_BITS) && di < 0)))
+        {
+            pidInteg[fan] += di;
+            if(pidInteg[fan] < 0)
+                pidInteg[fan] = 0;
+            else if(pidInteg[fan] > PID_OUT_MAX)
+                pidInteg[fan] = PID_OUT_MAX;
+        }
+
+        u = p + pidInteg[fan] + dd;
+        if(u < 0)
+            u = 0;
+        else if(u > PID_OUT_MAX)
+            u = PID_OUT_MAX;
+
+        pidOut[fan] = (u + (1L << (PID_OUT_FRAC_BITS - 1))) >> PID_OUT_FRAC_BITS;
+
+#ifdef DEBUG_PID
+        Serial.print(F("PID "));
+        Serial.print(fan);
+        Serial.print(F(": e "));
+        Serial.print(e);
+        Serial.print(F(" P "));
+        Serial.print(p >> PID_OUT_FRAC_BITS);
+        Serial.print(F(" I "));
+        Serial.print(pidInteg[fan] >> PID_OUT_FRAC_BITS);
+        Serial.print(F(" D "));
+        Serial.print(dd >> PID_OUT_FRAC_BITS);
+        Serial.print(F(" out "));
+        Serial.println(pidOut[fan]);
+#endif
+    }
+
+    return (pidOut[fan] > floor) ? pidOut[fan] : floor;
+}
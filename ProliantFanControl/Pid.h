@@ -0,0 +1,68 @@
+#ifndef __PID_H__
+#define __PID_H__
+
+#include "Config.h"
+
+/*******************************************************************************
+ *
+ *  PID temperature control (operating mode 'P')
+ *
+ * Holds the temperature of each fan (the weighted average, see @averageTemp) at its setpoint. The
+ * output of the mapping table (the normal auto mode) is the minimum, the PID can only add to it.
+ * Fixed point - gains are in Q8 per update period, temperatures in 1/TEMP_ONE C, so the output is
+ * in 1/(256*TEMP_ONE) %. The controller runs once per PID_PERIOD_MS (timer1 time base).
+ ******************************************************************************/
+
+#define PID_KP  0   /**< Index of the proportional gain in @pidGain */
+#define PID_KI  1   /**< Index of the integral gain */
+#define PID_KD  2   /**< Index of the derivative gain */
+
+#define PID_GAIN_FRAC_BITS  8
+#define PID_OUT_FRAC_BITS   (PID_GAIN_FRAC_BITS + TEMP_FRAC_BITS)
+
+extern unsigned char pidSetpoint[FANS]; /**< Target temperature in C */
+extern float         pidGain[FANS][3];  /**< Kp in %/C, Ki in %/(C*s), Kd in %/(C/s) (see PID_KP, ...) */
+
+
+/** 
+ * Convert the gains of the fan (pidGain) to the fixed point ones, call after any change
+ * 
+ * @param fan zero based fan index
+ */
+void pidSetGains(byte fan);
+
+
+/** 
+ * Reset the controller state of all the fans (integrators, derivative) and restart the period,
+ * call when entering the PID mode
+ */
+void pidBegin(void);
+
+
+/** 
+ * Check the update period - non blocking
+ * 
+ * @return 0 once per PID_PERIOD_MS (time to call @pidControl with update), 1 otherwise
+ */
+int pidTick(void);
+
+
+/** 
+ * PID control of one fan
+ *
+ * The integrator stops when the output is saturated at 100% or at the mapping table floor and the
+ * error would push it further (anti-windup), it is also limited to 0 .. 100%.
+ * 
+ * @param fan zero based fan index
+ * @param tmp fan temperature in 1/TEMP_ONE C (not clamped to the mapping table axis, a setpoint outside
+ *        of it still works)
+ * @param floor mapping table output in % (minimum output)
+ * @param update non zero to run the controller (once per period, see @pidTick), otherwise just the
+ *        last PID output is combined with the current floor
+ * 
+ * @return output duty cycle in %
+ */
+int pidControl(byte fan, int tmp, int floor, byte update);
+
+
+#endif // __PID_H__
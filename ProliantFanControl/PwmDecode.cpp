@@ -0,0 +1,266 @@
+#include <stdlib.h>
+#include "PwmDecode.h"
+
+
+// The period and the edge phases are kept with PWM_DEC_FRAC_BITS fractional bits. The phases add up
+// the period over the whole snapshot (up to PWM_CAPT_EDGES periods), with a rounded period 0.5 count
+// per period would make up several counts of the pulse width (0.6% at 25kHz). The sum of the periods
+// in inlierMean still fits to 32 bits with PWM_IN_FLATLINE_OVF <= 128.
+#define PWM_DEC_FRAC_BITS  4
+#define PWM_DEC_HALF       (1U << (PWM_DEC_FRAC_BITS - 1))
+
+
+/**
+ * Median of a small array (sorts the array in place)
+ *
+ * @param v values
+ * @param n number of values
+ *
+ * @return median value
+ */
+static uint32_t medianLong(uint32_t *v, byte n)
+{
+    // insertion sort, we have just few values
+    for(byte i=1; i<n; ++i)
+    {
+        uint32_t x = v[i];
+        byte j = i;
+        for(; j>0 && v[j-1]>x; --j)
+            v[j] = v[j-1];
+        v[j] = x;
+    }
+    return v[n/2];
+}
+
+
+/**
+ * Average of values within tolerance from the reference (typically the median)
+ *
+ * @param v values
+ * @param n number of values
+ * @param ref reference value
+ * @param tol max. allowed deviation from the reference
+ * @param inliers output - number of values within the tolerance
+ *
+ * @return average of the values within the tolerance, with PWM_DEC_FRAC_BITS fractional bits
+ */
+static uint32_t inlierMean(const uint32_t *v, byte n, uint32_t ref, uint32_t tol, byte *inliers)
+{
+    uint32_t sum = 0;   // the periods are limited (see PWM_IN_PERIOD_MAX), no overflow
+    byte     cnt = 0;
+
+    for(byte i=0; i<n; ++i)
+    {
+        uint32_t d = (v[i] > ref) ? (v[i] - ref) : (ref - v[i]);
+        if(d <= tol)
+        {
+            sum += v[i];
+            ++cnt;
+        }
+    }
+
+    *inliers = cnt;
+    if(cnt == 0)
+        return ref << PWM_DEC_FRAC_BITS;
+
+    return ((sum << PWM_DEC_FRAC_BITS) + cnt/2) / cnt;
+}
+
+
+/**
+ * Phase of the edges of one type
+ *
+ * Finds the newest "clean" edge (both its neighbours in the group are one period away) and averages
+ * phases of all the edges of the same type which agree with it.
+ *
+ * @param snap capture snapshot
+ * @param phase phases of the complete groups edges (0 .. period-1), with PWM_DEC_FRAC_BITS fractional bits
+ * @param first first slot of the complete groups
+ * @param groups number of complete groups
+ * @param rise edge type (non zero for rising)
+ * @param period PWM period, with PWM_DEC_FRAC_BITS fractional bits
+ * @param tol max. allowed deviation from the clean edge, with PWM_DEC_FRAC_BITS fractional bits
+ * @param agree output - number of edges which agree
+ * @param total output - number of edges of the given type
+ *
+ * @return phase of the edges (0 .. period-1), with PWM_DEC_FRAC_BITS fractional bits
+ */
+static uint32_t edgePhase(const PwmCaptSnapshot *snap, const uint32_t *phase, byte first, byte groups, byte rise,
+                          uint32_t period, uint32_t tol, byte *agree, byte *total)
+{
+    int      ref = -1;
+    uint32_t pc  = period >> PWM_DEC_FRAC_BITS;  // whole counts for the raw timestamps
+    uint32_t tc  = tol    >> PWM_DEC_FRAC_BITS;
+
+    *agree = 0;
+    *total = 0;
+
+    for(int g=groups-1; g>=0 && ref<0; --g)
+    {
+        byte idx = first + g*PWM_CAPT_GROUP;
+        if(!snap->rise[idx] != !rise)
+            continue;
+
+        for(byte i=PWM_CAPT_GROUP-2; i>0; --i)
+        {
+            uint32_t d1 = snap->time[idx + i]     - snap->time[idx + i - 1];
+            uint32_t d2 = snap->time[idx + i + 1] - snap->time[idx + i];
+            uint32_t e1 = (d1 > pc) ? (d1 - pc) : (pc - d1);
+            uint32_t e2 = (d2 > pc) ? (d2 - pc) : (pc - d2);
+            if(e1 <= tc && e2 <= tc)
+            {
+                ref = idx + i - first;
+                break;
+            }
+        }
+    }
+
+    if(ref < 0)
+        return 0;   // no clean edge, *agree is zero
+
+    int32_t  sum  = 0;
+    uint32_t half = period / 2;
+
+    for(byte g=0; g<groups; ++g)
+    {
+        byte idx = first + g*PWM_CAPT_GROUP;
+        if(!snap->rise[idx] != !rise)
+            continue;
+
+        for(byte i=0; i<PWM_CAPT_GROUP; ++i)
+        {
+            // deviation from the reference in range -period/2 .. period/2
+            uint32_t v = phase[idx + i - first] + period + half - phase[ref];
+            while(v >= period)
+                v -= period;
+            int32_t dev = (int32_t)v - (int32_t)half;
+
+            ++(*total);
+            if((uint32_t)labs(dev) <= tol)
+            {
+                sum += dev;
+                ++(*agree);
+            }
+        }
+    }
+
+    int32_t p = (int32_t)phase[ref] + sum / *agree;
+    if(p < 0)
+        p += period;
+    else if((uint32_t)p >= period)
+        p -= period;
+
+    return p;
+}
+
+
+int pwmDecode(const PwmCaptSnapshot *snap, PwmDecodeResult *res)
+{
+    // Skip the group which is just being written (the last one, possibly incomplete), use all the
+    // complete ones. The group types alternate (rising, falling, ...).
+    byte firstSlot = (PWM_CAPT_GROUP - (snap->head & (PWM_CAPT_GROUP - 1))) & (PWM_CAPT_GROUP - 1);
+    byte groups    = (PWM_CAPT_EDGES - firstSlot) / PWM_CAPT_GROUP;
+
+    // Periods - differences of the consecutive edges of the same type. If we miss an edge (e.g. too
+    // short pulse) we get a multiple of the period, the outlier rejection takes care of it.
+    uint32_t periods[PWM_CAPT_GROUPS * (PWM_CAPT_GROUP - 1)];
+    byte     nPeriods = 0;
+
+    for(byte g=0; g<groups; ++g)
+    {
+        byte idx = firstSlot + g*PWM_CAPT_GROUP;
+        for(byte i=1; i<PWM_CAPT_GROUP; ++i)
+            periods[nPeriods++] = snap->time[idx + i] - snap->time[idx + i - 1];
+    }
+
+    uint32_t medPeriod = medianLong(periods, nPeriods);
+
+    res->period      = 0;
+    res->width       = 0;
+    res->periodAgree = 0;
+    res->periods     = nPeriods;
+    res->riseAgree   = res->riseTotal = 0;
+    res->fallAgree   = res->fallTotal = 0;
+
+    // slower than we support (would be a "flatline" anyway), also keeps the math below in 32 bits
+    uint32_t period = 0;
+    if(medPeriod <= PWM_IN_PERIOD_MAX)
+        period = inlierMean(periods, nPeriods, medPeriod, medPeriod / PWM_IN_PERIOD_TOL, &res->periodAgree);
+
+    res->period = (period + PWM_DEC_HALF) >> PWM_DEC_FRAC_BITS;
+    if(res->period == 0)
+        return 1;
+
+    // Refine the period over the distance between the same edges of the groups two apart (the same edge
+    // type). The jitter of the edges is then divided by about 2*PWM_CAPT_GROUP periods instead of one,
+    // the phases below add up the period error over the whole snapshot.
+    uint32_t spanSum = 0;
+    uint32_t spanCnt = 0;
+    uint32_t spanTol = res->period / PWM_IN_EDGE_TOL;
+
+    for(byte g=2; g<groups; ++g)
+    {
+        byte idx = firstSlot + g*PWM_CAPT_GROUP;
+        for(byte i=0; i<PWM_CAPT_GROUP; ++i)
+        {
+            uint32_t d = snap->time[idx + i] - snap->time[idx + i - 2*PWM_CAPT_GROUP];
+            uint32_t n = (d + res->period/2) / res->period;
+            uint32_t e = d - n * res->period;
+            if(n != 0 && (e <= spanTol || -e <= spanTol))
+            {
+                spanSum += d;
+                spanCnt += n;
+            }
+        }
+    }
+
+    if(spanCnt != 0)
+    {
+        period = ((spanSum / spanCnt) << PWM_DEC_FRAC_BITS) + (((spanSum % spanCnt) << PWM_DEC_FRAC_BITS) + spanCnt/2) / spanCnt;
+        res->period = (period + PWM_DEC_HALF) >> PWM_DEC_FRAC_BITS;
+    }
+
+    // Phases of the edges (position within the period) relative to the first edge. When switching the
+    // edge we may have missed some, so the distance may be several periods + 1 pulse, use modulo.
+    uint32_t phase[PWM_CAPT_EDGES];
+    byte     nEdges = groups * PWM_CAPT_GROUP;
+
+    phase[0] = 0;
+    for(byte k=1; k<nEdges; ++k)
+    {
+        uint32_t d = snap->time[firstSlot + k] - snap->time[firstSlot + k - 1];
+        if(d >= (0xffffffffUL >> PWM_DEC_FRAC_BITS))
+            d %= period;    // a long gap, (d << n) % p == ((d % p) << n) % p
+        uint32_t p = phase[k-1] + (d << PWM_DEC_FRAC_BITS) % period;
+        if(p >= period)
+            p -= period;
+        phase[k] = p;
+    }
+
+    uint32_t tol       = period / PWM_IN_EDGE_TOL;
+    uint32_t phaseRise = edgePhase(snap, phase, firstSlot, groups, 1, period, tol, &res->riseAgree, &res->riseTotal);
+    uint32_t phaseFall = edgePhase(snap, phase, firstSlot, groups, 0, period, tol, &res->fallAgree, &res->fallTotal);
+
+    // positive pulse - from rising to falling edge
+    int32_t w = (int32_t)phaseFall - (int32_t)phaseRise;
+    if(w < 0)
+        w += period;
+    res->width = ((uint32_t)w + PWM_DEC_HALF) >> PWM_DEC_FRAC_BITS;
+
+    // Majority of the periods and edges must agree, otherwise it is noise/garbage
+    if( (res->periodAgree <= nPeriods/2)
+        ||
+        (res->riseAgree <= res->riseTotal/2)
+        ||
+        (res->fallAgree <= res->fallTotal/2) )
+        return 1;
+
+    return 0;
+}
+
+
+int pwmDecodeDuty(const PwmDecodeResult *res)
+{
+    // period <= PWM_IN_PERIOD_MAX, width * 1000 fits to 32 bits
+    return (int)((res->width * 1000 + res->period/2) / res->period);
+}
@@ -0,0 +1,95 @@
+#ifndef __PWMDECODE_H__
+#define __PWMDECODE_H__
+
+/*******************************************************************************
+ *
+ *  PWM decoder - edge timestamps to period and pulse width
+ *
+ * Pure computation on a capture snapshot, no timers, pins or globals. It builds for the Arduino as
+ * well as on a Linux host (g++ -c PwmDecode.cpp), so captured or synthetic edge traces can be fed
+ * through exactly the same code. Timestamps are 32 bits and wrap around, hence the fixed width
+ * types - unsigned long is 64 bits on a host.
+ ******************************************************************************/
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <stdint.h>
+typedef uint8_t byte;
+#endif
+
+#include "Config.h"
+
+
+// Edges are captured in groups of PWM_CAPT_GROUP edges of the same type (rising or falling), then the
+// ISR switches to the other edge type. The groups are aligned in the ring buffer, i.e. slots 0..3 is one
+// group, 4..7 another one, etc. We start with rising edges at slot 0 and there is an even number of
+// groups so the even groups are always rising edges and the odd ones falling - no need to store it.
+#define PWM_CAPT_GROUP   4
+#define PWM_CAPT_GROUPS  (PWM_CAPT_EDGES / PWM_CAPT_GROUP)
+
+#define pwmCaptSlotRising(slot)  (!((slot) & PWM_CAPT_GROUP))
+
+// Longest period we decode (timer1 counts), anything slower is a "flatline" - half of the timeout
+// (2 periods). It also keeps width * 1000 in 32 bits.
+#define PWM_IN_PERIOD_MAX  ((uint32_t)PWM_IN_FLATLINE_OVF << 15)
+
+#if PWM_IN_FLATLINE_OVF > 128
+#error PWM_IN_FLATLINE_OVF must be at most 128
+#endif
+
+
+/**
+ * Snapshot of the capture ring buffer (see @pwmCaptureSnapshot)
+ */
+struct PwmCaptSnapshot
+{
+    uint32_t time[PWM_CAPT_EDGES]; /**< Edge timestamps in timer1 counts (0.0625us) extended to 32 bits, oldest first */
+    byte rise[PWM_CAPT_EDGES];  /**< Non zero for rising edge */
+    byte head;                  /**< Number of captured edges (modulo 256) at the snapshot time */
+    byte edges;                 /**< Number of valid edges in the snapshot (the oldest are invalid just after the start) */
+    byte ovf;                   /**< Timer1 overflows since the last edge (saturated at 255) */
+};
+
+
+/**
+ * Decoder output (see @pwmDecode), filled in even for rejected captures
+ */
+struct PwmDecodeResult
+{
+    uint32_t period;     /**< PWM period in timer1 counts, 0 when unknown */
+    uint32_t width;      /**< Positive pulse width in timer1 counts */
+    byte periodAgree;    /**< Number of periods within the tolerance from the median */
+    byte periods;        /**< Number of periods */
+    byte riseAgree;      /**< Number of rising edges which agree on the phase */
+    byte riseTotal;      /**< Number of rising edges */
+    byte fallAgree;      /**< Number of falling edges which agree on the phase */
+    byte fallTotal;      /**< Number of falling edges */
+};
+
+
+/**
+ * Decode a full snapshot (snap->edges == PWM_CAPT_EDGES)
+ *
+ * Median of all the captured periods and phases of all the edges, the outliers are rejected. If
+ * the most of them do not agree the capture is rejected. Flatline (no edges) is up to the caller.
+ *
+ * @param snap capture snapshot
+ * @param res output - period, pulse width and the agreement counts
+ *
+ * @return 0 when accepted, 1 when rejected as noise/garbage
+ */
+int pwmDecode(const PwmCaptSnapshot *snap, PwmDecodeResult *res);
+
+
+/**
+ * Positive duty cycle of an accepted capture
+ *
+ * @param res decoder output (see @pwmDecode)
+ *
+ * @return duty cycle in tenths of percent, rounded
+ */
+int pwmDecodeDuty(const PwmDecodeResult *res);
+
+
+#endif // __PWMDECODE_H__
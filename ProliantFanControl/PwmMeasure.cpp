@@ -3,84 +3,371 @@
 #include "DataProcessing.h"
 #include "PwmMeasure.h"
 
-float pwmExpFilterVal     = PWM_EXPFILT_INIT;
-float pwmExpFilterWeight  = PWM_EXPFILT_WEIGHT;
+long  pwmExpFilterVal[PWM_INPUTS];
+float pwmExpFilterTc = PWM_EXPFILT_TC;
+unsigned long pwmExpFilterTcQ = (unsigned long)(PWM_EXPFILT_TC * FILT_TIME_PER_S + 0.5);
+unsigned long pwmFilterTime[PWM_INPUTS];
+long  pwmAdaptFilterDev[PWM_INPUTS];
+float pwmAdaptFilterGain  = PWM_ADAPTFILT_GAIN;
+unsigned int pwmAdaptFilterGainQ = (unsigned int)(PWM_ADAPTFILT_GAIN * EXPFILT_WEIGHT_ONE + 0.5);
+
+#ifdef DEBUG_ISR_TIMING
+// A5 is high while we are in the ISR
+#define ISR_TIMING_BEGIN()  (PORTC |=  bit (PORTC5))
+#define ISR_TIMING_END()    (PORTC &= ~bit (PORTC5))
+#else
+#define ISR_TIMING_BEGIN()
+#define ISR_TIMING_END()
+#endif
+
+#if PWM_INPUTS < 1 || PWM_INPUTS > 4
+#error PWM_INPUTS must be 1 .. 4
+#endif
+
+// Input pins, PWM1 uses timer1 input capture, the others are on port D (PDn is Dn) using pin change interrupts
+const byte pwmInPins[4] = { 8, 4, 6, 7 };
+
+// Input loss timeout in timer1 overflows (4096us), rounded up. The overflow counter saturates at 255.
+#define PWM_IN_LOSS_OVF  ((PWM_IN_LOSS_MS * 1000L + 4095) / 4096)
 
-volatile byte tmr1State = 0;    /**< Internal measurement phase/state. Starts at 0, at 5 is complete.*/
-volatile word tmr1Value[4];     /**< Internal counts - see the @ISR(TIMER1_CAPT_vect) */
+#if PWM_IN_LOSS_MS > 1000
+#error PWM_IN_LOSS_MS must be at most 1000
+#endif
+
+// A disconnected input must first look like a flat line, otherwise a slow input (period not known yet)
+// would be lost before its flat line is recognized
+#if PWM_IN_LOSS_OVF <= PWM_IN_FLATLINE_OVF
+#error PWM_IN_LOSS_MS must be longer than the flatline timeout (PWM_IN_FLATLINE_OVF * 4.1ms)
+#endif
+
+#if PWM_INPUTS > 1
+#define PWM_PCINT_MASK  ( bit (4) | (PWM_INPUTS > 2 ? bit (6) : 0) | (PWM_INPUTS > 3 ? bit (7) : 0) )
+#endif
+
+volatile word pwmTimerHigh;                            /**< Timer1 overflows - upper 16 bits of the timestamps */
+volatile unsigned long pwmCaptTime[PWM_INPUTS][PWM_CAPT_EDGES]; /**< Edge timestamps (timer1 counts extended to 32 bits), ring buffer for each input */
+volatile byte pwmCaptHead[PWM_INPUTS];                 /**< Number of captured edges (modulo 256), next slot is pwmCaptHead % PWM_CAPT_EDGES */
+volatile byte pwmCaptFull[PWM_INPUTS];                 /**< Non zero once the whole ring buffer has been written */
+volatile byte pwmCaptOvf[PWM_INPUTS];                  /**< Timer1 overflows since the last captured edge (saturated at 255) */
+#if PWM_INPUTS > 1
+volatile byte pwmPcintLast;                            /**< Port D state seen by the last pin change interrupt */
+#endif
+
+byte pwmLastHead[PWM_INPUTS];                          /**< pwmCaptHead seen by the last pwmMeasureUpdate */
+
+byte pwmPolMode[PWM_INPUTS];                           /**< Configured polarity (PWM_POL_POS, PWM_POL_NEG or PWM_POL_AUTO) */
+byte pwmPolarity[PWM_INPUTS];                          /**< Current polarity (PWM_POL_POS or PWM_POL_NEG), detected for PWM_POL_AUTO */
+long pwmPosDutyAvg[PWM_INPUTS];                        /**< Long term average of the positive duty cycle (1/65536 of tenths of percent) for polarity detection */
+unsigned long pwmPeriodTicks[PWM_INPUTS];              /**< Last decoded period in timer1 counts, 0 for "flatline" */
+
+unsigned long pwmStatAccepted[PWM_INPUTS];             /**< Number of decoded captures */
+unsigned long pwmStatRejected[PWM_INPUTS];             /**< Number of rejected captures */
+unsigned long pwmStatFlatline[PWM_INPUTS];             /**< Number of "flatline" captures */
+unsigned long pwmStatLost[PWM_INPUTS];                 /**< Number of input losses */
+
+byte pwmInLost[PWM_INPUTS];                            /**< Non zero while the input is lost (no edge for PWM_IN_LOSS_MS) */
 
 
 #ifndef DUTY_CYCLE_ONLY
-float pwmPeriod    = 0.0f;      /**< Output - PWM period in us */
-float pwmFrequency = 0.0f;      /**< Output - PWM frequency in kHz */
-float pwmPWidth    = 0.0f;      /**< Output - pusitive pulse width in us */
+float pwmPeriod[PWM_INPUTS];    /**< Output - PWM period in us */
+float pwmFrequency[PWM_INPUTS]; /**< Output - PWM frequency in kHz */
+float pwmPWidth[PWM_INPUTS];    /**< Output - pusitive pulse width in us */
+#endif
+int   pwmDuty[PWM_INPUTS];      /**< Ouptut - PWM duty cycle in tenths of percent */
+
+
+void pwmSetFilterTc(float tc)
+{
+    pwmExpFilterTc  = tc;
+    pwmExpFilterTcQ = ExpFilterTc(tc);
+}
+
+
+void pwmSetFilterGain(float gain)
+{
+    pwmAdaptFilterGain  = gain;
+    pwmAdaptFilterGainQ = ExpFilterWeight(gain);
+}
+
+
+void pwmSetPolarityMode(byte in, byte mode)
+{
+    pwmPolMode[in] = mode;
+
+    if(mode == PWM_POL_AUTO)
+    {
+        // start from the default, no evidence yet
+        pwmPosDutyAvg[in] = 500L << 16;
+#ifdef PWM_NEG_MEASURE
+        pwmPolarity[in] = PWM_POL_NEG;
+#else
+        pwmPolarity[in] = PWM_POL_POS;
 #endif
-float pwmDuty      = 0.0f;      /**< Ouptut - PWM duty cycle */
+    }
+    else
+        pwmPolarity[in] = mode;
+}
+
+
+unsigned long pwmInFrequency(byte in)
+{
+    unsigned long p = pwmPeriodTicks[in];
+
+    if(p == 0)
+        return 0;
+
+    return (F_CPU + p/2) / p;
+}
 
 
 void pwmMeasureBegin (void)
 {
-    TCCR1A    = 0;                         // normal operation mode
-    TCCR1B    = 0;                         // stop timer clock (no clock source)
-    TCNT1     = 0;                         // clear counter
-    TIFR1     = bit (ICF1)  | bit (TOV1);  // clear flags
-    tmr1State = 0;                         // clear tmr1State
-    TIMSK1    = bit (ICIE1) | bit (TOIE1); // interrupt on input capture for measurement and overflow to handle "flatline" of 0% and 100%
-    TCCR1B    = bit (CS10)  | bit (ICES1); // start clock with no prescaler, rising edge on pin D8
+    TIMSK1      = 0;                         // no timer1 interrupts while we are setting it up
+#ifdef DEBUG_ISR_TIMING
+    DDRC       |= bit (DDC5);
+#endif
+    TCCR1A      = 0;                         // normal operation mode
+    TCCR1B      = 0;                         // stop timer clock (no clock source)
+    TCNT1       = 0;                         // clear counter
+    pwmTimerHigh = 0;
+    for(byte in=0; in<PWM_INPUTS; ++in)
+    {
+        pwmCaptHead[in] = 0;
+        pwmCaptFull[in] = 0;
+        pwmCaptOvf[in]  = 0;
+        pwmLastHead[in] = 0;
+        pwmPeriodTicks[in]  = 0;
+        pwmExpFilterVal[in] = (long)PWM_EXPFILT_INIT << EXPFILT_FRAC_BITS;
+        pwmAdaptFilterDev[in] = 0;
+        pwmDuty[in] = PWM_EXPFILT_INIT;
+        pwmSetPolarityMode(in, PWM_POL_AUTO);
+    }
+    TIFR1       = bit (ICF1)  | bit (TOV1);  // clear flags
+    TIMSK1      = bit (ICIE1) | bit (TOIE1); // interrupt on input capture for measurement and overflow to handle "flatline" of 0% and 100%
+    TCCR1B      = bit (CS10)  | bit (ICES1); // start clock with no prescaler, rising edge on pin D8
+
+#if PWM_INPUTS > 1
+    // the other inputs - any change on the port D pins, timestamp is taken from timer1
+    pwmPcintLast = PIND;
+    PCMSK2      |= PWM_PCINT_MASK;
+    PCIFR        = bit (PCIF2);
+    PCICR       |= bit (PCIE2);
+#endif
+}
+
+
+/**
+ * Extend timer1 value to 32 bits
+ *
+ * Call from the ISRs only (interrupts disabled). If timer1 has overflown but the overflow ISR has not
+ * been called yet (TOV1 still set) and the value is "small" it has been captured after the overflow.
+ *
+ * @param low timer1 value (TCNT1 or ICR1)
+ *
+ * @return 32 bit timestamp
+ */
+static inline unsigned long pwmTimestamp(word low)
+{
+    word high = pwmTimerHigh;
+
+    if((TIFR1 & bit (TOV1)) && low < 0x8000)
+        ++high;
+
+    return ((unsigned long)high << 16) | low;
+}
+
+
+unsigned long pwmTimerTicks(void)
+{
+    byte oldSREG = SREG;
+    cli();
+
+    unsigned long now = pwmTimestamp(TCNT1);
+
+    SREG = oldSREG;
+    return now;
+}
+
+
+unsigned int timerFilterWeight(unsigned long tc, unsigned long *last)
+{
+    // the timestamps wrap around at 32 bits (unsigned long is wider in the host tests)
+    unsigned long now = pwmTimerTicks();
+    unsigned long dt  = (uint32_t)(now - *last) >> FILT_TIME_SHIFT;
+    unsigned int  w   = ExpFilterWeightDt(tc, dt);
+
+    // FILT_DT_MAX gives at least 1/16 for EXPFILT_TC_MAX, so a sample gets through eventually
+    if(w < EXPFILT_WEIGHT_MIN && dt < FILT_DT_MAX)
+        return 0;
+
+    // keep the part of a time unit cut off above, no drift with a fast loop
+    *last = (dt < FILT_DT_MAX) ? (uint32_t)(*last + (dt << FILT_TIME_SHIFT)) : now;
+    return w;
 }
 
 
 ISR (TIMER1_CAPT_vect)
 {
-    switch (tmr1State) {
-
-    case 0:                          // first rising edge
-        tmr1Value[0] = ICR1;
-        tmr1State = 1;
-        break;
-
-    case 1:                          // second rising edge
-        tmr1Value[1] = ICR1;
-        TIFR1       |=  bit (ICF1);  // after edge change the we should clear the Input Capture Flag
-        TCCR1B      &= ~bit (ICES1); // capture on falling edge (pin D8)
-        tmr1State    = 2;
-        break;
-
-    case 2:                          // first falling edge
-        tmr1State = 3;
-        break;
-
-    case 3:                          // second falling edge
-        tmr1Value[2] = ICR1;
-        tmr1State    = 4;
-        break;
-
-    case 4:                          // third falling edge
-        tmr1Value[3] = ICR1;
-        tmr1State    = 5;            // all tests done
-        TIMSK1       = 0;            // stop timer1 interrupts
-        break;
-
-    default:
-        break;
+    ISR_TIMING_BEGIN();
+
+    byte slot = pwmCaptHead[0] & (PWM_CAPT_EDGES - 1);
+
+    pwmCaptTime[0][slot] = pwmTimestamp(ICR1);
+
+    if((slot & (PWM_CAPT_GROUP - 1)) == (PWM_CAPT_GROUP - 1))
+    {
+        // end of the group - switch to the other edge
+        TCCR1B ^= bit (ICES1);
+        TIFR1   = bit (ICF1);        // after edge change the we should clear the Input Capture Flag
+
+        if(slot == (PWM_CAPT_EDGES - 1))
+            pwmCaptFull[0] = 1;
+    }
+
+    ++pwmCaptHead[0];
+    pwmCaptOvf[0] = 0;
+
+    ISR_TIMING_END();
+}
+
+
+#if PWM_INPUTS > 1
+ISR (PCINT2_vect)
+{
+    word low = TCNT1;              // as soon as possible
+
+    ISR_TIMING_BEGIN();
+
+    unsigned long now = pwmTimestamp(low);
+
+    byte pins    = PIND;
+    byte changed = (pins ^ pwmPcintLast) & PCMSK2;
+    pwmPcintLast = pins;
+
+    for(byte in=1; in<PWM_INPUTS; ++in)
+    {
+        byte mask = bit (pwmInPins[in]);
+        if(!(changed & mask))
+            continue;
+
+        // the same ring buffer layout as for the input capture - take just the edges of the type
+        // the current group is waiting for
+        byte slot = pwmCaptHead[in] & (PWM_CAPT_EDGES - 1);
+        if(!(pins & mask) != !pwmCaptSlotRising(slot))
+            continue;
+
+        pwmCaptTime[in][slot] = now;
+        if(slot == (PWM_CAPT_EDGES - 1))
+        {
+            // ring buffer complete - no more interrupts from this input until the loop takes it
+            // (see @pwmPcintRearm), i.e. a bounded load whatever the input frequency is
+            pwmCaptFull[in] = 1;
+            PCMSK2 &= ~mask;
+        }
+
+        ++pwmCaptHead[in];
+        pwmCaptOvf[in] = 0;
     }
+
+    ISR_TIMING_END();
 }
+#endif
 
 
-/** 
+ISR (TIMER1_OVF_vect)
+{
+    ISR_TIMING_BEGIN();
+
+    ++pwmTimerHigh;
+
+    // Just count the overflows, "flatline" is detected in pwmMeasureUpdate. Not for PWM2 .. PWM4
+    // waiting with a complete ring buffer for the loop, they are not listening.
+    for(byte in=0; in<PWM_INPUTS; ++in)
+        if(pwmCaptOvf[in] != 0xff && (in == 0 || !pwmCaptFull[in]))
+            ++pwmCaptOvf[in];
+
+    ISR_TIMING_END();
+}
+
+
+void pwmCaptureSnapshot(byte in, PwmCaptSnapshot *snap)
+{
+    unsigned long raw[PWM_CAPT_EDGES];
+    byte head, full;
+
+    // plain copy with interrupts disabled (keep it short), unroll it later
+    byte oldSREG = SREG;
+    cli();
+
+    memcpy(raw, (const void*)pwmCaptTime[in], sizeof(raw));
+    head      = pwmCaptHead[in];
+    full      = pwmCaptFull[in];
+    snap->ovf = pwmCaptOvf[in];
+
+    SREG = oldSREG;
+
+    // unroll the ring buffer, oldest edge first
+    byte slot = head & (PWM_CAPT_EDGES - 1);
+    for(byte i=0; i<PWM_CAPT_EDGES; ++i)
+    {
+        snap->time[i] = raw[slot];
+        snap->rise[i] = pwmCaptSlotRising(slot);
+        slot = (slot + 1) & (PWM_CAPT_EDGES - 1);
+    }
+
+    snap->head  = head;
+    snap->edges = full ? PWM_CAPT_EDGES : (head & (PWM_CAPT_EDGES - 1));
+}
+
+
+#if PWM_INPUTS > 1
+/**
+ * Start the next burst of PWM2 .. PWM4 edges
+ *
+ * The pin change ISR stops listening to an input once its ring buffer is complete. The snapshot has
+ * been taken, so forget the old edges (the next decode waits for a complete new burst) and enable
+ * the pin again.
+ *
+ * @param in zero based PWM input index, 1 .. PWM_INPUTS - 1
+ */
+static void pwmPcintRearm(byte in)
+{
+    byte mask = bit (pwmInPins[in]);
+
+    byte oldSREG = SREG;
+    cli();
+
+    pwmCaptFull[in] = 0;
+    pwmCaptOvf[in]  = 0;
+    pwmPcintLast    = (pwmPcintLast & ~mask) | (PIND & mask);
+    PCMSK2         |= mask;
+
+    SREG = oldSREG;
+}
+#endif
+
+
+/**
  * Simple average pin sampler for PWM input
- * 
+ *
+ * Called from the main loop only. Reading the port directly, digitalRead is way too slow.
+ *
+ * @param in zero based PWM input index
+ *
  * @return  average pin value
  */
-int ResamplePwmPin(void)
+int ResamplePwmPin(byte in)
 {
+    volatile byte *port = in ? &PIND : &PINB;    // D8 is PB0, the others PDn
+    byte           mask = in ? bit (pwmInPins[in]) : bit (PINB0);
+
     unsigned int sum = 0;
     for(int i=0; i<PWM_IN_RESAMPLE; ++i)
     {
-        if(digitalRead(8))
+        if(*port & mask)
             ++sum;
         __builtin_avr_delay_cycles(1);
-    }   
+    }
 
     if(sum < (PWM_IN_RESAMPLE/2))
         return 0;
@@ -89,166 +376,250 @@ int ResamplePwmPin(void)
 }
 
 
-ISR (TIMER1_OVF_vect)
+/**
+ * Positive duty cycle to the input duty cycle, detects polarity for PWM_POL_AUTO
+ *
+ * The heuristic for the detection is that the fans run slower than 50% most of the time, i.e. the
+ * active level is the one the signal spends less time in (on a long term average).
+ *
+ * @param in zero based PWM input index
+ * @param posDuty positive duty cycle (tenths of percent)
+ *
+ * @return duty cycle (tenths of percent) with the input polarity
+ */
+int polarityDuty(byte in, int posDuty)
 {
-    // Just check the pin and mark measurement as completed. Using "magic combinations" to indicate that..
-    if(ResamplePwmPin()) {
-        tmr1Value[0] = 100;
-        tmr1Value[1] = 100;
-        tmr1Value[2] = 100;
-        tmr1Value[3] = 100;
-    } else {
-        tmr1Value[0] = 0;
-        tmr1Value[1] = 0;
-        tmr1Value[2] = 0;
-        tmr1Value[3] = 0;
+    if(pwmPolMode[in] == PWM_POL_AUTO)
+    {
+        // very slow, ExpFilterInt does not have enough fractional bits for this
+        pwmPosDutyAvg[in] += (((long)posDuty << 16) - pwmPosDutyAvg[in]) >> PWM_POL_AUTO_SHIFT;
+        int avg = pwmPosDutyAvg[in] >> 16;
+
+        // with some hysteresis
+        if(avg > 500 + PWM_POL_AUTO_HYST)
+            pwmPolarity[in] = PWM_POL_NEG;
+        else if(avg < 500 - PWM_POL_AUTO_HYST)
+            pwmPolarity[in] = PWM_POL_POS;
     }
-    
-    tmr1State = 5;                 // all tests done
-    TIMSK1    = 0;                 // stop the ints
+
+    if(pwmPolarity[in] == PWM_POL_NEG)
+        return 1000 - posDuty;
+
+    return posDuty;
 }
 
 
-int pwmMeasureComplete (void)
+/**
+ * Decode the captured edges of one input (see @pwmMeasureUpdate)
+ *
+ * @param in zero based PWM input index
+ *
+ * @return 0 when new value is available
+ */
+int pwmMeasureInput (byte in)
 {
-    if(tmr1State != 5)
-        return 1;
+    PwmCaptSnapshot snap;
+    int             duty;
 
-    // timer1 ints (TIMSK1) should be already disabled after the measurement
-    // is complete and other ints should not bother us.
+    pwmCaptureSnapshot(in, &snap);
 
-#ifdef DEBUG_PWM_IN
-    for(int i=0; i<4; ++i) {
-        Serial.print(i);
-        Serial.print(":\t");
-        Serial.println(tmr1Value[i]);
-    }
+#if PWM_INPUTS > 1
+    if(in != 0 && snap.edges == PWM_CAPT_EDGES)
+        pwmPcintRearm(in);
 #endif
 
-    // no pulses - 0% or 100%
-    if( tmr1Value[0]==tmr1Value[1] && tmr1Value[1]==tmr1Value[2] && tmr1Value[2]==tmr1Value[3])
+    // No edge for about 2 periods (auto ranging based on the last period) - 0% or 100%. The first
+    // overflow may come right after the edge so we need at least two of them. If we do not know the
+    // period yet wait for the slowest PWM we support.
+    byte flatOvf = PWM_IN_FLATLINE_OVF;
+    if(pwmPeriodTicks[in] != 0 && (pwmPeriodTicks[in] >> 15) + 2 < PWM_IN_FLATLINE_OVF)
+        flatOvf = (pwmPeriodTicks[in] >> 15) + 2;
+
+    if(snap.ovf >= flatOvf)
     {
-#ifdef PWM_NEG_MEASURE
-        if(tmr1Value[0] == 0)
-            pwmDuty = 100.0f;
-        else
-            pwmDuty = 0.0f;
-#else
-        if(tmr1Value[0] == 0)
-            pwmDuty = 100.0f;
-        else
-            pwmDuty = 0.0f;
+        byte level = ResamplePwmPin(in);
+
+        // Flat at the pull-up (high) level for PWM_IN_LOSS_MS - the input is disconnected. Keep the
+        // filtered value as it is (do not let it drift to 0% or 100%), the fans get the fallback duty,
+        // never less than 100% with positive polarity (see @pwmSelectDuty). A flat low level is
+        // driven, i.e. a real 0% or 100% however long it lasts.
+        if(level && snap.ovf >= PWM_IN_LOSS_OVF)
+        {
+            if(pwmInLost[in])
+                return 1;
+
+#ifdef DEBUG_PWM_IN
+            Serial.println(F("Lost"));
 #endif
+            pwmInLost[in]      = 1;
+            pwmPeriodTicks[in] = 0;
+            ++pwmStatLost[in];
 
 #ifndef DUTY_CYCLE_ONLY
-        pwmPeriod    = 0.0f;
-        pwmPWidth    = 0.0f;
-        pwmFrequency = 0.0f;
+            pwmPeriod[in]    = 0.0f;
+            pwmPWidth[in]    = 0.0f;
+            pwmFrequency[in] = 0.0f;
 #endif
-    }
-    else
-    {
-        // Period = 3rd neg edge - 2nd neg edge. The same result should be also tmr1Value[1] - tmr1Value[0]
-        // i.e. 2nd pos - 1st pos
-        word periodValue = tmr1Value[3] - tmr1Value[2]; 
-
-        // TODO - add some filtering.
-        // there are some issues with very short negative pulses - sometimes we catch them, sometimes not
-        // This helps but not too much... still some work to do
-        word periodValue1 = tmr1Value[1] - tmr1Value[0];
-
-        // (3rd neg - 2nd pos) should be 1 period + 1 pos pulse (usually is 2 or 3, why?)
-        word widthValue  = tmr1Value[3] - tmr1Value[1];
-
-        // BUT we may have missed something and have several periods + 1 pos pulse, so use modulo
-        //word pwmWidth = widthValue - 2*periodValue;
-        word pwmWidth = widthValue % periodValue;
-        unsigned pers = widthValue / periodValue;
-
-        // Some heuristic filtering
-        //   - check for reasonable deviation in period
-        //   - and that we have also captured the pulse noy too behind (max 3 periods)
-        // If either check fails it means there are just too short pulses/noise??
-        // add long time period average check!!!!
-        int diff = (int)((long)periodValue - (long)periodValue1);
-        if ( (abs(diff) < 50)
-             &&
-             (0<=pwmWidth && pwmWidth<=periodValue)
-             &&
-             (pers < 4) )
-        {        
-#ifdef DEBUG_PWM_IN
-            Serial.print("widthValue ");
-            Serial.print(widthValue);
-            Serial.print(", pers ");
-            Serial.println(pers);
+            return 1;
+        }
 
-            Serial.print("pwmWidth ");
-            Serial.print(pwmWidth);
-            Serial.print("   periodVal ");
-            Serial.println(periodValue);
+#ifdef DEBUG_PWM_IN
+        Serial.println(F("Flatline"));
 #endif
+        duty = polarityDuty(in, level ? 1000 : 0);
+        pwmPeriodTicks[in] = 0;
+        ++pwmStatFlatline[in];
 
 #ifndef DUTY_CYCLE_ONLY
-            pwmPeriod    = periodValue * 0.0625;
-            pwmPWidth    = pwmWidth * 0.0625;
-            pwmFrequency = 1000 / pwmPeriod;
+        pwmPeriod[in]    = 0.0f;
+        pwmPWidth[in]    = 0.0f;
+        pwmFrequency[in] = 0.0f;
 #endif
+    }
+    else
+    {
+        // nothing new since the last time, keep the old value
+        if(snap.head == pwmLastHead[in])
+            return 1;
 
-#ifdef PWM_NEG_MEASURE
-            pwmDuty = (periodValue - pwmWidth) * 100.0 / periodValue;
-#else
-            pwmDuty = pwmWidth * 100.0 / periodValue;
-#endif
+        if(snap.edges < PWM_CAPT_EDGES)
+            return 1;                     // not enough data yet (just after the start)
+
+        pwmLastHead[in] = snap.head;
+
+#ifdef DEBUG_PWM_IN
+        for(int i=0; i<PWM_CAPT_EDGES; ++i) {
+            Serial.print(i);
+            Serial.print(snap.rise[i] ? F(":\tR ") : F(":\tF "));
+            Serial.println(snap.time[i]);
         }
-        else
+#endif
+
+        PwmDecodeResult res;
+
+        // Majority of the periods and edges must agree, otherwise it is noise/garbage
+        if(pwmDecode(&snap, &res))
         {
-            // typically impuls too short impuls
 #ifdef DEBUG_PWM_IN
-            Serial.println("Some garbage...");
-            Serial.print("Period diff ");
-            Serial.print(diff);
-            Serial.print(", widthValue ");
-            Serial.print(widthValue);
-            Serial.print(", pers ");
-            Serial.println(pers);
-            Serial.print(", pwmWidth ");
-            Serial.println(pwmWidth);
+            Serial.println(F("Some garbage..."));
+            Serial.print(F("Period "));
+            Serial.print(res.period);
+            Serial.print(F(", agree "));
+            Serial.print(res.periodAgree);
+            Serial.print('/');
+            Serial.print(res.periods);
+            Serial.print(F(", width "));
+            Serial.print(res.width);
+            Serial.print(F(", rise agree "));
+            Serial.print(res.riseAgree);
+            Serial.print('/');
+            Serial.print(res.riseTotal);
+            Serial.print(F(", fall agree "));
+            Serial.print(res.fallAgree);
+            Serial.print('/');
+            Serial.println(res.fallTotal);
 #endif
+            // hold the last good value
+            ++pwmStatRejected[in];
+            return 1;
+        }
 
-#ifdef PWM_NEG_MEASURE
-            if(ResamplePwmPin())
-#else
-                if(!ResamplePwmPin())
+#ifdef DEBUG_PWM_IN
+        Serial.print(F("pwmWidth "));
+        Serial.print(res.width);
+        Serial.print(F("   periodVal "));
+        Serial.println(res.period);
 #endif
-                    pwmDuty = 0.0;
-                else
-                    pwmDuty = 100.0;
 
 #ifndef DUTY_CYCLE_ONLY
-            pwmPeriod    = 0.0f;
-            pwmPWidth    = 0.0f;
-            pwmFrequency = 0.0f;
+        pwmPeriod[in]    = res.period * 0.0625;
+        pwmPWidth[in]    = res.width * 0.0625;
+        pwmFrequency[in] = 1000 / pwmPeriod[in];
 #endif
-        }
+
+        duty = polarityDuty(in, pwmDecodeDuty(&res));
+
+        pwmPeriodTicks[in] = res.period;
+        ++pwmStatAccepted[in];
     }
 
+    // recovered (edges again or driven low) - start from the current value, not from the one before the loss
+    if(pwmInLost[in])
+    {
+        pwmInLost[in] = 0;
+        pwmExpFilterVal[in] = (long)duty << EXPFILT_FRAC_BITS;
+        pwmAdaptFilterDev[in] = 0;
+    }
 #ifdef DEBUG_PWM_IN
-    Serial.print("Duty cycle: ");
-    Serial.println(pwmDuty);
+    Serial.print(F("Input "));
+    Serial.print(in + 1);
+    Serial.print(F(" duty cycle: "));
+    Serial.println(duty);
 #ifndef DUTY_CYCLE_ONLY
-    Serial.print("Period ");
-    Serial.print(pwmPeriod);
-    Serial.print("us, pulse width ");
-    Serial.print(pwmPWidth);
-    Serial.print("us, frquency ");
-    Serial.print(pwmFrequency);
-    Serial.println("kHz");
+    Serial.print(F("Period "));
+    Serial.print(pwmPeriod[in]);
+    Serial.print(F("us, pulse width "));
+    Serial.print(pwmPWidth[in]);
+    Serial.print(F("us, frquency "));
+    Serial.print(pwmFrequency[in]);
+    Serial.println(F("kHz"));
 #endif
 #endif
 
 
-    pwmDuty = ExpFilter(&pwmExpFilterVal, pwmExpFilterWeight, pwmDuty);
+    unsigned int weight = timerFilterWeight(pwmExpFilterTcQ, &pwmFilterTime[in]);
+    if(weight)
+        pwmDuty[in] = AdaptFilterInt(&pwmExpFilterVal[in], &pwmAdaptFilterDev[in], weight, pwmAdaptFilterGainQ, duty);
 
     return 0;
 }
+
+
+int pwmMeasureUpdate (void)
+{
+    int rc = 1;
+
+    for(byte in=0; in<PWM_INPUTS; ++in)
+        if(pwmMeasureInput(in) == 0)
+            rc = 0;
+
+    return rc;
+}
+
+
+int pwmSelectDuty(byte sel, int fallback)
+{
+    long sum = 0;
+    byte cnt = 0;
+    int  max = 0;
+
+    for(byte in=0; in<PWM_INPUTS; ++in)
+    {
+        if(!(sel & bit (in)))
+            continue;
+
+        int d = pwmDuty[in];
+        if(pwmInLost[in])
+        {
+            // Lost at the pull-up level. With positive polarity that level is 100% and a disconnected
+            // input cannot be told from a real 100% demand, so never less. With negative polarity it
+            // is 0%, the input is skipped (the fallback when all are lost).
+            if(pwmPolarity[in] != PWM_POL_POS)
+                continue;
+            d = 1000;
+        }
+
+        sum += d;
+        ++cnt;
+        if(d > max)
+            max = d;
+    }
+
+    if(cnt == 0)
+        return fallback;     // all lost (empty selection is checked when set/loaded)
+
+    if(sel & PWM_IN_SEL_AVG)
+        return (int)((sum + cnt/2) / cnt);
+
+    return max;
+}
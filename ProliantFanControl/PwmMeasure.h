@@ -2,6 +2,7 @@
 #define __PWMMEASURE_H__
 
 #include "Config.h"
+#include "PwmDecode.h"
 
 
 /*******************************************************************************
@@ -10,8 +11,29 @@
  *
  ******************************************************************************/
 
-extern float pwmExpFilterVal;     /**< Current filter value. */
-extern float pwmExpFilterWeight;  /**< Weight for the exponential filter, Let's make it "slower".  */
+extern long  pwmExpFilterVal[PWM_INPUTS]; /**< Current filter value for each input (see @ExpFilterInt). */
+extern float pwmExpFilterTc;      /**< Time constant of the exponential filter in s */
+extern unsigned long pwmExpFilterTcQ; /**< The same in filter time units, set by @pwmSetFilterTc */
+extern unsigned long pwmFilterTime[PWM_INPUTS]; /**< Time of the last filtered sample (see @timerFilterWeight) */
+extern long  pwmAdaptFilterDev[PWM_INPUTS]; /**< Filtered deviation for each input (see @AdaptFilterInt) */
+extern float pwmAdaptFilterGain;  /**< Relative weight increase per 1% of the deviation, 0 - plain exp. filter */
+extern unsigned int pwmAdaptFilterGainQ; /**< The same gain in Q15, set by @pwmSetFilterGain */
+
+
+/** 
+ * Set the PWM exponential filter time constant
+ * 
+ * @param tc time constant in s (0.0 .. EXPFILT_TC_MAX), 0.0 for no filtering
+ */
+void pwmSetFilterTc(float tc);
+
+
+/** 
+ * Set the PWM adaptive filter gain - relative weight increase per 1% of the deviation (see @AdaptFilterInt)
+ * 
+ * @param gain filter gain (0.0 .. 1.0), 0.0 for the plain exponential filter
+ */
+void pwmSetFilterGain(float gain);
 
 
 /*******************************************************************************
@@ -22,57 +44,192 @@ extern float pwmExpFilterWeight;  /**< Weight for the exponential filter, Let's
  * plus some refactoring/modifications...
  * Another, more generic solution is in http://forum.arduino.cc/index.php?topic=413133.msg2844242#msg2844242
  *
- * So far seems to be OK, but there are some ugly "heuristic" filters just based on my system.
- * This should be more robust and generic (see pwmMeasureComplete) ...
+ * Edges are captured continuously, pwmMeasureUpdate uses median of all captured periods and phases
+ * of all the edges, the outliers are rejected. If the most of them do not agree the capture is
+ * rejected and the last good value is kept.
+ *
+ * There are up to 4 inputs (PWM_INPUTS). PWM1 on D8 uses timer1 input capture, PWM2 .. PWM4 on
+ * D4, D6, D7 use pin change interrupt and read timer1 in the ISR (a bit more jitter, the outlier
+ * rejection takes care of it). All the outputs below are arrays indexed by the input.
  ******************************************************************************/
 
+extern const byte pwmInPins[4]; /**< Arduino pin for each input */
 
 #ifndef DUTY_CYCLE_ONLY
-extern float pwmPeriod;    /**< Output - PWM period in us */
-extern float pwmFrequency; /**< Output - PWM frequency in kHz */
-extern float pwmPWidth;    /**< Output - pusitive pulse width in us */
+extern float pwmPeriod[PWM_INPUTS];    /**< Output - PWM period in us */
+extern float pwmFrequency[PWM_INPUTS]; /**< Output - PWM frequency in kHz */
+extern float pwmPWidth[PWM_INPUTS];    /**< Output - pusitive pulse width in us */
 #endif
-extern float pwmDuty;      /**< Ouptut - PWM duty cycle */
+extern int   pwmDuty[PWM_INPUTS];      /**< Ouptut - PWM duty cycle in tenths of percent (0 .. 1000) */
+
+extern unsigned long pwmStatAccepted[PWM_INPUTS]; /**< Number of decoded captures */
+extern unsigned long pwmStatRejected[PWM_INPUTS]; /**< Number of captures rejected as noise/garbage (last good value was kept) */
+extern unsigned long pwmStatFlatline[PWM_INPUTS]; /**< Number of "flatline" (0% or 100%) captures */
+extern unsigned long pwmStatLost[PWM_INPUTS];     /**< Number of input losses (high without an edge for PWM_IN_LOSS_MS) */
+
+extern byte pwmInLost[PWM_INPUTS];             /**< Non zero while the input is lost, pwmDuty keeps the last value */
+
+
+extern byte pwmPolMode[PWM_INPUTS];            /**< Configured polarity (PWM_POL_*, see @pwmSetPolarityMode) */
+extern byte pwmPolarity[PWM_INPUTS];           /**< Current polarity (PWM_POL_POS or PWM_POL_NEG) */
+extern unsigned long pwmPeriodTicks[PWM_INPUTS]; /**< Last decoded period in timer1 counts (0.0625us), 0 for "flatline" */
+
+
+/** Input polarity - positive pulses are active (duty cycle is the high level time) */
+#define PWM_POL_POS   0
 
+/** Input polarity - negative pulses are active (duty cycle is the low level time) */
+#define PWM_POL_NEG   1
+
+/** Input polarity - detect at runtime (see @pwmSetPolarityMode) */
+#define PWM_POL_AUTO  2
+
+
+/** Input selection (see @pwmSelectDuty) - average of the selected inputs instead of max. */
+#define PWM_IN_SEL_AVG  0x80
+
+/** Input selection - all the inputs (max. of them) */
+#define PWM_IN_SEL_ALL  ((1 << PWM_INPUTS) - 1)
 
 /** 
- * Start PWM duty cycle measurement
+ * Set input polarity
  * 
- * Check the measurement end with @mmmm.
- * Be careful with using other interrupts during the measurment
+ * PWM_POL_AUTO starts with the default polarity (PWM_NEG_MEASURE) and switches when the input spends
+ * most of the time (long term average, see PWM_POL_AUTO_SHIFT) in the "active" level, i.e. it
+ * assumes the fans run below 50% most of the time.
+ *
+ * @param in zero based PWM input index
+ * @param mode PWM_POL_POS, PWM_POL_NEG or PWM_POL_AUTO
+ */
+void pwmSetPolarityMode(byte in, byte mode);
+
+
+/** 
+ * Measured input frequency
+ * 
+ * @param in zero based PWM input index
+ * 
+ * @return frequency in Hz, 0 for "flatline" or when not known yet
+ */
+unsigned long pwmInFrequency(byte in);
+
+
+/** 
+ * Start PWM capture engine
+ * 
+ * Timer1 is then running freely and the capture ISR keeps writing edge timestamps to a ring buffer.
+ * Timestamps are extended to 32 bits by counting the overflows, i.e. we can measure anything from
+ * 25kHz down to few Hz (see PWM_IN_FLATLINE_OVF). Poll the results with @pwmMeasureUpdate. Call it
+ * just once, all the inputs are set to PWM_POL_AUTO.
  */
 void pwmMeasureBegin (void);
 
 
+/** 
+ * Current time - timer1 extended to 32 bits
+ *
+ * Timer0 is used for PWM out so we do not have millis(), use this one instead. Wraps around after
+ * about 268s, use differences only.
+ * 
+ * @return timer1 counts (0.0625us)
+ */
+unsigned long pwmTimerTicks(void);
+
+
+/** 
+ * Filter weight for the time elapsed since the previous filtered sample (see @ExpFilterWeightDt)
+ *
+ * Returns 0 (skip this sample, the filter keeps its value) while the weight would be below
+ * EXPFILT_WEIGHT_MIN, the time then keeps running from the last filtered sample.
+ *
+ * @param tc time constant (see @ExpFilterTc)
+ * @param last time of the previous filtered sample (updated unless 0 is returned), timer1 counts
+ * 
+ * @return filter weight in Q15, 0 to skip the sample
+ */
+unsigned int timerFilterWeight(unsigned long tc, unsigned long *last);
+
+
 /** 
  * Timer1 capture handler
  *
- * Timer1 has been copied to ICR1 on the given edge.
+ * Timer1 has been copied to ICR1 on the given edge. Stores the timestamp in the ring buffer, after
+ * PWM_CAPT_GROUP edges of the same type switches to the other edge.
+ *
+ * Worst case about 120 cycles (7.5us) including the prologue/epilogue, see DEBUG_ISR_TIMING.
  */
 ISR (TIMER1_CAPT_vect);
 
 
+/** 
+ * Pin change handler for PWM2 .. PWM4 (port D)
+ *
+ * Reads timer1 first thing, then stores the timestamp for every changed input in its ring buffer,
+ * using the same grouping as @TIMER1_CAPT_vect (edges of the other type are ignored). Once the ring
+ * buffer of an input is complete its pin is masked until pwmMeasureUpdate has taken the snapshot, so
+ * each input costs at most about 2 * PWM_CAPT_EDGES interrupts per loop whatever its frequency (3
+ * inputs at 25kHz would otherwise need more than the whole CPU).
+ *
+ * Worst case about 200 cycles (12.5us) with all 4 inputs changing at once.
+ */
+#if PWM_INPUTS > 1
+ISR (PCINT2_vect);
+#endif
+
+
 /** 
  * Timer1 overflow handler
  * 
- * Happens if there is no edge within 65536 * 0.625us = 4096us ~ 244Hz
- * I.e. if we have 0% or 100% duty cycle.
+ * Happens every 65536 * 0.0625us = 4096us ~ 244Hz. Upper 16 bits of the timestamps, also counts
+ * overflows since the last edge, i.e. we can detect 0% or 100% duty cycle.
+ *
+ * Worst case about 60 cycles (3.8us) with 4 inputs.
  */
 ISR (TIMER1_OVF_vect);
 
 
 /** 
- * Finish measurements
+ * Make consistent copy of the capture ring buffer
  * 
- * Once finished the measured values (based on the config) are in:
+ * Interrupts are disabled just for the raw copy (about 280 cycles, 17.5us). Safe to call anytime
+ * from the main loop.
+ *
+ * @param in zero based PWM input index
+ * @param snap output snapshot
+ */
+void pwmCaptureSnapshot(byte in, PwmCaptSnapshot *snap);
+
+
+/** 
+ * Decode the captured edges of all the inputs - non blocking
+ * 
+ * Once finished the measured values (based on the config) for each input are in:
+ *  - pwmPeriodTicks - PWM period in timer1 counts (see @pwmInFrequency)
  *  - pwmPeriod    - PWM period in us
  *  - pwmFrequency - PWM frequency in kHz
  *  - pwmPWidth    - pusitive pulse width in us
- *  - pwmDuty      - PWM duty cycle
+ *  - pwmDuty      - PWM duty cycle in tenths of percent
+ *
+ * @return 0 when new values are available (for any input), 1 when there is nothing new or the
+ *         capture has been rejected (outputs are not changed)
+ */
+int pwmMeasureUpdate (void);
+
+
+/** 
+ * Duty cycle of the selected input(s)
+ * 
+ * A lost input (see @pwmInLost) sits at the pull-up level: with positive polarity it counts as 100%
+ * (a disconnected input looks the same as a real 100% demand, the fans never get less), with negative
+ * polarity it is skipped.
  *
- * @return 0 when when complete and fills the output
+ * @param sel bit mask of the inputs (bit 0 is PWM1), plus PWM_IN_SEL_AVG to average them
+ *            (otherwise the max. is used)
+ * @param fallback duty cycle in tenths of percent when all the selected inputs are skipped
+ * 
+ * @return duty cycle in tenths of percent
  */
-int pwmMeasureComplete (void);
+int pwmSelectDuty(byte sel, int fallback);
 
 
 #endif // __PWMMEASURE_H__
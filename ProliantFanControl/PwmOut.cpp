@@ -2,77 +2,213 @@
 #include "Config.h"
 #include "PwmOut.h"
 
-// Common macros for PWM out. Duty range is 0-80
+// Common macros for PWM out. Duty in permille, the fan is active for 1-80 timer counts from BOTTOM
+// (see pwmOutCounts): non-inverting compare output (set at BOTTOM, cleared on the match) or with
+// PWM_OUT_NEG inverting (cleared at BOTTOM, set on the match). Either way the one count minimum of
+// the fast PWM is at the slow end of the fan (1.25%) and OCRxB = TOP is a constantly active fan.
 
 #ifdef PWM_OUT_NEG
-#define PWM_OUT_0        HIGH
-#define PWM_OUT_100      LOW
-#define PWM_OUT_VAL(dc)  ((100 - (dc)) * 79 / 100)
+#define PWM_OUT_COM0B             (bit(COM0B1) | bit(COM0B0))
+#define PWM_OUT_COM2B             (bit(COM2B1) | bit(COM2B0))
+#define PWM_OUT_IDLE(pins, b)     ((pins) & bit(b))          /**< Pin at the level of a stopped fan */
+#define PWM_OUT_SET_IDLE(port, b) ((port) |= bit(b))
 #else
-#define PWM_OUT_0        LOW
-#define PWM_OUT_100      HIGH
-#define PWM_OUT_VAL(dc)  ((dc) * 79 / 100)
+#define PWM_OUT_COM0B             bit(COM0B1)
+#define PWM_OUT_COM2B             bit(COM2B1)
+#define PWM_OUT_IDLE(pins, b)     (!((pins) & bit(b)))
+#define PWM_OUT_SET_IDLE(port, b) ((port) &= ~bit(b))
 #endif
 
+// The pin is either driven by the compare output or disconnected from it (COMxB = 0) and held at
+// the idle level by PORT. Both the disconnect and the reconnect wait for the idle part of a period
+// (see TIMER0_COMPB_vect), so every edge on the pin is made by the timer.
+#define PWM_OUT_ON     0   /**< OCxB drives the pin */
+#define PWM_OUT_STOP   1   /**< Waiting for the idle part of a period to disconnect */
+#define PWM_OUT_OFF    2   /**< Disconnected, the pin is idle */
+#define PWM_OUT_START  3   /**< Waiting for the idle part of a period to reconnect */
+
+// The compare match which syncs the disconnect and the reconnect is at most a half period from
+// BOTTOM, the rest of the period leaves ~20us for the ISR latency (see the ISR list in PFCmain.cpp)
+#define PWM_OUT_SYNC_OCR  (PWM_OUT_TOP / 2)
+
+
+/** 
+ * Active time of the fan in timer counts, Q8 (fraction of a count in the low byte)
+ * 
+ * The fan is active for OCRxB + 1 counts out of PWM_OUT_TOP + 1 (fast PWM), at least one count. 
+ * 
+ * @param pm fan duty cycle in permille (1 .. 1000), 0 disconnects the pin instead
+ * 
+ * @return active time in 1/256 counts (256 .. (PWM_OUT_TOP + 1) * 256), the max. is a constantly
+ *         active fan, anything under 12.5 permille gets the one count minimum
+ */
+static unsigned int pwmOutCounts(unsigned int pm)
+{
+    unsigned int c = ((unsigned long)pm * ((PWM_OUT_TOP + 1) << 8) + 500) / 1000;
+    return (c < 256) ? 256 : c;
+}
+
 /* -----------------------------------------------------------------------
    PWM out 1 - using timer 0 (cannot use delay), controlling a fan on D5
    ----------------------------------------------------------------------- */
 
-unsigned char pwmA_Dc = 0; /**< Is PWM B just DC mode (0 or 100%)? */
+volatile unsigned char pwmA_State; /**< PWM_OUT_ON, PWM_OUT_STOP, PWM_OUT_OFF or PWM_OUT_START */
+
+volatile unsigned char pwmA_Ocr;   /**< OCR0B for the active time rounded down */
+volatile unsigned char pwmA_Frac;  /**< Dithering - fraction of a count (1/256), 0 - no dithering */
+unsigned char pwmA_Acc;            /**< Dithering - sigma-delta accumulator */
+
+
+#ifdef PWM_OUT_DITHER
+/** 
+ * Once per PWM period at TOP. OCR0B is double buffered, the value written here is used from the
+ * next BOTTOM to the end of the next period, i.e. one value per frame.
+ */
+ISR(TIMER0_COMPA_vect)
+{
+    unsigned char acc = pwmA_Acc + pwmA_Frac;
+    OCR0B    = pwmA_Ocr + (acc < pwmA_Acc);   // carry of the accumulator
+    pwmA_Acc = acc;
+}
+#endif
+
+
+/** 
+ * Compare match B while stopping or starting, OC0B has just gone idle. TCNT0 is read first, there
+ * must be at least a timer count to BOTTOM, otherwise try again in the next period:
+ * - stopping - disconnect the pin while it is idle
+ * - starting - reconnect after the sync match (OCR0B = PWM_OUT_SYNC_OCR), OC0B may have followed
+ *   the waveform while disconnected but it is idle from here to BOTTOM, the first pulse starts
+ *   at BOTTOM with the new OCR0B, full width
+ */
+ISR(TIMER0_COMPB_vect)
+{
+    unsigned char t = TCNT0;
+    if(t >= PWM_OUT_TOP - 1)
+        return;
+
+    if(pwmA_State == PWM_OUT_START)
+    {
+        if(t > PWM_OUT_SYNC_OCR)
+        {
+            TCCR0A |= PWM_OUT_COM0B;
+            OCR0B   = pwmA_Ocr;
+            TIFR0   = bit(OCF0A);                 // clear a stale match, writing one clears it
+            TIMSK0  = pwmA_Frac ? bit(OCIE0A) : 0;
+            pwmA_State = PWM_OUT_ON;
+        }
+    }
+    else if(PWM_OUT_IDLE(PIND, PIND5))
+    {
+        TCCR0A    &= ~(bit(COM0B1) | bit(COM0B0));
+        TIMSK0     = 0;
+        pwmA_State = PWM_OUT_OFF;
+    }
+}
 
 
 void pwmBeginA(unsigned int duty)
 {
-    pwmA_Dc = 0;
-    TCCR0A  = 0;                              // TC2 Control Register A
-    TCCR0B  = 0;                              // TC2 Control Register B
-    TIMSK0  = 0;                              // TC2 Interrupt Mask Register
-    TIFR0   = 0;                              // TC2 Interrupt Flag Register
-    TCCR0A |= bit(COM2B1) | bit(WGM21) | bit(WGM20);  // OC2B cleared/set on match when up/down counting, fast PWM
-    TCCR0B |= bit(WGM22) | bit(CS21);         // use clock/8, ie. res 0.5us
-    OCR0A   = 79;                             // TOP overflow value is 80 producing PWM 80 * 0.5us = 40us = 25kHz
+    TCCR0A  = 0;                              // TC0 Control Register A
+    TCCR0B  = 0;                              // TC0 Control Register B
+    TIMSK0  = 0;                              // TC0 Interrupt Mask Register
+    TIFR0   = bit(OCF0B) | bit(OCF0A) | bit(TOV0);  // TC0 Interrupt Flag Register, writing one clears
+    PWM_OUT_SET_IDLE(PORTD, PORTD5);          // the pin level when disconnected from OC0B
+    TCCR0A |= PWM_OUT_COM0B | bit(WGM01) | bit(WGM00);  // OC0B active from BOTTOM to the match, fast PWM
+    TCCR0B |= bit(WGM02) | bit(CS01);         // use clock/8, ie. res 0.5us
+    OCR0A   = PWM_OUT_TOP;                    // TOP overflow value is 80 producing PWM 80 * 0.5us = 40us = 25kHz
+    pwmA_State = PWM_OUT_ON;
     pwmSetDcA(duty);                             
-    pinMode(5, OUTPUT);
+    DDRD   |= bit(DDD5);
 }
 
 
 void pwmSetDcA(unsigned int duty)
 {
-    // Handle DC 0 and 100 as special cases
-    if(duty==0)
+    pwmSetPermilleA(duty * 10);
+}
+
+
+void pwmSetPermilleA(unsigned int pm)
+{
+    if(pm > 1000)
+        pm = 1000;
+
+    unsigned char oldSREG = SREG;
+    cli();
+
+    if(pm == 0)
     {
-        pwmA_Dc = 1;
+        // Stopped fan - disconnect at the end of a pulse, shorter one (never longer than the
+        // current) gives the ISR time
+        if(pwmA_State == PWM_OUT_ON)
+        {
+            if(pwmA_Ocr > PWM_OUT_SYNC_OCR)
+                pwmA_Ocr = PWM_OUT_SYNC_OCR;
+            pwmA_Frac  = 0;
+            OCR0B      = pwmA_Ocr;
+            TIFR0      = bit(OCF0B);              // clear a stale match, writing one clears it
+            TIMSK0     = bit(OCIE0B);
+            pwmA_State = PWM_OUT_STOP;
+        }
+        else if(pwmA_State == PWM_OUT_START)
+        {
+            // not reconnected yet, stay off
+            TIMSK0     = 0;
+            pwmA_State = PWM_OUT_OFF;
+        }
+        SREG = oldSREG;
+
 #ifdef DEBUG_PWM_OUT
-        Serial.print("Setting PWM out A to DC: ");
-        Serial.println(PWM_OUT_0);
+        Serial.println(F("Setting PWM out A to stopped"));
 #endif
-        digitalWrite(5, PWM_OUT_0);
         return;
     }
 
-    if(duty==100)
-    {
-        pwmA_Dc = 1;
-#ifdef DEBUG_PWM_OUT
-        Serial.print("Setting PWM out A to DC: ");
-        Serial.println(PWM_OUT_100);
+    unsigned int c = pwmOutCounts(pm);
+
+#ifdef PWM_OUT_DITHER
+    pwmA_Ocr  = (c >> 8) - 1;
+    pwmA_Frac = c & 0xff;
+#else
+    pwmA_Ocr  = ((c + 128) >> 8) - 1;
+    pwmA_Frac = 0;
 #endif
-        digitalWrite(5, PWM_OUT_100);
-        return;
-    }
 
-    // normal duty cycle after DC - use setup instead
-    if(pwmA_Dc)
+    if(pwmA_State == PWM_OUT_OFF || pwmA_State == PWM_OUT_START)
     {
-        pwmBeginA(duty);
-        return;
+        // reconnect in the idle part of a period, the ISR takes the new values from there
+        OCR0B = PWM_OUT_SYNC_OCR;
+        if(pwmA_State == PWM_OUT_OFF)
+        {
+            TIFR0      = bit(OCF0B);              // clear a stale match, writing one clears it
+            TIMSK0     = bit(OCIE0B);
+            pwmA_State = PWM_OUT_START;
+        }
     }
+    else
+    {
+        // double buffered, takes effect at the next BOTTOM
+        OCR0B = pwmA_Ocr;
+
+        if(pwmA_Frac)
+        {
+            if(!(TIMSK0 & bit(OCIE0A)))
+            {
+                TIFR0  = bit(OCF0A);              // clear a stale match, writing one clears it
+                TIMSK0 = bit(OCIE0A);
+            }
+        }
+        else
+            TIMSK0 = 0;
 
-    OCR0B = PWM_OUT_VAL(duty);
+        pwmA_State = PWM_OUT_ON;
+    }
+    SREG = oldSREG;
 
 #ifdef DEBUG_PWM_OUT
-    Serial.print("Setting PWM out A to ");
-    Serial.println(OCR0B);
+    Serial.print(F("Setting PWM out A to "));
+    Serial.println(pwmA_Ocr);
 #endif
 }
 
@@ -81,60 +217,156 @@ void pwmSetDcA(unsigned int duty)
    PWM out 2 - using timer2, controlling a fan on D3
    ----------------------------------------------------------------------- */
 
-unsigned char pwmB_Dc = 0; /**< Is PWM B just DC mode (0 or 100%)? */
+volatile unsigned char pwmB_State; /**< PWM_OUT_ON, PWM_OUT_STOP, PWM_OUT_OFF or PWM_OUT_START */
+
+volatile unsigned char pwmB_Ocr;   /**< OCR2B for the active time rounded down */
+volatile unsigned char pwmB_Frac;  /**< Dithering - fraction of a count (1/256), 0 - no dithering */
+unsigned char pwmB_Acc;            /**< Dithering - sigma-delta accumulator */
+
+
+#ifdef PWM_OUT_DITHER
+/** 
+ * Once per PWM period at TOP, see TIMER0_COMPA_vect
+ */
+ISR(TIMER2_COMPA_vect)
+{
+    unsigned char acc = pwmB_Acc + pwmB_Frac;
+    OCR2B    = pwmB_Ocr + (acc < pwmB_Acc);   // carry of the accumulator
+    pwmB_Acc = acc;
+}
+#endif
+
+
+/** 
+ * Compare match B while stopping or starting, see TIMER0_COMPB_vect
+ */
+ISR(TIMER2_COMPB_vect)
+{
+    unsigned char t = TCNT2;
+    if(t >= PWM_OUT_TOP - 1)
+        return;
+
+    if(pwmB_State == PWM_OUT_START)
+    {
+        if(t > PWM_OUT_SYNC_OCR)
+        {
+            TCCR2A |= PWM_OUT_COM2B;
+            OCR2B   = pwmB_Ocr;
+            TIFR2   = bit(OCF2A);                 // clear a stale match, writing one clears it
+            TIMSK2  = pwmB_Frac ? bit(OCIE2A) : 0;
+            pwmB_State = PWM_OUT_ON;
+        }
+    }
+    else if(PWM_OUT_IDLE(PIND, PIND3))
+    {
+        TCCR2A    &= ~(bit(COM2B1) | bit(COM2B0));
+        TIMSK2     = 0;
+        pwmB_State = PWM_OUT_OFF;
+    }
+}
 
 
 void pwmBeginB(unsigned int duty)
 {
-    pwmB_Dc = 0;
     TCCR2A  = 0;                              // TC2 Control Register A
     TCCR2B  = 0;                              // TC2 Control Register B
     TIMSK2  = 0;                              // TC2 Interrupt Mask Register
-    TIFR2   = 0;                              // TC2 Interrupt Flag Register
-    TCCR2A |= bit(COM2B1) | bit(WGM21) | bit(WGM20);  // OC2B cleared/set on match when up/down counting, fast PWM
+    TIFR2   = bit(OCF2B) | bit(OCF2A) | bit(TOV2);  // TC2 Interrupt Flag Register, writing one clears
+    PWM_OUT_SET_IDLE(PORTD, PORTD3);          // the pin level when disconnected from OC2B
+    TCCR2A |= PWM_OUT_COM2B | bit(WGM21) | bit(WGM20);  // OC2B active from BOTTOM to the match, fast PWM
     TCCR2B |= bit(WGM22) | bit(CS21);         // use clock/8, ie. res 0.5us
-    OCR2A   = 79;                             // TOP overflow value is 80 producing PWM 80 * 0.5us = 40us = 25kHz
+    OCR2A   = PWM_OUT_TOP;                    // TOP overflow value is 80 producing PWM 80 * 0.5us = 40us = 25kHz
+    pwmB_State = PWM_OUT_ON;
     pwmSetDcB(duty);                             
-    pinMode(3, OUTPUT);
+    DDRD   |= bit(DDD3);
 }
 
 
 void pwmSetDcB(unsigned int duty)
 {
-    // Handle DC 0 and 100 as special cases
-    if(duty==0)
+    pwmSetPermilleB(duty * 10);
+}
+
+
+void pwmSetPermilleB(unsigned int pm)
+{
+    if(pm > 1000)
+        pm = 1000;
+
+    unsigned char oldSREG = SREG;
+    cli();
+
+    if(pm == 0)
     {
-        pwmB_Dc = 1;
+        // Stopped fan - disconnect at the end of a pulse, shorter one (never longer than the
+        // current) gives the ISR time
+        if(pwmB_State == PWM_OUT_ON)
+        {
+            if(pwmB_Ocr > PWM_OUT_SYNC_OCR)
+                pwmB_Ocr = PWM_OUT_SYNC_OCR;
+            pwmB_Frac  = 0;
+            OCR2B      = pwmB_Ocr;
+            TIFR2      = bit(OCF2B);              // clear a stale match, writing one clears it
+            TIMSK2     = bit(OCIE2B);
+            pwmB_State = PWM_OUT_STOP;
+        }
+        else if(pwmB_State == PWM_OUT_START)
+        {
+            // not reconnected yet, stay off
+            TIMSK2     = 0;
+            pwmB_State = PWM_OUT_OFF;
+        }
+        SREG = oldSREG;
+
 #ifdef DEBUG_PWM_OUT
-        Serial.print("Setting PWM out B to DC: ");
-        Serial.println(PWM_OUT_0);
+        Serial.println(F("Setting PWM out B to stopped"));
 #endif
-        digitalWrite(3, PWM_OUT_0);
         return;
     }
 
-    if(duty==100)
-    {
-        pwmB_Dc = 1;
-#ifdef DEBUG_PWM_OUT
-        Serial.print("Setting PWM out B to DC: ");
-        Serial.println(PWM_OUT_100);
+    unsigned int c = pwmOutCounts(pm);
+
+#ifdef PWM_OUT_DITHER
+    pwmB_Ocr  = (c >> 8) - 1;
+    pwmB_Frac = c & 0xff;
+#else
+    pwmB_Ocr  = ((c + 128) >> 8) - 1;
+    pwmB_Frac = 0;
 #endif
-        digitalWrite(3, PWM_OUT_100);
-        return;
-    }
 
-    // normal duty cycle after DC - use setup instead
-    if(pwmB_Dc)
+    if(pwmB_State == PWM_OUT_OFF || pwmB_State == PWM_OUT_START)
     {
-        pwmBeginB(duty);
-        return;
+        // reconnect in the idle part of a period, the ISR takes the new values from there
+        OCR2B = PWM_OUT_SYNC_OCR;
+        if(pwmB_State == PWM_OUT_OFF)
+        {
+            TIFR2      = bit(OCF2B);              // clear a stale match, writing one clears it
+            TIMSK2     = bit(OCIE2B);
+            pwmB_State = PWM_OUT_START;
+        }
     }
+    else
+    {
+        // double buffered, takes effect at the next BOTTOM
+        OCR2B = pwmB_Ocr;
 
-    OCR2B = PWM_OUT_VAL(duty);
+        if(pwmB_Frac)
+        {
+            if(!(TIMSK2 & bit(OCIE2A)))
+            {
+                TIFR2  = bit(OCF2A);              // clear a stale match, writing one clears it
+                TIMSK2 = bit(OCIE2A);
+            }
+        }
+        else
+            TIMSK2 = 0;
+
+        pwmB_State = PWM_OUT_ON;
+    }
+    SREG = oldSREG;
 
 #ifdef DEBUG_PWM_OUT
-    Serial.print("Setting PWM out B to ");
-    Serial.println(OCR2B);
+    Serial.print(F("Setting PWM out B to "));
+    Serial.println(pwmB_Ocr);
 #endif
 }
@@ -1,50 +1,82 @@
-#ifndef __PWMOUT_H__
-#define __PWMOUT_H__
-
-/*******************************************************************************
- *
- *  PWM out
- *
- ******************************************************************************/
-
-/* -----------------------------------------------------------------------
-   PWM out 1 - using timer 0 (cannot use delay), controlling a fan on D5
-   ----------------------------------------------------------------------- */
-
-/** 
- * Start the PWM using timer 0, ouput on D3
- * 
- * @param duty see @pwmSetDcA
- */
-void pwmBeginA(unsigned int duty);
-
-
-/** 
- * Set duty cycle
- * 
- * @param duty desired fan duty cycle in percents (0-100)
- */
-void pwmSetDcA(unsigned int duty);
-
-
-/* -----------------------------------------------------------------------
-   PWM out 2 - using timer2, controlling a fan on D3
-   ----------------------------------------------------------------------- */
-
-/** 
- * Start the PWM using timer 2, ouput on D3
- * 
- * @param duty see @pwmSetDcB
- */
-void pwmBeginB(unsigned int duty);
-
-
-/** 
- * Set duty cycle
- * 
- * @param duty desired fan duty cycle in percents (0-100)
- */
-void pwmSetDcB(unsigned int duty);
-
-
-#endif // __PWMOUT_H__
+#ifndef __PWMOUT_H__
+#define __PWMOUT_H__
+
+/*******************************************************************************
+ *
+ *  PWM out
+ *
+ * 25kHz fast PWM, a period is PWM_OUT_TOP + 1 = 80 timer counts, i.e. 1.25% per count. With
+ * PWM_OUT_DITHER the duty in permille is kept as the count rounded down and a fraction (1/256 of
+ * a count), a sigma-delta at TOP of each period adds one count to every n-th period so the long
+ * run average matches the fraction. The ISR (~35 cycles per period) runs only when there is
+ * a fraction, otherwise the nearest count is set once.
+ *
+ * All the updates are glitch-free, every edge on the pin comes from the timer (fan active from
+ * BOTTOM to the compare match, the compare output inverted with PWM_OUT_NEG). OCRxB is double
+ * buffered (new value from the next period), a constantly active fan is OCRxB = TOP. A stopped fan
+ * (0) disconnects the pin from the timer (PORT at the idle level), back to PWM reconnects it. Both
+ * are synchronized by the compare match B interrupt to the idle part of a period, so the first
+ * pulse starts at BOTTOM with its full width. An update is a few register writes with interrupts
+ * disabled, no timer reprogramming, digitalWrite or busy waiting.
+ ******************************************************************************/
+
+/** TOP of the fast PWM (OCRxA), 16MHz / 8 / 80 = 25kHz */
+#define PWM_OUT_TOP  79
+
+/* -----------------------------------------------------------------------
+   PWM out 1 - using timer 0 (cannot use delay), controlling a fan on D5
+   ----------------------------------------------------------------------- */
+
+/** 
+ * Start the PWM using timer 0, ouput on D3
+ * 
+ * @param duty see @pwmSetDcA
+ */
+void pwmBeginA(unsigned int duty);
+
+
+/** 
+ * Set duty cycle
+ * 
+ * @param duty desired fan duty cycle in percents (0-100)
+ */
+void pwmSetDcA(unsigned int duty);
+
+
+/** 
+ * Set duty cycle with sub-percent resolution
+ * 
+ * @param pm desired fan duty cycle in permille (0-1000)
+ */
+void pwmSetPermilleA(unsigned int pm);
+
+
+/* -----------------------------------------------------------------------
+   PWM out 2 - using timer2, controlling a fan on D3
+   ----------------------------------------------------------------------- */
+
+/** 
+ * Start the PWM using timer 2, ouput on D3
+ * 
+ * @param duty see @pwmSetDcB
+ */
+void pwmBeginB(unsigned int duty);
+
+
+/** 
+ * Set duty cycle
+ * 
+ * @param duty desired fan duty cycle in percents (0-100)
+ */
+void pwmSetDcB(unsigned int duty);
+
+
+/** 
+ * Set duty cycle with sub-percent resolution
+ * 
+ * @param pm desired fan duty cycle in permille (0-1000)
+ */
+void pwmSetPermilleB(unsigned int pm);
+
+
+#endif // __PWMOUT_H__
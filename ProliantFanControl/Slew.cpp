@@ -0,0 +1,125 @@
+#include <Arduino.h>
+#include "Config.h"
+#include "PwmMeasure.h"
+#include "Slew.h"
+
+#define SLEW_PERIOD_TICKS  ((unsigned long)SLEW_PERIOD_MS * (F_CPU / 1000))
+
+#if SLEW_PERIOD_MS > 1000
+#error SLEW_PERIOD_MS must be at most 1000
+#endif
+
+unsigned char slewRise[FANS];         /**< Max. rise in %/s, 0 - unlimited */
+unsigned char slewFall[FANS];         /**< Max. fall in %/s, 0 - unlimited */
+unsigned char slewHystUp[FANS];       /**< Ignored rise of the computed duty in % */
+unsigned char slewHystDown[FANS];     /**< Ignored fall of the computed duty in % */
+unsigned char slewFlags[FANS];        /**< SLEW_FLAG_... */
+
+unsigned char slewHold[FANS];         /**< Computed duty after the hysteresis in % */
+int           slewOut[FANS];          /**< Output in 1/SLEW_ONE % */
+unsigned int  slewCarry[FANS];        /**< Fraction of the step carried to the next period (see @slewStep) */
+unsigned long slewPeriodStart;        /**< Start of the current period (see @pwmTimerTicks) */
+
+
+/** 
+ * Max. change of the output in this period
+ *
+ * The rate per period is rarely whole (1%/s is 1.6/SLEW_ONE % per 100ms), the fraction is carried to
+ * the next period so the long run rate is exact.
+ * 
+ * @param rate rate in %/s, not 0
+ * @param carry fraction left from the previous periods in 1/1000 of 1/SLEW_ONE % (will be updated)
+ * 
+ * @return max. change in 1/SLEW_ONE %
+ */
+static int slewStep(unsigned char rate, unsigned int *carry)
+{
+    // max. 255 * SLEW_ONE * 1000 + 999 fits to long
+    unsigned long acc = (unsigned long)rate * SLEW_ONE * SLEW_PERIOD_MS + *carry;
+
+    *carry = acc % 1000;
+    return acc / 1000;
+}
+
+
+int slewTick(void)
+{
+    unsigned long now = pwmTimerTicks();
+
+    unsigned long dt  = (uint32_t)(now - slewPeriodStart);
+
+    if(dt < SLEW_PERIOD_TICKS)
+        return 1;
+
+    // keep the periods exact (a late loop does not stretch them), start over after a long stall
+    slewPeriodStart = (dt < 2 * SLEW_PERIOD_TICKS) ? (uint32_t)(slewPeriodStart + SLEW_PERIOD_TICKS) : now;
+    return 0;
+}
+
+
+int slewControl(byte fan, int pwm, byte update)
+{
+    // hysteresis, asymmetric
+    if(pwm > slewHold[fan] + slewHystUp[fan] || pwm < slewHold[fan] - slewHystDown[fan])
+        slewHold[fan] = pwm;
+
+    int target = slewHold[fan] << SLEW_FRAC_BITS;
+    int out    = slewOut[fan];
+
+    if(target > out)
+    {
+        if(slewRise[fan] == 0)
+            out = target;
+        else if(update)
+        {
+            int step = slewStep(slewRise[fan], &slewCarry[fan]);
+            out = (target - out > step) ? (out + step) : target;
+        }
+    }
+    else if(target < out)
+    {
+        if(slewFall[fan] == 0)
+            out = target;
+        else if(update)
+        {
+            int step = slewStep(slewFall[fan], &slewCarry[fan]);
+            out = (out - target > step) ? (out - step) : target;
+        }
+    }
+
+    // the next ramp starts with no fraction
+    if(out == target)
+        slewCarry[fan] = 0;
+
+#ifdef DEBUG_SLEW
+    if(update && out != slewOut[fan])
+    {
+        Serial.print(F("Slew "));
+        Serial.print(fan);
+        Serial.print(F(": in "));
+        Serial.print(pwm);
+        Serial.print(F(" hold "));
+        Serial.print(slewHold[fan]);
+        Serial.print(F(" out "));
+        Serial.println(out);
+    }
+#endif
+
+    slewOut[fan] = out;
+    return (out + SLEW_ONE/2) >> SLEW_FRAC_BITS;
+}
+
+
+void slewTrack(byte fan, int pwm)
+{
+    slewHold[fan]  = pwm;
+    slewOut[fan]   = pwm << SLEW_FRAC_BITS;
+    slewCarry[fan] = 0;
+}
+
+
+int slewPermille(byte fan)
+{
+    // max. 100 * SLEW_ONE * 10 fits to int
+    return (slewOut[fan] * 10 + SLEW_ONE/2) >> SLEW_FRAC_BITS;
+}
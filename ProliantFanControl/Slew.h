@@ -0,0 +1,71 @@
+#ifndef __SLEW_H__
+#define __SLEW_H__
+
+#include "Config.h"
+
+/*******************************************************************************
+ *
+ *  Output conditioning - hysteresis and slew rate limit
+ *
+ * Sits between the control law (mapping table, curves, feed-forward, PID or the manual value) and
+ * PwmOut. The hysteresis ignores small changes of the computed duty (asymmetric, e.g. follow any
+ * rise but ignore a fall up to 2%) so the fan does not hunt around the mapping table cell edges,
+ * the slew rate limit then moves the output towards it at most by the rise / fall rate. Integer
+ * only - the output is kept in 1/SLEW_ONE %, moved once per SLEW_PERIOD_MS (timer1).
+ ******************************************************************************/
+
+#define SLEW_FRAC_BITS   4
+#define SLEW_ONE         (1 << SLEW_FRAC_BITS)
+
+#define SLEW_FLAG_MANUAL 0x01   /**< Condition also the manual mode output (see @slewFlags) */
+
+extern unsigned char slewRise[FANS];     /**< Max. rise in %/s, 0 - unlimited */
+extern unsigned char slewFall[FANS];     /**< Max. fall in %/s, 0 - unlimited */
+extern unsigned char slewHystUp[FANS];   /**< Ignored rise of the computed duty in % */
+extern unsigned char slewHystDown[FANS]; /**< Ignored fall of the computed duty in % */
+extern unsigned char slewFlags[FANS];    /**< SLEW_FLAG_... */
+
+
+/** 
+ * Check the update period - non blocking
+ * 
+ * @return 0 once per SLEW_PERIOD_MS (time to call @slewControl with update), 1 otherwise
+ */
+int slewTick(void);
+
+
+/** 
+ * Condition the output of one fan
+ * 
+ * @param fan zero based fan index
+ * @param pwm duty cycle in % computed by the control law
+ * @param update non zero to move the output by the slew rate (once per period, see @slewTick),
+ *        the unlimited direction follows immediately regardless
+ * 
+ * @return output duty cycle in %
+ */
+int slewControl(byte fan, int pwm, byte update);
+
+
+/** 
+ * Bypass the conditioning, just follow the output so that it continues from there (e.g. after
+ * switching from failsafe to auto mode)
+ * 
+ * @param fan zero based fan index
+ * @param pwm output duty cycle in %
+ */
+void slewTrack(byte fan, int pwm);
+
+
+/** 
+ * Current output with the sub-percent resolution of the ramp (see @pwmSetPermilleA)
+ * 
+ * @param fan zero based fan index
+ * 
+ * @return output duty cycle in permille, the same as the last @slewControl / @slewTrack in %
+ *         when not ramping
+ */
+int slewPermille(byte fan);
+
+
+#endif // __SLEW_H__
@@ -0,0 +1,264 @@
+#include <Arduino.h>
+#include "Config.h"
+#include "PwmMeasure.h"
+#include "Tach.h"
+
+// Tach pins are on port B (D11 is PB3, D12 is PB4)
+const byte tachPins[2] = { 11, 12 };
+
+#if FANS > 1
+#define TACH_PCINT_MASK  ( bit (3) | bit (4) )
+#else
+#define TACH_PCINT_MASK  ( bit (3) )
+#endif
+
+#define TACH_WINDOW_TICKS  ((unsigned long)TACH_WINDOW_MS * (F_CPU / 1000))
+
+#if TACH_WINDOW_MS > 1000
+#error TACH_WINDOW_MS must be at most 1000
+#endif
+
+volatile word tachCount[FANS];        /**< Falling edges in the current window */
+volatile byte tachLastPins;           /**< Port B state seen by the last pin change interrupt */
+
+unsigned long tachWindowStart;        /**< Start of the current window (see @pwmTimerTicks) */
+
+unsigned int tachRpm[FANS];           /**< Output - measured fan speed in RPM */
+byte         tachPpr[FANS];           /**< Tach pulses per fan revolution */
+
+
+void tachBegin(void)
+{
+    for(byte f=0; f<FANS; ++f)
+    {
+        pinMode(tachPins[f], INPUT_PULLUP);
+        tachCount[f] = 0;
+        tachRpm[f]   = 0;
+    }
+
+    tachLastPins    = PINB;
+    tachWindowStart = pwmTimerTicks();
+
+    PCMSK0 |= TACH_PCINT_MASK;
+    PCIFR   = bit (PCIF0);
+    PCICR  |= bit (PCIE0);
+}
+
+
+ISR (PCINT0_vect)
+{
+    byte pins = PINB;
+    byte fell = tachLastPins & ~pins & TACH_PCINT_MASK;
+    tachLastPins = pins;
+
+    if(fell & bit (3))
+        ++tachCount[0];
+#if FANS > 1
+    if(fell & bit (4))
+        ++tachCount[1];
+#endif
+}
+
+
+int tachUpdate(void)
+{
+    unsigned long now     = pwmTimerTicks();
+    unsigned long elapsed = now - tachWindowStart;
+
+    if(elapsed < TACH_WINDOW_TICKS)
+        return 1;
+
+    word cnt[FANS];
+
+    byte oldSREG = SREG;
+    cli();
+    for(byte f=0; f<FANS; ++f)
+    {
+        cnt[f]       = tachCount[f];
+        tachCount[f] = 0;
+    }
+    SREG = oldSREG;
+
+    tachWindowStart = now;
+
+    // in 16us units (256 timer1 counts) to keep it in 32 bits, 60s = 3750000 units (count < 1145 for
+    // 1s window, i.e. up to 68000 RPM)
+    unsigned long units = elapsed >> 8;
+
+    for(byte f=0; f<FANS; ++f)
+    {
+        unsigned long rpm = ((unsigned long)cnt[f] * (60UL * (F_CPU >> 8)) + units * tachPpr[f] / 2) / (units * tachPpr[f]);
+
+        tachRpm[f] = (rpm > 0xffff) ? 0xffff : rpm;
+    }
+
+#ifdef DEBUG_TACH
+    Serial.print(F("Tach "));
+    for(byte f=0; f<FANS; ++f)
+    {
+        Serial.print(cnt[f]);
+        Serial.print(' ');
+        Serial.print(tachRpm[f]);
+        Serial.print(' ');
+    }
+    Serial.println(elapsed);
+#endif
+
+    return 0;
+}
+
+
+/*******************************************************************************
+ *  Emulated tach output
+ ******************************************************************************/
+
+#ifdef TACH_EMU
+
+#define TACH_EMU_STEP  32768U                          // "keep the level" step for long half periods
+#define TACH_EMU_DUTY_STEP  (100 / (TACH_EMU_POINTS - 1))
+
+unsigned int tachEmuCurve[FANS][TACH_EMU_POINTS];      /**< Emulated RPM for the duty cycles 0 .. 100% */
+
+volatile unsigned long tachEmuHalf[FANS];              /**< Half period of the emulated tach in timer1 counts, 0 - no pulses */
+
+// ISR only
+unsigned long tachEmuLeft[FANS];                       /**< Counts till the next edge */
+byte          tachEmuLevel[FANS];                      /**< Current output level */
+byte          tachEmuEdge[FANS];                       /**< Non zero if the next match is an edge */
+
+
+void tachEmuBegin(void)
+{
+    DDRB |= bit (DDB1);                                // D9
+#if FANS > 1
+    DDRB |= bit (DDB2);                                // D10
+#endif
+
+    for(byte f=0; f<FANS; ++f)
+    {
+        tachEmuHalf[f]  = 0;
+        tachEmuLeft[f]  = 0;
+        tachEmuLevel[f] = 1;
+        tachEmuEdge[f]  = 0;
+    }
+
+    byte oldSREG = SREG;
+    cli();
+
+    // set the outputs high (forced compare), keep them high on the next match
+    TCCR1A |= bit (COM1A1) | bit (COM1A0);
+    TCCR1C  = bit (FOC1A);
+    OCR1A   = TCNT1 + TACH_EMU_STEP;
+    TIFR1   = bit (OCF1A);
+    TIMSK1 |= bit (OCIE1A);
+#if FANS > 1
+    TCCR1A |= bit (COM1B1) | bit (COM1B0);
+    TCCR1C  = bit (FOC1B);
+    OCR1B   = TCNT1 + TACH_EMU_STEP;
+    TIFR1   = bit (OCF1B);
+    TIMSK1 |= bit (OCIE1B);
+#endif
+
+    SREG = oldSREG;
+}
+
+
+/**
+ * Schedule the next compare match of the emulated tach (ISR only)
+ *
+ * @param f zero based fan index
+ * @param level output level after the next match
+ *
+ * @return number of counts till the next match
+ */
+static inline word tachEmuNext(byte f, byte *level)
+{
+    if(tachEmuEdge[f])
+        tachEmuLevel[f] = !tachEmuLevel[f];   // we have just made an edge
+
+    if(tachEmuLeft[f] == 0)
+        tachEmuLeft[f] = tachEmuHalf[f];      // next half period (or nothing if stopped)
+
+    word step;
+    if(tachEmuLeft[f] == 0 || tachEmuLeft[f] > 0xffff)
+    {
+        step = TACH_EMU_STEP;                 // keep the level
+        tachEmuEdge[f] = 0;
+    }
+    else
+    {
+        step = tachEmuLeft[f];
+        tachEmuEdge[f] = 1;
+    }
+
+    if(tachEmuLeft[f] != 0)
+        tachEmuLeft[f] -= step;
+
+    *level = tachEmuEdge[f] ? !tachEmuLevel[f] : tachEmuLevel[f];
+    return step;
+}
+
+
+ISR (TIMER1_COMPA_vect)
+{
+    byte level;
+
+    OCR1A += tachEmuNext(0, &level);
+
+    // "set" or "clear" on the next match
+    if(level)
+        TCCR1A |= bit (COM1A0);
+    else
+        TCCR1A &= ~bit (COM1A0);
+}
+
+
+#if FANS > 1
+ISR (TIMER1_COMPB_vect)
+{
+    byte level;
+
+    OCR1B += tachEmuNext(1, &level);
+
+    if(level)
+        TCCR1A |= bit (COM1B0);
+    else
+        TCCR1A &= ~bit (COM1B0);
+}
+#endif
+
+
+unsigned int tachEmuRpm(byte fan, int duty)
+{
+    if(duty <= 0)
+        return tachEmuCurve[fan][0];
+
+    if(duty >= 100)
+        return tachEmuCurve[fan][TACH_EMU_POINTS - 1];
+
+    byte idx  = duty / TACH_EMU_DUTY_STEP;
+    int  dist = duty % TACH_EMU_DUTY_STEP;
+
+    long r1 = tachEmuCurve[fan][idx];
+    long r2 = tachEmuCurve[fan][idx + 1];
+
+    return (unsigned int)(r1 + ((r2 - r1) * dist + TACH_EMU_DUTY_STEP/2) / TACH_EMU_DUTY_STEP);
+}
+
+
+void tachEmuSet(byte fan, int duty)
+{
+    unsigned int  rpm  = tachEmuRpm(fan, duty);
+    unsigned long half = 0;
+
+    // f = rpm * ppr / 60, half period = F_CPU / 2f
+    if(rpm != 0)
+        half = (F_CPU * 30 + ((unsigned long)rpm * tachPpr[fan]) / 2) / ((unsigned long)rpm * tachPpr[fan]);
+
+    byte oldSREG = SREG;
+    cli();
+    tachEmuHalf[fan] = half;
+    SREG = oldSREG;
+}
+
+#endif // TACH_EMU
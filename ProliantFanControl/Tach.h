@@ -0,0 +1,104 @@
+#ifndef __TACH_H__
+#define __TACH_H__
+
+#include "Config.h"
+
+/*******************************************************************************
+ *
+ *  Fan tachometer (RPM) measurement
+ *
+ * Tach signals of the output fans (open collector, internal pullup) are on D11 (fan 1) and D12
+ * (fan 2) using pin change interrupt. The ISR just counts falling edges, tachUpdate converts the
+ * counts to RPM once per TACH_WINDOW_MS (the window is measured by timer1, see @pwmTimerTicks).
+ ******************************************************************************/
+
+extern const byte   tachPins[2];   /**< Arduino pin for each fan tach input */
+extern unsigned int tachRpm[FANS]; /**< Output - measured fan speed in RPM (0 for stalled fan) */
+extern byte         tachPpr[FANS]; /**< Tach pulses per fan revolution */
+
+
+/** 
+ * Start tach measurement
+ * 
+ * Call after @pwmMeasureBegin (timer1 is used as the time base).
+ */
+void tachBegin(void);
+
+
+/** 
+ * Pin change handler for the tach inputs (port B)
+ *
+ * Counts falling edges. Worst case about 50 cycles (3.1us).
+ */
+ISR (PCINT0_vect);
+
+
+/** 
+ * Update RPM when the measurement window is over - non blocking
+ * 
+ * @return 0 when new values are available in tachRpm, 1 otherwise
+ */
+int tachUpdate(void);
+
+
+/*******************************************************************************
+ *
+ *  Emulated tach output
+ *
+ * Synthetic tach signal for the server fan headers (so that the server does not complain about
+ * slow fans) on D9 (fan 1, OC1A) and D10 (fan 2, OC1B). The edges are generated by timer1 compare
+ * match in HW ("set"/"clear" on compare), the ISR just schedules the next match, i.e. there is no
+ * jitter from the ISR latency. Longer half periods than 65536 counts are split into steps which
+ * keep the level.
+ *
+ * RPM for the given duty cycle (the fan input PWM) is interpolated from the curve with
+ * TACH_EMU_POINTS points for 0 .. 100%.
+ ******************************************************************************/
+
+#ifdef TACH_EMU
+
+extern unsigned int tachEmuCurve[FANS][TACH_EMU_POINTS]; /**< Emulated RPM for the duty cycles 0 .. 100% */
+
+
+/** 
+ * Start tach emulation, the outputs do not pulse until @tachEmuSet
+ * 
+ * Call after @pwmMeasureBegin (it resets timer1 setup).
+ */
+void tachEmuBegin(void);
+
+
+/** 
+ * Set emulated tach for the given input duty cycle
+ * 
+ * @param fan zero based fan index
+ * @param duty duty cycle in percents (0 .. 100)
+ */
+void tachEmuSet(byte fan, int duty);
+
+
+/** 
+ * Emulated RPM for the given duty cycle (see @tachEmuCurve)
+ * 
+ * @param fan zero based fan index
+ * @param duty duty cycle in percents (0 .. 100)
+ * 
+ * @return RPM
+ */
+unsigned int tachEmuRpm(byte fan, int duty);
+
+
+/** 
+ * Timer1 compare match A/B handlers - schedule the next edge of the emulated tach
+ *
+ * Worst case about 90 cycles (5.6us), at least every 2ms.
+ */
+ISR (TIMER1_COMPA_vect);
+#if FANS > 1
+ISR (TIMER1_COMPB_vect);
+#endif
+
+#endif // TACH_EMU
+
+
+#endif // __TACH_H__
@@ -42,17 +42,25 @@ def main():
     parser.add_option('-p', '--pwm-filter',
                       dest    = 'pwmFilter',
                       metavar = 'PWMFILTER',
-                      default = 0.1,
+                      default = 0.4,
                       type    = 'float',
-                      help    = 'PWM exp. filter weight'
+                      help    = 'PWM exp. filter time constant in seconds (0 for no filtering)'
                       )
 
     parser.add_option('-t', '--temp-filter',
                       dest    = 'tempFilter',
                       metavar = 'TEMPFILTER',
-                      default = 0.1,
+                      default = 0.4,
                       type    = 'float',
-                      help    = 'Temp. exp. filter weight'
+                      help    = 'Temp. exp. filter time constant in seconds (0 for no filtering)'
+                      )
+
+    parser.add_option('-g', '--pwm-filter-gain',
+                      dest    = 'pwmFilterGain',
+                      metavar = 'PWMFILTERGAIN',
+                      default = None,
+                      type    = 'float',
+                      help    = 'PWM adaptive filter gain (time constant divided by 1 + gain * deviation in %, 0 for plain exp. filter)'
                       )
 
     parser.add_option('-f', '--filename',
@@ -97,7 +105,7 @@ def main():
                     'GetTempWeights', 'SetTempWeights', 'SaveTempWeights',
                     'GetPwmMap', 'SetPwmMap', 'SavePwmMap',
 		    'DumpJson', 'LoadJson', 'LoadCommitJson', 'VerifyJson',
-		    'ModeManual', 'ModeAuto', 'ModeFailsafe' ]
+		    'ModeManual', 'ModeAuto', 'ModeFailsafe', 'ModePid' ]
 
     parser.add_option('-c', '--command',
                       dest    = 'cmds',
@@ -149,11 +157,12 @@ def main():
                 rc = 5
             else:
                 print 'GetFilter OK'
-                print 'Filt_PWM:    {}'.format(ctrl.pwmWeight)
-                print 'Filt_temp:   {}'.format(ctrl.tempWeight)
+                print 'Filt_PWM_tc:  {}'.format(ctrl.pwmTc)
+                print 'Filt_temp_tc: {}'.format(ctrl.tempTc)
+                print 'Filt_PWM_gain: {}'.format(ctrl.pwmGain)
     
         elif(cmd == 'SetFilter'):
-            if not ctrl.SetPwmFilt(options.pwmFilter, options.tempFilter):
+            if not ctrl.SetPwmFilt(options.pwmFilter, options.tempFilter, options.pwmFilterGain):
                 logging.error('SetPwmFilt failed')
                 rc = 6
             else:
@@ -343,6 +352,13 @@ def main():
             else:
                 print 'ModeFailsafe OK'
 
+        elif(cmd == 'ModePid'):
+	    if not ctrl.ModePid():
+                logging.error('ModePid failed')
+                rc = 17
+            else:
+                print 'ModePid OK'
+
 
 	#------- Monitor -------
         elif(cmd == 'Monitor'):
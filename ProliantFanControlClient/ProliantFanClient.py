@@ -22,6 +22,9 @@ class FanController(object):
     def __init__(self, comPort='COM6', timeout=2, waitForReset=False):
         self.numFans       = -1
         self.numTemps      = -1
+        self.numPwmInputs  = 1
+        self.pwmIns        = []
+        self.fanRpms       = []
 
         self.tempWeights   = None
         self.pwmMap        = None
@@ -29,14 +32,26 @@ class FanController(object):
         self.pwmStepSize   = -1
         self.pwmNumCoeffs  = -1
 
-        self.pwmWeight     = -1.0
-        self.tempWeight    = -1.0
+        self.pwmTc         = -1.0   # exp. filter time constants in s
+        self.tempTc        = -1.0
+        self.pwmGain       = 0.0    # adaptive PWM filter gain
+        self.tempKalman    = None   # temp. Kalman filter [q, r], q 0.0 - exp. filter
 
         self.tempStep      = -1
         self.tempMin       = -1
         self.tempMax       = -1
         self.tempNumCoeffs = -1
 
+        self.tempAxis      = None
+        self.pwmAxis       = None
+
+        self.fanCtrl       = None   # 'TABLE' or 'MAXCURVE' for each fan
+        self.tempCurves    = None   # [fan][sensor] list of [temp, duty] points
+        self.pid           = None   # [fan] setpoint, Kp, Ki, Kd
+        self.feedFwd       = None   # [fan] gain, max. boost, decay
+        self.fanBoosts     = None   # feed-forward boost from the last report
+        self.slew          = None   # [fan] rise, fall, hysteresis up, down (+ 'MANUAL')
+
         self.comPort       = comPort
         self.timeout       = timeout
         self.waitForReset  = waitForReset
@@ -45,7 +60,7 @@ class FanController(object):
 
     def Open(self):
         try:
-            self.serPort = serial.Serial(port=self.comPort, baudrate=19200, timeout=self.timeout)
+            self.serPort = serial.Serial(port=self.comPort, baudrate=115200, timeout=self.timeout)
         except serial.serialutil.SerialException as ex:
             logging.error('Cannot open serial port: "{}"'.format(ex))
             return False
@@ -71,17 +86,39 @@ class FanController(object):
         # initialize the 2 dim array
         self.tempWeights = [[-1.0 for x in range(self.numTemps)] for y in range(self.numFans)]
 
-        # initialize the 3 dim array
-        self.pwmMap = [[[-1.0 for x in range(self.pwmNumCoeffs)] for y in range(self.tempNumCoeffs)] for z in range(self.numFans)]
+        self.fanCtrl    = ['TABLE' for x in range(self.numFans)]
+        self.tempCurves = [[[] for x in range(self.numTemps)] for y in range(self.numFans)]
+        self.pid        = [[] for x in range(self.numFans)]
+        self.feedFwd    = [[] for x in range(self.numFans)]
+        self.slew       = [[] for x in range(self.numFans)]
+
+        self.InitMap()
 
         return True
 
 
+    # axes and the map according to the geometry from GetHwConfig
+    def InitMap(self):
+        # default (uniform) axes, older firmware does not support the axis commands
+        self.tempAxis = [self.tempMin + self.tempStep * t for t in range(self.tempNumCoeffs)]
+        self.pwmAxis  = [self.pwmStepSize * p for p in range(self.pwmNumCoeffs)]
+
+        if not self.GetTempAxis() or not self.GetPwmAxis():
+            logging.warning('Cannot read the mapping table axes, using the uniform ones')
+
+        # initialize the 3 dim array
+        self.pwmMap = [[[-1.0 for x in range(self.pwmNumCoeffs)] for y in range(self.tempNumCoeffs)] for z in range(self.numFans)]
+
+
     def ReadAll(self):
         if not self.GetPwmFilt():
             logging.error('GetPwmFilt failed')
             return False
 
+        if not self.GetTempKalman():
+            logging.error('GetTempKalman failed')
+            return False
+
         if not self.GetAllTempWeights():
             logging.error('GetAllTempWeights failed')
             return False
@@ -90,6 +127,23 @@ class FanController(object):
             logging.error('GetPwmMapAll failed')
             return False
 
+        if not self.GetFanCtrlAll():
+            logging.error('GetFanCtrlAll failed')
+            return False
+
+        for f in range(self.numFans):
+            if not self.GetPid(f+1):
+                logging.error('GetPid failed')
+                return False
+
+            if not self.GetFeedFwd(f+1):
+                logging.error('GetFeedFwd failed')
+                return False
+
+            if not self.GetSlew(f+1):
+                logging.error('GetSlew failed')
+                return False
+
         return True
 
     def Dump(self, fileName=None):
@@ -105,17 +159,39 @@ class FanController(object):
         print('Num_Temps:   {}'.format(self.numTemps),      file=f)
         print('PWM_step:    {}'.format(self.pwmStepSize),   file=f)
         print('PWM_coeffs:  {}'.format(self.pwmNumCoeffs),  file=f)
-        print('Filt_PWM:    {}'.format(self.pwmWeight),     file=f)
-        print('Filt_temp:   {}'.format(self.tempWeight),    file=f)
+        print('Filt_PWM_tc:  {}'.format(self.pwmTc),        file=f)
+        print('Filt_temp_tc: {}'.format(self.tempTc),       file=f)
+        print('Filt_PWM_gain: {}'.format(self.pwmGain),     file=f)
+        print('Temp_Kalman: {}'.format(', '.join(str(x) for x in self.tempKalman)), file=f)
         print('Temp_step:   {}'.format(self.tempStep),      file=f)
         print('Temp_min:    {}'.format(self.tempMin),       file=f)
         print('Temp_max:    {}'.format(self.tempMax),       file=f)
         print('Temp_coeffs: {}'.format(self.tempNumCoeffs), file=f)
+        print('Temp_axis:   ' + ', '.join(str(x) for x in self.tempAxis), file=f)
+        print('PWM_axis:    ' + ', '.join(str(x) for x in self.pwmAxis),  file=f)
 
         print('TempWeights:', file=f)
         for fan in range(self.numFans):
             print('  Fan_{}: '.format(fan+1) + ', '.join(str(x) for x in self.tempWeights[fan]), file=f)
 
+        print('FanCtrl:', file=f)
+        for fan in range(self.numFans):
+            print('  Fan_{}: {}'.format(fan+1, self.fanCtrl[fan]), file=f)
+            for s in range(self.numTemps):
+                print('    T{}: '.format(s) + ' '.join('{}:{}'.format(p[0], p[1]) for p in self.tempCurves[fan][s]), file=f)
+
+        print('PID:', file=f)
+        for fan in range(self.numFans):
+            print('  Fan_{}: '.format(fan+1) + ', '.join(str(x) for x in self.pid[fan]), file=f)
+
+        print('FeedFwd:', file=f)
+        for fan in range(self.numFans):
+            print('  Fan_{}: '.format(fan+1) + ', '.join(str(x) for x in self.feedFwd[fan]), file=f)
+
+        print('Slew:', file=f)
+        for fan in range(self.numFans):
+            print('  Fan_{}: '.format(fan+1) + ', '.join(str(x) for x in self.slew[fan]), file=f)
+
         print('PwmMap:', file=f)
         for fan in range(self.numFans):
             print('  Fan_{}: '.format(fan+1), file=f)
@@ -131,12 +207,16 @@ class FanController(object):
         data['Num_Temps']   = self.numTemps
         data['PWM_step']    = self.pwmStepSize
         data['PWM_coeffs']  = self.pwmNumCoeffs
-        data['Filt_PWM']    = self.pwmWeight
-        data['Filt_temp']   = self.tempWeight
+        data['Filt_PWM_tc']   = self.pwmTc
+        data['Filt_temp_tc']  = self.tempTc
+        data['Filt_PWM_gain'] = self.pwmGain
+        data['Temp_Kalman']   = self.tempKalman
         data['Temp_step']   = self.tempStep
         data['Temp_min']    = self.tempMin
         data['Temp_max']    = self.tempMax
         data['Temp_coeffs'] = self.tempNumCoeffs
+        data['Temp_axis']   = self.tempAxis
+        data['PWM_axis']    = self.pwmAxis
 
         tw = {}
         for fan in range(self.numFans):
@@ -144,6 +224,21 @@ class FanController(object):
 
         data['TempWeights'] = tw
 
+        fc = {}
+        tc = {}
+        for fan in range(self.numFans):
+            fc['Fan_{}'.format(fan+1)] = self.fanCtrl[fan]
+            tc['Fan_{}'.format(fan+1)] = dict(('T{}'.format(s), self.tempCurves[fan][s]) for s in range(self.numTemps))
+
+        data['FanCtrl']    = fc
+        data['TempCurves'] = tc
+
+        data['PID'] = dict(('Fan_{}'.format(fan+1), self.pid[fan]) for fan in range(self.numFans))
+
+        data['FeedFwd'] = dict(('Fan_{}'.format(fan+1), self.feedFwd[fan]) for fan in range(self.numFans))
+
+        data['Slew'] = dict(('Fan_{}'.format(fan+1), self.slew[fan]) for fan in range(self.numFans))
+
         m = {}
         for fan in range(self.numFans):
             tp = {}
@@ -181,35 +276,48 @@ class FanController(object):
 
 	#--- Filt ---
 	pwmFiltVal = None
-	pwmFilt = data.get('Filt_PWM')
-	if pwmFilt:
+	pwmFilt = data.get('Filt_PWM_tc')
+	if pwmFilt is not None:
 	    pwmFiltVal = float(pwmFilt)
-	    if pwmFiltVal>=0.0 and pwmFiltVal<=1.0:
-		logging.debug('Got Filt_PWM = {}'.format(pwmFiltVal))
+	    if pwmFiltVal>=0.0 and pwmFiltVal<=60.0:
+		logging.debug('Got Filt_PWM_tc = {}'.format(pwmFiltVal))
 		# some action
-		self.pwmWeight = pwmFiltVal
+		self.pwmTc = pwmFiltVal
 		
 	    else:
-		logging.error('Filt_PWM out of range: {}'.format(val))
+		logging.error('Filt_PWM_tc out of range: {}'.format(pwmFilt))
 		f.close()
 		return False
 
 	tempFiltVal = None
-	tempFilt = data.get('Filt_temp')
-	if tempFilt:
+	tempFilt = data.get('Filt_temp_tc')
+	if tempFilt is not None:
 	    tempFiltVal = float(tempFilt)
-	    if tempFiltVal>=0.0 and tempFiltVal<=1.0:
-		logging.debug('Got Filt_temp = {}'.format(tempFiltVal))
+	    if tempFiltVal>=0.0 and tempFiltVal<=60.0:
+		logging.debug('Got Filt_temp_tc = {}'.format(tempFiltVal))
 		# some action
-		self.tempWeight = tempFiltVal
+		self.tempTc = tempFiltVal
 		
 	    else:
-		logging.error('Filt_temp out of range: {}'.format(val))
+		logging.error('Filt_temp_tc out of range: {}'.format(tempFilt))
+		f.close()
+		return False
+
+	pwmGainVal = None
+	pwmGain = data.get('Filt_PWM_gain')
+	if pwmGain is not None:
+	    pwmGainVal = float(pwmGain)
+	    if pwmGainVal>=0.0 and pwmGainVal<=1.0:
+		logging.debug('Got Filt_PWM_gain = {}'.format(pwmGainVal))
+		self.pwmGain = pwmGainVal
+
+	    else:
+		logging.error('Filt_PWM_gain out of range: {}'.format(pwmGain))
 		f.close()
 		return False
 
-	if pwmFiltVal or tempFiltVal:
-	    if not self.SetPwmFilt(self.pwmWeight, self.tempWeight) or not self.GetPwmFilt():
+	if pwmFiltVal is not None or tempFiltVal is not None or pwmGainVal is not None:
+	    if not self.SetPwmFilt(self.pwmTc, self.tempTc, self.pwmGain) or not self.GetPwmFilt():
 		f.close()
 		return False
 
@@ -218,6 +326,18 @@ class FanController(object):
 		    f.close()
 		    return False
 
+	tKalman = data.get('Temp_Kalman')
+	if tKalman:
+	    if len(tKalman) != 2 or not self.SetTempKalman(*tKalman) or not self.GetTempKalman():
+		logging.error('Wrong Temp_Kalman: {}'.format(tKalman))
+		f.close()
+		return False
+
+	    if save:
+		if not self.SaveTempKalman():
+		    f.close()
+		    return False
+
 	#--- TempWeights ---
 	tWeights = data.get('TempWeights')
 	if tWeights:
@@ -252,6 +372,132 @@ class FanController(object):
 		    return False
 
 
+	#--- Fan control and temperature curves ---
+	tCurves = data.get('TempCurves')
+	if tCurves:
+	    for fan in range(self.numFans):
+		fCurves = tCurves.get('Fan_{}'.format(fan+1))
+		if not fCurves:
+		    continue
+
+		for s in range(self.numTemps):
+		    points = fCurves.get('T{}'.format(s))
+		    if points and not self.SetTempCurve(fan+1, s, points):
+			f.close()
+			return False
+
+		if not self.GetFanCtrl(fan+1):
+		    f.close()
+		    return False
+
+		if save:
+		    if not self.SaveTempCurve(fan+1):
+			f.close()
+			return False
+
+	fCtrl = data.get('FanCtrl')
+	if fCtrl:
+	    for fan in range(self.numFans):
+		ctrl = fCtrl.get('Fan_{}'.format(fan+1))
+		if ctrl and (not self.SetFanCtrl(fan+1, ctrl) or not self.GetFanCtrl(fan+1)):
+		    f.close()
+		    return False
+
+	    if save:
+		if not self.SaveFanCtrl():
+		    f.close()
+		    return False
+
+	#--- PID ---
+	pid = data.get('PID')
+	if pid:
+	    for fan in range(self.numFans):
+		vals = pid.get('Fan_{}'.format(fan+1))
+		if not vals:
+		    continue
+
+		if len(vals) != 4 or not self.SetPid(fan+1, *vals) or not self.GetPid(fan+1):
+		    logging.error('Wrong PID for fan {}: {}'.format(fan+1, vals))
+		    f.close()
+		    return False
+
+		if save:
+		    if not self.SavePid(fan+1):
+			f.close()
+			return False
+
+	#--- Feed-forward boost ---
+	ff = data.get('FeedFwd')
+	if ff:
+	    for fan in range(self.numFans):
+		vals = ff.get('Fan_{}'.format(fan+1))
+		if not vals:
+		    continue
+
+		if len(vals) != 3 or not self.SetFeedFwd(fan+1, *vals) or not self.GetFeedFwd(fan+1):
+		    logging.error('Wrong feed-forward for fan {}: {}'.format(fan+1, vals))
+		    f.close()
+		    return False
+
+		if save:
+		    if not self.SaveFeedFwd(fan+1):
+			f.close()
+			return False
+
+	#--- Output slew rate and hysteresis ---
+	slew = data.get('Slew')
+	if slew:
+	    for fan in range(self.numFans):
+		vals = slew.get('Fan_{}'.format(fan+1))
+		if not vals:
+		    continue
+
+		if len(vals) not in (4, 5) or not self.SetSlew(fan+1, *vals) or not self.GetSlew(fan+1):
+		    logging.error('Wrong slew rate for fan {}: {}'.format(fan+1, vals))
+		    f.close()
+		    return False
+
+		if save:
+		    if not self.SaveSlew(fan+1):
+			f.close()
+			return False
+
+	#--- Geometry (resets the axes and the map) ---
+	geom = [data.get('Temp_min'), data.get('Temp_step'), data.get('Temp_max'), data.get('PWM_step')]
+	if None not in geom and geom != [self.tempMin, self.tempStep, self.tempMax, self.pwmStepSize]:
+	    logging.info('Changing mapping table geometry to {}'.format(geom))
+	    if not self.SetMapGeometry(*geom):
+		f.close()
+		return False
+
+	    if save:
+		if not self.SaveMapGeometry():
+		    f.close()
+		    return False
+
+	#--- Axes (before the map, its temperatures are the axis breakpoints) ---
+	tAxis = data.get('Temp_axis')
+	if tAxis:
+	    if not self.SetTempAxis([int(x) for x in tAxis]) or not self.GetTempAxis():
+		f.close()
+		return False
+
+	    if save:
+		if not self.SaveTempAxis():
+		    f.close()
+		    return False
+
+	pAxis = data.get('PWM_axis')
+	if pAxis:
+	    if not self.SetPwmAxis([int(x) for x in pAxis]) or not self.GetPwmAxis():
+		f.close()
+		return False
+
+	    if save:
+		if not self.SavePwmAxis():
+		    f.close()
+		    return False
+
 	#--- PWM_map ---
 	pwmMap = data.get('PWM_map')
 	if pwmMap:
@@ -308,39 +554,44 @@ class FanController(object):
 
 	#--- Filt ---
 	pwmFiltVal = None
-	pwmFilt = data.get('Filt_PWM')
-	if pwmFilt:
+	pwmFilt = data.get('Filt_PWM_tc')
+	if pwmFilt is not None:
 	    pwmFiltVal = float(pwmFilt)
-	    if pwmFiltVal>=0.0 and pwmFiltVal<=1.0:
+	    if pwmFiltVal>=0.0 and pwmFiltVal<=60.0:
 		# some action
-		if self.pwmWeight != pwmFiltVal:
-		    logging.error('Filt_PWM mismatch: JSON {} != ctrl {}'.format(pwmFiltVal, self.pwmWeight))
+		if self.pwmTc != pwmFiltVal:
+		    logging.error('Filt_PWM_tc mismatch: JSON {} != ctrl {}'.format(pwmFiltVal, self.pwmTc))
 		    rc = False
 
-		logging.debug('Verified Filt_PWM = {}'.format(pwmFiltVal))
+		logging.debug('Verified Filt_PWM_tc = {}'.format(pwmFiltVal))
 		
 	    else:
-		logging.error('Filt_PWM out of range: {}'.format(val))
+		logging.error('Filt_PWM_tc out of range: {}'.format(pwmFilt))
 		f.close()
 		return False
 
 	tempFiltVal = None
-	tempFilt = data.get('Filt_temp')
-	if tempFilt:
+	tempFilt = data.get('Filt_temp_tc')
+	if tempFilt is not None:
 	    tempFiltVal = float(tempFilt)
-	    if tempFiltVal>=0.0 and tempFiltVal<=1.0:
+	    if tempFiltVal>=0.0 and tempFiltVal<=60.0:
 		# some action
-		if self.tempWeight != tempFiltVal:
-		    logging.error('Filt_temp mismatch: JSON {} != ctrl {}'.format(tempFiltVal, self.tempWeight))
+		if self.tempTc != tempFiltVal:
+		    logging.error('Filt_temp_tc mismatch: JSON {} != ctrl {}'.format(tempFiltVal, self.tempTc))
 		    rc = False
 
-		logging.debug('Verified Filt_temp = {}'.format(tempFiltVal))
+		logging.debug('Verified Filt_temp_tc = {}'.format(tempFiltVal))
 		
 	    else:
-		logging.error('Filt_temp out of range: {}'.format(val))
+		logging.error('Filt_temp_tc out of range: {}'.format(tempFilt))
 		f.close()
 		return False
 
+	pwmGain = data.get('Filt_PWM_gain')
+	if pwmGain is not None and self.pwmGain != float(pwmGain):
+	    logging.error('Filt_PWM_gain mismatch: JSON {} != ctrl {}'.format(pwmGain, self.pwmGain))
+	    rc = False
+
 	#--- TempWeights ---
 	tWeights = data.get('TempWeights')
 	if tWeights:
@@ -373,6 +624,17 @@ class FanController(object):
 		    return False
 
 
+	#--- Axes ---
+	tAxis = data.get('Temp_axis')
+	if tAxis and [int(x) for x in tAxis] != self.tempAxis:
+	    logging.error('Temp_axis mismatch: JSON {} != ctrl {}'.format(tAxis, self.tempAxis))
+	    rc = False
+
+	pAxis = data.get('PWM_axis')
+	if pAxis and [int(x) for x in pAxis] != self.pwmAxis:
+	    logging.error('PWM_axis mismatch: JSON {} != ctrl {}'.format(pAxis, self.pwmAxis))
+	    rc = False
+
 	#--- PWM_map ---
 	pwmMap = data.get('PWM_map')
 	if pwmMap:
@@ -429,21 +691,26 @@ class FanController(object):
         self.serPort = None
 
 
-    def Tmp2Idx(self, temp):
-        if temp <= self.tempMin:
-            return 0
+    # index of the last breakpoint <= value (0 below the axis), same as the controller
+    def AxisIdx(self, axis, value):
+        idx = len(axis) - 1
+        while idx > 0 and axis[idx] > value:
+            idx = idx - 1
 
-        if temp >= self.tempMax:
-            return self.tempNumCoeffs - 1
+        return idx
 
-        if ((temp - self.tempMin) % self.tempStep) != 0:
+
+    def Tmp2Idx(self, temp):
+        idx = self.AxisIdx(self.tempAxis, temp)
+
+        if temp > self.tempAxis[0] and temp < self.tempAxis[-1] and temp != self.tempAxis[idx]:
             logging.warning('Temp {} is not on the grid'.format(temp))
 
-        return (temp - self.tempMin) / self.tempStep
+        return idx
 
 
     def Idx2Tmp(self, idx):
-        if self.tempStep < 0:
+        if self.tempAxis is None:
             logging.error('Not initialized yet')
             return False
 
@@ -451,7 +718,7 @@ class FanController(object):
             logging.error('Wrong index')
             return False
         
-        return self.tempMin + self.tempStep * idx
+        return self.tempAxis[idx]
 
     
     def SendCommand(self, command):
@@ -484,11 +751,14 @@ class FanController(object):
 
 
     # returns mode, pwmIn, temps, fans
+    # pwmIn is the first PWM input, all of them are in self.pwmIns, fan RPMs are in self.fanRpms
     def ParseAsyncReport(self, report):
         logging.debug('ParseAsyncReport: {}'.format(report))
         tokens = report.split()
         numTokens = len(tokens)
-        expTokens = self.numTemps + self.numFans + 2  # first token + pwm in
+        expTokens = self.numTemps + 2*self.numFans + self.numPwmInputs + 1  # first token + pwm in(s) + fans out and rpm
+        if report[1:2] in ('A', 'P'):
+            expTokens += self.numFans   # feed-forward boost
         if numTokens != expTokens:
             logging.error('Wrong number of tokens, expected {} received {}'.format(expTokens, numTokens))
             return None
@@ -496,19 +766,32 @@ class FanController(object):
         modeStr = tokens[0]
         mode = modeStr[1]
         
-        pwmInStr = tokens[1]
-        pwmIn = int(pwmInStr.split(':', 2)[1]) 
-        
-        tempsStr = tokens[2:2+self.numTemps]
+        self.pwmIns = []
+        for i in range(self.numPwmInputs):
+            self.pwmIns.append(int(tokens[1+i].split(':', 2)[1]))
+        pwmIn = self.pwmIns[0]
+
+        tempsStart = 1 + self.numPwmInputs
+        tempsStr = tokens[tempsStart:tempsStart+self.numTemps]
         temps = []
         for i in range(self.numTemps):
-            temps.append(int(tempsStr[i].split(':', 2)[1]))
+            temps.append(float(tempsStr[i].split(':', 2)[1]))
 
-        fansStr = tokens[2+self.numTemps:]
+        fansStr = tokens[tempsStart+self.numTemps:]
         fans = []
         for i in range(self.numFans):
             fans.append(int(fansStr[i].split(':', 2)[1]))
 
+        self.fanRpms = []
+        for i in range(self.numFans):
+            self.fanRpms.append(int(fansStr[self.numFans+i].split(':', 2)[1]))
+
+        # included in the fans out already
+        self.fanBoosts = [0] * self.numFans
+        if len(fansStr) > 2*self.numFans:
+            for i in range(self.numFans):
+                self.fanBoosts[i] = int(fansStr[2*self.numFans+i].split(':', 2)[1])
+
         logging.debug('Parsed mode:{}, pwmIn:{}, temps:{}, fans:{}'.format(mode, pwmIn, str(temps), str(fans)))
         return (mode, pwmIn, temps, fans)
 
@@ -543,6 +826,9 @@ class FanController(object):
             elif n=='Temps':
                 self.numTemps = int(v)
 
+            elif n=='PWM_inputs':
+                self.numPwmInputs = int(v)
+
             elif n=='PWM_step':
                 self.pwmStepSize = int(v)
 
@@ -575,6 +861,212 @@ class FanController(object):
 
         return True
 
+    #--------------------- Fan control -------------------
+    # GetFanCtrl F1 and GetTempCurve F1 T<n> for all the sensors
+    def GetFanCtrl(self, fan):
+        succ,resp = self.SendCommand('GetFanCtrl F{}'.format(fan))
+        if not succ:
+            return False
+
+        respSplit = resp.split()
+        if len(respSplit) != 2 or respSplit[0] != 'F{}'.format(fan):
+            logging.error('Wrong response format: ' + resp)
+            return False
+
+        self.fanCtrl[fan-1] = respSplit[1]
+
+        for s in range(self.numTemps):
+            succ,resp = self.SendCommand('GetTempCurve F{} T{}'.format(fan, s))
+            if not succ:
+                return False
+
+            respSplit = resp.split()
+            if respSplit[:2] != ['F{}'.format(fan), 'T{}'.format(s)]:
+                logging.error('Wrong response format: ' + resp)
+                return False
+
+            self.tempCurves[fan-1][s] = [[int(x) for x in p.split(':')] for p in respSplit[2:]]
+
+        logging.debug('Fan {} control {}, curves {}'.format(fan, self.fanCtrl[fan-1], self.tempCurves[fan-1]))
+        return True
+
+    def GetFanCtrlAll(self):
+        for f in range(self.numFans):
+            if not self.GetFanCtrl(f+1):
+                return False
+
+        return True
+
+    # SetFanCtrl F1 MAXCURVE
+    def SetFanCtrl(self, fan, ctrl):
+        succ,resp = self.SendCommand('SetFanCtrl F{} {}'.format(fan, ctrl))
+        return succ
+
+    def SaveFanCtrl(self):
+        succ,resp = self.SendCommand('SaveFanCtrl')
+        return succ
+
+    # SetTempCurve F1 T1 30:0 40:50 50:80 60:100
+    def SetTempCurve(self, fan, sensor, points):
+        succ,resp = self.SendCommand('SetTempCurve F{} T{} {}'.format(fan, sensor,
+                                                                      ' '.join('{}:{}'.format(p[0], p[1]) for p in points)))
+        return succ
+
+    # SaveTempCurve F1 - all the sensors of the fan
+    def SaveTempCurve(self, fan):
+        succ,resp = self.SendCommand('SaveTempCurve F{}'.format(fan))
+        return succ
+
+    #--------------------- PID -------------------
+    # GetPid F1 -> F1 45 5.000 0.100 0.000 (setpoint, Kp, Ki, Kd)
+    def GetPid(self, fan):
+        succ,resp = self.SendCommand('GetPid F{}'.format(fan))
+        if not succ:
+            return False
+
+        respSplit = resp.split()
+        if len(respSplit) != 5 or respSplit[0] != 'F{}'.format(fan):
+            logging.error('Wrong response format: ' + resp)
+            return False
+
+        self.pid[fan-1] = [int(respSplit[1])] + [float(x) for x in respSplit[2:]]
+        logging.debug('Fan {} PID {}'.format(fan, self.pid[fan-1]))
+        return True
+
+    # SetPid F1 45 5.0 0.1 0.0
+    def SetPid(self, fan, setpoint, kp, ki, kd):
+        succ,resp = self.SendCommand('SetPid F{} {} {} {} {}'.format(fan, setpoint, kp, ki, kd))
+        return succ
+
+    def SavePid(self, fan):
+        succ,resp = self.SendCommand('SavePid F{}'.format(fan))
+        return succ
+
+    #--------------------- Feed-forward boost -------------------
+    # GetFeedFwd F1 -> F1 20 30 2 (gain, max. boost, decay)
+    def GetFeedFwd(self, fan):
+        succ,resp = self.SendCommand('GetFeedFwd F{}'.format(fan))
+        if not succ:
+            return False
+
+        respSplit = resp.split()
+        if len(respSplit) != 4 or respSplit[0] != 'F{}'.format(fan):
+            logging.error('Wrong response format: ' + resp)
+            return False
+
+        self.feedFwd[fan-1] = [int(x) for x in respSplit[1:]]
+        logging.debug('Fan {} feed-forward {}'.format(fan, self.feedFwd[fan-1]))
+        return True
+
+    # SetFeedFwd F1 20 30 2
+    def SetFeedFwd(self, fan, gain, maxBoost, decay):
+        succ,resp = self.SendCommand('SetFeedFwd F{} {} {} {}'.format(fan, gain, maxBoost, decay))
+        return succ
+
+    def SaveFeedFwd(self, fan):
+        succ,resp = self.SendCommand('SaveFeedFwd F{}'.format(fan))
+        return succ
+
+    #--------------------- Output slew rate and hysteresis -------------------
+    # GetSlew F1 -> F1 20 5 0 2 [MANUAL] (rise, fall, hysteresis up, down)
+    def GetSlew(self, fan):
+        succ,resp = self.SendCommand('GetSlew F{}'.format(fan))
+        if not succ:
+            return False
+
+        respSplit = resp.split()
+        if len(respSplit) not in (5, 6) or respSplit[0] != 'F{}'.format(fan):
+            logging.error('Wrong response format: ' + resp)
+            return False
+
+        self.slew[fan-1] = [int(x) for x in respSplit[1:5]] + respSplit[5:]
+        logging.debug('Fan {} slew {}'.format(fan, self.slew[fan-1]))
+        return True
+
+    # SetSlew F1 20 5 0 2 [MANUAL]
+    def SetSlew(self, fan, rise, fall, hystUp, hystDown, manual=''):
+        succ,resp = self.SendCommand('SetSlew F{} {} {} {} {} {}'.format(fan, rise, fall, hystUp, hystDown, manual).rstrip())
+        return succ
+
+    def SaveSlew(self, fan):
+        succ,resp = self.SendCommand('SaveSlew F{}'.format(fan))
+        return succ
+
+    #--------------------- Mapping table geometry -------------------
+    # SetMapGeometry 20 5 55 5 - resets the axes and the map, the config is re-read
+    def SetMapGeometry(self, tempMin, tempStep, tempMax, pwmStep):
+        succ,resp = self.SendCommand('SetMapGeometry {} {} {} {}'.format(tempMin, tempStep, tempMax, pwmStep))
+        if not succ:
+            return False
+
+        if not self.GetHwConfig():
+            return False
+
+        self.InitMap()
+        return self.GetPwmMapAll()
+
+    # saves also the axes and the whole map
+    def SaveMapGeometry(self):
+        succ,resp = self.SendCommand('SaveMapGeometry')
+        return succ
+
+    #--------------------- Mapping table axes -------------------
+    def GetAxis(self, cmd, numCoeffs):
+        succ,resp = self.SendCommand(cmd)
+        if not succ:
+            return None
+
+        respSplit = resp.split()
+        if len(respSplit) != numCoeffs:
+            logging.error('Wrong response format: ' + resp)
+            return None
+
+        return [int(x) for x in respSplit]
+
+    def GetTempAxis(self):
+        axis = self.GetAxis('GetTempAxis', self.tempNumCoeffs)
+        if axis is None:
+            return False
+
+        self.tempAxis = axis
+        logging.debug('Temp. axis: {}'.format(self.tempAxis))
+        return True
+
+    # SetTempAxis 20 30 35 40 44 48 52 60
+    def SetTempAxis(self, axis):
+        if len(axis) != self.tempNumCoeffs:
+            logging.error('Wrong number of temp. axis values (expected {} but got {})'.format(self.tempNumCoeffs, len(axis)))
+            return False
+
+        succ,resp = self.SendCommand('SetTempAxis ' + ' '.join([str(i) for i in axis]))
+        return succ
+
+    def SaveTempAxis(self):
+        succ,resp = self.SendCommand('SaveTempAxis')
+        return succ
+
+    def GetPwmAxis(self):
+        axis = self.GetAxis('GetPwmAxis', self.pwmNumCoeffs)
+        if axis is None:
+            return False
+
+        self.pwmAxis = axis
+        logging.debug('PWM axis: {}'.format(self.pwmAxis))
+        return True
+
+    # SetPwmAxis 0 5 10 15 20 25 30 35 40 45 50 55 60 65 70 75 80 85 90 95 100
+    def SetPwmAxis(self, axis):
+        if len(axis) != self.pwmNumCoeffs:
+            logging.error('Wrong number of PWM axis values (expected {} but got {})'.format(self.pwmNumCoeffs, len(axis)))
+            return False
+
+        succ,resp = self.SendCommand('SetPwmAxis ' + ' '.join([str(i) for i in axis]))
+        return succ
+
+    def SavePwmAxis(self):
+        succ,resp = self.SendCommand('SavePwmAxis')
+        return succ
+
     #--------------------- Temperature -------------------
     def GetTempWeights(self, fan):
         if self.numFans <= 0:
@@ -660,24 +1152,52 @@ class FanController(object):
             return False
 
         respSplit = resp.split()
-        if len(respSplit) != 2:
+        if len(respSplit) not in (2, 3):
             logging.error('Wrong response format: ' + resp)
             return False
         
-        self.pwmWeight  = float(respSplit[0])
-        self.tempWeight = float(respSplit[1])
-        logging.debug('PWM exponential filter: PWM weight is {} and temp weight is {}'.format(self.pwmWeight, self.tempWeight))
+        self.pwmTc      = float(respSplit[0])
+        self.tempTc     = float(respSplit[1])
+        self.pwmGain    = float(respSplit[2]) if len(respSplit) > 2 else 0.0
+        logging.debug('Exponential filter: PWM time constant is {} s (gain {}) and temp time constant is {} s'.format(self.pwmTc, self.pwmGain, self.tempTc))
         return True
 
-    # SetPwmFilt 0.1 0.1
-    def SetPwmFilt(self, pwmWeight, tempWeight):
-        succ,resp = self.SendCommand('SetPwmFilt {} {}'.format(pwmWeight, tempWeight))
+    # SetPwmFilt 0.4 0.4 [0.4] (time constants in s)
+    def SetPwmFilt(self, pwmTc, tempTc, pwmGain=None):
+        if pwmGain is None:
+            succ,resp = self.SendCommand('SetPwmFilt {} {}'.format(pwmTc, tempTc))
+        else:
+            succ,resp = self.SendCommand('SetPwmFilt {} {} {}'.format(pwmTc, tempTc, pwmGain))
         return succ
 
     def SavePwmFilt(self):
         succ,resp = self.SendCommand('SavePwmFilt')
         return succ
 
+    # GetTempKalman -> 1.000000 1.0000 (q, r)
+    def GetTempKalman(self):
+        succ,resp = self.SendCommand('GetTempKalman')
+        if not succ:
+            return False
+
+        respSplit = resp.split()
+        if len(respSplit) != 2:
+            logging.error('Wrong response format: ' + resp)
+            return False
+
+        self.tempKalman = [float(x) for x in respSplit]
+        logging.debug('Temp. Kalman filter: q {} r {}'.format(*self.tempKalman))
+        return True
+
+    # SetTempKalman 1.0 1.0
+    def SetTempKalman(self, q, r):
+        succ,resp = self.SendCommand('SetTempKalman {} {}'.format(q, r))
+        return succ
+
+    def SaveTempKalman(self):
+        succ,resp = self.SendCommand('SaveTempKalman')
+        return succ
+
 
 
     # FAN - 1 based, realtemp
@@ -806,6 +1326,11 @@ class FanController(object):
         succ,resp = self.SendCommand('ModeAuto')
         return succ
 
+    # ModePid
+    def ModePid(self):
+        succ,resp = self.SendCommand('ModePid')
+        return succ
+
     # ModeFailsafe
     def ModeFailsafe(self):
         succ,resp = self.SendCommand('ModeFailsafe')
@@ -822,53 +1347,76 @@ class FanController(object):
             tSum = tSum + self.tempWeights[index][a] * temps[a]
             wSum = wSum + self.tempWeights[index][a]
 
-        result = int(tSum / wSum)
+        # all zero weights mean plain average, the controller keeps 1/16 C (no truncation)
+        if wSum > 0.0:
+            result = tSum / wSum
+        else:
+            result = sum(temps) / float(self.numTemps)
 
-        if result < self.tempMin:
-            result = self.tempMin
-        elif result > self.tempMax:
-            result = self.tempMax
+        if result < self.tempAxis[0]:
+            result = self.tempAxis[0]
+        elif result > self.tempAxis[-1]:
+            result = self.tempAxis[-1]
 
         logging.debug('Average temp for fan {} is {}'.format(index, result))
         return result;
 
 
-    def InterpolatePwm(self, index, pwmIn, temp):
-        temp = temp - self.tempMin
+    # duty cycle from the temperature curve of the sensor, flat outside
+    def CurveDuty(self, index, sensor, temp):
+        points = self.tempCurves[index][sensor]
+        if temp <= points[0][0]:
+            return points[0][1]
+
+        for a in range(1, len(points)):
+            if temp < points[a][0]:
+                t1,d1 = points[a-1]
+                t2,d2 = points[a]
+                return d1 + (d2 - d1) * (temp - t1) / float(t2 - t1)
 
-        idxTmp1 = int(temp / self.tempStep)
-        distTmp = temp % self.tempStep
+        return points[-1][1]
+
+
+    def InterpolatePwm(self, index, pwmIn, temp):
+        idxTmp1 = self.AxisIdx(self.tempAxis, temp)
         idxTmp2 = idxTmp1
+        spanTmp = 1.0
+        distTmp = 0.0
 
-        if distTmp != 0:
-            idxTmp2 = idxTmp2+1
+        if idxTmp1 < self.tempNumCoeffs-1:
+            idxTmp2 = idxTmp1+1
+            spanTmp = float(self.tempAxis[idxTmp2] - self.tempAxis[idxTmp1])
+            distTmp = max(0.0, temp - self.tempAxis[idxTmp1])
 
         #print idxTmp1, distTmp, idxTmp2
 
 
-        idxPwm1 = int(pwmIn / self.pwmStepSize)
-        distPwm = pwmIn % self.pwmStepSize
+        idxPwm1 = self.AxisIdx(self.pwmAxis, pwmIn)
         idxPwm2 = idxPwm1
+        spanPwm = 1
+        distPwm = 0
 
-        if distPwm != 0:
-            idxPwm2 = idxPwm2+1
+        if idxPwm1 < self.pwmNumCoeffs-1:
+            idxPwm2 = idxPwm1+1
+            spanPwm = self.pwmAxis[idxPwm2] - self.pwmAxis[idxPwm1]
+            distPwm = pwmIn - self.pwmAxis[idxPwm1]
 
         #print idxPwm1, distPwm, idxPwm2
 
-        pwmVal1 = ( float(self.pwmMap[index][idxTmp1][idxPwm1]) * float(self.pwmStepSize-distPwm) \
+        pwmVal1 = ( float(self.pwmMap[index][idxTmp1][idxPwm1]) * float(spanPwm-distPwm) \
                     + \
                     float(self.pwmMap[index][idxTmp1][idxPwm2]) * float(distPwm) ) \
-                    / float(self.pwmStepSize)
+                    / float(spanPwm)
         #print pwmVal1
 
-        pwmVal2 = ( float(self.pwmMap[index][idxTmp2][idxPwm1]) * float(self.pwmStepSize-distPwm) \
+        pwmVal2 = ( float(self.pwmMap[index][idxTmp2][idxPwm1]) * float(spanPwm-distPwm) \
                     + \
                     float(self.pwmMap[index][idxTmp2][idxPwm2]) * float(distPwm) ) \
-                    / float(self.pwmStepSize)
+                    / float(spanPwm)
 
         #print pwmVal1
 
-        pwmOut = (pwmVal1 * float(self.tempStep-distTmp) + pwmVal2 * float(distTmp)) / float(self.tempStep)
+        pwmOut = (pwmVal1 * float(spanTmp-distTmp) + pwmVal2 * float(distTmp)) / float(spanTmp)
 
         logging.debug('Interpolated PWM out for fan {} is {}'.format(index, pwmOut))
         return int(pwmOut+0.5)
@@ -894,11 +1442,23 @@ class FanController(object):
                             logging.error('In failsafe mode fan {} should be the same as PWM in {} but is {}'.format(i+1, pwmIn, fans[i]))
                             success = False
 
-                elif mode=='A': # compute the magic
+                elif mode=='A' or mode=='P': # compute the magic
                     for i in range(self.numFans):
                         temp = self.AverageTemps(i, temps)
                         pwmOut = self.InterpolatePwm(i, pwmIn, temp)
-                        if fans[i] != pwmOut:
+                        if self.fanCtrl[i] == 'MAXCURVE':
+                            pwmOut = max([pwmOut] + [int(self.CurveDuty(i, s, temps[s]) + 0.5) for s in range(self.numTemps)])
+                        pwmOut = min(100, pwmOut + self.fanBoosts[i])
+                        # reported temps are rounded to 0.1C, the controller uses 1/16C
+                        if any(self.slew[i][:4]):
+                            # lags behind by the slew rate / hysteresis
+                            logging.debug('Fan {} output is conditioned ({} vs. {}), not checked'.format(i+1, fans[i], pwmOut))
+                        elif mode=='P':
+                            # PID state is unknown, the table is just the minimum
+                            if fans[i] < pwmOut - 1:
+                                logging.error('In PID mode fan {} should be at least {} but is {}'.format(i+1, pwmOut, fans[i]))
+                                success = False
+                        elif abs(fans[i] - pwmOut) > 1:
                             logging.error('In auto mode fan {} should be {} but is {}'.format(i+1, pwmOut, fans[i]))
                             success = False
                         else:
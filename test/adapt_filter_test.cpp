@@ -0,0 +1,221 @@
+/*******************************************************************************
+ *
+ *  Adaptive PWM input filter - AdaptFilterInt step and noise response
+ *
+ * Duty cycle steps (tenths of percent) with zero mean noise, for a few min. weights and gains:
+ * - the integer filter follows its float model (reference.h) within the ExpFilterInt rounding bound
+ *   (plus the weight quantization while the deviation moves)
+ * - zero gain is exactly ExpFilterInt
+ * - a gain makes the step response faster (samples to 90% of the step), the price is more noise left
+ *   on the output in the steady state: the noise keeps the deviation up to its amplitude, so the weight
+ *   is at most weight * (1 + gain * amplitude) and the std. dev. at most the plain filter's one scaled
+ *   by sqrt(w / (2 - w)) for that weight
+ * - a single glitch moves the output by the min. weight only
+ * - with the weight from the sample time (ExpFilterWeightDt) the step response takes the same time
+ *   (within RATE_TOL and one loop period) at every loop period in loopsMs, the gain included
+ * Host benchmark of ExpFilterInt, AdaptFilterInt and the float model (AVR cycles - see avr_bench).
+ ******************************************************************************/
+
+#include <Arduino.h>
+#include "DataProcessing.h"
+#include "reference.h"
+#include "bench.h"
+
+static const float weights[] = { 0.02f, 0.05f, 0.2f };
+static const float gains[]   = { 0.0f, 0.1f, 0.4f, 1.0f };
+static const int   noises[]  = { 0, 5, 20 };   // uniform +-, tenths of percent
+
+static const int   loopsMs[] = { 5, 10, 21, 40, 80 };
+
+#define RATE_TC    0.4f    // s
+#define RATE_TOL   0.15    // relative to the mean time to 90%
+
+struct Step
+{
+    int from;
+    int to;
+};
+
+static const Step steps[] = { { 200, 800 }, { 800, 200 }, { 0, 1000 }, { 400, 450 } };
+
+
+static uint32_t rngState = 0x6a09e667;
+
+static uint32_t rnd(void)
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+static int noisy(int v, int noise)
+{
+    if(noise)
+        v += (int)(rnd() % (2 * noise + 1)) - noise;
+    return (v < 0) ? 0 : (v > 1000) ? 1000 : v;
+}
+
+
+struct Response
+{
+    long   rise;      // samples to 90% of the step
+    double noiseSd;   // output std. dev. in the steady state
+    double maxErr;    // max. difference from the float model
+};
+
+
+static void respond(float wf, float gf, const Step *st, int noise, Response *r)
+{
+    unsigned int wq = ExpFilterWeight(wf);
+    unsigned int gq = ExpFilterWeight(gf);
+
+    long  state = (long)st->from << EXPFILT_FRAC_BITS, dev = 0;
+    float fstate = st->from, fdev = 0.0f;
+
+    const long settle = (long)(12.0f / wf);
+    const long n      = settle + 4000;
+    double     sum = 0.0, sum2 = 0.0;
+
+    r->rise   = -1;
+    r->maxErr = 0.0;
+
+    for(long k=0; k<n; ++k)
+    {
+        int v = noisy(st->to, noise);
+        int o = AdaptFilterInt(&state, &dev, wq, gq, v);
+        float fo = AdaptFilter(&fstate, &fdev, (float)wq / EXPFILT_WEIGHT_ONE, (float)gq / EXPFILT_WEIGHT_ONE, v);
+
+        double e = fabs(o - fo);
+        if(e > r->maxErr)
+            r->maxErr = e;
+
+        if(r->rise < 0 && ((st->to > st->from) ? (o >= st->from + (st->to - st->from) * 9 / 10)
+                                               : (o <= st->from + (st->to - st->from) * 9 / 10)))
+            r->rise = k;
+
+        if(k >= settle)
+        {
+            sum  += o;
+            sum2 += (double)o * o;
+        }
+    }
+
+    double m = sum / (n - settle);
+    r->noiseSd = sqrt(fmax(0.0, sum2 / (n - settle) - m * m));
+}
+
+
+int main(void)
+{
+    printf("adapt_filter_test\n");
+
+    // zero gain - the same as ExpFilterInt, for every weight
+    unsigned long same = 0;
+    for(unsigned int wq=1; wq<=EXPFILT_WEIGHT_ONE; wq+=7)
+    {
+        long a = 0, dev = 0, e = 0;
+        for(int k=0; k<64; ++k)
+        {
+            int v = (int)(rnd() % 1001);
+            CHECK(AdaptFilterInt(&a, &dev, wq, 0, v) == ExpFilterInt(&e, wq, v) && a == e, "zero gain, weight %u", wq);
+            ++same;
+        }
+    }
+    printf("  zero gain: %lu samples the same as ExpFilterInt\n", same);
+
+    printf("  %-6s %-6s %-6s %-12s %8s %8s %10s\n", "weight", "gain", "noise", "step", "rise", "noise sd", "float diff");
+    for(unsigned w=0; w<sizeof(weights)/sizeof(weights[0]); ++w)
+    {
+        for(unsigned s=0; s<sizeof(steps)/sizeof(steps[0]); ++s)
+        {
+            for(unsigned n=0; n<sizeof(noises)/sizeof(noises[0]); ++n)
+            {
+                Response plain;
+                rngState = 0x6a09e667 + n;   // the same noise as the adaptive ones below
+                respond(weights[w], 0.0f, &steps[s], noises[n], &plain);
+
+                for(unsigned g=0; g<sizeof(gains)/sizeof(gains[0]); ++g)
+                {
+                    Response r;
+                    rngState = 0x6a09e667 + n;   // the same noise for every gain
+                    respond(weights[w], gains[g], &steps[s], noises[n], &r);
+
+                    if(s == 0)
+                        printf("  %-6.2f %-6.3f %-6d %4d -> %-4d %8ld %8.2f %10.2f\n", weights[w], gains[g], noises[n],
+                               steps[s].from, steps[s].to, r.rise, r.noiseSd, r.maxErr);
+
+                    // ExpFilterInt bound 1/(2^(FRAC+1)*w) plus the rounding to tenths, the integer weight
+                    // comes from the rounded deviation which may differ by one unit
+                    double bound = 1.0 / ((1 << (EXPFILT_FRAC_BITS + 1)) * weights[w]) + 0.5
+                                 + gains[g] / 10.0 * abs(steps[s].to - steps[s].from);
+                    CHECK(r.maxErr <= bound, "weight %.2f gain %.3f noise %d step %d->%d: %.2f from the float model, bound %.2f",
+                          weights[w], gains[g], noises[n], steps[s].from, steps[s].to, r.maxErr, bound);
+
+                    CHECK(r.rise >= 0 && r.rise <= plain.rise, "weight %.2f gain %.3f noise %d step %d->%d: rise %ld, plain %ld",
+                          weights[w], gains[g], noises[n], steps[s].from, steps[s].to, r.rise, plain.rise);
+
+                    // noise on the output of an exp. filter goes with sqrt(w / (2 - w))
+                    double wMax  = fmin(1.0, weights[w] * (1.0 + gains[g] * noises[n] / 10.0));
+                    double scale = sqrt(wMax / (2.0 - wMax) / (weights[w] / (2.0 - weights[w])));
+                    CHECK(r.noiseSd <= scale * plain.noiseSd + 0.5,
+                          "weight %.2f gain %.3f noise %d step %d->%d: noise sd %.2f, plain %.2f, max. %.2f",
+                          weights[w], gains[g], noises[n], steps[s].from, steps[s].to, r.noiseSd, plain.noiseSd,
+                          scale * plain.noiseSd + 0.5);
+                }
+            }
+        }
+    }
+
+    // a single glitch after a long steady input - just the min. weight
+    for(unsigned g=0; g<sizeof(gains)/sizeof(gains[0]); ++g)
+    {
+        unsigned int wq = ExpFilterWeight(0.05f);
+        long state = 300L << EXPFILT_FRAC_BITS, dev = 0;
+        for(int k=0; k<1000; ++k)
+            AdaptFilterInt(&state, &dev, wq, ExpFilterWeight(gains[g]), 300);
+        int o = AdaptFilterInt(&state, &dev, wq, ExpFilterWeight(gains[g]), 1000);
+        CHECK(abs(o - (300 + 35)) <= 1, "gain %.3f: glitch to %d, expected 335", gains[g], o);
+    }
+
+    // the same time to 90% at every loop period - the weight from the time, the gain scales it
+    for(unsigned g=0; g<sizeof(gains)/sizeof(gains[0]); ++g)
+    {
+        double t90[sizeof(loopsMs)/sizeof(loopsMs[0])], mean = 0.0;
+        for(unsigned l=0; l<sizeof(loopsMs)/sizeof(loopsMs[0]); ++l)
+        {
+            unsigned int wq = ExpFilterWeightDt(ExpFilterTc(RATE_TC), (unsigned long)loopsMs[l] * FILT_TIME_PER_S / 1000);
+            long state = 200L << EXPFILT_FRAC_BITS, dev = 0;
+            int  k = 1;
+            while(AdaptFilterInt(&state, &dev, wq, ExpFilterWeight(gains[g]), 600) < 560 && k < 100000)
+                ++k;
+            t90[l] = k * loopsMs[l] / 1000.0;
+            mean  += t90[l] / (sizeof(loopsMs)/sizeof(loopsMs[0]));
+        }
+        printf("  gain %.3f, tc %.1fs, 20%% -> 60%%: 90%% after", gains[g], RATE_TC);
+        for(unsigned l=0; l<sizeof(loopsMs)/sizeof(loopsMs[0]); ++l)
+        {
+            printf(" %.3fs", t90[l]);
+            CHECK(fabs(t90[l] - mean) <= RATE_TOL * mean + loopsMs[l] / 1000.0, "gain %.3f: 90%% after %.3fs at %dms loop, mean %.3fs",
+                  gains[g], t90[l], loopsMs[l], mean);
+        }
+        printf(" (loop");
+        for(unsigned l=0; l<sizeof(loopsMs)/sizeof(loopsMs[0]); ++l)
+            printf(" %dms", loopsMs[l]);
+        printf(")\n");
+    }
+
+    // benchmark
+    unsigned int wq = ExpFilterWeight(0.05f), gq = ExpFilterWeight(0.4f);
+    long  istate = 0, idev = 0;
+    float fstate = 0.0f, fdev = 0.0f;
+
+    const long n = 20000000;
+    printf("  host benchmark:\n");
+    double eb = BENCH("ExpFilterInt", n, benchSink += ExpFilterInt(&istate, wq, i & 0x3ff));
+    double ab = BENCH("AdaptFilterInt", n, benchSink += AdaptFilterInt(&istate, &idev, wq, gq, i & 0x3ff));
+    double fb = BENCH("float AdaptFilter", n, benchSink += (long)AdaptFilter(&fstate, &fdev, 0.05f, 0.4f, (float)(i & 0x3ff)));
+    printf("  host ratio adaptive/exp %.2f, float/int %.2f\n", ab / eb, fb / ab);
+
+    return checkResult("adapt_filter_test");
+}
@@ -0,0 +1,144 @@
+/*******************************************************************************
+ *
+ *  Q15 weighted temperature average vs. the float one it replaced
+ *
+ * Every weight vector of a 0.05 grid (all the ratios the normalized weights can have at that
+ * resolution, zero weights included) with a set of temperature vectors. The Q15 result must be the
+ * exact average rounded, unless the exact average is within the Q15 weight quantization of a .5 tie.
+ * The float version is compared the same way. Host benchmark of both variants (AVR cycles - see
+ * avr_bench).
+ ******************************************************************************/
+
+#include <Arduino.h>
+#include "PFCmain.h"
+#include "DataProcessing.h"
+#include "reference.h"
+#include "bench.h"
+
+#define GRID 20   // weights 0, 1/GRID .. 1
+
+
+static uint32_t rngState = 0x12345678;
+
+static uint32_t rnd(void)
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+
+/** Exact average (double) and the max. error of the Q15 weights applied to the temperatures */
+static double exactAverage(unsigned char fan, double *qErr)
+{
+    double sum = 0.0, wSum = 0.0;
+
+    for(int a=0; a<TEMP_SENSORS; ++a)
+        wSum += tempWeights[fan][a];
+
+    *qErr = 0.0;
+    for(int a=0; a<TEMP_SENSORS; ++a)
+    {
+        double w = (wSum > 0.0) ? tempWeights[fan][a] / wSum : 1.0 / TEMP_SENSORS;
+        sum   += w * temps[a];
+        *qErr += fabs(tempWeightsQ[fan][a] / (double)TEMP_WEIGHT_ONE - w) * abs(temps[a]);
+    }
+
+    return sum;
+}
+
+
+/** Result is the rounded exact value or the exact value is a near tie */
+static int roundedOrTie(int r, double exact, double tol)
+{
+    if(r == (int)floor(exact + 0.5))
+        return 1;
+
+    double tie = floor(exact) + 0.5;
+    return fabs(exact - tie) <= tol && (r == (int)floor(exact) || r == (int)floor(exact) + 1);
+}
+
+
+int main(void)
+{
+    printf("average_test\n");
+
+    // axis wide enough for no clamping, 0 .. 255 C
+    mapTempCoeffs = 2;
+    tempAxis[0]   = 0;
+    tempAxis[1]   = 255;
+
+    // temperature vectors - extremes and random ones in 0 .. 100 C
+    enum { VECTORS = 24 };
+    int tv[VECTORS][TEMP_SENSORS];
+    for(int v=0; v<VECTORS; ++v)
+        for(int a=0; a<TEMP_SENSORS; ++a)
+            tv[v][a] = (v == 0) ? 0 : (v == 1) ? 100 * TEMP_ONE : (v == 2) ? (a & 1) * 100 * TEMP_ONE
+                     : (int)(rnd() % (100 * TEMP_ONE + 1));
+
+    unsigned long cases = 0, qTies = 0, fDiff = 0, fTies = 0;
+    int idx[TEMP_SENSORS] = { 0 };
+
+    for(;;)
+    {
+        for(int a=0; a<TEMP_SENSORS; ++a)
+            tempWeights[0][a] = (float)idx[a] / GRID;
+        normalizeTempWeights(0);
+
+        unsigned long sumQ = 0;
+        for(int a=0; a<TEMP_SENSORS; ++a)
+            sumQ += tempWeightsQ[0][a];
+        CHECK(sumQ == TEMP_WEIGHT_ONE, "weights sum %lu", sumQ);
+
+        for(int v=0; v<VECTORS; ++v)
+        {
+            memcpy(temps, tv[v], sizeof(temps));
+
+            double qErr;
+            double exact = exactAverage(0, &qErr);
+            int    q     = averageTemp(0);
+            int    f     = floatAverageTemp(0);
+
+            // AVR widths - the Q15 dot product fits to 32 bit long
+            CHECK(exact * TEMP_WEIGHT_ONE < 0x7fffffffL, "sum range");
+
+            CHECK(roundedOrTie(q, exact, qErr + 1e-9), "weights %d %d %d %d temps %d %d %d %d: Q15 %d exact %f",
+                  idx[0], idx[1], idx[2], idx[3], temps[0], temps[1], temps[2], temps[3], q, exact);
+            CHECK(roundedOrTie(f, exact, 1e-3), "float %d exact %f", f, exact);
+
+            if(q != (int)floor(exact + 0.5))
+                ++qTies;
+            if(f != (int)floor(exact + 0.5))
+                ++fTies;
+            if(q != f)
+                ++fDiff;
+            ++cases;
+        }
+
+        // next weight vector
+        int a = 0;
+        while(a < TEMP_SENSORS && ++idx[a] > GRID)
+            idx[a++] = 0;
+        if(a == TEMP_SENSORS)
+            break;
+    }
+
+    printf("  %lu cases: Q15 differs from float in %lu, Q15 %lu and float %lu rounded the other way at a .5 tie\n",
+           cases, fDiff, qTies, fTies);
+
+    // benchmark with a typical weight vector
+    tempWeights[0][0] = 0.0f;
+    tempWeights[0][1] = 1.0f;
+    tempWeights[0][2] = 2.0f;
+    tempWeights[0][3] = 0.5f;
+    normalizeTempWeights(0);
+
+    const long n = 20000000;
+    printf("  host benchmark (%d sensors):\n", TEMP_SENSORS);
+    double fb = BENCH("float average", n, temps[i & 3] = i & 0x3ff; benchSink += floatAverageTemp(0));
+    double qb = BENCH("averageTemp (Q15)", n, temps[i & 3] = i & 0x3ff; benchSink += averageTemp(0));
+    printf("  host ratio float/Q15 %.2f\n", fb / qb);
+
+    return checkResult("average_test");
+}
@@ -0,0 +1,264 @@
+/*******************************************************************************
+ *
+ *  AVR cycle benchmark of the integer code vs. the float code it replaced
+ *
+ * Runs on the Nano (make avr-bench) instead of the fan controller. Timer1 counts the CPU cycles (no
+ * prescaler), each kernel runs BENCH_N times with varying inputs and the report is the mean and max.
+ * cycles per call, the timing overhead subtracted. Output on the serial line at SERIAL_SPEED.
+ *
+ * The ISRs are measured the same way, with the whole cost from the interrupt entry to reti: their
+ * flag is made pending with interrupts disabled, then TCNT1 is read around sei / nop / cli (the ISR
+ * runs after the nop), the same sequence with nothing pending is the overhead. PCINT2_vect needs
+ * PWM_INPUTS > 1 in Config.h, its pins are driven as outputs here - keep the inputs disconnected.
+ ******************************************************************************/
+
+#include <Arduino.h>
+#include "PFCmain.h"
+#include "MCP9701.h"
+#include "PwmMeasure.h"
+#include "PwmOut.h"
+#include "reference.h"
+
+#define BENCH_N 256
+
+static word   benchOverhead;
+static word   benchIsrOverhead;
+volatile long benchSink;
+
+extern volatile byte pwmCaptFull[PWM_INPUTS];   // PwmMeasure.cpp
+#if PWM_INPUTS > 1
+extern volatile byte pwmPcintLast;
+#endif
+
+
+static void benchReport(const __FlashStringHelper *name, unsigned long mean, word max)
+{
+    Serial.print(name);
+    Serial.print(F("\t"));
+    Serial.print(mean);
+    Serial.print(F("\t"));
+    Serial.println(max);
+}
+
+
+/** Time "stmt" BENCH_N times (i is the run index 0 .. BENCH_N-1) with interrupts disabled */
+#define BENCH(name, stmt)                                               \
+    do {                                                                \
+        unsigned long sum_ = 0;                                         \
+        word          max_ = 0;                                         \
+        for(int i=0; i<BENCH_N; ++i)                                    \
+        {                                                               \
+            cli();                                                      \
+            word t0_ = TCNT1;                                           \
+            asm volatile("" ::: "memory");                              \
+            stmt;                                                       \
+            asm volatile("" ::: "memory");                              \
+            word t_ = TCNT1 - t0_ - benchOverhead;                      \
+            sei();                                                      \
+            sum_ += t_;                                                 \
+            if(t_ > max_)                                               \
+                max_ = t_;                                              \
+        }                                                               \
+        benchReport(F(name), sum_ / BENCH_N, max_);                     \
+    } while(0)
+
+
+/**
+ * Time an ISR BENCH_N times: "arm" (interrupts enabled) makes its flag pending or gets it ready to
+ * be, "pending" tells when it is. Interrupts stay disabled from the flag to the measurement.
+ */
+#define BENCH_ISR(name, arm, pending)                                   \
+    do {                                                                \
+        unsigned long sum_ = 0;                                         \
+        word          max_ = 0;                                         \
+        Serial.flush();               /* no USART_UDRE_vect meanwhile */\
+        for(int i=0; i<BENCH_N; ++i)                                    \
+        {                                                               \
+            arm;                                                        \
+            cli();                                                      \
+            while(!(pending))                                           \
+                ;                                                       \
+            word t0_ = TCNT1;                                           \
+            sei();                                                      \
+            asm volatile("nop" ::: "memory");                           \
+            cli();                                                      \
+            word t_ = TCNT1 - t0_ - benchIsrOverhead;                   \
+            sei();                                                      \
+            sum_ += t_;                                                 \
+            if(t_ > max_)                                               \
+                max_ = t_;                                              \
+        }                                                               \
+        benchReport(F(name), sum_ / BENCH_N, max_);                     \
+    } while(0)
+
+
+/** Fixed-point duty cycle and exponential filter */
+static void benchFixedPoint(void)
+{
+    float fstate = 0.0f;
+    long  istate = 0;
+
+    BENCH("float duty",      benchSink += (long)floatDuty(100 + i, 640 + i));
+    BENCH("pwmDecodeDuty",   benchSink += intDuty(100 + i, 640 + i));
+    BENCH("float ExpFilter", benchSink += (long)ExpFilter(&fstate, 0.05f, (float)(i * 4)));
+    BENCH("ExpFilterInt",    benchSink += ExpFilterInt(&istate, 1638, i * 4));
+}
+
+
+/** Adaptive PWM input filter, weight 0.05 and gain 0.02 */
+static void benchAdaptFilter(void)
+{
+    float fstate = 0.0f, fdev = 0.0f;
+    long  istate = 0, idev = 0;
+
+    BENCH("float AdaptFilter", benchSink += (long)AdaptFilter(&fstate, &fdev, 0.05f, 0.02f, (float)(i * 3)));
+    BENCH("AdaptFilterInt",    benchSink += AdaptFilterInt(&istate, &idev, 1638, 13107, i * 3));
+}
+
+
+/** Weighted average temperature */
+static void benchAverage(void)
+{
+    mapTempCoeffs = 2;
+    tempAxis[0]   = 0;
+    tempAxis[1]   = 255;
+    tempWeights[0][0] = 0.0f;
+    tempWeights[0][1] = 1.0f;
+    tempWeights[0][2] = 2.0f;
+    tempWeights[0][3] = 0.5f;
+    normalizeTempWeights(0);
+
+    BENCH("float average",     temps[i & 3] = i * 4; benchSink += floatAverageTemp(0));
+    BENCH("averageTemp (Q15)", temps[i & 3] = i * 4; benchSink += averageTemp(0));
+}
+
+
+/** Temperature reading - conversion and filter, the ADC (two reads) measured separately */
+static void benchTempFilter(void)
+{
+    // short enough for every call to update the filter (see timerFilterWeight)
+    tempSetFilterTc(0.001f);
+    float fstate = 25.0f;
+
+    BENCH("analogRead x2",              analogRead(A0); benchSink += analogRead(A0));
+    BENCH("float conversion + ExpFilter", analogRead(A0); benchSink += (long)floatReadTemp(&fstate, 0.05f, analogRead(A0)));
+    BENCH("readTemp (ExpFilterInt)",    benchSink += readTemp(0));
+}
+
+
+/** Mapping table interpolation, default geometry */
+static void benchMap(void)
+{
+    setMapGeometry(TEMP_MIN, TEMP_STEP, TEMP_MAX, PWM_STEP);
+    for(int c=0; c<MAP_CELLS; ++c)
+        mappingTable[0][c] = (c * 37) % 101;
+
+    BENCH("float interpolation",      benchSink += floatInterpolatePwm(0, i % 101, 320 + i));
+    BENCH("interpolatePwm (integer)", benchSink += interpolatePwm(0, i % 101, 320 + i));
+    BENCH("interpolatePwm, flicker",  benchSink += interpolatePwm(0, 50, 600 + (i & 1)));
+}
+
+
+/** The ISRs, entry to reti */
+static void benchIsr(void)
+{
+    // PWM out A as in the firmware, a duty with a fraction of a count - dithering
+    pwmBeginA(50);
+    pwmSetPermilleA(503);
+    BENCH_ISR("TIMER0_COMPA (dither)", TIFR0 = bit (OCF0A), TIFR0 & bit (OCF0A));
+    TIMSK0 = 0;
+
+    // stop - the match disconnects, start - the sync match reconnects (or tries again)
+    BENCH_ISR("TIMER0_COMPB (stop)", pwmSetPermilleA(500); while(!(TCCR0A & bit (COM0B1))); cli(); pwmSetPermilleA(0),
+              TIFR0 & bit (OCF0B));
+    BENCH_ISR("TIMER0_COMPB (start)", pwmSetPermilleA(0); while(TCCR0A & bit (COM0B1)); cli(); pwmSetPermilleA(500),
+              TIFR0 & bit (OCF0B));
+    TIMSK0 = 0;
+
+    // D8 toggled as an output - the input capture sees it, every other edge matches ICES1
+    DDRB  |= bit (DDB0);
+    TIMSK1 = bit (ICIE1);
+    BENCH_ISR("TIMER1_CAPT", cli(); TIFR1 = bit (ICF1); while(!(TIFR1 & bit (ICF1))) { PINB = bit (PINB0); __builtin_avr_delay_cycles(8); },
+              TIFR1 & bit (ICF1));
+    TIMSK1 = bit (TOIE1);
+    BENCH_ISR("TIMER1_OVF", TIFR1 = bit (TOV1), TIFR1 & bit (TOV1));
+    TIMSK1 = 0;
+    DDRB  &= ~bit (DDB0);
+
+#if PWM_INPUTS > 1
+    // PWM2 on D4 toggled as an output, re-armed when its ring buffer is complete (every other edge
+    // is stored, see PCINT2_vect)
+    DDRD  |= bit (DDD4);
+    pwmPcintLast = PIND;
+    PCMSK2 = bit (PCINT20);
+    PCIFR  = bit (PCIF2);
+    PCICR |= bit (PCIE2);
+    BENCH_ISR("PCINT2 (1 input)", cli(); if(!(PCMSK2 & bit (PCINT20))) { pwmCaptFull[1] = 0; PCMSK2 |= bit (PCINT20); }
+              PIND = bit (PIND4), PCIFR & bit (PCIF2));
+#if PWM_INPUTS > 3
+    // all three changing at once - the worst case
+    DDRD  |= bit (DDD6) | bit (DDD7);
+    pwmPcintLast = PIND;
+    BENCH_ISR("PCINT2 (3 inputs)", cli(); pwmCaptFull[1] = pwmCaptFull[2] = pwmCaptFull[3] = 0;
+              PCMSK2 = bit (PCINT20) | bit (PCINT22) | bit (PCINT23); PIND = bit (PIND4) | bit (PIND6) | bit (PIND7),
+              PCIFR & bit (PCIF2));
+    DDRD  &= ~(bit (DDD6) | bit (DDD7));
+#endif
+    PCICR &= ~bit (PCIE2);
+    PCMSK2 = 0;
+    DDRD  &= ~bit (DDD4);
+#endif
+}
+
+
+void setup()
+{
+    Serial.begin(SERIAL_SPEED);
+
+    // timer1 free running at F_CPU, no interrupts
+    TIMSK1 = 0;
+    TCCR1A = 0;
+    TCCR1B = bit (CS10);
+
+    // the timing itself
+    unsigned long sum = 0;
+    for(int i=0; i<BENCH_N; ++i)
+    {
+        cli();
+        word t0 = TCNT1;
+        asm volatile("" ::: "memory");
+        word t = TCNT1 - t0;
+        sei();
+        sum += t;
+    }
+    benchOverhead = sum / BENCH_N;
+
+    // the ISR timing, nothing pending
+    sum = 0;
+    for(int i=0; i<BENCH_N; ++i)
+    {
+        cli();
+        word t0 = TCNT1;
+        sei();
+        asm volatile("nop" ::: "memory");
+        cli();
+        word t = TCNT1 - t0;
+        sei();
+        sum += t;
+    }
+    benchIsrOverhead = sum / BENCH_N;
+
+    Serial.println(F("kernel\tmean\tmax (cycles)"));
+    benchFixedPoint();
+    benchAdaptFilter();
+    benchAverage();
+    benchTempFilter();
+    benchMap();
+    benchIsr();
+    Serial.println(F("done"));
+}
+
+
+void loop()
+{
+}
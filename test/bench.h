@@ -0,0 +1,57 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+/*******************************************************************************
+ *
+ *  Host micro benchmark and check helpers for the tests
+ *
+ * The times are host ns per call, they show the relative cost of two variants only. The AVR has
+ * no FPU, the float variants are relatively much more expensive there (soft float).
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <time.h>
+
+static inline double benchNow(void)
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec * 1e9 + t.tv_nsec;
+}
+
+/** Time "stmt" executed n times (i is the loop index), prints and returns ns per call */
+#define BENCH(name, n, stmt)                                            \
+    ({                                                                  \
+        double t0_ = benchNow();                                        \
+        for(long i=0; i<(n); ++i) { stmt; }                             \
+        double ns_ = (benchNow() - t0_) / (n);                          \
+        printf("  %-36s %8.2f ns/call\n", name, ns_);                   \
+        ns_;                                                            \
+    })
+
+/** Keep the compiler from optimizing a result away */
+static volatile long benchSink;
+
+
+static int checkFails;
+
+/** Report a failed check (the first few of each kind) and count it */
+#define CHECK(cond, ...)                                                \
+    do {                                                                \
+        if(!(cond)) {                                                   \
+            if(checkFails++ < 10) {                                     \
+                printf("  FAIL %s:%d: ", __FILE__, __LINE__);           \
+                printf(__VA_ARGS__);                                    \
+                printf("\n");                                           \
+            }                                                           \
+        }                                                               \
+    } while(0)
+
+/** Exit code of the test - prints the summary */
+static inline int checkResult(const char *test)
+{
+    printf("%s: %s (%d failed checks)\n", test, checkFails ? "FAIL" : "ok", checkFails);
+    return checkFails ? 1 : 0;
+}
+
+#endif // __BENCH_H__
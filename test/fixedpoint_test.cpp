@@ -0,0 +1,122 @@
+/*******************************************************************************
+ *
+ *  Fixed-point PWM duty cycle and integer exponential filter vs. the float code they replaced
+ *
+ * - pwmDecodeDuty for every period 1 .. 20000 counts (25kHz .. 800Hz) and every pulse width, and
+ *   for the longest periods we decode, against the exact rounding and the old float percent
+ * - ExpFilterInt step responses for every Q15 weight against the exact (double) filter, within the
+ *   bound documented in DataProcessing.h, with the intermediate values checked for the AVR widths
+ * - host benchmark of both variants (AVR cycles - see avr_bench)
+ ******************************************************************************/
+
+#include <Arduino.h>
+#include "PwmDecode.h"
+#include "DataProcessing.h"
+#include "reference.h"
+#include "bench.h"
+
+
+static void checkDuty(uint32_t w, uint32_t p, unsigned long *n, double *maxFloatErr)
+{
+    int d = intDuty(w, p);
+
+    // exact rounding (half up) of w * 1000 / p
+    uint64_t exact = ((uint64_t)w * 2000 + p) / (2 * (uint64_t)p);
+    CHECK((uint64_t)d == exact, "duty w=%u p=%u: %d, exact %lu", w, p, d, (unsigned long)exact);
+
+    double e = fabs(d / 10.0 - floatDuty(w, p));
+    if(e > *maxFloatErr)
+        *maxFloatErr = e;
+    CHECK(e <= 0.05 + 1e-4, "duty w=%u p=%u: %d vs float %f", w, p, d, floatDuty(w, p));
+    ++*n;
+}
+
+
+static void testDuty(void)
+{
+    unsigned long n = 0;
+    double maxFloatErr = 0.0;
+
+    for(uint32_t p=1; p<=20000; ++p)
+        for(uint32_t w=0; w<=p; ++w)
+            checkDuty(w, p, &n, &maxFloatErr);
+
+    // the longest periods - width * 1000 must not overflow 32 bits
+    for(uint32_t p=PWM_IN_PERIOD_MAX - 63; p<=PWM_IN_PERIOD_MAX; ++p)
+        for(uint32_t w=0; w<=p; w += (w < 2048 || p - w < 2048) ? 1 : 997)
+            checkDuty(w, p, &n, &maxFloatErr);
+
+    printf("  duty: %lu width/period pairs, max. difference from the float percent %.4f%%\n", n, maxFloatErr);
+}
+
+
+static void testFilter(void)
+{
+    unsigned long steps = 0;
+    double maxErr  = 0.0;   // output vs. exact, in units of the value
+    double maxRel  = 0.0;   // state vs. exact, relative to the documented bound
+
+    for(unsigned int w=1; w<=EXPFILT_WEIGHT_ONE; ++w)
+    {
+        double wf    = (double)w / EXPFILT_WEIGHT_ONE;
+        double bound = 1.0 / ((1 << (EXPFILT_FRAC_BITS + 1)) * wf) + 1.0 / (1 << EXPFILT_FRAC_BITS);
+        long   n     = (long)(12.0 / wf) + 1;    // settles to e^-12
+
+        static const int targets[] = { 1000, 0, 500, 999 };
+
+        long   state = 0;
+        double exact = 0.0;
+
+        for(unsigned t=0; t<sizeof(targets)/sizeof(targets[0]); ++t)
+        {
+            for(long k=0; k<n; ++k, ++steps)
+            {
+                // AVR widths - |diff| < 2^16, diff * weight fits to 32 bit long
+                long diff = ((long)targets[t] << EXPFILT_FRAC_BITS) - state;
+                CHECK(labs(diff) < 65536 && labs(diff * (long)w) < 0x80000000L, "filter w=%u range", w);
+
+                int out = ExpFilterInt(&state, w, targets[t]);
+                exact   = wf * targets[t] + (1.0 - wf) * exact;
+
+                double se = fabs(state / (double)(1 << EXPFILT_FRAC_BITS) - exact);
+                double oe = fabs(out - exact);
+                CHECK(se <= bound, "filter w=%u step %ld: state %f exact %f bound %f", w, k,
+                      state / (double)(1 << EXPFILT_FRAC_BITS), exact, bound);
+                CHECK(oe <= bound + 0.5, "filter w=%u step %ld: out %d exact %f", w, k, out, exact);
+
+                if(oe > maxErr)
+                    maxErr = oe;
+                if(se / bound > maxRel)
+                    maxRel = se / bound;
+            }
+        }
+    }
+
+    printf("  filter: all %u weights, %lu steps, state within %.2f of the bound, output max. %.3f from exact\n",
+           EXPFILT_WEIGHT_ONE, steps, maxRel, maxErr);
+}
+
+
+static void bench(void)
+{
+    const long n = 20000000;
+    float  fstate = 0.0f;
+    long   istate = 0;
+
+    printf("  host benchmark:\n");
+    double f1 = BENCH("float duty (width*100.0/period)", n, benchSink += (long)floatDuty(i & 0x1ff, 640 + (i & 0xff)));
+    double i1 = BENCH("pwmDecodeDuty", n, benchSink += intDuty(i & 0x1ff, 640 + (i & 0xff)));
+    double f2 = BENCH("float ExpFilter", n, benchSink += (long)ExpFilter(&fstate, 0.05f, (float)(i & 0x3ff)));
+    double i2 = BENCH("ExpFilterInt", n, benchSink += ExpFilterInt(&istate, 1638, i & 0x3ff));
+    printf("  host ratio float/int: duty %.2f, filter %.2f\n", f1 / i1, f2 / i2);
+}
+
+
+int main(void)
+{
+    printf("fixedpoint_test\n");
+    testDuty();
+    testFilter();
+    bench();
+    return checkResult("fixedpoint_test");
+}
@@ -0,0 +1,126 @@
+#ifndef __HOST_ARDUINO_H__
+#define __HOST_ARDUINO_H__
+
+/*******************************************************************************
+ *
+ *  Host stub of the Arduino core for the host tests
+ *
+ * Just enough to build the units under test with g++ on Linux. The AVR registers are plain
+ * variables (see host.cpp), a test can preset them or check what the code wrote. Note that
+ * int is 32 and long 64 bits on a host (16 and 32 on the AVR), the tests check the ranges of
+ * the intermediate values where it matters.
+ ******************************************************************************/
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#define F_CPU 16000000UL
+
+typedef uint8_t  byte;
+typedef uint16_t word;
+typedef bool     boolean;
+
+#define bit(b)  (1UL << (b))
+#define _BV(b)  (1 << (b))
+
+#define PROGMEM
+#define PSTR(s)               (s)
+#define F(s)                  (s)
+#define pgm_read_byte(p)      (*(const uint8_t *)(p))
+#define pgm_read_word(p)      (*(const uint16_t *)(p))
+#define strcmp_P(a, b)        strcmp((a), (b))
+
+#define ISR(vect)  extern "C" void vect(void)
+
+extern volatile uint8_t  SREG;
+extern volatile uint8_t  TCCR0A, TCCR0B, TIMSK0, TIFR0, OCR0A, OCR0B, TCNT0;
+extern volatile uint8_t  TCCR2A, TCCR2B, TIMSK2, TIFR2, OCR2A, OCR2B, TCNT2;
+extern volatile uint8_t  TCCR1A, TCCR1B, TIMSK1, TIFR1;
+extern volatile uint16_t TCNT1, ICR1, OCR1A, OCR1B;
+extern volatile uint8_t  PINB, PORTB, DDRB, PINC, PORTC, DDRC, PIND, PORTD, DDRD;
+extern volatile uint8_t  ADMUX, ADCSRA;
+extern volatile uint16_t ADCW;
+
+// ATmega328 bit numbers
+#define PINB0   0
+#define CS10    0
+#define ICES1   6
+#define TOV1    0
+#define ICF1    5
+#define TOIE1   0
+#define ICIE1   5
+#define COM0B1  5
+#define COM0B0  4
+#define WGM00   0
+#define WGM01   1
+#define WGM02   3
+#define CS01    1
+#define OCIE0A  1
+#define OCIE0B  2
+#define OCF0A   1
+#define OCF0B   2
+#define TOV0    0
+#define COM2B1  5
+#define COM2B0  4
+#define WGM20   0
+#define WGM21   1
+#define WGM22   3
+#define CS21    1
+#define OCIE2A  1
+#define OCIE2B  2
+#define OCF2A   1
+#define OCF2B   2
+#define TOV2    0
+#define PIND3   3
+#define PIND5   5
+#define PORTD3  3
+#define PORTD5  5
+#define DDD3    3
+#define DDD5    5
+#define REFS1   7
+#define REFS0   6
+#define MUX3    3
+#define ADEN    7
+#define ADSC    6
+
+#define bit_is_set(sfr, b)  ((sfr) & _BV(b))
+
+#define __builtin_avr_delay_cycles(n)  ((void)(n))
+
+void cli(void);
+void sei(void);
+
+#define A0 14
+
+/** analogRead returns hostAnalog[channel] (A0 .. A7 and 0 .. 7 are the same channels) */
+extern int hostAnalog[8];
+int analogRead(uint8_t pin);
+
+
+/** Serial output goes to stdout when hostSerialEcho is set */
+extern bool hostSerialEcho;
+
+class HostSerial
+{
+public:
+    void begin(long) {}
+    int  available(void) { return 0; }
+    int  read(void) { return -1; }
+    void print(const char *s);
+    void print(char c);
+    void print(long v, int base = 10);
+    void print(unsigned long v, int base = 10);
+    void print(int v, int base = 10)           { print((long)v, base); }
+    void print(unsigned int v, int base = 10)  { print((unsigned long)v, base); }
+    void print(unsigned char v, int base = 10) { print((unsigned long)v, base); }
+    void print(double v, int digits = 2);
+    void println(void) { print("\r\n"); }
+    template<class T> void println(T v) { print(v); println(); }
+    template<class T> void println(T v, int f) { print(v, f); println(); }
+};
+
+extern HostSerial Serial;
+
+#endif // __HOST_ARDUINO_H__
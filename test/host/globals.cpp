@@ -0,0 +1,25 @@
+#include <Arduino.h>
+#include "PFCmain.h"
+
+/*******************************************************************************
+ *
+ *  Main global data (see PFCmain.cpp) for the units which use it
+ *
+ ******************************************************************************/
+
+float          tempWeights[FANS][TEMP_SENSORS];
+unsigned int  tempWeightsQ[FANS][TEMP_SENSORS];
+unsigned char mappingTable[FANS][MAP_CELLS];
+unsigned char     tempAxis[TEMP_COEFFS_MAX];
+unsigned char      pwmAxis[PWM_COEFFS_MAX];
+unsigned char   mapTempMin;
+unsigned char   mapTempStep;
+unsigned char   mapTempCoeffs;
+unsigned char   mapPwmStep;
+unsigned char   mapPwmCoeffs;
+int                  temps[TEMP_SENSORS];
+unsigned char      pwmInSel[FANS];
+unsigned char   pwmFallback[FANS];
+unsigned char       fanCtrl[FANS];
+unsigned char     curveTemp[FANS][TEMP_SENSORS][TEMP_CURVE_POINTS];
+unsigned char     curveDuty[FANS][TEMP_SENSORS][TEMP_CURVE_POINTS];
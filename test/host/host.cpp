@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <Arduino.h>
+
+/*******************************************************************************
+ *
+ *  Host stub of the Arduino core - registers and serial output
+ *
+ ******************************************************************************/
+
+volatile uint8_t  SREG;
+volatile uint8_t  TCCR0A, TCCR0B, TIMSK0, TIFR0, OCR0A, OCR0B, TCNT0;
+volatile uint8_t  TCCR2A, TCCR2B, TIMSK2, TIFR2, OCR2A, OCR2B, TCNT2;
+volatile uint8_t  TCCR1A, TCCR1B, TIMSK1, TIFR1;
+volatile uint16_t TCNT1, ICR1, OCR1A, OCR1B;
+volatile uint8_t  PINB, PORTB, DDRB, PINC, PORTC, DDRC, PIND, PORTD, DDRD;
+volatile uint8_t  ADMUX, ADCSRA;
+volatile uint16_t ADCW;
+
+void cli(void) {}
+void sei(void) {}
+
+int hostAnalog[8];
+
+int analogRead(uint8_t pin)
+{
+    return hostAnalog[(pin >= A0 ? pin - A0 : pin) & 7];
+}
+
+
+bool       hostSerialEcho;
+HostSerial Serial;
+
+void HostSerial::print(const char *s)
+{
+    if(hostSerialEcho)
+        fputs(s, stdout);
+}
+
+void HostSerial::print(char c)
+{
+    if(hostSerialEcho)
+        putchar(c);
+}
+
+void HostSerial::print(long v, int base)
+{
+    if(hostSerialEcho)
+        printf(base == 16 ? "%lX" : "%ld", v);
+}
+
+void HostSerial::print(unsigned long v, int base)
+{
+    if(hostSerialEcho)
+        printf(base == 16 ? "%lX" : "%lu", v);
+}
+
+void HostSerial::print(double v, int digits)
+{
+    if(hostSerialEcho)
+        printf("%.*f", digits, v);
+}
@@ -0,0 +1,118 @@
+/*******************************************************************************
+ *
+ *  Internal temperature - the ADC state machine never blocks the loop
+ *
+ * readInternalTemp is called from a simulated 2ms loop (timer1 in PwmMeasure.cpp), the test plays
+ * the ADC: a conversion started by setting ADSC finishes one loop later with ADCW at the sensor
+ * value. Checks:
+ * - every call returns, even with a conversion which never finishes (a busy wait would hang here,
+ *   the alarm turns it into a failure)
+ * - no conversion starts earlier than INT_TEMP_SETTLE_MS after switching to the internal reference,
+ *   the first one is discarded, the ADC is busy for the whole cycle and free after it
+ * - the filtered value converges to the sensor temperature
+ ******************************************************************************/
+
+#include <unistd.h>
+#include <Arduino.h>
+#include "DataProcessing.h"
+#include "MCP9701.h"
+#include "InternalTemp.h"
+#include "PwmMeasure.h"
+#include "bench.h"
+
+extern volatile word pwmTimerHigh;
+
+#define LOOP_MS         2
+#define INT_REF_ADMUX   (_BV(REFS1) | _BV(REFS0) | _BV(MUX3))
+
+
+/** Simulated timer1, 32 bit */
+static uint32_t simTicks;
+
+static void simAdvance(unsigned long ticks)
+{
+    simTicks    += ticks;
+    pwmTimerHigh = (word)(simTicks >> 16);
+    TCNT1        = (word)simTicks;
+}
+
+
+int main(void)
+{
+    printf("internal_temp_test\n");
+    alarm(60);
+
+    const float tempC = 35.0f;
+    const int   adc   = (int)(tempC * AVR_INT_TEMP_coeff + AVR_INT_TEMP_offset + 0.5);
+
+    unsigned long switched = 0, conversions = 0, samples = 0, busyLoops = 0, loops = 0;
+    byte          converting = 0;
+    int           t = 0;
+
+    simAdvance(1);
+    for(; loops<20000; ++loops)
+    {
+        simAdvance((unsigned long)LOOP_MS * (F_CPU / 1000));
+
+        // the conversion started in the previous loop has finished
+        if(converting)
+        {
+            ADCSRA    &= ~_BV(ADSC);
+            ADCW       = (conversions & 1) ? 0 : adc;   // the discarded first one is garbage
+            converting = 0;
+        }
+
+        byte wasBusy = intTempAdcBusy();
+        t = readInternalTemp();
+
+        if(!wasBusy && intTempAdcBusy())
+        {
+            CHECK(ADMUX == INT_REF_ADMUX && (ADCSRA & _BV(ADEN)), "loop %lu: internal reference not selected", loops);
+            switched = simTicks;
+        }
+
+        if(ADCSRA & _BV(ADSC))
+        {
+            if(!converting)
+            {
+                ++conversions;
+                CHECK((uint32_t)(simTicks - switched) >= (uint32_t)INT_TEMP_SETTLE_MS * (F_CPU / 1000),
+                      "loop %lu: conversion %.1fms after the reference switch", loops,
+                      (uint32_t)(simTicks - switched) * 1000.0 / F_CPU);
+            }
+            converting = 1;
+        }
+
+        if(wasBusy && !intTempAdcBusy())
+        {
+            ++samples;
+            CHECK(!(conversions & 1), "loop %lu: sample after %lu conversions", loops, conversions);
+        }
+
+        if(intTempAdcBusy())
+            ++busyLoops;
+    }
+
+    unsigned long cycle = loops / samples;
+    printf("  %lu loops of %dms, a sample every %lu loops (%lu busy), %.2f C\n", loops, LOOP_MS, cycle,
+           busyLoops / samples, (float)t / TEMP_ONE);
+    CHECK(cycle <= INT_TEMP_SETTLE_MS / LOOP_MS + 4, "%lu loops per sample", cycle);
+    // ExpFilterInt may stop 1/(2^(FRAC+1)*w) counts short of the input (w ~ 1/16 here), plus the rounding
+    float expected = (adc - AVR_INT_TEMP_offset) / AVR_INT_TEMP_coeff;
+    float bound    = 16.0f / (1 << (EXPFILT_FRAC_BITS + 1)) / AVR_INT_TEMP_coeff + 1.0f / TEMP_ONE;
+    CHECK(fabs((float)t / TEMP_ONE - expected) <= bound, "temperature %.3f, expected %.3f", (float)t / TEMP_ONE, expected);
+
+    // a conversion which never finishes - the calls must still return
+    while(!(ADCSRA & _BV(ADSC)))
+    {
+        simAdvance((unsigned long)LOOP_MS * (F_CPU / 1000));
+        readInternalTemp();
+    }
+    for(int k=0; k<1000; ++k)
+    {
+        simAdvance((unsigned long)LOOP_MS * (F_CPU / 1000));
+        CHECK(readInternalTemp() == t && intTempAdcBusy(), "stuck conversion, call %d", k);
+    }
+
+    return checkResult("internal_temp_test");
+}
@@ -0,0 +1,279 @@
+/*******************************************************************************
+ *
+ *  Temperature filters on sensor traces - KalmanFilterInt vs. ExpFilterInt
+ *
+ * Feeds MCP9701 traces through readTemp (the real code path, simulated timer1 and ADC) with the exp.
+ * filter and with the Kalman filter at a few process noise values, and compares the outputs with a
+ * zero lag reference - the centered moving average of the readings over REF_HALF_MS each side (no lag
+ * on a ramp, smooths the noise). Reports the RMS and max. error and the output noise (std. dev. of the
+ * sample to sample changes) for each filter and trace. Checks that every filter stays within
+ * TRACE_RMS_MAX of the reference, and that on a trace which moves the best Kalman filter follows it
+ * more closely (RMS) than the default exp. filter at no more than KALMAN_NOISE_MAX times its noise.
+ * The Kalman filter runs on a fixed period (TEMP_KALMAN_PERIOD_MS), so its response to a clean step of
+ * STEP_COUNTS takes the same time (within STEP_TOL and one loop period) at every loop period in loopsMs.
+ *
+ * Trace format (text, one item per line):
+ *   # comment
+ *   <ms> <ADC counts>          reading - time since the start, raw analogRead
+ *
+ * Record one on the real HW with DEBUG_TEMP_TRACE (Config.h): keep the "TT1 " lines of the serial
+ * output without the prefix. The synthetic ones in traces/temp/ come from "make traces".
+ *
+ * Usage: kalman_test trace...
+ ******************************************************************************/
+
+#include <vector>
+#include <Arduino.h>
+#include "DataProcessing.h"
+#include "MCP9701.h"
+#include "PwmMeasure.h"
+#include "bench.h"
+
+#define REF_HALF_MS      500     // reference moving average, each side
+#define WARMUP_MS        2000    // not evaluated, the filters start
+#define TRACE_RMS_MAX    0.5     // C
+#define KALMAN_NOISE_MAX 2.0
+#define STEP_COUNTS      20      // ADC counts, ~5C (below KALMAN_RESET_RESIDUAL)
+#define STEP_TOL         0.15    // relative to the mean time to 90%
+
+static const int loopsMs[] = { 5, 10, 21, 40, 80 };
+
+extern volatile word pwmTimerHigh;
+long intTempKalmanSlope;   // InternalTemp.cpp is not linked
+
+
+struct Reading
+{
+    unsigned long ms;
+    int           adc;
+};
+
+
+struct FilterSpec
+{
+    const char *name;
+    float       tc;      // exp. filter time constant (s), for q == 0
+    float       q;       // Kalman process noise, 0 - exp. filter
+};
+
+static const FilterSpec filters[] =
+{
+    { "exp tc 0.4s (default)", 0.4f, 0.0f    },
+    { "exp tc 2s",             2.0f, 0.0f    },
+    { "Kalman q 0.1",          0.0f, 0.1f    },
+    { "Kalman q 1",            0.0f, 1.0f    },
+    { "Kalman q 5",            0.0f, 5.0f    },
+};
+
+#define FILTERS (sizeof(filters)/sizeof(filters[0]))
+
+
+struct Result
+{
+    double rms;
+    double maxErr;
+    double noise;
+};
+
+
+static int loadTrace(const char *path, std::vector<Reading> *r)
+{
+    FILE *f = fopen(path, "r");
+    if(!f)
+    {
+        perror(path);
+        return -1;
+    }
+
+    char line[128];
+    while(fgets(line, sizeof(line), f))
+    {
+        Reading rd;
+        if(line[0] == '#' || sscanf(line, "%lu %d", &rd.ms, &rd.adc) != 2)
+            continue;
+        r->push_back(rd);
+    }
+
+    fclose(f);
+    return r->empty() ? -1 : 0;
+}
+
+
+static inline double adcToC(double adc)
+{
+    return adc * MCP9701_A - MCP9701_B;
+}
+
+
+static void runFilter(const FilterSpec *fs, const std::vector<Reading> &tr, const std::vector<double> &ref, Result *res)
+{
+    // simulated timer1 at the reading times (starting at 1s, the filter time must be non zero)
+    uint32_t ticks = F_CPU;
+    pwmTimerHigh   = (word)(ticks >> 16);
+    TCNT1          = (word)ticks;
+
+    tempSetFilterTc(fs->tc);
+    tempSetKalman(fs->q, 1.0f);
+    tempExpFilterVal[0] = (long)tr[0].adc << EXPFILT_FRAC_BITS;
+    tempFilterTime[0]   = ticks;
+
+    double sum2 = 0.0, maxErr = 0.0, dsum = 0.0, dsum2 = 0.0;
+    long   n = 0, dn = 0;
+    double last = 0.0;
+
+    for(size_t k=0; k<tr.size(); ++k)
+    {
+        uint32_t t = F_CPU + (uint32_t)tr[k].ms * (F_CPU / 1000);
+        pwmTimerHigh = (word)(t >> 16);
+        TCNT1        = (word)t;
+
+        hostAnalog[0] = tr[k].adc;
+        double out = (double)readTemp(0) / TEMP_ONE;
+
+        if(tr[k].ms >= WARMUP_MS && tr[k].ms + REF_HALF_MS <= tr.back().ms)
+        {
+            double e = out - ref[k];
+            sum2 += e * e;
+            if(fabs(e) > maxErr)
+                maxErr = fabs(e);
+            ++n;
+
+            double d = out - last;
+            dsum  += d;
+            dsum2 += d * d;
+            ++dn;
+        }
+        last = out;
+    }
+
+    res->rms    = sqrt(sum2 / n);
+    res->maxErr = maxErr;
+    res->noise  = sqrt(fmax(0.0, dsum2 / dn - (dsum / dn) * (dsum / dn)));
+}
+
+
+/** Time (s) to 90% of a clean step in the readings at the given loop period */
+static double stepTime(float q, int loopMs)
+{
+    tempSetFilterTc(0.4f);
+    tempSetKalman(q, 1.0f);
+    tempFilterTime[0] = F_CPU;
+
+    double from = adcToC(200), to = adcToC(200 + STEP_COUNTS);
+    for(uint32_t ms=0; ms<60000; ms+=loopMs)
+    {
+        uint32_t t = F_CPU + ms * (F_CPU / 1000);
+        pwmTimerHigh = (word)(t >> 16);
+        TCNT1        = (word)t;
+
+        hostAnalog[0] = (ms < 20000) ? 200 : 200 + STEP_COUNTS;
+        double out = (double)readTemp(0) / TEMP_ONE;
+        if(ms >= 20000 && out >= from + 0.9 * (to - from))
+            return (ms - 20000) / 1000.0;
+    }
+    return -1.0;
+}
+
+
+static void testStep(void)
+{
+    for(size_t f=0; f<FILTERS; ++f)
+    {
+        if(filters[f].q == 0.0f)
+            continue;
+
+        double t90[sizeof(loopsMs)/sizeof(loopsMs[0])], mean = 0.0;
+        for(size_t l=0; l<sizeof(loopsMs)/sizeof(loopsMs[0]); ++l)
+        {
+            t90[l] = stepTime(filters[f].q, loopsMs[l]);
+            mean  += t90[l] / (sizeof(loopsMs)/sizeof(loopsMs[0]));
+        }
+
+        printf("  %s, step %d counts: 90%% after", filters[f].name, STEP_COUNTS);
+        for(size_t l=0; l<sizeof(loopsMs)/sizeof(loopsMs[0]); ++l)
+        {
+            printf(" %.2fs", t90[l]);
+            CHECK(t90[l] >= 0.0 && fabs(t90[l] - mean) <= STEP_TOL * mean + loopsMs[l] / 1000.0,
+                  "%s: step 90%% after %.2fs at %dms loop, mean %.2fs", filters[f].name, t90[l], loopsMs[l], mean);
+        }
+        printf(" (loop");
+        for(size_t l=0; l<sizeof(loopsMs)/sizeof(loopsMs[0]); ++l)
+            printf(" %dms", loopsMs[l]);
+        printf(")\n");
+    }
+}
+
+
+static void testTrace(const char *path)
+{
+    std::vector<Reading> tr;
+    if(loadTrace(path, &tr))
+    {
+        CHECK(0, "%s: no readings", path);
+        return;
+    }
+
+    // zero lag reference
+    std::vector<double> ref(tr.size());
+    size_t lo = 0, hi = 0;
+    double sum = 0.0;
+    for(size_t k=0; k<tr.size(); ++k)
+    {
+        while(hi < tr.size() && tr[hi].ms <= tr[k].ms + REF_HALF_MS)
+            sum += tr[hi++].adc;
+        while(tr[lo].ms + REF_HALF_MS < tr[k].ms)
+            sum -= tr[lo++].adc;
+        ref[k] = adcToC(sum / (hi - lo));
+    }
+
+    double refMin = ref[0], refMax = ref[0];
+    for(size_t k=0; k<ref.size(); ++k)
+    {
+        refMin = fmin(refMin, ref[k]);
+        refMax = fmax(refMax, ref[k]);
+    }
+
+    printf("  %s: %lu readings, %.1f s, %.2f .. %.2f C\n", path, (unsigned long)tr.size(), tr.back().ms / 1000.0, refMin, refMax);
+    printf("    %-24s %8s %8s %8s\n", "filter", "RMS C", "max C", "noise C");
+
+    Result res[FILTERS];
+    for(size_t f=0; f<FILTERS; ++f)
+    {
+        runFilter(&filters[f], tr, ref, &res[f]);
+        printf("    %-24s %8.3f %8.3f %8.4f\n", filters[f].name, res[f].rms, res[f].maxErr, res[f].noise);
+        CHECK(res[f].rms <= TRACE_RMS_MAX, "%s %s: RMS %.3f C", path, filters[f].name, res[f].rms);
+    }
+
+    // a moving temperature - the best Kalman filter beats the exp. one at a comparable noise
+    if(refMax - refMin >= 5.0)
+    {
+        size_t best = 0;
+        for(size_t f=0; f<FILTERS; ++f)
+            if(filters[f].q > 0.0f && res[f].noise <= KALMAN_NOISE_MAX * res[0].noise && (!best || res[f].rms < res[best].rms))
+                best = f;
+
+        CHECK(best && res[best].rms < res[0].rms, "%s: no Kalman filter follows better than the exp. one", path);
+        if(best)
+            printf("    %s: RMS %.0f%% of the exp. filter's at %.1fx its noise\n", filters[best].name,
+                   100.0 * res[best].rms / res[0].rms, res[best].noise / res[0].noise);
+    }
+}
+
+
+int main(int argc, char **argv)
+{
+    printf("kalman_test\n");
+
+    if(argc < 2)
+    {
+        printf("usage: kalman_test trace...\n");
+        return 2;
+    }
+
+    testStep();
+
+    for(int a=1; a<argc; ++a)
+        testTrace(argv[a]);
+
+    return checkResult("kalman_test");
+}
@@ -0,0 +1,167 @@
+/*******************************************************************************
+ *
+ *  Integer mapping table interpolation vs. the float one it replaced
+ *
+ * Several geometries (the default one, fine and coarse steps, non-uniform axes up to the widest
+ * segments) and tables (random, flat, checkerboard of 0 and 100). Every input PWM 0 .. 100 and every
+ * temperature in 1/TEMP_ONE C from below to above the axis. The integer result must be the exact
+ * bilinear value rounded half up, the float one may differ at the .5 ties only. Host benchmark of both
+ * variants (AVR cycles - see avr_bench), and of the temperature flickering by 1/TEMP_ONE C which used to
+ * rebuild the cached row on every change.
+ ******************************************************************************/
+
+#include <Arduino.h>
+#include "PFCmain.h"
+#include "DataProcessing.h"
+#include "reference.h"
+#include "bench.h"
+
+
+static uint32_t rngState = 0x2545f491;
+
+static uint32_t rnd(void)
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+
+/** Position on an axis - segment and fraction, clamped to the ends */
+static void axisPos(const unsigned char *axis, int n, double v, int *i, double *frac)
+{
+    if(v <= axis[0])
+    {
+        *i = 0;
+        *frac = 0.0;
+        return;
+    }
+    for(int a=0; a<n-1; ++a)
+    {
+        if(v < axis[a+1])
+        {
+            *i = a;
+            *frac = (v - axis[a]) / (axis[a+1] - axis[a]);
+            return;
+        }
+    }
+    *i = n - 1;
+    *frac = 0.0;
+}
+
+
+/** Exact bilinear value */
+static double exactMap(unsigned char fan, int pwm, int tmp)
+{
+    int    it, ip;
+    double ft, fp;
+    axisPos(tempAxis, mapTempCoeffs, (double)tmp / TEMP_ONE, &it, &ft);
+    axisPos(pwmAxis, mapPwmCoeffs, pwm, &ip, &fp);
+
+    int it2 = (it < mapTempCoeffs - 1) ? it + 1 : it;
+    int ip2 = (ip < mapPwmCoeffs - 1) ? ip + 1 : ip;
+
+    double v1 = mapCell(fan, it,  ip) * (1.0 - fp) + mapCell(fan, it,  ip2) * fp;
+    double v2 = mapCell(fan, it2, ip) * (1.0 - fp) + mapCell(fan, it2, ip2) * fp;
+    return v1 * (1.0 - ft) + v2 * ft;
+}
+
+
+struct Counts
+{
+    unsigned long cases;
+    unsigned long floatTies;   // float rounded a .5 tie the other way
+};
+
+
+static void testTables(const char *geom, Counts *cnt)
+{
+    for(int t=0; t<4; ++t)
+    {
+        for(int c=0; c<mapTempCoeffs*mapPwmCoeffs; ++c)
+        {
+            int r = c / mapPwmCoeffs, p = c % mapPwmCoeffs;
+            mappingTable[0][c] = (t == 0) ? rnd() % 101 : (t == 1) ? 100 : (t == 2) ? ((r + p) & 1) * 100
+                               : (unsigned char)((r * 37 + p * 11) % 101);
+        }
+
+        for(int tmp=(tempAxis[0] - 2) * TEMP_ONE; tmp<=(tempAxis[mapTempCoeffs-1] + 2) * TEMP_ONE; ++tmp)
+        {
+            for(int pwm=0; pwm<=100; ++pwm, ++cnt->cases)
+            {
+                double exact = exactMap(0, pwm, tmp);
+                int    i     = interpolatePwm(0, pwm, tmp);
+                int    f     = floatInterpolatePwm(0, pwm, tmp);
+                int    r     = (int)floor(exact + 0.5 + 1e-9);   // half up, exact ties are rationals
+
+                CHECK(i == r, "%s table %d pwm %d tmp %d: int %d exact %f", geom, t, pwm, tmp, i, exact);
+                if(f != r)
+                {
+                    ++cnt->floatTies;
+                    CHECK(fabs(exact - floor(exact) - 0.5) < 1e-4, "%s table %d pwm %d tmp %d: float %d exact %f",
+                          geom, t, pwm, tmp, f, exact);
+                }
+            }
+        }
+    }
+}
+
+
+static void setAxis(unsigned char *axis, int n, const unsigned char *v)
+{
+    for(int a=0; a<n; ++a)
+        axis[a] = v[a];
+}
+
+
+int main(void)
+{
+    printf("map_test\n");
+
+    Counts cnt = { 0, 0 };
+
+    setMapGeometry(TEMP_MIN, TEMP_STEP, TEMP_MAX, PWM_STEP);
+    testTables("default", &cnt);
+
+    setMapGeometry(20, 1, 27, 5);
+    testTables("1C steps", &cnt);
+
+    setMapGeometry(0, 85, 255, 50);
+    testTables("coarse", &cnt);
+
+    // the widest segments: 255 C and 99 %
+    setMapGeometry(0, 255, 255, 50);
+    static const unsigned char wideP[] = { 0, 1, 100 };
+    setAxis(pwmAxis, 3, wideP);
+    testTables("widest", &cnt);
+
+    // non-uniform axes
+    setMapGeometry(TEMP_MIN, TEMP_STEP, TEMP_MAX, PWM_STEP);
+    static const unsigned char nuT[] = { 15, 25, 30, 33, 36, 40, 50, 70 };
+    static const unsigned char nuP[] = { 0, 2, 5, 10, 15, 20, 25, 30, 35, 40, 45, 50, 55, 60, 70, 75, 80, 85, 90, 97, 100 };
+    setAxis(tempAxis, TEMP_COEFFS, nuT);
+    setAxis(pwmAxis, PWM_COEFFS, nuP);
+    testTables("non-uniform", &cnt);
+
+    printf("  %lu cases, the float version rounded %lu .5 ties the other way\n", cnt.cases, cnt.floatTies);
+
+    // benchmark - default geometry, random table, the temperature moving
+    setMapGeometry(TEMP_MIN, TEMP_STEP, TEMP_MAX, PWM_STEP);
+    for(int c=0; c<MAP_CELLS; ++c)
+        mappingTable[0][c] = rnd() % 101;
+
+    const long n = 20000000;
+    printf("  host benchmark:\n");
+    double fb = BENCH("float interpolation", n, benchSink += floatInterpolatePwm(0, i % 101, 320 + (i & 0x1ff)));
+    double ib = BENCH("interpolatePwm (integer)", n, benchSink += interpolatePwm(0, i % 101, 320 + (i & 0x1ff)));
+    printf("  host ratio float/int %.2f\n", fb / ib);
+
+    // the averaged temperature flickering by 1/TEMP_ONE C costs the same, there is nothing to rebuild
+    // (a row rebuild would be 101 interpolations, the limit is loose for a busy host)
+    double kb = BENCH("interpolatePwm, temperature flicker", n, benchSink += interpolatePwm(0, 50, 600 + (i & 1)));
+    printf("  flicker/moving %.2f\n", kb / ib);
+    CHECK(kb < 10.0 * ib, "flicker %.2f ns vs %.2f ns", kb, ib);
+
+    return checkResult("map_test");
+}
@@ -0,0 +1,111 @@
+/*******************************************************************************
+ *
+ *  Input loss vs. a 0% / 100% flat line
+ *
+ * pwmMeasureInput on input 1 (D8, PINB0) with no edge for a given number of timer1 overflows and the
+ * pin held at a level:
+ * - low (driven against the pull-up) is a flat line for any time, never a loss
+ * - high (the pull-up, i.e. disconnected or a driven high) is a flat line up to PWM_IN_LOSS_MS, a loss
+ *   after that - the filtered duty stays where it was
+ * - the loss is counted once and it recovers as soon as the pin is driven low
+ * - a lost input never lowers the fan duty below what its flat level means: with positive polarity
+ *   (high is 100%) the selection gives 100% whatever the fallback, with negative the fallback
+ ******************************************************************************/
+
+#include <Arduino.h>
+#include "PwmMeasure.h"
+#include "DataProcessing.h"
+#include "bench.h"
+
+#define LOSS_OVF ((PWM_IN_LOSS_MS * 1000L + 4095) / 4096)
+
+// PwmMeasure.cpp internals
+extern volatile word pwmTimerHigh;
+extern volatile byte pwmCaptOvf[PWM_INPUTS];
+extern int pwmMeasureInput(byte in);
+
+
+/** Simulated timer1, 32 bit */
+static uint32_t simTicks;
+
+
+/** One 21ms loop with no edge for ovf overflows and the pin at level, returns non zero for no update */
+static int flatLoop(byte ovf, byte level)
+{
+    simTicks     += 21 * (F_CPU / 1000);
+    pwmTimerHigh  = (word)(simTicks >> 16);
+    TCNT1         = (word)simTicks;
+
+    pwmCaptOvf[0] = ovf;
+    PINB          = level ? bit (PINB0) : 0;
+    return pwmMeasureInput(0);
+}
+
+
+static void testPolarity(byte pol)
+{
+    pwmSetPolarityMode(0, pol);
+    pwmPeriodTicks[0]  = 0;
+    pwmInLost[0]       = 0;
+    pwmStatLost[0]     = 0;
+    pwmStatFlatline[0] = 0;
+
+    int lowDuty  = (pol == PWM_POL_POS) ? 0 : 1000;
+    int highDuty = 1000 - lowDuty;
+
+    // below the flatline timeout nothing happens (no edges captured, nothing to decode)
+    flatLoop(PWM_IN_FLATLINE_OVF - 1, 0);
+    CHECK(pwmStatFlatline[0] == 0, "pol %d: flat line before %d overflows", pol, PWM_IN_FLATLINE_OVF);
+
+    // driven low - a flat line however long it lasts
+    for(int ovf=PWM_IN_FLATLINE_OVF; ovf<=255; ++ovf)
+    {
+        CHECK(flatLoop(ovf, 0) == 0 && !pwmInLost[0], "pol %d: low for %d overflows is lost", pol, ovf);
+        CHECK(pwmStatFlatline[0] == (unsigned long)(ovf - PWM_IN_FLATLINE_OVF + 1), "pol %d: flatline count", pol);
+    }
+    CHECK(abs(pwmDuty[0] - lowDuty) <= 1, "pol %d: low level duty %d, expected %d", pol, pwmDuty[0], lowDuty);
+
+    // high - a flat line up to the loss timeout
+    for(int ovf=PWM_IN_FLATLINE_OVF; ovf<LOSS_OVF; ++ovf)
+        CHECK(flatLoop(ovf, 1) == 0 && !pwmInLost[0], "pol %d: high for %d overflows is lost", pol, ovf);
+    CHECK(pwmStatLost[0] == 0, "pol %d: lost before the timeout", pol);
+
+    // ... and a loss after it, counted once, the filtered value holds
+    int held = pwmDuty[0];
+    for(int ovf=LOSS_OVF; ovf<=255; ++ovf)
+        CHECK(flatLoop(ovf, 1) == 1 && pwmInLost[0], "pol %d: high for %d overflows not lost", pol, ovf);
+    CHECK(pwmStatLost[0] == 1, "pol %d: %lu losses", pol, pwmStatLost[0]);
+    CHECK(pwmDuty[0] == held, "pol %d: duty moved to %d while lost", pol, pwmDuty[0]);
+    CHECK(pwmPeriodTicks[0] == 0, "pol %d: period kept while lost", pol);
+
+    // the fans - a low fallback must not slow them down when the high level means 100%
+    for(int fb=0; fb<=1000; fb+=100)
+    {
+        int d = pwmSelectDuty(1, fb);
+        CHECK(d == ((pol == PWM_POL_POS) ? 1000 : fb), "pol %d: lost, fallback %d, selected %d", pol, fb, d);
+        d = pwmSelectDuty(1 | PWM_IN_SEL_AVG, fb);
+        CHECK(d == ((pol == PWM_POL_POS) ? 1000 : fb), "pol %d: lost, fallback %d, selected (avg.) %d", pol, fb, d);
+    }
+
+    // driven low again - recovered, starts from the low level
+    CHECK(flatLoop(255, 0) == 0 && !pwmInLost[0], "pol %d: not recovered", pol);
+    for(int k=0; k<2000; ++k)
+        flatLoop(255, 0);
+    CHECK(abs(pwmDuty[0] - lowDuty) <= 1, "pol %d: recovered duty %d, expected %d", pol, pwmDuty[0], lowDuty);
+    CHECK(pwmSelectDuty(1, 1000) == pwmDuty[0], "pol %d: recovered, selected %d", pol, pwmSelectDuty(1, 1000));
+
+    printf("  %s: low %d, high %d permille up to %d overflows, then lost (fans at %s)\n",
+           (pol == PWM_POL_POS) ? "positive" : "negative", lowDuty, highDuty, (int)LOSS_OVF - 1,
+           (pol == PWM_POL_POS) ? "100%" : "the fallback");
+}
+
+
+int main(void)
+{
+    printf("pwm_loss_test\n");
+
+    testPolarity(PWM_POL_POS);
+    testPolarity(PWM_POL_NEG);
+
+    return checkResult("pwm_loss_test");
+}
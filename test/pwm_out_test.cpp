@@ -0,0 +1,340 @@
+/*******************************************************************************
+ *
+ *  PWM out - duty and no runt pulse on the simulated timers
+ *
+ * Timer0 / timer2 in fast PWM (TOP = OCRxA) simulated count by count: OCRxB double buffered (taken
+ * at BOTTOM), the compare output waveform set at BOTTOM and cleared on the match (inverted by the
+ * COMxB mode), the pin driven by it or by PORT when disconnected, OCFxA / OCFxB and the PwmOut ISRs
+ * run 1 .. ISR_LATENCY counts after the flag (other ISRs blocking). The waveform keeps running while
+ * the pin is disconnected - the worst case for a reconnect. The ISR reads TCNTx ISR_WRITE counts
+ * before its register writes land. Random duty requests from the loop, with many stops (0) and
+ * starts and values close to both ends:
+ * - every edge on the pin is made by the timer - none from a register write in the code
+ * - no pulse is shorter than the OCRxB + 1 counts programmed for its period
+ * - the fan is active for OCRxB + 1 counts from BOTTOM in both polarities (PWM_OUT_NEG)
+ * - a stop or a start is on the pin within START_PERIODS
+ * - the long run average fan duty over AVG_PERIODS is the permille for every value 0 .. 1000 (the
+ *   one count minimum below 12.5 permille), within a count over the window and the Q8 rounding with
+ *   PWM_OUT_DITHER, the nearest count without
+ ******************************************************************************/
+
+#include <Arduino.h>
+#include "Config.h"
+#include "PwmOut.h"
+#include "bench.h"
+
+#define ISR_LATENCY    38      // counts (0.5us), ~300 cycles
+#define ISR_WRITE      2       // counts from reading TCNTx to the last register write
+#define START_PERIODS  4
+#define AVG_PERIODS    512
+#define PERIODS        500000L
+#define COUNTS         (PWM_OUT_TOP + 1)
+
+extern "C" void TIMER0_COMPA_vect(void);
+extern "C" void TIMER0_COMPB_vect(void);
+extern "C" void TIMER2_COMPA_vect(void);
+extern "C" void TIMER2_COMPB_vect(void);
+
+
+/** A PWM out channel - its timer registers, pin and code */
+struct Channel
+{
+    const char       *name;
+    volatile uint8_t *tccrA, *timsk, *tifr, *ocrB, *tcnt;
+    byte              pin;       // in PORTD / PIND
+    byte              comB1, comB0, ocieA, ocieB, ocfA, ocfB;
+    void            (*isrA)(void);
+    void            (*isrB)(void);
+    void            (*begin)(unsigned int duty);
+    void            (*set)(unsigned int pm);
+};
+
+#ifdef PWM_OUT_DITHER
+#define ISR_A(vect)  vect
+#else
+#define ISR_A(vect)  NULL
+#endif
+
+static const Channel channels[] =
+{
+    { "A (timer0, D5)", &TCCR0A, &TIMSK0, &TIFR0, &OCR0B, &TCNT0, PIND5, COM0B1, COM0B0, OCIE0A, OCIE0B, OCF0A, OCF0B,
+      ISR_A(TIMER0_COMPA_vect), TIMER0_COMPB_vect, pwmBeginA, pwmSetPermilleA },
+    { "B (timer2, D3)", &TCCR2A, &TIMSK2, &TIFR2, &OCR2B, &TCNT2, PIND3, COM2B1, COM2B0, OCIE2A, OCIE2B, OCF2A, OCF2B,
+      ISR_A(TIMER2_COMPA_vect), TIMER2_COMPB_vect, pwmBeginB, pwmSetPermilleB },
+};
+
+
+static uint32_t rngState = 0x243f6a88;
+
+static uint32_t rnd(void)
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+
+/** Simulated timer */
+static const Channel *ch;
+static long  now;              // counts since the start
+static int   cnt;              // TCNTx
+static int   ocrAct;           // OCRxB in use this period
+static byte  wave;             // compare output, 1 from BOTTOM to the match
+static byte  flagA, flagB;     // OCFxA, OCFxB
+static byte  pending;          // ISR scheduled, 1 - A, 2 - B
+static long  pendingAt;
+
+/** Pulses on the pin */
+static long  pulseStart, pulseOcr;
+static long  edges, badEdges, pulses, runts;
+static long  activeCounts;
+
+
+static byte connected(void)
+{
+    return (*ch->tccrA & bit(ch->comB1)) != 0;
+}
+
+static byte pinLevel(void)
+{
+    if(!connected())
+        return (PORTD >> ch->pin) & 1;
+    return (*ch->tccrA & bit(ch->comB0)) ? !wave : wave;
+}
+
+/** The fan sees the pin inverted with PWM_OUT_NEG */
+static byte fanActive(void)
+{
+#ifdef PWM_OUT_NEG
+    return !pinLevel();
+#else
+    return pinLevel();
+#endif
+}
+
+
+/** A pin change, by the timer or not */
+static void pinChange(byte active, byte byTimer)
+{
+    ++edges;
+    if(!byTimer)
+        ++badEdges;
+
+    if(active)
+    {
+        pulseStart = now;
+        pulseOcr   = byTimer ? ocrAct : -1;   // a pulse not started at BOTTOM is a runt anyway
+    }
+    else
+    {
+        ++pulses;
+        if(pulseOcr < 0 || (pulseOcr < PWM_OUT_TOP && now - pulseStart != pulseOcr + 1))
+            ++runts;
+    }
+}
+
+
+/** One timer count */
+static void tick(void)
+{
+    byte before = fanActive();
+
+    int old = cnt;
+    cnt = (old == PWM_OUT_TOP) ? 0 : old + 1;
+    if(old == ocrAct)
+    {
+        flagB = 1;
+        if(ocrAct != PWM_OUT_TOP)
+            wave = 0;
+    }
+    if(old == PWM_OUT_TOP)
+        flagA = 1;
+    if(cnt == 0)
+    {
+        ocrAct = *ch->ocrB;
+        wave   = 1;
+    }
+    ++now;
+
+    byte after = fanActive();
+    if(after != before)
+        pinChange(after, 1);
+    activeCounts += after;
+}
+
+
+/** Code run with the registers as the timer has them, TIFRx writes clear the flags */
+static void runCode(void (*fn)(void), unsigned int pm)
+{
+    byte before = fanActive();
+
+    *ch->tifr = 0;
+    if(fn)
+        fn();
+    else
+        ch->set(pm);
+    if(*ch->tifr & bit(ch->ocfA))
+        flagA = 0;
+    if(*ch->tifr & bit(ch->ocfB))
+        flagB = 0;
+
+    byte after = fanActive();
+    if(after != before)
+        pinChange(after, 0);
+}
+
+
+/** Schedule and run the ISRs */
+static void interrupts(void)
+{
+    if(!pending)
+    {
+        if(ch->isrA && (*ch->timsk & bit(ch->ocieA)) && flagA)
+            pending = 1;
+        else if((*ch->timsk & bit(ch->ocieB)) && flagB)
+            pending = 2;
+        if(pending)
+            pendingAt = now + 1 + rnd() % ISR_LATENCY;
+    }
+
+    if(pending && now >= pendingAt)
+    {
+        if(pending == 1)
+            flagA = 0;
+        else
+            flagB = 0;
+        *ch->tcnt = cnt;
+        PIND      = pinLevel() << ch->pin;
+
+        for(int k=0; k<ISR_WRITE; ++k)
+            tick();
+
+        runCode((pending == 1) ? ch->isrA : ch->isrB, 0);
+        pending = 0;
+    }
+}
+
+
+static void simBegin(const Channel *c)
+{
+    ch = c;
+    now = 0; cnt = 0; ocrAct = 0; wave = 0; flagA = 0; flagB = 0; pending = 0;
+    pulseStart = 0; pulseOcr = -1; edges = 0; badEdges = 0; pulses = 0; runts = 0;
+    PORTD = 0;
+
+    ch->begin(35);
+}
+
+
+static void simPeriods(long periods)
+{
+    for(long end = now + periods * COUNTS; now < end; )
+    {
+        tick();
+        interrupts();
+    }
+}
+
+
+static void testChannel(const Channel *c)
+{
+    simBegin(c);
+
+    long requests = 0, stops = 0, starts = 0, maxStart = 0;
+    long nextRequest = COUNTS, requestAt = -1;
+    byte want = 1;
+
+    while(now < PERIODS * COUNTS)
+    {
+        tick();
+        interrupts();
+
+        if(now >= nextRequest)
+        {
+            unsigned int pm;
+            switch(rnd() % 8)
+            {
+                case 0:  pm = 0; break;
+                case 1:  pm = 1000; break;
+                case 2:  pm = rnd() % 30; break;
+                case 3:  pm = 970 + rnd() % 31; break;
+                default: pm = rnd() % 1001; break;
+            }
+            runCode(NULL, pm);
+            ++requests;
+
+            if((pm != 0) != want)
+            {
+                want      = (pm != 0);
+                requestAt = now;
+                want ? ++starts : ++stops;
+            }
+            nextRequest = now + 2 + rnd() % (30 * COUNTS);
+        }
+
+        // a stop or a start is done when the pin gets (dis)connected
+        if(requestAt >= 0 && connected() == want)
+        {
+            if(now - requestAt > maxStart)
+                maxStart = now - requestAt;
+            requestAt = -1;
+        }
+    }
+
+    printf("  %s: %ld requests (%ld stops, %ld starts), %ld edges, %ld not by the timer, %ld pulses, %ld runts, stop / start in max. %.1f periods\n",
+           ch->name, requests, stops, starts, edges, badEdges, pulses, runts, (double)maxStart / COUNTS);
+    CHECK(badEdges == 0, "%s: %ld edges not made by the timer", ch->name, badEdges);
+    CHECK(runts == 0, "%s: %ld pulses shorter than programmed", ch->name, runts);
+    CHECK(maxStart <= START_PERIODS * COUNTS, "%s: stop / start took %.1f periods", ch->name, (double)maxStart / COUNTS);
+}
+
+
+static void testAverage(const Channel *c)
+{
+    simBegin(c);
+
+    double maxErr = 0.0;
+    for(unsigned int pm=0; pm<=1000; ++pm)
+    {
+        runCode(NULL, pm);
+
+        // settle (a stop or start, the new OCRxB), then a window from BOTTOM
+        simPeriods(START_PERIODS + 1);
+        while(cnt != 0)
+        {
+            tick();
+            interrupts();
+        }
+        activeCounts = 0;
+        simPeriods(AVG_PERIODS);
+
+        double duty = activeCounts * 1000.0 / (AVG_PERIODS * COUNTS);
+        double expected = (pm == 0) ? 0.0 : fmax(pm, 1000.0 / COUNTS);
+#ifdef PWM_OUT_DITHER
+        double tol = 1000.0 / COUNTS / AVG_PERIODS + 0.5 / 256 * 1000.0 / COUNTS + 1e-9;
+#else
+        double tol = 0.5 * 1000.0 / COUNTS + 1e-9;
+#endif
+        if(fabs(duty - expected) > maxErr)
+            maxErr = fabs(duty - expected);
+        CHECK(fabs(duty - expected) <= tol, "%s: %u permille, average %.3f", ch->name, pm, duty);
+    }
+
+    printf("  %s: 0 .. 1000 permille, average over %d periods off by max. %.3f permille\n", ch->name, AVG_PERIODS, maxErr);
+    CHECK(badEdges == 0 && runts == 0, "%s: %ld edges not by the timer, %ld runts while stepping", ch->name, badEdges, runts);
+}
+
+
+int main(void)
+{
+    printf("pwm_out_test\n");
+
+    for(unsigned c=0; c<sizeof(channels)/sizeof(channels[0]); ++c)
+    {
+        testChannel(&channels[c]);
+        testAverage(&channels[c]);
+    }
+
+    return checkResult("pwm_out_test");
+}
@@ -0,0 +1,210 @@
+/*******************************************************************************
+ *
+ *  PWM decoder replay harness
+ *
+ * Feeds edge traces through the firmware capture code - TIMER1_CAPT_vect and pwmCaptureSnapshot
+ * (PwmMeasure.cpp) on the simulated timer1 (timer1_sim.h) - and PwmDecode.cpp, the same decoder the
+ * Arduino runs. Reports the duty cycle error of the accepted captures, the accept ratio and the decoder
+ * throughput, fails when a trace is out of its limits.
+ *
+ * Trace format (text, one item per line):
+ *   # comment
+ *   period <timer1 counts>     expected period
+ *   duty <tenths of percent>   expected positive duty cycle
+ *   tol <tenths of percent>    max. duty error of an accepted capture
+ *   accept <percent>           min. accepted captures (of all the decoded snapshots)
+ *   <time> <level>             edge - 32 bit timer1 timestamp (wraps around) and the new pin level
+ *
+ * Usage: pwm_replay [-l latency] [-j jitter] trace...
+ *   -l  capture ISR latency in timer1 counts (default 60), the edge type switch happens this late
+ *   -j  timestamp jitter in timer1 counts (default 0), models a pin change interrupt input
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+#include "timer1_sim.h"
+#include "PwmDecode.h"
+
+extern volatile byte pwmCaptHead[PWM_INPUTS];   // PwmMeasure.cpp
+
+
+struct Edge
+{
+    uint32_t time;
+    byte     level;
+};
+
+struct Trace
+{
+    std::vector<Edge> edges;
+    uint32_t period;
+    int      duty;
+    int      tol;
+    int      accept;
+};
+
+
+static int loadTrace(const char *path, Trace *tr)
+{
+    FILE *f = fopen(path, "r");
+    if(!f)
+    {
+        perror(path);
+        return 1;
+    }
+
+    char line[128];
+    tr->period = 0;
+    tr->duty   = -1;
+    tr->tol    = 1;
+    tr->accept = 100;
+
+    while(fgets(line, sizeof(line), f))
+    {
+        unsigned long t;
+        int v;
+        if(line[0] == '#' || line[0] == '\n')
+            continue;
+        if(sscanf(line, "period %lu", &t) == 1)
+            tr->period = t;
+        else if(sscanf(line, "duty %d", &v) == 1)
+            tr->duty = v;
+        else if(sscanf(line, "tol %d", &v) == 1)
+            tr->tol = v;
+        else if(sscanf(line, "accept %d", &v) == 1)
+            tr->accept = v;
+        else if(sscanf(line, "%lu %d", &t, &v) == 2)
+        {
+            Edge e = { (uint32_t)t, (byte)(v != 0) };
+            tr->edges.push_back(e);
+        }
+        else
+        {
+            fprintf(stderr, "%s: bad line: %s", path, line);
+            fclose(f);
+            return 1;
+        }
+    }
+
+    fclose(f);
+
+    if(tr->period == 0 || tr->duty < 0 || tr->edges.size() < 2*PWM_CAPT_EDGES)
+    {
+        fprintf(stderr, "%s: missing period/duty or too short\n", path);
+        return 1;
+    }
+    return 0;
+}
+
+
+struct Stats
+{
+    unsigned long decoded;
+    unsigned long accepted;
+    long          maxErr;
+    double        sumErr;
+    double        ns;
+};
+
+
+/** Decode what the loop would see now (a full ring only) */
+static void decodeSnap(const Trace *tr, Stats *st)
+{
+    PwmCaptSnapshot snap;
+    PwmDecodeResult res;
+    pwmCaptureSnapshot(0, &snap);
+    if(snap.edges < PWM_CAPT_EDGES)
+        return;
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int rc = pwmDecode(&snap, &res);
+    int duty = rc ? 0 : pwmDecodeDuty(&res);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    st->ns += (t1.tv_sec - t0.tv_sec) * 1e9 + (t1.tv_nsec - t0.tv_nsec);
+    ++st->decoded;
+    if(rc)
+        return;
+
+    ++st->accepted;
+    long err = labs((long)duty - tr->duty);
+    if(err > st->maxErr)
+        st->maxErr = err;
+    st->sumErr += err;
+}
+
+
+static int replay(const char *path, uint32_t latency, uint32_t jitter)
+{
+    Trace tr;
+    if(loadTrace(path, &tr))
+        return 1;
+
+    Stats st;
+    memset(&st, 0, sizeof(st));
+
+    pwmMeasureBegin();
+    simCaptLatency = latency;
+    simCaptJitter  = jitter;
+    simStart(tr.edges[0].time - 1);
+
+    // the main loop decodes whenever there is something new, here after every single capture ISR
+    byte head = pwmCaptHead[0];
+    for(size_t i=0; i<tr.edges.size(); ++i)
+    {
+        simRun(tr.edges[i].time);
+        if(pwmCaptHead[0] != head)
+        {
+            head = pwmCaptHead[0];
+            decodeSnap(&tr, &st);
+        }
+        simEdge(tr.edges[i].time, tr.edges[i].level);
+    }
+    simRun(tr.edges.back().time + latency + 1);
+    if(pwmCaptHead[0] != head)
+        decodeSnap(&tr, &st);
+
+    double acceptPct = st.decoded ? 100.0 * st.accepted / st.decoded : 0;
+    double meanErr   = st.accepted ? st.sumErr / st.accepted : 0;
+    int    fail      = (st.maxErr > tr.tol) || (acceptPct < tr.accept) || (st.accepted == 0);
+
+    printf("%-22s %6zu %7lu %7.1f%% %6ld %7.2f %9.0f  %s\n", strrchr(path, '/') ? strrchr(path, '/') + 1 : path,
+           tr.edges.size(), st.decoded, acceptPct, st.maxErr, meanErr,
+           st.ns ? st.decoded * 1e9 / st.ns : 0, fail ? "FAIL" : "ok");
+
+    return fail;
+}
+
+
+int main(int argc, char **argv)
+{
+    uint32_t latency = 60;
+    uint32_t jitter  = 0;
+    int      fails   = 0;
+    int      i       = 1;
+
+    for(; i<argc && argv[i][0] == '-'; ++i)
+    {
+        if(!strcmp(argv[i], "-l") && i+1 < argc)
+            latency = strtoul(argv[++i], NULL, 0);
+        else if(!strcmp(argv[i], "-j") && i+1 < argc)
+            jitter = strtoul(argv[++i], NULL, 0);
+        else
+        {
+            fprintf(stderr, "usage: %s [-l latency] [-j jitter] trace...\n", argv[0]);
+            return 2;
+        }
+    }
+
+    printf("ISR latency %u counts, timestamp jitter %u counts\n", latency, jitter);
+    printf("%-22s %6s %7s %8s %6s %7s %9s\n", "trace", "edges", "decoded", "accepted", "maxerr", "meanerr", "decodes/s");
+    for(; i<argc; ++i)
+        fails += replay(argv[i], latency, jitter);
+
+    return fails ? 1 : 0;
+}
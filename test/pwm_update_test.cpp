@@ -0,0 +1,121 @@
+/*******************************************************************************
+ *
+ *  PWM input - pwmMeasureUpdate never blocks the loop
+ *
+ * pwmMeasureUpdate is called from a simulated 1 .. 2ms loop, the capture and overflow ISRs run on the
+ * simulated timer1 (timer1_sim.h) between the calls. A busy wait for an edge or for the timer would
+ * hang here (the time does not move inside a call), the alarm turns it into a failure. Input 1 in
+ * four states:
+ * - no edges, below the flat line timeout - nothing new, the duty is held
+ * - a partial ring (fewer than PWM_CAPT_EDGES edges) - nothing new, the duty is held
+ * - 25kHz, the ring overwritten many times between the calls - the duty follows the signal
+ * - a flat line at the pull-up level - the duty moves to 100%, lost after PWM_IN_LOSS_MS with the
+ *   duty held
+ ******************************************************************************/
+
+#include <unistd.h>
+#include "timer1_sim.h"
+#include "DataProcessing.h"
+#include "bench.h"
+
+#define MS  (F_CPU / 1000)
+
+extern volatile byte pwmCaptHead[PWM_INPUTS];   // PwmMeasure.cpp
+
+
+/** Signal on D8, 0 - no edges (flat at the level) */
+static uint32_t sigPeriod, sigHigh;
+static byte     sigLevel;
+static uint32_t sigNext;          /**< Time of the next edge */
+
+static unsigned long calls;
+
+
+/** One loop - the signal and the ISRs for ticks, then a pwmMeasureUpdate call */
+static int loopStep(uint32_t ticks)
+{
+    uint32_t end = simNow + ticks;
+
+    while(sigPeriod && (int32_t)(end - sigNext) >= 0)
+    {
+        sigLevel = !sigLevel;
+        simEdge(sigNext, sigLevel);
+        sigNext += sigLevel ? sigHigh : sigPeriod - sigHigh;
+    }
+    simRun(end);
+    PINB = sigLevel ? bit (PINB0) : 0;
+
+    ++calls;
+    return pwmMeasureUpdate();
+}
+
+
+static void signal(uint32_t period, uint32_t high, byte level)
+{
+    sigPeriod = period;
+    sigHigh   = high;
+    sigLevel  = level;
+    sigNext   = simNow + 1;
+}
+
+
+/** Loops for ms, returns the number of calls with a new value */
+static unsigned long run(unsigned long ms, const char *state, int held)
+{
+    unsigned long updates = 0;
+    uint32_t      start   = simNow;
+
+    while((uint32_t)(simNow - start) < ms * MS)
+    {
+        if(loopStep((1000 + simRnd() % 1000) * (MS / 1000)) == 0)
+            ++updates;
+        if(held >= 0)
+            CHECK(pwmDuty[0] == held, "%s: duty %d, held %d", state, pwmDuty[0], held);
+    }
+    return updates;
+}
+
+
+int main(void)
+{
+    printf("pwm_update_test\n");
+    alarm(60);
+
+    pwmMeasureBegin();
+    pwmSetPolarityMode(0, PWM_POL_POS);
+    simStart(1);
+
+    // no edges, shorter than the flat line timeout
+    signal(0, 0, 0);
+    unsigned long u = run((PWM_IN_FLATLINE_OVF - 2) * 4, "no edges", pwmDuty[0]);
+    CHECK(u == 0, "no edges: %lu updates", u);
+    printf("  no edges: %lu calls, duty held at %d\n", calls, pwmDuty[0]);
+
+    // 100Hz for 30ms - a few edges, the ring is not complete
+    calls = 0;
+    signal(10 * MS, 3 * MS, 0);
+    u = run(30, "partial ring", pwmDuty[0]);
+    CHECK(u == 0 && pwmCaptHead[0] > 0 && pwmCaptHead[0] < PWM_CAPT_EDGES, "partial ring: %lu updates, %d edges", u, pwmCaptHead[0]);
+    printf("  partial ring: %lu calls, %d edges, duty held at %d\n", calls, pwmCaptHead[0], pwmDuty[0]);
+
+    // 25kHz 30% - ~50 edges per loop, decoded from whatever the ring has at the call
+    calls = 0;
+    signal(640, 192, 0);
+    u = run(4000, "25kHz", -1);
+    CHECK(u > calls / 2, "25kHz: %lu updates of %lu calls", u, calls);
+    CHECK(abs(pwmDuty[0] - 300) <= 3, "25kHz: duty %d, expected 300", pwmDuty[0]);
+    printf("  25kHz, overwritten ring: %lu calls, %lu updates, duty %d\n", calls, u, pwmDuty[0]);
+
+    // flat at the pull-up level - a flat line, then lost and held
+    calls = 0;
+    signal(0, 0, 1);
+    run(PWM_IN_LOSS_MS + 100, "flat line", -1);
+    CHECK(pwmDuty[0] > 300, "flat line: duty %d, not moving to 100%%", pwmDuty[0]);
+    CHECK(pwmInLost[0], "flat line: not lost after %dms", PWM_IN_LOSS_MS + 100);
+    int held = pwmDuty[0];
+    u = run(2000, "lost", held);
+    CHECK(u == 0, "lost: %lu updates", u);
+    printf("  flat line: %lu calls, lost, duty held at %d\n", calls, held);
+
+    return checkResult("pwm_update_test");
+}
@@ -0,0 +1,139 @@
+#ifndef __REFERENCE_H__
+#define __REFERENCE_H__
+
+/*******************************************************************************
+ *
+ *  Float reference implementations - the code replaced by the integer versions
+ *
+ * Used by the host equivalence tests and by the AVR cycle benchmark (avr_bench). The AVR double is
+ * a float, hence float everywhere.
+ ******************************************************************************/
+
+#include "PwmDecode.h"
+#include "DataProcessing.h"
+#include "PFCmain.h"
+#include "MCP9701.h"
+
+
+/** Exponential filter (replaced by @ExpFilterInt) */
+static inline float ExpFilter(float *oldVal, float weight, float newVal)
+{
+    *oldVal = (weight * newVal) + ((1.0f - weight) * (*oldVal));
+    return *oldVal;
+}
+
+
+/** Adaptive exponential filter, the float model of @AdaptFilterInt (weight and gain as fractions) */
+static inline float AdaptFilter(float *oldVal, float *dev, float weight, float gain, float newVal)
+{
+    if(gain > 0.0f)
+    {
+        float w = weight * (1.0f + gain * fabsf(*dev) / 10.0f);
+        *dev   += fminf(weight * ADAPTFILT_DEV_SPEED, (float)ADAPTFILT_DEV_WEIGHT / EXPFILT_WEIGHT_ONE) * (newVal - *oldVal - *dev);
+        weight  = (w > 1.0f) ? 1.0f : w;
+    }
+
+    return ExpFilter(oldVal, weight, newVal);
+}
+
+
+/** Duty cycle in % (replaced by @pwmDecodeDuty) */
+static inline float floatDuty(uint32_t width, uint32_t period)
+{
+    return (float)width * 100.0f / (float)period;
+}
+
+
+/** @pwmDecodeDuty without a decoder result at hand */
+static inline int intDuty(uint32_t width, uint32_t period)
+{
+    PwmDecodeResult res;
+    res.width  = width;
+    res.period = period;
+    return pwmDecodeDuty(&res);
+}
+
+/** MCP9701 reading in C, float conversion and filter (replaced by the integer @readTemp) */
+static inline float floatReadTemp(float *state, float weight, int adc)
+{
+    float temp = (float)adc * (float)MCP9701_A - (float)MCP9701_B;
+
+    return ExpFilter(state, weight, temp);
+}
+
+
+/**
+ * Weighted average temperature (replaced by the Q15 @averageTemp) - float multiply-accumulate and
+ * division by the weight sum, rounded, all zero weights mean plain average, clamped to the axis
+ */
+static inline int floatAverageTemp(unsigned char fan)
+{
+    float sum  = 0.0f;
+    float wSum = 0.0f;
+
+    for(int a=0; a<TEMP_SENSORS; ++a)
+    {
+        sum  += tempWeights[fan][a] * temps[a];
+        wSum += tempWeights[fan][a];
+    }
+
+    if(wSum <= 0.0f)
+    {
+        sum = 0.0f;
+        for(int a=0; a<TEMP_SENSORS; ++a)
+            sum += temps[a];
+        wSum = TEMP_SENSORS;
+    }
+
+    int result = (int)(sum / wSum + 0.5f);
+
+    if(result < tempAxis[0] * TEMP_ONE)
+        result = tempAxis[0] * TEMP_ONE;
+    else if(result > tempAxis[mapTempCoeffs-1] * TEMP_ONE)
+        result = tempAxis[mapTempCoeffs-1] * TEMP_ONE;
+
+    return result;
+}
+
+/**
+ * Mapping table bilinear interpolation (replaced by the integer @interpolatePwm) - float passes along
+ * the PWM axis for both rows, then along the temperature axis, rounded
+ */
+static inline int floatInterpolatePwm(unsigned char fan, unsigned char pwm, int tmp)
+{
+    unsigned char idxTmp1 = axisIndex(tempAxis, mapTempCoeffs, tmp >> TEMP_FRAC_BITS);
+    unsigned char idxTmp2 = idxTmp1;
+    int           spanTmp = 1;
+    int           distTmp = 0;
+
+    if(idxTmp1 < mapTempCoeffs-1)
+    {
+        idxTmp2 = idxTmp1 + 1;
+        spanTmp = (tempAxis[idxTmp2] - tempAxis[idxTmp1]) * TEMP_ONE;
+        distTmp = tmp - tempAxis[idxTmp1] * TEMP_ONE;
+        if(distTmp < 0)
+            distTmp = 0;
+    }
+
+    unsigned char idxPwm1 = axisIndex(pwmAxis, mapPwmCoeffs, pwm);
+    unsigned char idxPwm2 = idxPwm1;
+    unsigned char spanPwm = 1;
+    unsigned char distPwm = 0;
+
+    if(idxPwm1 < mapPwmCoeffs-1)
+    {
+        idxPwm2 = idxPwm1 + 1;
+        spanPwm = pwmAxis[idxPwm2] - pwmAxis[idxPwm1];
+        distPwm = pwm - pwmAxis[idxPwm1];
+    }
+
+    float pwmVal1 = ((float)(mapCell(fan, idxTmp1, idxPwm1)) * (float)(spanPwm-distPwm)
+                     + (float)(mapCell(fan, idxTmp1, idxPwm2)) * (float)distPwm) / (float)(spanPwm);
+    float pwmVal2 = ((float)(mapCell(fan, idxTmp2, idxPwm1)) * (float)(spanPwm-distPwm)
+                     + (float)(mapCell(fan, idxTmp2, idxPwm2)) * (float)distPwm) / (float)(spanPwm);
+    float pwmOut  = (pwmVal1 * (float)(spanTmp-distTmp) + pwmVal2 * (float)distTmp) / (float)(spanTmp);
+
+    return (int)(pwmOut + 0.5f);
+}
+
+#endif // __REFERENCE_H__
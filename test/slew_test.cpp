@@ -0,0 +1,106 @@
+/*******************************************************************************
+ *
+ *  Slew rate limit - the ramps run at the configured rate
+ *
+ * Every rise and fall rate 1 .. 255 %/s, ramps 0 -> 100% and back driven by slewTick on the
+ * simulated timer1 (PwmMeasure.cpp) with an irregular loop period. A ramp must take 100/rate s,
+ * give or take one SLEW_PERIOD_MS, and the output must never move faster than the rate allows.
+ ******************************************************************************/
+
+#include <Arduino.h>
+#include "Config.h"
+#include "PwmMeasure.h"
+#include "Slew.h"
+#include "bench.h"
+
+extern volatile word pwmTimerHigh;
+
+
+/** Simulated timer1, 32 bit */
+static uint32_t simTicks;
+
+static void simAdvance(unsigned long ticks)
+{
+    simTicks    += ticks;
+    pwmTimerHigh = (word)(simTicks >> 16);
+    TCNT1        = (word)simTicks;
+}
+
+
+static uint32_t rngState = 0x9e3779b9;
+
+static uint32_t rnd(void)
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+
+/** Ramp from to target at rate, returns the time it took in ms and the most the output got ahead of the ideal ramp (permille) */
+static double ramp(int from, int to, int rate, double *ahead)
+{
+    slewTrack(0, from);
+    slewRise[0] = (to > from) ? rate : 0;
+    slewFall[0] = (to > from) ? 0 : rate;
+
+    uint32_t start = simTicks;
+    double   worst = 0.0;
+
+    while(slewPermille(0) != to * 10)
+    {
+        // 1 .. 30ms loops
+        simAdvance((1 + rnd() % 30) * (F_CPU / 1000));
+        slewControl(0, to, !slewTick());
+
+        // the ideal ramp from the start against the output in permille
+        double t     = (double)(uint32_t)(simTicks - start) / F_CPU;
+        double ideal = from * 10 + ((to > from) ? 1 : -1) * rate * 10 * t;
+        double a     = ((to > from) ? (slewPermille(0) - ideal) : (ideal - slewPermille(0)));
+        if(a > worst)
+            worst = a;
+
+        if(t > 200.0)
+            break;
+    }
+
+    *ahead = worst;
+    return (double)(uint32_t)(simTicks - start) * 1000.0 / F_CPU;
+}
+
+
+int main(void)
+{
+    printf("slew_test\n");
+
+    double maxErr = 0.0, maxDev = 0.0;
+    for(int rate=1; rate<=255; ++rate)
+    {
+        for(int dir=0; dir<2; ++dir)
+        {
+            double expected = 100.0 / rate * 1000.0;
+            double ahead    = 0.0;
+            double ms       = dir ? ramp(100, 0, rate, &ahead) : ramp(0, 100, rate, &ahead);
+
+            // ahead of the ideal ramp by at most one step (in steps, the permille rounding included)
+            ahead /= rate * 10.0 * SLEW_PERIOD_MS / 1000;
+            if(ahead > maxErr)
+                maxErr = ahead;
+            CHECK(ahead <= 1.0 + 0.5 / (rate * 10.0 * SLEW_PERIOD_MS / 1000), "rate %d %s: ahead by %.2f steps",
+                  rate, dir ? "fall" : "rise", ahead);
+
+            double dev      = fabs(ms - expected);
+            if(dev > maxDev)
+                maxDev = dev;
+
+            // the first tick may come up to one period late, the last loop up to 30ms after the end
+            CHECK(dev <= SLEW_PERIOD_MS + 30 + 1, "rate %d %s: %.0fms, expected %.0fms", rate, dir ? "fall" : "rise", ms, expected);
+        }
+    }
+
+    printf("  rates 1 .. 255 %%/s: ramp time off by max. %.1fms, ahead of the ideal ramp by max. %.2f steps\n",
+           maxDev, maxErr);
+
+    return checkResult("slew_test");
+}
@@ -0,0 +1,186 @@
+/*******************************************************************************
+ *
+ *  Temperature filter step response - integer readTemp (ExpFilterInt on the ADC counts) vs. the
+ *  float filter on the converted temperature it replaced
+ *
+ * Steps of the ADC reading for several time constants and loop periods, the time comes from the
+ * simulated timer1 (PwmMeasure.cpp is linked, so the real timerFilterWeight decides which loops
+ * update the filter):
+ * - every update must follow the float filter fed with the same samples and weights within the
+ *   ExpFilterInt bound (converted to C) plus the 1/TEMP_ONE rounding
+ * - 63% and 95% of the step must be reached when the float filter running every loop (exact time)
+ *   reaches them, give or take the longest time between the updates (EXPFILT_WEIGHT_MIN) and one loop
+ * - no update may be further apart than EXPFILT_WEIGHT_MIN allows
+ * Host benchmark of both variants (AVR cycles - see avr_bench).
+ ******************************************************************************/
+
+#include <Arduino.h>
+#include "DataProcessing.h"
+#include "MCP9701.h"
+#include "InternalTemp.h"
+#include "PwmMeasure.h"
+#include "reference.h"
+#include "bench.h"
+
+extern volatile word pwmTimerHigh;
+long intTempKalmanSlope;   // InternalTemp.cpp is not linked
+
+
+/** Simulated timer1, 32 bit */
+static uint32_t simTicks;
+
+static void simAdvance(unsigned long ticks)
+{
+    simTicks    += ticks;
+    pwmTimerHigh = (word)(simTicks >> 16);
+    TCNT1        = (word)simTicks;
+}
+
+
+struct Step
+{
+    int from;
+    int to;
+};
+
+static const Step steps[] =
+{
+    { 180, 220 },  // about 24 .. 34 C
+    { 220, 180 },
+    { 200, 201 },  // single count
+    { 82,  400 },  // 0 C .. 80 C
+    { 0,   1023 },
+};
+
+static const float tcs[]   = { 0.05f, 0.4f, 2.0f, 10.0f, 60.0f };
+static const int   loops[] = { 1, 5, 21, 80 };   // ms
+
+
+/** Time (loop index) where the response reaches the level */
+static long crossing(const float *v, long n, float from, float to, float level)
+{
+    for(long k=0; k<n; ++k)
+        if((to > from) ? (v[k] >= level) : (v[k] <= level))
+            return k;
+    return -1;
+}
+
+
+static void testStep(float tc, int loopMs, const Step *st, double *maxErr, long *maxGap)
+{
+    tempSetFilterTc(tc);
+
+    unsigned long loopTicks = (unsigned long)loopMs * (F_CPU / 1000);
+    unsigned long loopDt    = loopTicks >> FILT_TIME_SHIFT;
+    float         wLoop     = 1.0f - expf(-1e-3f * loopMs / tc);
+    long          n         = (long)(8.0f * (tc + 1e-3f * loopMs) / (1e-3f * loopMs)) + 2;
+
+    // the longest time between the updates - the first one with the weight of at least EXPFILT_WEIGHT_MIN
+    unsigned long gapDt = 0;
+    while(ExpFilterWeightDt(tempExpFilterTcQ, gapDt) < EXPFILT_WEIGHT_MIN && gapDt < FILT_DT_MAX)
+        gapDt += loopDt;
+    long gapLoops = (long)(gapDt / loopDt);
+
+    float *vi = new float[n];   // integer readTemp
+    float *vf = new float[n];   // float filter every loop
+
+    float from = (float)st->from * (float)MCP9701_A - (float)MCP9701_B;
+    float to   = (float)st->to   * (float)MCP9701_A - (float)MCP9701_B;
+
+    simAdvance(loopTicks);
+    tempExpFilterVal[0] = (long)st->from << EXPFILT_FRAC_BITS;
+    tempFilterTime[0]   = simTicks;
+    hostAnalog[0]       = st->to;
+
+    float fSame = from;     // float filter with the updates of the integer one
+    float fLoop = from;
+    long  last  = -1;
+
+    for(long k=0; k<n; ++k)
+    {
+        simAdvance(loopTicks);
+
+        unsigned long prev = tempFilterTime[0];
+        vi[k] = (float)readTemp(0) / TEMP_ONE;
+        vf[k] = floatReadTemp(&fLoop, wLoop, st->to);
+
+        if(tempFilterTime[0] == prev)
+            continue;
+
+        // updated - the same weight for the float filter
+        unsigned int wq = ExpFilterWeightDt(tempExpFilterTcQ, (uint32_t)(tempFilterTime[0] - prev) >> FILT_TIME_SHIFT);
+        float        wf = (float)wq / EXPFILT_WEIGHT_ONE;
+        floatReadTemp(&fSame, wf, st->to);
+
+        CHECK(wq >= EXPFILT_WEIGHT_MIN, "tc %.2f loop %dms: weight %u", tc, loopMs, wq);
+        CHECK(k - last <= gapLoops, "tc %.2f loop %dms: %ld loops between the updates, max. %ld",
+              tc, loopMs, k - last, gapLoops);
+        if(k - last > *maxGap)
+            *maxGap = k - last;
+        last = k;
+
+        // converted filter bound: 1/(2^(FRAC+1)*w) counts, plus the 1/TEMP_ONE rounding and the Q16 constants
+        double bound = MCP9701_A / ((1 << (EXPFILT_FRAC_BITS + 1)) * wf) + 0.5 / TEMP_ONE + 0.01;
+        double e     = fabs(vi[k] - fSame);
+        if(e > *maxErr)
+            *maxErr = e;
+        CHECK(e <= bound, "tc %.2f loop %dms step %d->%d loop %ld: int %.4f float %.4f bound %.4f",
+              tc, loopMs, st->from, st->to, k, vi[k], fSame, bound);
+    }
+
+    // the integer value may be off by the bound, so the float crossings of the level -+ bound
+    float bound = MCP9701_A / ((1 << (EXPFILT_FRAC_BITS + 1)) * ((float)EXPFILT_WEIGHT_MIN / EXPFILT_WEIGHT_ONE))
+                + 0.5f / TEMP_ONE + 0.01f;
+    float sgn   = (to > from) ? 1.0f : -1.0f;
+    if(fabs(to - from) >= 4.0f / TEMP_ONE)
+    {
+        for(int p=0; p<2; ++p)
+        {
+            float frac  = p ? 0.95f : 0.63f;
+            float level = from + (to - from) * frac;
+            long  ki    = crossing(vi, n, from, to, level);
+            long  kfLo  = crossing(vf, n, from, to, level - sgn * bound);
+            long  kfHi  = crossing(vf, n, from, to, level + sgn * bound);
+            if(kfHi < 0)
+                kfHi = n;
+            CHECK(ki >= 0 && ki >= kfLo - gapLoops - 1 && ki <= kfHi + gapLoops + 1,
+                  "tc %.2f loop %dms step %d->%d: %.0f%% at loop %ld, float %ld .. %ld",
+                  tc, loopMs, st->from, st->to, frac * 100, ki, kfLo, kfHi);
+        }
+    }
+
+    delete[] vi;
+    delete[] vf;
+}
+
+
+int main(void)
+{
+    printf("temp_filter_test\n");
+
+    double maxErr = 0.0;
+    long   maxGap = 0;
+    int    cases  = 0;
+
+    for(unsigned t=0; t<sizeof(tcs)/sizeof(tcs[0]); ++t)
+        for(unsigned l=0; l<sizeof(loops)/sizeof(loops[0]); ++l)
+            for(unsigned s=0; s<sizeof(steps)/sizeof(steps[0]); ++s, ++cases)
+                testStep(tcs[t], loops[l], &steps[s], &maxErr, &maxGap);
+
+    printf("  %d step responses, max. difference from the float filter %.4f C, up to %ld loops per update\n",
+           cases, maxErr, maxGap);
+
+    // benchmark at the default time constant and the old 21ms loop, every loop updates
+    tempSetFilterTc(0.4f);
+    unsigned long loopTicks = (unsigned long)EXPFILT_LEGACY_LOOP_MS * (F_CPU / 1000);
+    float wf     = (float)ExpFilterWeightDt(tempExpFilterTcQ, loopTicks >> FILT_TIME_SHIFT) / EXPFILT_WEIGHT_ONE;
+    float fstate = 25.0f;
+
+    const long n = 20000000;
+    printf("  host benchmark (conversion + filter, no ADC):\n");
+    double fb = BENCH("float conversion + ExpFilter", n, benchSink += (long)floatReadTemp(&fstate, wf, 180 + (i & 0x3f)));
+    double ib = BENCH("readTemp (ExpFilterInt)", n, simAdvance(loopTicks); hostAnalog[0] = 180 + (i & 0x3f); benchSink += readTemp(0));
+    printf("  host ratio float/int %.2f\n", fb / ib);
+
+    return checkResult("temp_filter_test");
+}
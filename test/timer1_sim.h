@@ -0,0 +1,123 @@
+#ifndef __TIMER1_SIM_H__
+#define __TIMER1_SIM_H__
+
+/*******************************************************************************
+ *
+ *  Simulated timer1 with the input capture on D8 for the host tests
+ *
+ * Drives the firmware ISRs (PwmMeasure.cpp) through the host registers: the 32 bit time runs in
+ * timer1 counts, TCNT1 follows it, every 16 bit wrap runs TIMER1_OVF_vect. An edge of the type
+ * selected by ICES1 latches ICR1 (a later one before the ISR overwrites it), TIMER1_CAPT_vect runs
+ * simCaptLatency counts after the first one. An overflow while the capture is pending leaves TOV1
+ * set for the capture ISR (as pwmTimestamp expects) and runs right after it - the capture vector
+ * has the higher priority. Edges of the other type are not captured. PINB0 follows the edges.
+ ******************************************************************************/
+
+#include <Arduino.h>
+#include "PwmMeasure.h"
+
+extern volatile word pwmTimerHigh;
+extern "C" void TIMER1_CAPT_vect(void);
+extern "C" void TIMER1_OVF_vect(void);
+
+
+static uint32_t simNow;               /**< Timer1, 32 bit */
+static uint32_t simCaptLatency = 60;  /**< Capture ISR latency (counts) */
+static uint32_t simCaptJitter;        /**< Random error of the latched timestamp (counts), models a PCINT input */
+static byte     simCaptPending;       /**< ICR1 latched, the ISR has not run yet */
+static uint32_t simCaptIsrAt;
+static byte     simTov;               /**< TOV1 set, the overflow ISR has not run yet */
+
+
+/** The registers as the code sees them */
+static void simRegs(void)
+{
+    TCNT1 = (word)simNow;
+    TIFR1 = (simTov ? bit (TOV1) : 0) | (simCaptPending ? bit (ICF1) : 0);
+}
+
+
+static void simOvf(void)
+{
+    simTov = 0;
+    simRegs();
+    TIMER1_OVF_vect();
+}
+
+
+/** Start at t, no ISR pending (call after pwmMeasureBegin) */
+static void simStart(uint32_t t)
+{
+    simNow         = t;
+    pwmTimerHigh   = (word)(t >> 16);
+    simCaptPending = 0;
+    simTov         = 0;
+    simRegs();
+}
+
+
+/** Run the timer to t (wraps around, at most 2^31 counts ahead) with the ISRs on the way */
+static void simRun(uint32_t t)
+{
+    for(;;)
+    {
+        uint32_t dT = t - simNow;
+        uint32_t dW = (uint32_t)((simNow | 0xffff) + 1) - simNow;
+        uint32_t dC = simCaptPending ? (uint32_t)(simCaptIsrAt - simNow) : 0xffffffff;
+
+        if(dC <= dT && dC < dW)
+        {
+            simNow = simCaptIsrAt;
+            simCaptPending = 0;
+            simRegs();
+            TIFR1 |= bit (ICF1);
+            TIMER1_CAPT_vect();
+            if(simTov)
+                simOvf();
+        }
+        else if(dW <= dT)
+        {
+            simNow += dW;
+            simTov  = 1;
+            if(!simCaptPending)
+                simOvf();
+        }
+        else
+            break;
+    }
+
+    simNow = t;
+    simRegs();
+}
+
+
+static uint32_t simRngState = 0x510e527f;
+
+static uint32_t simRnd(void)
+{
+    simRngState ^= simRngState << 13;
+    simRngState ^= simRngState >> 17;
+    simRngState ^= simRngState << 5;
+    return simRngState;
+}
+
+
+/** An edge on D8 at t (not before the current time), level is the new pin level */
+static void simEdge(uint32_t t, byte level)
+{
+    simRun(t);
+    PINB = level ? bit (PINB0) : 0;
+
+    if(!level != !(TCCR1B & bit (ICES1)))
+        return;
+
+    ICR1 = (word)(t + (simCaptJitter ? simRnd() % (simCaptJitter + 1) : 0));
+    if(!simCaptPending)
+    {
+        simCaptPending = 1;
+        simCaptIsrAt   = t + simCaptLatency;
+    }
+    simRegs();
+}
+
+#endif // __TIMER1_SIM_H__
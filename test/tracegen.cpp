@@ -0,0 +1,200 @@
+/*******************************************************************************
+ *
+ *  PWM input and temperature trace generator
+ *
+ * Writes the synthetic edge traces in traces/ (see pwm_replay.cpp for the format) and the MCP9701
+ * sensor traces in traces/temp/ (see kalman_test.cpp). Deterministic, the committed traces are the
+ * output of "make traces".
+ ******************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+
+
+/** Small deterministic PRNG (xorshift32), the traces must not depend on the host libc */
+static uint32_t rngState;
+
+static uint32_t rnd(void)
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 17;
+    rngState ^= rngState << 5;
+    return rngState;
+}
+
+/** Uniform -j .. +j */
+static int jitter(int j)
+{
+    return j ? (int)(rnd() % (2*j + 1)) - j : 0;
+}
+
+
+struct TraceSpec
+{
+    const char *file;
+    const char *desc;
+    uint32_t start;      /**< Timestamp of the first edge (timer1 counts, 32 bits) */
+    uint32_t period;     /**< PWM period in timer1 counts */
+    int      duty;       /**< Positive duty cycle in tenths of percent */
+    int      periods;    /**< Number of periods */
+    int      jit;        /**< Edge jitter (+- timer1 counts) */
+    int      glitchPm;   /**< Probability of a glitch (short spurious pulse) per period, permille */
+    int      dropPm;     /**< Probability of a missing pulse per period, permille */
+    int      tol;        /**< Max. duty error of an accepted capture (tenths of percent), the jitter of one pulse */
+    int      accept;     /**< Min. accepted captures (percent of the decoded snapshots) */
+};
+
+
+static const TraceSpec specs[] =
+{
+    // file                 description                                          start       period duty  periods jit glitch drop tol accept
+    { "clean_25k.txt",      "25kHz 30%, +-1 count jitter",                        0,          640,   300,  400,    1,  0,     0,   3,  99 },
+    { "noise_25k.txt",      "25kHz 25%, +-3 counts jitter, glitches on 5% of the periods", 0, 640,   250,  400,    3,  50,    0,   9,  80 },
+    { "short_hi_25k.txt",   "25kHz 0.5% - 3 count pulses, falling edge missed by the edge switch", 0, 640, 5, 400, 0, 0, 0,   2,  90 },
+    { "short_lo_25k.txt",   "25kHz 99.5% - 3 count gaps",                         0,          640,   995,  400,    0,  0,     0,   2,  90 },
+    { "missing_1k.txt",     "1kHz 42%, 3% of the pulses missing",                 0,          16000, 420,  400,    2,  0,     30,  1,  90 },
+    { "wrap_25k.txt",       "25kHz 70%, timestamps wrap around 2^32",             0xffff0000, 640,   700,  400,    1,  0,     0,   3,  99 },
+    { "slow_20hz.txt",      "20Hz 10%, timestamps wrap around 2^32",              0xfff00000, 800000, 100, 60,     20, 0,     0,   1,  99 },
+};
+
+
+static void writeTrace(const TraceSpec *s)
+{
+    char path[128];
+    snprintf(path, sizeof(path), "traces/%s", s->file);
+
+    FILE *f = fopen(path, "w");
+    if(!f)
+    {
+        perror(path);
+        exit(1);
+    }
+
+    rngState = 0x2545f491;
+
+    fprintf(f, "# %s\n", s->desc);
+    fprintf(f, "period %u\nduty %d\ntol %d\naccept %d\n", s->period, s->duty, s->tol, s->accept);
+
+    uint32_t width = (uint32_t)(((uint64_t)s->period * s->duty + 500) / 1000);
+    uint32_t t     = s->start;
+
+    for(int p=0; p<s->periods; ++p, t += s->period)
+    {
+        if(s->dropPm && (int)(rnd() % 1000) < s->dropPm)
+            continue;
+
+        fprintf(f, "%u 1\n", t + jitter(s->jit));
+        if(s->glitchPm && (int)(rnd() % 1000) < s->glitchPm)
+        {
+            // spurious low pulse within the high part or high pulse within the low part
+            uint32_t gw = 1 + rnd() % 16;
+            uint32_t m  = 2 + s->jit;   // keep the glitch edges in order with the jittered ones
+            if(width > gw + 3*m && rnd() % 2)
+            {
+                uint32_t g = t + m + rnd() % (width - gw - 2*m);
+                fprintf(f, "%u 0\n%u 1\n", g, g + gw);
+            }
+            else if(s->period - width > gw + 3*m)
+            {
+                uint32_t g = t + width + m + rnd() % (s->period - width - gw - 2*m);
+                fprintf(f, "%u 0\n%u 1\n%u 0\n", t + width + jitter(s->jit), g, g + gw);
+                continue;
+            }
+        }
+        fprintf(f, "%u 0\n", t + width + jitter(s->jit));
+    }
+
+    fclose(f);
+}
+
+
+struct TempSpec
+{
+    const char *file;
+    const char *desc;
+    int      seconds;    /**< Trace length */
+    int      heatAt;     /**< Start of the heating (s), 0 - none */
+    float    heatTo;     /**< Temperature the heating goes to (C) */
+    float    heatTc;     /**< Heating time constant (s) */
+    int      coolAt;     /**< Start of the cooling - fans up (s), 0 - none */
+    float    coolTo;     /**< Temperature the cooling goes to (C) */
+    float    coolTc;     /**< Cooling time constant (s) */
+    int      spikePm;    /**< Probability of a spike (EMI, single reading off by 4 .. 12 counts) per reading, permille */
+};
+
+
+static const TempSpec tempSpecs[] =
+{
+    // file                 description                                          s    heat: at to   tc    cool: at to   tc    spike
+    { "idle.txt",           "idle server, 30C with a slow drift, spikes on 0.2% of the readings", 120, 0, 0.0f, 0.0f, 0, 0.0f, 0.0f, 2 },
+    { "load.txt",           "load step 30C -> 50C (tc 40s), fans up at 80s -> 38C (tc 15s)", 150, 10, 50.0f, 40.0f, 80, 38.0f, 15.0f, 2 },
+};
+
+
+/** Gaussian-ish noise (sum of 4 uniforms), std. dev. sd */
+static float gauss(float sd)
+{
+    float s = 0.0f;
+    for(int k=0; k<4; ++k)
+        s += (float)(rnd() % 10001) / 10000.0f - 0.5f;
+    return s * sd * 1.732f;
+}
+
+
+/**
+ * MCP9701 read by the Nano ADC every loop: 19.5mV/C + 400mV, 5V reference (about 0.25C per count), the
+ * analog noise about 0.6 counts, loop period 25ms +-5ms
+ */
+static void writeTempTrace(const TempSpec *s)
+{
+    char path[128];
+    snprintf(path, sizeof(path), "traces/temp/%s", s->file);
+
+    FILE *f = fopen(path, "w");
+    if(!f)
+    {
+        perror(path);
+        exit(1);
+    }
+
+    rngState = 0x3c6ef372;
+
+    fprintf(f, "# %s\n", s->desc);
+    fprintf(f, "# synthetic (tracegen), a recorded one has the same format - see kalman_test.cpp\n");
+
+    float temp = 30.0f;
+    for(unsigned long ms=0; ms<s->seconds*1000UL; )
+    {
+        int   step = 25 + jitter(5);
+        float dt   = step / 1000.0f;
+        float t    = (ms += step) / 1000.0f;
+
+        if(s->coolAt && t >= s->coolAt)
+            temp += (s->coolTo - temp) * (1.0f - expf(-dt / s->coolTc));
+        else if(s->heatAt && t >= s->heatAt)
+            temp += (s->heatTo - temp) * (1.0f - expf(-dt / s->heatTc));
+        else
+            temp = 30.0f + 0.3f * sinf(t * 0.05f);
+
+        float v   = (0.400f + 0.0195f * temp) / 5.0f * 1024.0f + gauss(0.6f);
+        int   adc = (int)floorf(v + 0.5f);
+        if(s->spikePm && (int)(rnd() % 1000) < s->spikePm)
+            adc += (rnd() % 2 ? 1 : -1) * (4 + (int)(rnd() % 9));
+
+        fprintf(f, "%lu %d\n", ms, adc);
+    }
+
+    fclose(f);
+}
+
+
+int main(void)
+{
+    for(unsigned i=0; i<sizeof(specs)/sizeof(specs[0]); ++i)
+        writeTrace(&specs[i]);
+    for(unsigned i=0; i<sizeof(tempSpecs)/sizeof(tempSpecs[0]); ++i)
+        writeTempTrace(&tempSpecs[i]);
+    return 0;
+}